@@ -0,0 +1,114 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ==========================================================================
+
+    Syscalls program reads and sets the clock, talks to ntp servers and
+    sleeps with. Normal build calls kernel directly, names below are
+    just aliases of syscalls. Simulation build (NTPD_SETWAIT_SIM) links
+    bench/sim.c instead, which implements them on virtual clock and
+    virtual network, so hours of retries pass in microseconds, see
+    bench/ntpsim.c.
+
+    Only ntp path is covered: dns, other time sources, netlink, server
+    and supervisor still talk to kernel in simulation build, servers
+    have to be given as addresses there.
+
+   ========================================================================== */
+
+#ifndef BACKEND_H
+#define BACKEND_H 1
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#if HAVE_CLOCK_ADJTIME
+#   include <sys/timex.h>
+#endif
+
+#if HAVE_SYS_TIMERFD_H
+#   include <sys/timerfd.h>
+#endif
+
+#if NTPD_SETWAIT_SIM
+
+int backend_clock_gettime(clockid_t, struct timespec *);
+int backend_clock_settime(clockid_t, const struct timespec *);
+#if HAVE_CLOCK_ADJTIME
+int backend_clock_adjtime(clockid_t, struct timex *);
+#endif
+int backend_sigtimedwait(const sigset_t *, siginfo_t *,
+    const struct timespec *);
+int backend_poll(struct pollfd *, nfds_t, int);
+#if HAVE_SYS_TIMERFD_H
+int backend_timerfd_create(clockid_t, int);
+#endif
+int backend_socket(int, int, int);
+int backend_connect(int, const struct sockaddr *, socklen_t);
+int backend_setsockopt(int, int, int, const void *, socklen_t);
+ssize_t backend_send(int, const void *, size_t, int);
+ssize_t backend_recvmsg(int, struct msghdr *, int);
+#if HAVE_RECVMMSG
+int backend_recvmmsg(int, struct mmsghdr *, unsigned int, int,
+    struct timespec *);
+#endif
+int backend_close(int);
+long backend_io_uring_setup(unsigned, void *);
+uint32_t backend_entropy(void);
+
+#else /* NTPD_SETWAIT_SIM */
+
+#define backend_clock_gettime clock_gettime
+#define backend_clock_settime clock_settime
+#define backend_clock_adjtime clock_adjtime
+#define backend_sigtimedwait sigtimedwait
+#define backend_poll poll
+#define backend_timerfd_create timerfd_create
+#define backend_socket socket
+#define backend_connect connect
+#define backend_setsockopt setsockopt
+#define backend_send send
+#define backend_recvmsg recvmsg
+#define backend_recvmmsg recvmmsg
+#define backend_close close
+#define backend_io_uring_setup(entries, p) \
+    syscall(__NR_io_uring_setup, entries, p)
+
+
+/* ==========================================================================
+    Returns seed for random numbers, taken from /dev/urandom, and mixed
+    with pid and time, so it's different in each process, even when
+    there is no /dev/urandom.
+   ========================================================================== */
+
+
+static inline uint32_t backend_entropy(void)
+{
+    int              fd;    /* opened /dev/urandom */
+    uint32_t         seed;  /* random seed */
+    struct timespec  ts;    /* current monotonic time */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    seed = 0;
+    if ((fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC)) >= 0)
+    {
+        if (read(fd, &seed, sizeof(seed)) != sizeof(seed))
+            seed = 0;
+
+        close(fd);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return seed ^ (uint32_t)getpid() ^ (uint32_t)ts.tv_nsec;
+}
+
+#endif /* NTPD_SETWAIT_SIM */
+
+#endif
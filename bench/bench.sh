@@ -0,0 +1,100 @@
+#!/bin/sh
+
+# runs ntpd-setwait-bench against fakentp on loopback in a few network
+# scenarios, and prints how long it takes to get time from it.
+#
+# environment:
+#   BENCH_PORT  port fakentp listens on, must match one bench binary
+#               was compiled with
+#   BENCH_RUNS  number of runs per scenario
+#   BENCH_OPTS  additional options for ntpd-setwait-bench
+
+port="${BENCH_PORT:-12323}"
+runs="${BENCH_RUNS:-20}"
+opts="${BENCH_OPTS:-}"
+tmp="$(mktemp -d)"
+
+trap 'rm -rf "${tmp}"' EXIT
+
+# name and fakentp options of each scenario
+scenarios="
+lan:-d1
+wan:-d40 -j20
+lossy:-d40 -j20 -l30
+malformed:-d5 -m50
+skewed:-d5 -s3600.5
+slow:-d300 -j200 -l10
+"
+
+# prints p-th percentile of numbers in file $1, which must be sorted
+percentile()
+{
+    awk -v p="${2}" '{ v[NR] = $1 } END {
+        i = int((NR * p + 99) / 100); if (i < 1) i = 1; print v[i] }' "${1}"
+}
+
+# prints mean of numbers in file $1
+mean()
+{
+    awk '{ s += $1 } END { if (NR) printf "%.0f", s / NR }' "${1}"
+}
+
+run_one()
+{
+    ./fakentp -p"${port}" ${1} > "${tmp}/srv" &
+    srv=${!}
+
+    while ! grep -q ready "${tmp}/srv" 2>/dev/null
+    do
+        if ! kill -0 ${srv} 2>/dev/null
+        then
+            echo "fakentp failed to start" >&2
+            return 1
+        fi
+        sleep 0.01
+    done
+
+    ./ntpd-setwait-bench -f -i127.0.0.1 ${opts} 0 /bin/sh \
+        > "${tmp}/cli" 2>/dev/null
+    ret=${?}
+
+    kill ${srv}
+    wait ${srv}
+
+    [ ${ret} -eq 0 ] || return 1
+
+    # bench sync <ns> cpu <us> wakeups <n> syscalls <n>
+    awk '/^bench/ { print $3 / 1000000 >> "'"${tmp}/sync"'";
+        print $5 >> "'"${tmp}/cpu"'"; print $7 >> "'"${tmp}/wake"'";
+        print $9 >> "'"${tmp}/sys"'" }' "${tmp}/cli"
+    awk '/^requests/ { print $2 >> "'"${tmp}/pkts"'" }' "${tmp}/srv"
+}
+
+printf "%-10s %5s %8s %8s %8s %8s %8s %8s %8s %8s\n" scenario runs \
+    "p50[ms]" "p90[ms]" "p99[ms]" "max[ms]" packets "cpu[us]" wakeups \
+    syscalls
+
+echo "${scenarios}" | while IFS=: read name srvopts
+do
+    [ -z "${name}" ] && continue
+    rm -f "${tmp}/sync" "${tmp}/cpu" "${tmp}/wake" "${tmp}/sys" \
+        "${tmp}/pkts"
+
+    i=0
+    while [ ${i} -lt ${runs} ]
+    do
+        if ! run_one "${srvopts}"
+        then
+            echo "${name}: run ${i} failed" >&2
+            exit 1
+        fi
+        i=$((i + 1))
+    done
+
+    sort -n "${tmp}/sync" > "${tmp}/sorted"
+    printf "%-10s %5d %8.1f %8.1f %8.1f %8.1f %8s %8s %8s %8s\n" "${name}" \
+        ${runs} $(percentile "${tmp}/sorted" 50) \
+        $(percentile "${tmp}/sorted" 90) $(percentile "${tmp}/sorted" 99) \
+        $(percentile "${tmp}/sorted" 100) $(mean "${tmp}/pkts") \
+        $(mean "${tmp}/cpu") $(mean "${tmp}/wake") $(mean "${tmp}/sys")
+done
@@ -0,0 +1,435 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ==========================================================================
+         -------------------------------------------------------
+        / fake ntp server for benchmarks, answers on loopback   \
+        | with configurable delay, jitter, loss, clock skew and |
+        | malformed replies. Prints number of requests it got   |
+        \ when terminated.                                      /
+         -------------------------------------------------------
+   ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+
+/* ==========================================================================
+          __             __                     __   _
+     ____/ /___   _____ / /____ _ _____ ____ _ / /_ (_)____   ____   _____
+    / __  // _ \ / ___// // __ `// ___// __ `// __// // __ \ / __ \ / ___/
+   / /_/ //  __// /__ / // /_/ // /   / /_/ // /_ / // /_/ // / / /(__  )
+   \__,_/ \___/ \___//_/ \__,_//_/    \__,_/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+#define NTP_PACKET_LEN (48)
+#define NTP_UNIX_EPOCH_DIFF (2208988800ll)
+#define NSEC_PER_SEC (1000000000ll)
+
+/* max number of replies that wait for their delay to pass
+ */
+
+#define QUEUE_LEN (64)
+
+
+/* reply waiting to be sent
+ */
+
+struct reply
+{
+    int64_t                  due;      /* monotonic time to send it at */
+    struct sockaddr_storage  addr;     /* client to send reply to */
+    socklen_t                addrlen;  /* length of addr */
+    unsigned char            packet[NTP_PACKET_LEN];  /* reply to send */
+    int                      len;      /* length of packet to send */
+};
+
+
+/* how server misbehaves, times are in nanoseconds
+ */
+
+struct config
+{
+    int64_t                  delay;     /* one way delay of reply */
+    int64_t                  jitter;    /* max random delay added */
+    int64_t                  skew;      /* offset of our clock */
+    int                      loss;      /* percent of lost requests */
+    int                      malformed; /* percent of malformed replies */
+    int                      stratum;   /* stratum we report */
+};
+
+
+static volatile sig_atomic_t  g_stop;
+
+
+/* ==========================================================================
+                  _                __           ____
+    ____   _____ (_)_   __ ____ _ / /_ ___     / __/__  __ ____   _____ _____
+   / __ \ / ___// /| | / // __ `// __// _ \   / /_ / / / // __ \ / ___// ___/
+  / /_/ // /   / / | |/ // /_/ // /_ /  __/  / __// /_/ // / / // /__ (__  )
+ / .___//_/   /_/  |___/ \__,_/ \__/ \___/  /_/   \__,_//_/ /_/ \___//____/
+/_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Returns time of clock clk in nanoseconds.
+   ========================================================================== */
+
+
+static int64_t now_ns
+(
+    clockid_t        clk  /* clock to read */
+)
+{
+    struct timespec  ts;  /* current time */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    clock_gettime(clk, &ts);
+    return (int64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+
+/* ==========================================================================
+    Stores unix time ns as 64bit ntp timestamp in buf.
+   ========================================================================== */
+
+
+static void ns_to_ntp
+(
+    int64_t         ns,    /* unix time to convert */
+    unsigned char  *buf    /* timestamp in ntp format will be stored here */
+)
+{
+    uint32_t        sec;   /* seconds part of timestamp */
+    uint32_t        frac;  /* fraction part of timestamp */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    sec = (uint32_t)(ns / NSEC_PER_SEC + NTP_UNIX_EPOCH_DIFF);
+    frac = (uint32_t)(((uint64_t)(ns % NSEC_PER_SEC) << 32) / NSEC_PER_SEC);
+
+    buf[0] = sec >> 24;
+    buf[1] = sec >> 16;
+    buf[2] = sec >> 8;
+    buf[3] = sec;
+    buf[4] = frac >> 24;
+    buf[5] = frac >> 16;
+    buf[6] = frac >> 8;
+    buf[7] = frac;
+}
+
+
+/* ==========================================================================
+    Returns 1 with probability of percent %.
+   ========================================================================== */
+
+
+static int chance
+(
+    int  percent  /* probability in percents */
+)
+{
+    return random() % 100 < percent;
+}
+
+
+/* ==========================================================================
+    Builds reply to request req, received at time rec (our skewed clock),
+    into r. Reply is sent after delay, and we pretend it reached us after
+    half of it, so offset measured by client is not affected by delay.
+    Sometimes reply is made invalid, in one of the ways real servers (or
+    attackers) do it.
+   ========================================================================== */
+
+
+static void build_reply
+(
+    const unsigned char  *req,   /* request from client */
+    int64_t               rec,   /* time request arrived */
+    const struct config  *cfg,   /* server config */
+    struct reply         *r      /* reply will be stored here */
+)
+{
+    int64_t               d;     /* delay of this reply */
+    unsigned char        *p;     /* reply packet */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    d = cfg->delay;
+    if (cfg->jitter)
+        d += (int64_t)(random() % (cfg->jitter / 1000 + 1)) * 1000;
+
+    r->due = now_ns(CLOCK_MONOTONIC) + 2 * d;
+    r->len = NTP_PACKET_LEN;
+    p = r->packet;
+
+    memset(p, 0x00, NTP_PACKET_LEN);
+    p[0] = 0 << 6 | 4 << 3 | 4;  /* no leap, version 4, server mode */
+    p[1] = (unsigned char)cfg->stratum;
+    p[2] = 6;                    /* poll */
+    p[3] = 0xec;                 /* precision, ~60ns */
+    memcpy(p + 12, "LOCL", 4);
+    ns_to_ntp(rec + d, p + 16);  /* reference time */
+    memcpy(p + 24, req + 40, 8); /* origin is client's transmit */
+    ns_to_ntp(rec + d, p + 32);
+    ns_to_ntp(rec + d, p + 40);
+
+    if (!chance(cfg->malformed))
+        return;
+
+    switch (random() % 4)
+    {
+    case 0:
+        r->len = NTP_PACKET_LEN - 1;
+        break;
+
+    case 1:
+        p[24] ^= 0xff;
+        break;
+
+    case 2:
+        p[0] = 0 << 6 | 4 << 3 | 3;
+        break;
+
+    case 3:
+        memset(p + 40, 0x00, 8);
+        break;
+    }
+}
+
+
+/* ==========================================================================
+    Signal handler, makes main loop quit.
+   ========================================================================== */
+
+
+static void on_signal
+(
+    int  signo  /* signal that arrived */
+)
+{
+    (void)signo;
+    g_stop = 1;
+}
+
+
+/* ==========================================================================
+    Prints programs help.
+   ========================================================================== */
+
+
+static void print_help
+(
+    const char  *name  /* name of program (argv[0]) */
+)
+{
+    fprintf(stderr, "usage: %s [-a<addr>] [-p<port>] [-d<ms>] [-j<ms>] "
+            "[-l<percent>] [-m<percent>] [-s<sec>] [-S<stratum>]\n\n", name);
+    fprintf(stderr, "-a<addr>    ipv4 address to listen on (127.0.0.1)\n");
+    fprintf(stderr, "-p<port>    port to listen on (123)\n");
+    fprintf(stderr, "-d<ms>      one way network delay\n");
+    fprintf(stderr, "-j<ms>      max random delay added to -d\n");
+    fprintf(stderr, "-l<percent> requests to drop\n");
+    fprintf(stderr, "-m<percent> replies to make invalid\n");
+    fprintf(stderr, "-s<sec>     offset of our clock to real one\n");
+    fprintf(stderr, "-S<stratum> stratum to report (2)\n");
+}
+
+
+/* ==========================================================================
+                                              _
+                           ____ ___   ____ _ (_)____
+                          / __ `__ \ / __ `// // __ \
+                         / / / / / // /_/ // // / / /
+                        /_/ /_/ /_/ \__,_//_//_/ /_/
+
+   ========================================================================== */
+
+
+int main
+(
+    int                  argc,      /* number of arguments in argv list */
+    char                *argv[]     /* list of program arguments */
+)
+{
+    int                  fd;        /* socket we listen on */
+    int                  i;         /* just an iterator */
+    int                  ret;       /* return value from functions */
+    int                  nqueue;    /* replies waiting in queue */
+    int                  timeout;   /* poll timeout in ms */
+    unsigned long        nreq;      /* requests received */
+    unsigned long        nlost;     /* requests dropped on purpose */
+    int64_t              now;       /* current monotonic time */
+    int64_t              next;      /* nearest reply due time */
+    struct config        cfg;       /* how we misbehave */
+    struct sockaddr_in   sin;       /* address we listen on */
+    struct pollfd        pfd;       /* socket to wait on */
+    struct sigaction     sa;        /* signal action to quit on */
+    struct reply         queue[QUEUE_LEN];  /* replies waiting for delay */
+    unsigned char        req[NTP_PACKET_LEN];  /* received request */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    memset(&cfg, 0x00, sizeof(cfg));
+    cfg.stratum = 2;
+    memset(&sin, 0x00, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(123);
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    for (i = 1; i < argc && argv[i][0] == '-'; ++i)
+    {
+        switch (argv[i][1])
+        {
+        case 'a':
+            if (inet_pton(AF_INET, &argv[i][2], &sin.sin_addr) != 1)
+            {
+                fprintf(stderr, "invalid address %s\n", argv[i]);
+                return 1;
+            }
+            break;
+
+        case 'p':
+            sin.sin_port = htons(atoi(&argv[i][2]));
+            break;
+
+        case 'd':
+            cfg.delay = atol(&argv[i][2]) * 1000000ll;
+            break;
+
+        case 'j':
+            cfg.jitter = atol(&argv[i][2]) * 1000000ll;
+            break;
+
+        case 'l':
+            cfg.loss = atoi(&argv[i][2]);
+            break;
+
+        case 'm':
+            cfg.malformed = atoi(&argv[i][2]);
+            break;
+
+        case 's':
+            cfg.skew = atof(&argv[i][2]) * NSEC_PER_SEC;
+            break;
+
+        case 'S':
+            cfg.stratum = atoi(&argv[i][2]);
+            break;
+
+        default:
+            print_help(argv[0]);
+            return 1;
+        }
+    }
+
+    if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0 ||
+            bind(fd, (struct sockaddr *)&sin, sizeof(sin)) != 0)
+    {
+        perror("fakentp: socket");
+        return 1;
+    }
+
+    /* no SA_RESTART, so poll() is interrupted and we can print
+     * stats and quit
+     */
+
+    memset(&sa, 0x00, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+
+    srandom((unsigned)(getpid() ^ now_ns(CLOCK_MONOTONIC)));
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    nqueue = 0;
+    nreq = 0;
+    nlost = 0;
+
+    /* tell whoever started us that we are ready to serve
+     */
+
+    printf("ready\n");
+    fflush(stdout);
+
+    while (!g_stop)
+    {
+        /* send replies which delay has passed
+         */
+
+        now = now_ns(CLOCK_MONOTONIC);
+        next = INT64_MAX;
+
+        for (i = 0; i < nqueue; )
+        {
+            if (queue[i].due <= now)
+            {
+                sendto(fd, queue[i].packet, queue[i].len, 0,
+                        (struct sockaddr *)&queue[i].addr, queue[i].addrlen);
+                queue[i] = queue[--nqueue];
+                continue;
+            }
+
+            if (queue[i].due < next)
+                next = queue[i].due;
+            ++i;
+        }
+
+        /* signal may arrive right before poll(), so don't sleep
+         * for too long, or we would not notice we should quit
+         */
+
+        timeout = next == INT64_MAX ? 100 :
+            (int)((next - now + 999999) / 1000000);
+        timeout = timeout > 100 ? 100 : timeout;
+
+        ret = poll(&pfd, 1, timeout);
+        if (ret <= 0)
+            continue;
+
+        queue[nqueue].addrlen = sizeof(queue[nqueue].addr);
+        ret = recvfrom(fd, req, sizeof(req), 0,
+                (struct sockaddr *)&queue[nqueue].addr,
+                &queue[nqueue].addrlen);
+
+        if (ret != sizeof(req))
+            continue;
+
+        nreq++;
+        if (chance(cfg.loss) || nqueue == QUEUE_LEN - 1)
+        {
+            nlost++;
+            continue;
+        }
+
+        build_reply(req, now_ns(CLOCK_REALTIME) + cfg.skew, &cfg,
+                &queue[nqueue]);
+        nqueue++;
+    }
+
+    printf("requests %lu lost %lu\n", nreq, nlost);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,379 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ==========================================================================
+         -------------------------------------------------------
+        / sntp load generator, floods server with requests from \
+        | many threads, each keeping a window of requests in    |
+        | flight, and prints requests per second it got answers |
+        \ to, and percentiles of latency of replies             /
+         -------------------------------------------------------
+   ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+
+/* ==========================================================================
+          __             __                     __   _
+     ____/ /___   _____ / /____ _ _____ ____ _ / /_ (_)____   ____   _____
+    / __  // _ \ / ___// // __ `// ___// __ `// __// // __ \ / __ \ / ___/
+   / /_/ //  __// /__ / // /_/ // /   / /_/ // /_ / // /_/ // / / /(__  )
+   \__,_/ \___/ \___//_/ \__,_//_/    \__,_/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+#define NTP_PACKET_LEN (48)
+#define NSEC_PER_SEC (1000000000ll)
+
+/* latency histogram has 1us buckets up to that many us, slower
+ * replies land in the last one
+ */
+
+#define HIST_LEN (100000)
+
+/* max requests in flight per thread
+ */
+
+#define MAX_WINDOW (256)
+
+/* when no reply comes in that time, requests in flight are taken
+ * as lost, and sent again
+ */
+
+#define LOST_MS (100)
+
+
+/* single load thread, and what it measured
+ */
+
+struct loader
+{
+    pthread_t           thread;    /* load thread */
+    struct sockaddr_in  server;    /* server to flood */
+    int64_t             deadline;  /* monotonic time to stop at */
+    int                 window;    /* requests to keep in flight */
+    unsigned long       nreq;      /* requests sent */
+    unsigned long       nrep;      /* replies received */
+    unsigned long       nkod;      /* kiss-o'-death replies received */
+    unsigned long       nlost;     /* requests given up on */
+    uint32_t            hist[HIST_LEN];  /* latency histogram */
+};
+
+
+/* ==========================================================================
+                  _                __           ____
+    ____   _____ (_)_   __ ____ _ / /_ ___     / __/__  __ ____   _____ _____
+   / __ \ / ___// /| | / // __ `// __// _ \   / /_ / / / // __ \ / ___// ___/
+  / /_/ // /   / / | |/ // /_/ // /_ /  __/  / __// /_/ // / / // /__ (__  )
+ / .___//_/   /_/  |___/ \__,_/ \__/ \___/  /_/   \__,_//_/ /_/ \___//____/
+/_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Returns monotonic time in nanoseconds.
+   ========================================================================== */
+
+
+static int64_t now_ns(void)
+{
+    struct timespec  ts;  /* current time */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+
+/* ==========================================================================
+    Sends single request. Transmit timestamp holds monotonic time it was
+    sent at, server copies it to origin of reply, so we know latency
+    without keeping track of requests.
+
+    returns
+            0       request sent
+           -1       on error
+   ========================================================================== */
+
+
+static int send_request
+(
+    int            fd     /* connected socket */
+)
+{
+    int64_t        now;   /* time request is sent */
+    unsigned char  req[NTP_PACKET_LEN];  /* request to send */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    memset(req, 0x00, sizeof(req));
+    req[0] = 0 << 6 | 4 << 3 | 3;  /* no leap, version 4, client mode */
+    now = now_ns();
+    memcpy(req + 40, &now, sizeof(now));
+
+    return send(fd, req, sizeof(req), 0) == sizeof(req) ? 0 : -1;
+}
+
+
+/* ==========================================================================
+    Load thread, keeps window requests in flight until deadline, each
+    reply is followed by next request right away.
+   ========================================================================== */
+
+
+static void *load_run
+(
+    void           *arg        /* loader to run */
+)
+{
+    struct loader  *l;         /* loader we run */
+    int             fd;        /* socket connected to server */
+    int             i;         /* just an iterator */
+    int             inflight;  /* requests without reply */
+    int64_t         org;       /* time request was sent */
+    int64_t         lat;       /* latency in us */
+    struct pollfd   pfd;       /* socket to wait on */
+    unsigned char   rep[NTP_PACKET_LEN];  /* received reply */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    l = arg;
+
+    if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0 ||
+            connect(fd, (struct sockaddr *)&l->server,
+                sizeof(l->server)) != 0)
+    {
+        perror("ntpload: socket");
+        return NULL;
+    }
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    inflight = 0;
+
+    while (now_ns() < l->deadline)
+    {
+        for (; inflight < l->window; ++inflight, ++l->nreq)
+            if (send_request(fd) != 0)
+                break;
+
+        if (poll(&pfd, 1, LOST_MS) <= 0)
+        {
+            l->nlost += inflight;
+            inflight = 0;
+            continue;
+        }
+
+        while (recv(fd, rep, sizeof(rep), MSG_DONTWAIT) == sizeof(rep))
+        {
+            memcpy(&org, rep + 24, sizeof(org));
+            lat = (now_ns() - org) / 1000;
+            i = lat < 0 ? 0 : lat >= HIST_LEN ? HIST_LEN - 1 : (int)lat;
+
+            l->hist[i]++;
+            l->nrep++;
+            l->nkod += rep[1] == 0;
+            inflight -= inflight > 0;
+        }
+    }
+
+    close(fd);
+    return NULL;
+}
+
+
+/* ==========================================================================
+    Returns latency in us below which p permille of replies came.
+   ========================================================================== */
+
+
+static int percentile
+(
+    const uint32_t  *hist,  /* merged latency histogram */
+    unsigned long    n,     /* number of replies in hist */
+    int              p      /* permille to find */
+)
+{
+    unsigned long    sum;   /* replies counted so far */
+    int              i;     /* just an iterator */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    for (sum = 0, i = 0; i != HIST_LEN; ++i)
+        if ((sum += hist[i]) * 1000 >= n * p)
+            return i;
+
+    return HIST_LEN - 1;
+}
+
+
+/* ==========================================================================
+    Prints programs help.
+   ========================================================================== */
+
+
+static void print_help
+(
+    const char  *name  /* name of program (argv[0]) */
+)
+{
+    fprintf(stderr, "usage: %s [-a<addr>] [-p<port>] [-t<threads>] "
+            "[-d<sec>] [-w<num>]\n\n", name);
+    fprintf(stderr, "-a<addr>    ipv4 address of server (127.0.0.1)\n");
+    fprintf(stderr, "-p<port>    port of server (123)\n");
+    fprintf(stderr, "-t<threads> number of load threads (1)\n");
+    fprintf(stderr, "-d<sec>     how long to run (5)\n");
+    fprintf(stderr, "-w<num>     requests in flight per thread (16)\n");
+}
+
+
+/* ==========================================================================
+                                              _
+                           ____ ___   ____ _ (_)____
+                          / __ `__ \ / __ `// // __ \
+                         / / / / / // /_/ // // / / /
+                        /_/ /_/ /_/ \__,_//_//_/ /_/
+
+   ========================================================================== */
+
+
+int main
+(
+    int                  argc,      /* number of arguments in argv list */
+    char                *argv[]     /* list of program arguments */
+)
+{
+    int                  i;         /* just an iterator */
+    int                  j;         /* just another iterator */
+    int                  nthreads;  /* number of load threads */
+    int                  window;    /* requests in flight per thread */
+    long                 duration;  /* how long to run in seconds */
+    int64_t              start;     /* time load started */
+    double               elapsed;   /* time load really took */
+    unsigned long        nreq;      /* requests sent */
+    unsigned long        nrep;      /* replies received */
+    unsigned long        nkod;      /* kiss-o'-death received */
+    unsigned long        nlost;     /* requests lost */
+    struct sockaddr_in   sin;       /* server address */
+    struct loader       *loaders;   /* load threads */
+    static uint32_t      hist[HIST_LEN];  /* merged histogram */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    memset(&sin, 0x00, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(123);
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    nthreads = 1;
+    duration = 5;
+    window = 16;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; ++i)
+    {
+        switch (argv[i][1])
+        {
+        case 'a':
+            if (inet_pton(AF_INET, &argv[i][2], &sin.sin_addr) != 1)
+            {
+                fprintf(stderr, "invalid address %s\n", argv[i]);
+                return 1;
+            }
+            break;
+
+        case 'p':
+            sin.sin_port = htons(atoi(&argv[i][2]));
+            break;
+
+        case 't':
+            nthreads = atoi(&argv[i][2]);
+            break;
+
+        case 'd':
+            duration = atol(&argv[i][2]);
+            break;
+
+        case 'w':
+            window = atoi(&argv[i][2]);
+            break;
+
+        default:
+            print_help(argv[0]);
+            return 1;
+        }
+    }
+
+    if (nthreads < 1 || duration < 1 || window < 1 || window > MAX_WINDOW)
+    {
+        print_help(argv[0]);
+        return 1;
+    }
+
+    if ((loaders = calloc(nthreads, sizeof(*loaders))) == NULL)
+    {
+        perror("ntpload: calloc");
+        return 1;
+    }
+
+    start = now_ns();
+    for (i = 0; i != nthreads; ++i)
+    {
+        loaders[i].server = sin;
+        loaders[i].window = window;
+        loaders[i].deadline = start + duration * NSEC_PER_SEC;
+        if (pthread_create(&loaders[i].thread, NULL, load_run,
+                    &loaders[i]) != 0)
+        {
+            perror("ntpload: pthread_create");
+            return 1;
+        }
+    }
+
+    nreq = nrep = nkod = nlost = 0;
+    for (i = 0; i != nthreads; ++i)
+    {
+        pthread_join(loaders[i].thread, NULL);
+        nreq += loaders[i].nreq;
+        nrep += loaders[i].nrep;
+        nkod += loaders[i].nkod;
+        nlost += loaders[i].nlost;
+
+        for (j = 0; j != HIST_LEN; ++j)
+            hist[j] += loaders[i].hist[j];
+    }
+
+    elapsed = (double)(now_ns() - start) / NSEC_PER_SEC;
+
+    /* load <threads> sent <n> replies <n> rate <n/s> kod <n> lost <n>
+     * p50 <us> p90 <us> p99 <us> p999 <us>
+     */
+
+    printf("load %d sent %lu replies %lu rate %.0f kod %lu lost %lu "
+            "p50 %d p90 %d p99 %d p999 %d\n", nthreads, nreq, nrep,
+            nrep / elapsed, nkod, nlost, percentile(hist, nrep, 500),
+            percentile(hist, nrep, 900), percentile(hist, nrep, 990),
+            percentile(hist, nrep, 999));
+
+    free(loaders);
+    return 0;
+}
@@ -0,0 +1,524 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ==========================================================================
+         --------------------------------------------------------------
+        / runs thousands of simulated boots of ntpd-setwait on virtual \
+        | clock and network, and prints how long they took to get      |
+        \ time, and how many packets they sent                         /
+         --------------------------------------------------------------
+   ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include "ntpd-setwait-config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sim.h"
+#include "sysclock.h"
+
+
+/* ==========================================================================
+          __             __                     __   _
+     ____/ /___   _____ / /____ _ _____ ____ _ / /_ (_)____   ____   _____
+    / __  // _ \ / ___// // __ `// ___// __ `// __// // __ \ / __ \ / ___/
+   / /_/ //  __// /__ / // /_/ // /   / /_/ // /_ / // /_/ // / / /(__  )
+   \__,_/ \___/ \___//_/ \__,_//_/    \__,_/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+/* max number of arguments passed to simulated ntpd-setwait
+ */
+
+#define NTPSIM_MAX_ARGS (64)
+
+
+/* ==========================================================================
+                  _                __           ____
+    ____   _____ (_)_   __ ____ _ / /_ ___     / __/__  __ ____   _____ _____
+   / __ \ / ___// /| | / // __ `// __// _ \   / /_ / / / // __ \ / ___// ___/
+  / /_/ // /   / / | |/ // /_/ // /_ /  __/  / __// /_/ // / / // /__ (__  )
+ / .___//_/   /_/  |___/ \__,_/ \__/ \___/  /_/   \__,_//_/ /_/ \___//____/
+/_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Returns monotonic time in nanoseconds.
+   ========================================================================== */
+
+
+static int64_t now_ns(void)
+{
+    struct timespec  ts;  /* current time */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+
+/* ==========================================================================
+    Parses server description "delay,jitter,loss[,skew[,dist[,stratum]]]"
+    (ms, ms, percent, seconds, u|e|p) into srv.
+
+    returns
+            0       server parsed
+           -1       description is not valid
+   ========================================================================== */
+
+
+static int parse_server
+(
+    const char         *str,     /* description of server */
+    struct sim_server  *srv      /* parsed server will be stored here */
+)
+{
+    double              delay;   /* one way delay in ms */
+    double              jitter;  /* random delay in ms */
+    double              skew;    /* clock error of server in seconds */
+    char                dist;    /* distribution of jitter */
+    int                 n;       /* number of parsed fields */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    memset(srv, 0x00, sizeof(*srv));
+    skew = 0;
+    dist = 'u';
+    srv->stratum = 2;
+
+    n = sscanf(str, "%lf,%lf,%d,%lf,%c,%d", &delay, &jitter, &srv->loss,
+            &skew, &dist, &srv->stratum);
+
+    if (n < 3 || delay < 0 || jitter < 0 || srv->loss < 0 ||
+            srv->loss > 100 || strchr("uep", dist) == NULL)
+        return -1;
+
+    srv->delay = (int64_t)(delay * 1000000);
+    srv->jitter = (int64_t)(jitter * 1000000);
+    srv->skew = (int64_t)(skew * NSEC_PER_SEC);
+    srv->dist = dist == 'e' ? SIM_DIST_EXP :
+        dist == 'p' ? SIM_DIST_PARETO : SIM_DIST_UNIFORM;
+    return 0;
+}
+
+
+/* ==========================================================================
+    Parses outage description "start,length[,server]" (seconds of boot
+    time, server counted from 1) into o.
+
+    returns
+            0       outage parsed
+           -1       description is not valid
+   ========================================================================== */
+
+
+static int parse_outage
+(
+    const char         *str,    /* description of outage */
+    int                 link,   /* kind of outage */
+    struct sim_outage  *o       /* parsed outage will be stored here */
+)
+{
+    double              start;  /* start of outage in seconds */
+    double              len;    /* length of outage in seconds */
+    int                 n;      /* number of parsed fields */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    o->server = 0;
+    n = sscanf(str, "%lf,%lf,%d", &start, &len, &o->server);
+    if (n < 2 || start < 0 || len < 0 || o->server < 0 ||
+            o->server > SIM_MAX_SERVERS)
+        return -1;
+
+    o->start = (int64_t)(start * NSEC_PER_SEC);
+    o->end = o->start + (int64_t)(len * NSEC_PER_SEC);
+    o->server -= 1;
+    o->link = link;
+    return 0;
+}
+
+
+/* ==========================================================================
+    Simulates single boot in child process, so each one starts with
+    fresh program state, just like real boot. Never returns.
+   ========================================================================== */
+
+
+static void boot
+(
+    const struct sim_scenario  *sc,     /* scenario to simulate */
+    uint64_t                    seed,   /* seed of this boot */
+    int                         fd,     /* result will be written here */
+    int                         argc,   /* number of arguments in argv */
+    char                       *argv[], /* arguments for ntpd-setwait */
+    int                         quiet   /* drop logs of program */
+)
+{
+    int                         null;   /* /dev/null */
+    int                         ret;    /* return value of program */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (quiet && (null = open("/dev/null", O_WRONLY)) >= 0)
+    {
+        dup2(null, STDERR_FILENO);
+        dup2(null, STDOUT_FILENO);
+        close(null);
+    }
+
+    sim_init(sc, seed, fd);
+    ret = ntpd_setwait_main(argc, argv);
+    sim_finish(ret == 0);
+}
+
+
+/* ==========================================================================
+    qsort() comparator of int64_t
+   ========================================================================== */
+
+
+static int cmp_i64
+(
+    const void  *a,  /* first number */
+    const void  *b   /* second number */
+)
+{
+    int64_t      x;  /* first number */
+    int64_t      y;  /* second number */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    x = *(const int64_t *)a;
+    y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+
+/* ==========================================================================
+    Sorts v and prints its 50, 90, 99 percentile and max, divided by div.
+   ========================================================================== */
+
+
+static void print_dist
+(
+    const char        *name,  /* what is printed */
+    int64_t           *v,     /* values */
+    size_t             n,     /* number of elements in v */
+    double             div    /* unit of printed values */
+)
+{
+    size_t             i;     /* just an iterator */
+    static const int   pct[] = { 50, 90, 99, 100 };  /* percentiles */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    printf("%-12s", name);
+    if (n == 0)
+    {
+        printf("%12s\n", "-");
+        return;
+    }
+
+    qsort(v, n, sizeof(*v), cmp_i64);
+    for (i = 0; i != sizeof(pct) / sizeof(*pct); ++i)
+        printf(" %12.3f", v[(n * pct[i] + 99) / 100 - 1] / div);
+
+    printf("\n");
+}
+
+
+/* ==========================================================================
+    Prints programs help.
+   ========================================================================== */
+
+
+static void print_help
+(
+    const char  *name  /* name of program (argv[0]) */
+)
+{
+    fprintf(stderr, "usage: %s [-n<boots>] [-r<seed>] [-j<jobs>] [-t<sec>] "
+            "[-b<sec>] [-c<sec>] [-m<sec>] [-s<server>]... [-o<outage>]... "
+            "[-O<outage>]... [-v] [-- <ntpd-setwait options>]\n\n", name);
+    fprintf(stderr, "-n<boots>   boots to simulate (1000)\n");
+    fprintf(stderr, "-r<seed>    seed of first boot, each next gets +1 (1)\n");
+    fprintf(stderr, "-j<jobs>    boots simulated at once (1)\n");
+    fprintf(stderr, "-t<sec>     give up on boot after that long (86400)\n");
+    fprintf(stderr, "-b<sec>     boot time program starts at (5)\n");
+    fprintf(stderr, "-c<sec>     error of local clock at start (0)\n");
+    fprintf(stderr, "-m<sec>     max deviation passed to program (1)\n");
+    fprintf(stderr, "-s<server>  add server 10.0.0.n, "
+            "delay,jitter,loss[,skew[,dist[,stratum]]]\n");
+    fprintf(stderr, "            in ms,ms,percent,sec,u|e|p "
+            "(uniform, exponential, pareto)\n");
+    fprintf(stderr, "-o<outage>  servers lose packets, "
+            "start,length[,server] in sec\n");
+    fprintf(stderr, "-O<outage>  link is down, no route to servers\n");
+    fprintf(stderr, "-v          simulate single boot, with logs\n");
+}
+
+
+/* ==========================================================================
+                                              _
+                           ____ ___   ____ _ (_)____
+                          / __ `__ \ / __ `// // __ \
+                         / / / / / // /_/ // // / / /
+                        /_/ /_/ /_/ \__,_//_//_/ /_/
+
+   ========================================================================== */
+
+
+int main
+(
+    int                  argc,      /* number of arguments in argv list */
+    char                *argv[]     /* list of program arguments */
+)
+{
+    int                  i;         /* just an iterator */
+    int                  n;         /* number of boots to simulate */
+    int                  jobs;      /* boots simulated at once */
+    int                  running;   /* children running now */
+    int                  started;   /* boots started so far */
+    int                  verbose;   /* show logs of single boot */
+    int                  status;    /* exit status of child */
+    int                  pfd[2];    /* pipe results come through */
+    int                  cargc;     /* number of arguments in cargv */
+    size_t               nsynced;   /* boots that got time */
+    size_t               nresults;  /* boots that reported result */
+    unsigned             crashed;   /* boots that did not report */
+    uint64_t             seed;      /* seed of first boot */
+    int64_t              start;     /* time simulation started at */
+    int64_t              elapsed;   /* wall time simulation took */
+    int64_t             *sync;      /* time to sync of synced boots */
+    int64_t             *error;     /* clock error of synced boots */
+    int64_t             *packets;   /* packets sent in each boot */
+    pid_t                pid;       /* pid of child */
+    double               maxdev;    /* max deviation for program */
+    struct sim_result    r;         /* result of single boot */
+    struct sim_scenario  sc;        /* simulated scenario */
+    char                *cargv[NTPSIM_MAX_ARGS];  /* program arguments */
+    char                 maxdevs[32];  /* maxdev as string */
+    char                 hosts[SIM_MAX_SERVERS][16];  /* -i options */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    memset(&sc, 0x00, sizeof(sc));
+    sc.boot = 5 * NSEC_PER_SEC;
+    sc.limit = 86400 * NSEC_PER_SEC;
+    n = 1000;
+    jobs = 1;
+    seed = 1;
+    verbose = 0;
+    maxdev = 1;
+
+    for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1] != '-'; ++i)
+    {
+        switch (argv[i][1])
+        {
+        case 'n':
+            n = atoi(&argv[i][2]);
+            break;
+
+        case 'r':
+            seed = strtoull(&argv[i][2], NULL, 10);
+            break;
+
+        case 'j':
+            jobs = atoi(&argv[i][2]);
+            break;
+
+        case 't':
+            sc.limit = (int64_t)(atof(&argv[i][2]) * NSEC_PER_SEC);
+            break;
+
+        case 'b':
+            sc.boot = (int64_t)(atof(&argv[i][2]) * NSEC_PER_SEC);
+            break;
+
+        case 'c':
+            sc.error = (int64_t)(atof(&argv[i][2]) * NSEC_PER_SEC);
+            break;
+
+        case 'm':
+            maxdev = atof(&argv[i][2]);
+            break;
+
+        case 's':
+            if (sc.nservers == SIM_MAX_SERVERS ||
+                    parse_server(&argv[i][2], &sc.servers[sc.nservers]) != 0)
+            {
+                fprintf(stderr, "invalid server %s\n", argv[i]);
+                return 1;
+            }
+
+            sc.nservers++;
+            break;
+
+        case 'o':
+        case 'O':
+            if (sc.noutages == SIM_MAX_OUTAGES ||
+                    parse_outage(&argv[i][2], argv[i][1] == 'O',
+                        &sc.outages[sc.noutages]) != 0)
+            {
+                fprintf(stderr, "invalid outage %s\n", argv[i]);
+                return 1;
+            }
+
+            sc.noutages++;
+            break;
+
+        case 'v':
+            verbose = 1;
+            break;
+
+        default:
+            print_help(argv[0]);
+            return 1;
+        }
+    }
+
+    /* everything after -- is for ntpd-setwait
+     */
+
+    i += i < argc && strcmp(argv[i], "--") == 0;
+
+    if (n <= 0 || jobs <= 0 || sc.limit <= sc.boot)
+    {
+        print_help(argv[0]);
+        return 1;
+    }
+
+    if (sc.nservers == 0)
+        parse_server("10,5,0", &sc.servers[sc.nservers++]);
+
+    sc.limit += sc.boot;
+    if (verbose)
+        n = 1;
+
+    /* arguments of simulated ntpd-setwait, never detach,
+     * ntpd is never executed in simulation
+     */
+
+    cargc = 0;
+    cargv[cargc++] = "ntpd-setwait";
+    cargv[cargc++] = "-f";
+    cargv[cargc++] = verbose ? "-Ln" : "-Le";
+
+    for (started = 0; started != sc.nservers; ++started)
+    {
+        sprintf(hosts[started], "-i10.0.0.%d", started + 1);
+        cargv[cargc++] = hosts[started];
+    }
+
+    for (; i < argc && cargc < NTPSIM_MAX_ARGS - 3; ++i)
+        cargv[cargc++] = argv[i];
+
+    snprintf(maxdevs, sizeof(maxdevs), "%g", maxdev);
+    cargv[cargc++] = maxdevs;
+    cargv[cargc++] = "/bin/true";
+    cargv[cargc] = NULL;
+
+    sync = malloc(n * sizeof(*sync));
+    error = malloc(n * sizeof(*error));
+    packets = malloc(n * sizeof(*packets));
+    if (sync == NULL || error == NULL || packets == NULL || pipe(pfd) != 0)
+    {
+        perror("ntpsim");
+        return 1;
+    }
+
+    /* children would inherit unflushed output, and print it
+     * again on exit
+     */
+
+    fflush(stdout);
+    start = now_ns();
+    running = 0;
+    started = 0;
+    nsynced = 0;
+    nresults = 0;
+    crashed = 0;
+
+    while (started != n || running)
+    {
+        if (started != n && running != jobs)
+        {
+            if ((pid = fork()) < 0)
+            {
+                perror("ntpsim: fork");
+                return 1;
+            }
+
+            if (pid == 0)
+            {
+                close(pfd[0]);
+                boot(&sc, seed + started, pfd[1], cargc, cargv, !verbose);
+            }
+
+            started++;
+            running++;
+            continue;
+        }
+
+        if (wait(&status) < 0)
+        {
+            perror("ntpsim: wait");
+            return 1;
+        }
+
+        running--;
+
+        /* result is written before child exits, and it's smaller
+         * than PIPE_BUF, so it's already there, in one piece
+         */
+
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 ||
+                read(pfd[0], &r, sizeof(r)) != sizeof(r))
+        {
+            crashed++;
+            continue;
+        }
+
+        packets[nresults++] = r.packets;
+        if (!r.synced)
+            continue;
+
+        sync[nsynced] = r.time;
+        error[nsynced] = r.error < 0 ? -r.error : r.error;
+        nsynced++;
+    }
+
+    elapsed = now_ns() - start;
+
+    printf("boots %d, synced %.1f%%, crashed %u, %.0f boots/s\n", n,
+            100.0 * nsynced / n, crashed,
+            n / ((double)(elapsed ? elapsed : 1) / NSEC_PER_SEC));
+    printf("%-12s %12s %12s %12s %12s\n", "", "p50", "p90", "p99", "max");
+    print_dist("sync[s]", sync, nsynced, NSEC_PER_SEC);
+    print_dist("error[ms]", error, nsynced, 1000000.0);
+    print_dist("packets", packets, nresults, 1.0);
+
+    free(sync);
+    free(error);
+    free(packets);
+    return crashed ? 1 : 0;
+}
@@ -0,0 +1,78 @@
+#!/bin/sh
+
+# runs ntpd-setwait-bench in server mode (-P -X), synced to fakentp,
+# and floods it with ntpload, with more and more worker threads, and
+# prints requests per second it answered and latency percentiles.
+# Load generator runs on the same machine, so it takes cpus from the
+# server, numbers are for comparing, not absolute.
+#
+# environment:
+#   BENCH_PORT     port fakentp listens on, must match one bench binary
+#                  was compiled with
+#   BENCH_SERVE    port server under test listens on
+#   BENCH_CORES    worker thread counts to test
+#   BENCH_TIME     seconds of load per run
+#   BENCH_WINDOW   requests in flight per load thread
+
+port="${BENCH_PORT:-12323}"
+serve="${BENCH_SERVE:-12324}"
+cores="${BENCH_CORES:-1 2 4}"
+duration="${BENCH_TIME:-5}"
+window="${BENCH_WINDOW:-32}"
+tmp="$(mktemp -d)"
+
+trap 'rm -rf "${tmp}"' EXIT
+
+# waits until file $1 contains $2, while process $3 lives
+wait_for()
+{
+    while ! grep -q "${2}" "${1}" 2>/dev/null
+    do
+        if ! kill -0 ${3} 2>/dev/null
+        then
+            return 1
+        fi
+        sleep 0.01
+    done
+}
+
+./fakentp -p"${port}" -d1 > "${tmp}/srv" &
+srv=${!}
+
+if ! wait_for "${tmp}/srv" ready ${srv}
+then
+    echo "fakentp failed to start" >&2
+    exit 1
+fi
+
+printf "%6s %10s %8s %8s %8s %8s %8s %8s\n" workers "req/s" kod lost \
+    "p50[us]" "p90[us]" "p99[us]" "p999[us]"
+
+for n in ${cores}
+do
+    ./ntpd-setwait-bench -f -i127.0.0.1 -P3600,3600 -X"${serve},${n}" -Ln,0 \
+        0 > "${tmp}/cli" 2>&1 &
+    cli=${!}
+
+    if ! wait_for "${tmp}/cli" "serving time" ${cli}
+    then
+        echo "server with ${n} workers failed to start" >&2
+        cat "${tmp}/cli" >&2
+        kill ${srv}
+        exit 1
+    fi
+
+    ./ntpload -p"${serve}" -t"${n}" -d"${duration}" -w"${window}" \
+        > "${tmp}/load"
+
+    kill ${cli}
+    wait ${cli} 2>/dev/null
+
+    # load <threads> sent <n> replies <n> rate <n/s> kod <n> lost <n>
+    # p50 <us> p90 <us> p99 <us> p999 <us>
+    awk -v n="${n}" '/^load/ { printf "%6d %10d %8d %8d %8d %8d %8d %8d\n",
+        n, $8, $10, $12, $14, $16, $18, $20 }' "${tmp}/load"
+done
+
+kill ${srv}
+wait ${srv}
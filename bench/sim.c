@@ -0,0 +1,966 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ==========================================================================
+         --------------------------------------------------------------
+        / simulated clock and network for ntpsim, implements backend.h \
+        \ on virtual time, with servers that lose, delay and lie       /
+         --------------------------------------------------------------
+   ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include "ntpd-setwait-config.h"
+
+#include <errno.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "backend.h"
+#include "log.h"
+#include "sim.h"
+#include "sysclock.h"
+
+
+/* ==========================================================================
+          __             __                     __   _
+     ____/ /___   _____ / /____ _ _____ ____ _ / /_ (_)____   ____   _____
+    / __  // _ \ / ___// // __ `// ___// __ `// __// // __ \ / __ \ / ___/
+   / /_/ //  __// /__ / // /_/ // /   / /_/ // /_ / // /_/ // / / /(__  )
+   \__,_/ \___/ \___//_/ \__,_//_/    \__,_/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+/* sockets of simulation get numbers from here up, so they never
+ * clash with real fds, like log file
+ */
+
+#define SIM_FD_BASE (1000)
+#define SIM_MAX_SOCKETS (64)
+
+/* max number of replies waiting for their delay to pass, on
+ * single socket
+ */
+
+#define SIM_QUEUE_LEN (16)
+
+/* true (world) time at boot time 0, unix time in 2027
+ */
+
+#define SIM_EPOCH (1800000000ll * NSEC_PER_SEC)
+
+#define SIM_PACKET_LEN (48)
+#define SIM_UNIX_EPOCH_DIFF (2208988800ll)
+
+/* time server needs to turn request into reply
+ */
+
+#define SIM_SERVER_TIME (10000ll)
+
+/* same boot clock sysclock.c reads
+ */
+
+#ifdef CLOCK_BOOTTIME
+#   define SIM_BOOTTIME CLOCK_BOOTTIME
+#else
+#   define SIM_BOOTTIME CLOCK_MONOTONIC
+#endif
+
+
+/* reply on its way to us
+ */
+
+struct datagram
+{
+    int64_t        due;     /* boot time reply reaches us */
+    unsigned char  data[SIM_PACKET_LEN];  /* reply packet */
+};
+
+
+/* simulated udp socket
+ */
+
+struct sock
+{
+    int              used;     /* socket is open */
+    int              server;   /* server it's connected to, or -1 */
+    struct datagram  q[SIM_QUEUE_LEN];  /* replies on their way */
+    int              nq;       /* number of elements in q */
+};
+
+
+static struct
+{
+    struct sim_scenario  sc;       /* what we simulate */
+    int64_t              now;      /* current boot time */
+    int64_t              error;    /* local clock minus true time */
+    long                 nominal;  /* nominal kernel tick in us */
+    long                 tick;     /* current kernel tick in us */
+    uint64_t             rng;      /* random generator state */
+    unsigned             packets;  /* requests sent */
+    int                  fd;       /* results are written here */
+    struct sock          socks[SIM_MAX_SOCKETS];  /* open sockets */
+} g_sim;
+
+
+/* ==========================================================================
+                  _                __           ____
+    ____   _____ (_)_   __ ____ _ / /_ ___     / __/__  __ ____   _____ _____
+   / __ \ / ___// /| | / // __ `// __// _ \   / /_ / / / // __ \ / ___// ___/
+  / /_/ // /   / / | |/ // /_/ // /_ /  __/  / __// /_/ // / / // /__ (__  )
+ / .___//_/   /_/  |___/ \__,_/ \__/ \___/  /_/   \__,_//_/ /_/ \___//____/
+/_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Returns random 64bit number (xorshift64*), whole simulation runs on
+    this single generator, so boot with the same seed is repeated
+    exactly.
+   ========================================================================== */
+
+
+static uint64_t rnd(void)
+{
+    g_sim.rng ^= g_sim.rng >> 12;
+    g_sim.rng ^= g_sim.rng << 25;
+    g_sim.rng ^= g_sim.rng >> 27;
+    return g_sim.rng * 2685821657736338717ull;
+}
+
+
+/* ==========================================================================
+    Returns random number from (0, 1].
+   ========================================================================== */
+
+
+static double rnd_unit(void)
+{
+    return (double)((rnd() >> 11) + 1) / (double)(1ull << 53);
+}
+
+
+/* ==========================================================================
+    Draws random part of one way delay to server from its distribution.
+
+    returns
+            random delay in nanoseconds
+   ========================================================================== */
+
+
+static int64_t jitter
+(
+    const struct sim_server  *srv    /* server to draw delay for */
+)
+{
+    double                    d;     /* drawn delay */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (srv->jitter == 0)
+        return 0;
+
+    switch (srv->dist)
+    {
+    case SIM_DIST_EXP:
+        d = -(double)srv->jitter * log(rnd_unit());
+        break;
+
+    case SIM_DIST_PARETO:
+        /* with alpha 1.5 mean is 3 times minimum, tail is
+         * heavy, rare replies come very late
+         */
+
+        d = (double)srv->jitter / 3 * pow(rnd_unit(), -1 / 1.5);
+        break;
+
+    default:
+        return (int64_t)(rnd() % (uint64_t)(srv->jitter + 1));
+    }
+
+    return d > 60.0 * NSEC_PER_SEC ? 60 * NSEC_PER_SEC : (int64_t)d;
+}
+
+
+/* ==========================================================================
+    Moves virtual time forward to boot time t. Slewing clock (tick
+    changed with clock_adjtime()) gains or loses its share on the way.
+    Boot that did not get time before scenario limit ends here.
+   ========================================================================== */
+
+
+static void advance
+(
+    int64_t  t      /* boot time to move to */
+)
+{
+    if (t > g_sim.sc.limit)
+    {
+        g_sim.now = g_sim.sc.limit;
+        sim_finish(0);
+    }
+
+    if (t <= g_sim.now)
+        return;
+
+    g_sim.error += (t - g_sim.now) * (g_sim.tick - g_sim.nominal) /
+        g_sim.nominal;
+    g_sim.now = t;
+}
+
+
+/* ==========================================================================
+    Checks if outage of given kind affects server now.
+
+    returns
+            1       server is in outage
+            0       it works
+   ========================================================================== */
+
+
+static int in_outage
+(
+    int                       server,  /* index of server */
+    int                       link     /* kind of outage to look for */
+)
+{
+    int                       i;       /* just an iterator */
+    const struct sim_outage  *o;       /* checked outage */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    for (i = 0; i != g_sim.sc.noutages; ++i)
+    {
+        o = &g_sim.sc.outages[i];
+        if (o->link == link && (o->server == -1 || o->server == server) &&
+                g_sim.now >= o->start && g_sim.now < o->end)
+            return 1;
+    }
+
+    return 0;
+}
+
+
+/* ==========================================================================
+    Finds simulated socket of fd.
+
+    returns
+            socket, or NULL when fd is not ours
+   ========================================================================== */
+
+
+static struct sock *sock_get
+(
+    int  fd     /* fd to look for */
+)
+{
+    if (fd < SIM_FD_BASE || fd >= SIM_FD_BASE + SIM_MAX_SOCKETS ||
+            g_sim.socks[fd - SIM_FD_BASE].used == 0)
+        return NULL;
+
+    return &g_sim.socks[fd - SIM_FD_BASE];
+}
+
+
+/* ==========================================================================
+    Finds reply on socket s that has already arrived, the oldest one.
+
+    returns
+            index of reply in queue, or -1 when nothing arrived yet
+   ========================================================================== */
+
+
+static int sock_ready
+(
+    const struct sock  *s      /* socket to check */
+)
+{
+    int                 i;     /* just an iterator */
+    int                 best;  /* reply that arrived first */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    best = -1;
+    for (i = 0; i != s->nq; ++i)
+        if (s->q[i].due <= g_sim.now &&
+                (best == -1 || s->q[i].due < s->q[best].due))
+            best = i;
+
+    return best;
+}
+
+
+/* ==========================================================================
+    Stores unix time ns as 64bit ntp timestamp in buf.
+   ========================================================================== */
+
+
+static void ns_to_ntp
+(
+    int64_t         ns,    /* unix time to convert */
+    unsigned char  *buf    /* timestamp in ntp format will be stored here */
+)
+{
+    uint32_t        sec;   /* seconds part of timestamp */
+    uint32_t        frac;  /* fraction part of timestamp */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    sec = (uint32_t)(ns / NSEC_PER_SEC + SIM_UNIX_EPOCH_DIFF);
+    frac = (uint32_t)(((uint64_t)(ns % NSEC_PER_SEC) << 32) / NSEC_PER_SEC);
+
+    buf[0] = sec >> 24;
+    buf[1] = sec >> 16;
+    buf[2] = sec >> 8;
+    buf[3] = sec;
+    buf[4] = frac >> 24;
+    buf[5] = frac >> 16;
+    buf[6] = frac >> 8;
+    buf[7] = frac;
+}
+
+
+/* ==========================================================================
+    Server answers request req sent over socket s right now. Each
+    direction gets its own delay, so path is asymmetric, like real
+    ones, and server stamps reply with its own (maybe lying) clock.
+   ========================================================================== */
+
+
+static void answer
+(
+    struct sock              *s,     /* socket request was sent over */
+    const unsigned char      *req    /* ntp request */
+)
+{
+    int64_t                   fwd;   /* delay of request */
+    int64_t                   back;  /* delay of reply */
+    int64_t                   rec;   /* server time request arrived at */
+    unsigned char            *p;     /* reply packet */
+    const struct sim_server  *srv;   /* server that answers */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    srv = &g_sim.sc.servers[s->server];
+    if (s->nq == SIM_QUEUE_LEN || (req[0] & 0x07) != 3)
+        return;
+
+    fwd = srv->delay + jitter(srv);
+    back = srv->delay + jitter(srv);
+    rec = SIM_EPOCH + g_sim.now + fwd + srv->skew;
+
+    s->q[s->nq].due = g_sim.now + fwd + SIM_SERVER_TIME + back;
+    p = s->q[s->nq++].data;
+
+    memset(p, 0x00, SIM_PACKET_LEN);
+    p[0] = 0 << 6 | 4 << 3 | 4;  /* no leap, version 4, server mode */
+    p[1] = (unsigned char)srv->stratum;
+    p[2] = 6;                    /* poll */
+    p[3] = 0xec;                 /* precision, ~60ns */
+    memcpy(p + 12, "SIM", 3);
+    ns_to_ntp(rec - 16 * NSEC_PER_SEC, p + 16);  /* reference time */
+    memcpy(p + 24, req + 40, 8); /* origin is client's transmit */
+    ns_to_ntp(rec, p + 32);
+    ns_to_ntp(rec + SIM_SERVER_TIME, p + 40);
+}
+
+
+/* ==========================================================================
+                                        __     __ _
+                         ____   __  __ / /_   / /(_)_____
+                        / __ \ / / / // __ \ / // // ___/
+                       / /_/ // /_/ // /_/ // // // /__
+                      / .___/ \__,_//_.___//_//_/ \___/
+                     /_/
+               ____                     __   _
+              / __/__  __ ____   _____ / /_ (_)____   ____   _____
+             / /_ / / / // __ \ / ___// __// // __ \ / __ \ / ___/
+            / __// /_/ // / / // /__ / /_ / // /_/ // / / /(__  )
+           /_/   \__,_//_/ /_/ \___/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Prepares simulation of single boot, for scenario sc. Random numbers
+    are drawn from seed, result is written to fd, by sim_finish().
+   ========================================================================== */
+
+
+void sim_init
+(
+    const struct sim_scenario  *sc,    /* scenario to simulate */
+    uint64_t                    seed,  /* seed of random numbers */
+    int                         fd     /* where to write result */
+)
+{
+    memset(&g_sim, 0x00, sizeof(g_sim));
+    g_sim.sc = *sc;
+    g_sim.now = sc->boot;
+    g_sim.error = sc->error;
+    g_sim.nominal = 1000000 / sysconf(_SC_CLK_TCK);
+    g_sim.tick = g_sim.nominal;
+    g_sim.rng = seed * 0x9e3779b97f4a7c15ull + 1;
+    g_sim.fd = fd;
+}
+
+
+/* ==========================================================================
+    Ends simulated boot, and writes its result for driver. Logs of the
+    program are flushed first, so -v shows them.
+   ========================================================================== */
+
+
+void sim_finish
+(
+    int                synced  /* time has been set */
+)
+{
+    struct sim_result  r;      /* result of boot */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    memset(&r, 0x00, sizeof(r));
+    r.synced = synced;
+    r.time = g_sim.now - g_sim.sc.boot;
+    r.packets = g_sim.packets;
+    r.error = g_sim.error;
+
+    /* program keeps logs in memory until it's about to exit,
+     * simulated boot is ended before it gets there
+     */
+
+    log_flush();
+
+    if (write(g_sim.fd, &r, sizeof(r)) != sizeof(r))
+        _exit(1);
+
+    _exit(0);
+}
+
+
+/* ==========================================================================
+    Reads virtual clocks. Realtime is true time plus error of local
+    clock, boot and monotonic clocks are the same, and never slewed.
+   ========================================================================== */
+
+
+int backend_clock_gettime
+(
+    clockid_t         clk,  /* clock to read */
+    struct timespec  *ts    /* time will be stored here */
+)
+{
+    int64_t           t;    /* read time */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (clk == CLOCK_REALTIME)
+        t = SIM_EPOCH + g_sim.now + g_sim.error;
+    else if (clk == CLOCK_MONOTONIC || clk == SIM_BOOTTIME)
+        t = g_sim.now;
+    else
+        return clock_gettime(clk, ts);
+
+    ts->tv_sec = t / NSEC_PER_SEC;
+    ts->tv_nsec = t % NSEC_PER_SEC;
+    return 0;
+}
+
+
+/* ==========================================================================
+    Sets virtual realtime clock.
+   ========================================================================== */
+
+
+int backend_clock_settime
+(
+    clockid_t               clk,  /* clock to set */
+    const struct timespec  *ts    /* time to set */
+)
+{
+    if (clk != CLOCK_REALTIME)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    g_sim.error = (int64_t)ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec -
+        SIM_EPOCH - g_sim.now;
+    return 0;
+}
+
+
+#if HAVE_CLOCK_ADJTIME
+
+
+/* ==========================================================================
+    Adjusts virtual realtime clock. Step (ADJ_SETOFFSET) moves it right
+    away, changed tick makes it run faster or slower from now on, kernel
+    pll (ADJ_OFFSET) is not simulated, it's too slow to matter at boot.
+   ========================================================================== */
+
+
+int backend_clock_adjtime
+(
+    clockid_t      clk,  /* clock to adjust */
+    struct timex  *tx    /* adjustment to make */
+)
+{
+    if (clk != CLOCK_REALTIME)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (tx->modes & ADJ_SETOFFSET)
+        g_sim.error += (int64_t)tx->time.tv_sec * NSEC_PER_SEC +
+            tx->time.tv_usec * (tx->modes & ADJ_NANO ? 1 : 1000);
+
+    if (tx->modes & ADJ_TICK)
+        g_sim.tick = tx->tick;
+
+    tx->tick = g_sim.tick;
+    tx->freq = 0;
+    return TIME_OK;
+}
+
+
+#endif /* HAVE_CLOCK_ADJTIME */
+
+
+/* ==========================================================================
+    No signal ever comes in simulation, so it's sleep for ts.
+   ========================================================================== */
+
+
+int backend_sigtimedwait
+(
+    const sigset_t         *set,   /* signals to wait for */
+    siginfo_t              *info,  /* info about signal */
+    const struct timespec  *ts     /* max time to wait */
+)
+{
+    (void)set;
+    (void)info;
+
+    advance(g_sim.now + (int64_t)ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec);
+    errno = EAGAIN;
+    return -1;
+}
+
+
+/* ==========================================================================
+    Waits for replies, like poll() does, but instead of sleeping, virtual
+    time jumps right to arrival of the nearest reply, or to timeout.
+    Fds that are not ours never become ready.
+   ========================================================================== */
+
+
+int backend_poll
+(
+    struct pollfd  *pfd,      /* fds to wait for */
+    nfds_t          nfds,     /* number of elements in pfd */
+    int             timeout   /* max time to wait in ms, -1 forever */
+)
+{
+    nfds_t          i;        /* just an iterator */
+    int             j;        /* just another iterator */
+    int             n;        /* number of ready fds */
+    int64_t         next;     /* boot time nearest reply arrives at */
+    int64_t         end;      /* boot time wait ends at */
+    struct sock    *s;        /* polled socket */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    end = timeout < 0 ? INT64_MAX : g_sim.now + timeout * 1000000ll;
+
+    for (;;)
+    {
+        n = 0;
+        next = INT64_MAX;
+
+        for (i = 0; i != nfds; ++i)
+        {
+            pfd[i].revents = 0;
+            if ((s = sock_get(pfd[i].fd)) == NULL ||
+                    (pfd[i].events & POLLIN) == 0)
+                continue;
+
+            if (sock_ready(s) >= 0)
+            {
+                pfd[i].revents = POLLIN;
+                n++;
+                continue;
+            }
+
+            for (j = 0; j != s->nq; ++j)
+                next = s->q[j].due < next ? s->q[j].due : next;
+        }
+
+        if (n || timeout == 0)
+            return n;
+
+        if (next > end)
+        {
+            advance(end);
+            return 0;
+        }
+
+        advance(next);
+    }
+}
+
+
+#if HAVE_SYS_TIMERFD_H
+
+
+/* ==========================================================================
+    There are no timerfds in simulation, sleeps fall back to poll()
+    timeout, which runs on virtual time, where there is no suspend.
+   ========================================================================== */
+
+
+int backend_timerfd_create
+(
+    clockid_t  clk,    /* clock of timer */
+    int        flags   /* timerfd flags */
+)
+{
+    (void)clk;
+    (void)flags;
+
+    errno = ENOSYS;
+    return -1;
+}
+
+
+#endif /* HAVE_SYS_TIMERFD_H */
+
+
+/* ==========================================================================
+    Opens simulated udp socket, nothing else is supported.
+   ========================================================================== */
+
+
+int backend_socket
+(
+    int  domain,    /* address family */
+    int  type,      /* socket type, with flags */
+    int  protocol   /* protocol */
+)
+{
+    int  i;         /* just an iterator */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    (void)protocol;
+
+    if ((domain != AF_INET && domain != AF_INET6) ||
+            (type & 0xf) != SOCK_DGRAM)
+    {
+        errno = EAFNOSUPPORT;
+        return -1;
+    }
+
+    for (i = 0; i != SIM_MAX_SOCKETS; ++i)
+    {
+        if (g_sim.socks[i].used)
+            continue;
+
+        memset(&g_sim.socks[i], 0x00, sizeof(g_sim.socks[i]));
+        g_sim.socks[i].used = 1;
+        g_sim.socks[i].server = -1;
+        return SIM_FD_BASE + i;
+    }
+
+    errno = EMFILE;
+    return -1;
+}
+
+
+/* ==========================================================================
+    Connects socket to server. Servers are 10.0.0.1, 10.0.0.2 and so on,
+    any other address is a black hole. With link down, there is no route
+    to anything.
+   ========================================================================== */
+
+
+int backend_connect
+(
+    int                         fd,       /* socket to connect */
+    const struct sockaddr      *addr,     /* address to connect to */
+    socklen_t                   addrlen   /* length of addr */
+)
+{
+    struct sock                *s;        /* connected socket */
+    const struct sockaddr_in   *sin;      /* ipv4 address */
+    uint32_t                    ip;       /* address in host order */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    (void)addrlen;
+
+    if ((s = sock_get(fd)) == NULL)
+    {
+        errno = EBADF;
+        return -1;
+    }
+
+    s->server = -1;
+    if (addr->sa_family == AF_INET)
+    {
+        sin = (const struct sockaddr_in *)addr;
+        ip = ntohl(sin->sin_addr.s_addr);
+        if ((ip & 0xffffff00u) == 0x0a000000u && (ip & 0xff) >= 1 &&
+                (int)(ip & 0xff) <= g_sim.sc.nservers)
+            s->server = (int)(ip & 0xff) - 1;
+    }
+
+    if (in_outage(s->server, 1))
+    {
+        errno = ENETUNREACH;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* ==========================================================================
+    Kernel timestamps are not simulated, user space time is exact here
+    anyway.
+   ========================================================================== */
+
+
+int backend_setsockopt
+(
+    int          fd,       /* socket to set option on */
+    int          level,    /* level of option */
+    int          optname,  /* option to set */
+    const void  *optval,   /* value of option */
+    socklen_t    optlen    /* length of optval */
+)
+{
+    (void)optval;
+    (void)optlen;
+
+    if (sock_get(fd) == NULL)
+    {
+        errno = EBADF;
+        return -1;
+    }
+
+#ifdef SO_TIMESTAMPING
+    if (level == SOL_SOCKET && optname == SO_TIMESTAMPING)
+    {
+        errno = ENOPROTOOPT;
+        return -1;
+    }
+#endif
+
+#ifdef SO_TIMESTAMPNS
+    if (level == SOL_SOCKET && optname == SO_TIMESTAMPNS)
+    {
+        errno = ENOPROTOOPT;
+        return -1;
+    }
+#endif
+
+    (void)level;
+    (void)optname;
+    return 0;
+}
+
+
+/* ==========================================================================
+    Sends request to server socket is connected to. Request may get lost
+    (randomly, or server is in outage), or answered after delay.
+   ========================================================================== */
+
+
+ssize_t backend_send
+(
+    int           fd,     /* socket to send over */
+    const void   *buf,    /* data to send */
+    size_t        len,    /* length of buf */
+    int           flags   /* send flags */
+)
+{
+    struct sock  *s;      /* socket to send over */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    (void)flags;
+
+    if ((s = sock_get(fd)) == NULL)
+    {
+        errno = EBADF;
+        return -1;
+    }
+
+    if (in_outage(s->server, 1))
+    {
+        errno = ENETUNREACH;
+        return -1;
+    }
+
+    g_sim.packets++;
+
+    if (s->server == -1 || len != SIM_PACKET_LEN ||
+            in_outage(s->server, 0) ||
+            (int)(rnd() % 100) < g_sim.sc.servers[s->server].loss)
+        return (ssize_t)len;
+
+    answer(s, buf);
+    return (ssize_t)len;
+}
+
+
+/* ==========================================================================
+    Receives reply that already arrived. Error queue is always empty, as
+    there are no kernel timestamps, and there is no control data.
+   ========================================================================== */
+
+
+ssize_t backend_recvmsg
+(
+    int              fd,     /* socket to receive from */
+    struct msghdr   *msg,    /* received message will be stored here */
+    int              flags   /* receive flags */
+)
+{
+    int              i;      /* index of reply in queue */
+    size_t           len;    /* length of copied data */
+    struct sock     *s;      /* socket to receive from */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if ((s = sock_get(fd)) == NULL)
+    {
+        errno = EBADF;
+        return -1;
+    }
+
+    if (flags & MSG_ERRQUEUE || (i = sock_ready(s)) < 0)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    len = msg->msg_iov[0].iov_len;
+    msg->msg_flags = len < SIM_PACKET_LEN ? MSG_TRUNC : 0;
+    len = len < SIM_PACKET_LEN ? len : SIM_PACKET_LEN;
+    memcpy(msg->msg_iov[0].iov_base, s->q[i].data, len);
+    msg->msg_controllen = 0;
+    msg->msg_namelen = 0;
+
+    s->q[i] = s->q[--s->nq];
+    return (ssize_t)len;
+}
+
+
+#if HAVE_RECVMMSG
+
+
+/* ==========================================================================
+    Receives up to vlen replies that already arrived.
+   ========================================================================== */
+
+
+int backend_recvmmsg
+(
+    int               fd,       /* socket to receive from */
+    struct mmsghdr   *mmsg,     /* received messages will be stored here */
+    unsigned int      vlen,     /* number of elements in mmsg */
+    int               flags,    /* receive flags */
+    struct timespec  *timeout   /* not used */
+)
+{
+    unsigned int      i;        /* just an iterator */
+    ssize_t           len;      /* length of received message */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    (void)timeout;
+
+    for (i = 0; i != vlen; ++i)
+    {
+        if ((len = backend_recvmsg(fd, &mmsg[i].msg_hdr, flags)) < 0)
+            break;
+
+        mmsg[i].msg_len = (unsigned int)len;
+    }
+
+    return i ? (int)i : -1;
+}
+
+
+#endif /* HAVE_RECVMMSG */
+
+
+/* ==========================================================================
+    Closes simulated socket, replies on their way to it are lost.
+   ========================================================================== */
+
+
+int backend_close
+(
+    int           fd     /* fd to close */
+)
+{
+    struct sock  *s;     /* socket to close */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if ((s = sock_get(fd)) == NULL)
+        return close(fd);
+
+    s->used = 0;
+    return 0;
+}
+
+
+/* ==========================================================================
+    There is no io_uring in simulation, program falls back to poll().
+   ========================================================================== */
+
+
+long backend_io_uring_setup
+(
+    unsigned  entries,  /* size of ring */
+    void     *p         /* ring parameters */
+)
+{
+    (void)entries;
+    (void)p;
+
+    errno = ENOSYS;
+    return -1;
+}
+
+
+/* ==========================================================================
+    Seed of program's random numbers comes from simulation, so retry
+    jitter is repeated too.
+   ========================================================================== */
+
+
+uint32_t backend_entropy(void)
+{
+    return (uint32_t)(rnd() >> 32);
+}
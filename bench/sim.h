@@ -0,0 +1,80 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ========================================================================== */
+
+#ifndef SIM_H
+#define SIM_H 1
+
+#include <stdint.h>
+
+/* max number of simulated ntp servers, server n has address
+ * 10.0.0.n (first one is 10.0.0.1)
+ */
+
+#define SIM_MAX_SERVERS (8)
+
+/* max number of scripted outages
+ */
+
+#define SIM_MAX_OUTAGES (16)
+
+/* distributions random part of delay is drawn from
+ */
+
+#define SIM_DIST_UNIFORM (0)  /* uniform between 0 and jitter */
+#define SIM_DIST_EXP     (1)  /* exponential, jitter is mean */
+#define SIM_DIST_PARETO  (2)  /* pareto (alpha 1.5), jitter is mean */
+
+/* simulated server, all times are in nanoseconds
+ */
+
+struct sim_server
+{
+    int64_t  delay;    /* one way network delay */
+    int64_t  jitter;   /* random delay added to each direction */
+    int      dist;     /* SIM_DIST_* jitter is drawn from */
+    int      loss;     /* percent of lost requests */
+    int64_t  skew;     /* how much server's clock lies */
+    int      stratum;  /* stratum server reports */
+};
+
+/* period of time in which server (or whole network) does not
+ * work, times are boot times in nanoseconds
+ */
+
+struct sim_outage
+{
+    int64_t  start;    /* boot time outage starts at */
+    int64_t  end;      /* boot time outage ends at */
+    int      server;   /* index of server, or -1 for all of them */
+    int      link;     /* 1 link down (no route), 0 packets lost */
+};
+
+struct sim_scenario
+{
+    struct sim_server  servers[SIM_MAX_SERVERS];  /* ntp servers */
+    int                nservers;  /* number of elements in servers */
+    struct sim_outage  outages[SIM_MAX_OUTAGES];  /* scripted outages */
+    int                noutages;  /* number of elements in outages */
+    int64_t            boot;      /* boot time program starts at */
+    int64_t            error;     /* error of local clock at start */
+    int64_t            limit;     /* boot time simulation gives up at */
+};
+
+/* what happened in single simulated boot
+ */
+
+struct sim_result
+{
+    int       synced;   /* time has been set */
+    int64_t   time;     /* time from start to sync */
+    unsigned  packets;  /* requests sent to servers */
+    int64_t   error;    /* error of local clock at the end */
+};
+
+void sim_init(const struct sim_scenario *, uint64_t, int);
+void sim_finish(int) __attribute__((noreturn));
+int ntpd_setwait_main(int, char *[]);
+
+#endif
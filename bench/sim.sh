@@ -0,0 +1,55 @@
+#!/bin/sh
+
+# runs ntpsim in a few scenarios, that would take hours (or days) of
+# real time each, and prints distribution of time to get time, and of
+# packets sent for it, over many simulated boots.
+#
+# environment:
+#   SIM_BOOTS   number of boots per scenario
+#   SIM_JOBS    boots simulated at once
+#   SIM_SEED    seed of first boot, same seed gives same numbers
+
+boots="${SIM_BOOTS:-1000}"
+jobs="${SIM_JOBS:-$(nproc 2>/dev/null || echo 1)}"
+seed="${SIM_SEED:-1}"
+tmp="$(mktemp -d)"
+
+trap 'rm -rf "${tmp}"' EXIT
+
+# name and ntpsim options of each scenario, servers are
+# delay,jitter,loss[,skew[,dist]] in ms,ms,%,s, liar has clock off by
+# an hour, as does local clock (-c), so error shows who won
+scenarios="
+lan:-s1,1,0
+wan:-s40,20,0,0,e
+lossy:-s40,20,30,0,e
+heavytail:-s40,20,5,0,p
+nolink:-s10,5,0 -O0,3600
+flapping:-s10,5,0 -o0,60 -o90,60 -o180,60 -o270,600
+deadfirst:-s10,5,0 -s10,5,0 -o0,86400,1
+liar:-c3600 -s10,5,0,3600 -s10,5,0 -s10,5,0
+quorum:-c3600 -s10,5,0,3600 -s10,5,0 -s10,5,0 -- -q2
+"
+
+echo "${scenarios}" | while IFS=: read name opts
+do
+    [ -z "${name}" ] && continue
+
+    echo "== ${name}: ${opts}"
+    ./ntpsim -n"${boots}" -j"${jobs}" -r"${seed}" ${opts} || exit 1
+    echo
+done
+
+# clock is decades behind at boot (no rtc), servers are asked before
+# it's stepped, and scores of them must still be saved after that
+echo "== scoreboard: clock 30 years behind, state in ${tmp}"
+./ntpsim -n1 -r"${seed}" -c-946728000 -s10,5,0 -s10,5,0 -- -d"${tmp}" \
+    > /dev/null || exit 1
+
+if ! grep -q "^10.0.0.1 " "${tmp}/servers" 2>/dev/null
+then
+    echo "scoreboard: servers file lost after clock step" >&2
+    exit 1
+fi
+
+echo "servers file kept $(wc -l < "${tmp}/servers") servers"
@@ -0,0 +1,330 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ==========================================================================
+         ------------------------------------------------------------
+        / sntp client that stays resident instead of ntpd,           \
+        \ polls servers with adaptive interval and disciplines clock /
+         ------------------------------------------------------------
+   ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include "ntpd-setwait-config.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if HAVE_SYS_TIMERFD_H
+#   include <sys/timerfd.h>
+#endif
+
+#include "client.h"
+#include "log.h"
+#include "sysclock.h"
+
+
+/* ==========================================================================
+          __             __                     __   _
+     ____/ /___   _____ / /____ _ _____ ____ _ / /_ (_)____   ____   _____
+    / __  // _ \ / ___// // __ `// ___// __ `// __// // __ \ / __ \ / ___/
+   / /_/ //  __// /__ / // /_/ // /   / /_/ // /_ / // /_/ // / / /(__  )
+   \__,_/ \___/ \___//_/ \__,_//_/    \__,_/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+/* offsets larger than that are stepped, smaller ones are passed to
+ * kernel pll, same threshold as ntpd uses
+ */
+
+#define CLIENT_STEP (128 * 1000000ll)
+
+
+/* offset we are happy with, poll interval grows while offsets stay
+ * below that (or below their error, when it's larger, as we cannot
+ * measure better), and shrinks when they don't
+ */
+
+#define CLIENT_TARGET (2 * 1000000ll)
+
+
+/* number of consecutive good offsets before poll interval is doubled
+ */
+
+#define CLIENT_GOOD_POLLS (4)
+
+
+/* CLOCK_BOOTTIME keeps counting when system is suspended, so poll
+ * is not late after resume
+ */
+
+#ifdef CLOCK_BOOTTIME
+#   define CLIENT_CLOCK CLOCK_BOOTTIME
+#else
+#   define CLIENT_CLOCK CLOCK_MONOTONIC
+#endif
+
+
+/* ==========================================================================
+                  _                __           ____
+    ____   _____ (_)_   __ ____ _ / /_ ___     / __/__  __ ____   _____ _____
+   / __ \ / ___// /| | / // __ `// __// _ \   / /_ / / / // __ \ / ___// ___/
+  / /_/ // /   / / | |/ // /_/ // /_ /  __/  / __// /_/ // / / // /__ (__  )
+ / .___//_/   /_/  |___/ \__,_/ \__/ \___/  /_/   \__,_//_/ /_/ \___//____/
+/_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Computes time constant for kernel pll from poll interval, it's log2
+    of interval in seconds minus 4, as ntpd does it.
+
+    returns
+            time constant, 0..10
+   ========================================================================== */
+
+
+static int time_constant
+(
+    int64_t  interval  /* poll interval */
+)
+{
+    int      tc;       /* computed time constant */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    for (tc = -4, interval /= NSEC_PER_SEC; interval > 1; interval >>= 1)
+        tc++;
+
+    return tc < 0 ? 0 : tc > 10 ? 10 : tc;
+}
+
+
+/* ==========================================================================
+                                        __     __ _
+                         ____   __  __ / /_   / /(_)_____
+                        / __ \ / / / // __ \ / // // ___/
+                       / /_/ // /_/ // /_/ // // // /__
+                      / .___/ \__,_//_.___//_//_/ \___/
+                     /_/
+               ____                     __   _
+              / __/__  __ ____   _____ / /_ (_)____   ____   _____
+             / /_ / / / // __ \ / ___// __// // __ \ / __ \ / ___/
+            / __// /_/ // / / // /__ / /_ / // /_/ // / / /(__  )
+           /_/   \__,_//_/ /_/ \___/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Prepares client to poll servers every min to max seconds. Timers
+    are timerfds, so we sleep in single poll() until it's time to ask
+    servers, or until someone sets the clock, and nothing is allocated,
+    so memory used stays the same no matter how long we run.
+
+    returns
+            0       client ready
+           -1       on error
+   ========================================================================== */
+
+
+int client_init
+(
+    struct client  *c,    /* client to initialize */
+    long            min,  /* min poll interval in seconds */
+    long            max   /* max poll interval in seconds */
+)
+{
+    memset(c, 0x00, sizeof(*c));
+    c->min = min * NSEC_PER_SEC;
+    c->max = max * NSEC_PER_SEC;
+    c->interval = c->min;
+    c->tfd = -1;
+    c->jfd = -1;
+
+#if HAVE_SYS_TIMERFD_H
+    if ((c->tfd = timerfd_create(CLIENT_CLOCK, TFD_CLOEXEC)) < 0)
+    {
+        error("e/timerfd_create()");
+        return -1;
+    }
+
+    /* without it, we won't know about clock being set
+     */
+
+    if ((c->jfd = sysclock_jump_open()) < 0)
+        error("w/sysclock_jump_open()");
+#endif
+    return 0;
+}
+
+
+/* ==========================================================================
+    Sleeps until it's time to poll servers, that is for current poll
+    interval, or until realtime clock is set by someone else (like user
+    with date), after which we better check time right away.
+
+    returns
+            0       it's time to poll servers
+            1       clock has been set by someone else
+           -1       on error
+   ========================================================================== */
+
+
+int client_wait
+(
+    struct client      *c       /* client to wait for */
+)
+{
+#if HAVE_SYS_TIMERFD_H
+    uint64_t            n;      /* expirations of timer */
+    struct itimerspec   its;    /* time to expire at */
+    struct pollfd       pfd[2]; /* timers to wait on */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    memset(&its, 0x00, sizeof(its));
+    its.it_value.tv_sec = c->interval / NSEC_PER_SEC;
+    its.it_value.tv_nsec = c->interval % NSEC_PER_SEC;
+
+    if (timerfd_settime(c->tfd, 0, &its, NULL) != 0)
+    {
+        error("e/timerfd_settime()");
+        return -1;
+    }
+
+    pfd[0].fd = c->tfd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = c->jfd;
+    pfd[1].events = POLLIN;
+
+    for (;;)
+    {
+        if (poll(pfd, 2, -1) < 0)
+        {
+            /* signal, like SIGUSR1 asking to flush log
+             */
+
+            if (errno == EINTR)
+                continue;
+
+            error("e/poll() client timers");
+            return -1;
+        }
+
+        if (pfd[1].revents && sysclock_jumped(c->jfd))
+            return 1;
+
+        if (pfd[0].revents)
+        {
+            if (read(c->tfd, &n, sizeof(n)) < 0 && errno != EINTR)
+            {
+                error("e/read() poll timer");
+                return -1;
+            }
+
+            return 0;
+        }
+    }
+#else
+    struct timespec  ts;  /* time to sleep */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    ts.tv_sec = c->interval / NSEC_PER_SEC;
+    ts.tv_nsec = c->interval % NSEC_PER_SEC;
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+        ;
+
+    return 0;
+#endif
+}
+
+
+/* ==========================================================================
+    Corrects clock by offset measured with given error, and adapts poll
+    interval. Large offset is stepped, small one is passed to kernel
+    pll. When offsets stay within target (or their error, since we
+    cannot do better), interval doubles every few polls, up to max,
+    kernel has frequency figured out by then. Offset over target halves
+    interval, step starts over from min.
+   ========================================================================== */
+
+
+void client_update
+(
+    struct client  *c,       /* client that measured offset */
+    int64_t         offset,  /* measured offset of clock */
+    int64_t         err      /* max error of offset */
+)
+{
+    int64_t         abs;     /* absolute value of offset */
+    int64_t         target;  /* offset we are happy with */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    abs = offset < 0 ? -offset : offset;
+    target = err > CLIENT_TARGET ? err : CLIENT_TARGET;
+
+    if (abs >= CLIENT_STEP)
+    {
+        log_print("n/offset %+.6fs too big for pll, stepping clock\n",
+                (double)offset / NSEC_PER_SEC);
+
+        if (sysclock_step(offset) != 0)
+            error("w/sysclock_step()");
+
+        /* step cancels jump timer, it was us, re-arm it
+         */
+
+        sysclock_jumped(c->jfd);
+        c->interval = c->min;
+        c->good = 0;
+        return;
+    }
+
+    if (sysclock_discipline(offset, err, time_constant(c->interval)) != 0)
+        error("w/sysclock_discipline()");
+
+    if (abs < target)
+    {
+        if (++c->good >= CLIENT_GOOD_POLLS && c->interval < c->max)
+        {
+            c->interval = c->interval * 2 > c->max ? c->max : c->interval * 2;
+            c->good = 0;
+        }
+
+        return;
+    }
+
+    c->interval = c->interval / 2 < c->min ? c->min : c->interval / 2;
+    c->good = 0;
+}
+
+
+/* ==========================================================================
+    Records failed poll, next poll is done sooner, as we may have lost
+    track of time, but not sooner than min interval, so servers that are
+    down are not hammered.
+   ========================================================================== */
+
+
+void client_failed
+(
+    struct client  *c  /* client that failed to poll */
+)
+{
+    c->interval = c->interval / 2 < c->min ? c->min : c->interval / 2;
+    c->good = 0;
+}
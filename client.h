@@ -0,0 +1,30 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ========================================================================== */
+
+#ifndef CLIENT_H
+#define CLIENT_H 1
+
+#include <stdint.h>
+
+/* state of resident sntp client (-P option), all times are in
+ * nanoseconds
+ */
+
+struct client
+{
+    int      tfd;       /* timer of next poll, or -1 */
+    int      jfd;       /* timer cancelled when clock is set, or -1 */
+    int64_t  interval;  /* current poll interval */
+    int64_t  min;       /* min poll interval */
+    int64_t  max;       /* max poll interval */
+    int      good;      /* consecutive polls with good offset */
+};
+
+int client_init(struct client *, long, long);
+int client_wait(struct client *);
+void client_update(struct client *, int64_t, int64_t);
+void client_failed(struct client *);
+
+#endif
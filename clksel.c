@@ -0,0 +1,195 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ==========================================================================
+         --------------------------------------------------------
+        < clock selection, finds offset most of servers agree on >
+         --------------------------------------------------------
+   ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "clksel.h"
+#include "ntp.h"
+
+
+/* ==========================================================================
+          __             __                     __   _
+     ____/ /___   _____ / /____ _ _____ ____ _ / /_ (_)____   ____   _____
+    / __  // _ \ / ___// // __ `// ___// __ `// __// // __ \ / __ \ / ___/
+   / /_/ //  __// /__ / // /_/ // /   / /_/ // /_ / // /_/ // / / /(__  )
+   \__,_/ \___/ \___//_/ \__,_//_/    \__,_/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+/* smallest error we assume for any server, even if it says its
+ * time is perfect, so servers with tiny delays on lan can still
+ * agree with each other (MINDISP from RFC 5905)
+ */
+
+#define CLKSEL_MIN_DISP (5 * 1000000ll)
+
+
+/* single end of correctness interval
+ */
+
+struct edge
+{
+    int64_t  t;     /* offset at which interval starts or ends */
+    int      type;  /* 1 when interval starts, -1 when it ends */
+};
+
+
+/* ==========================================================================
+                  _                __           ____
+    ____   _____ (_)_   __ ____ _ / /_ ___     / __/__  __ ____   _____ _____
+   / __ \ / ___// /| | / // __ `// __// _ \   / /_ / / / // __ \ / ___// ___/
+  / /_/ // /   / / | |/ // /_/ // /_ /  __/  / __// /_/ // / / // /__ (__  )
+ / .___//_/   /_/  |___/ \__,_/ \__/ \___/  /_/   \__,_//_/ /_/ \___//____/
+/_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    qsort() comparator for interval edges. Edges are sorted by offset,
+    and when offsets are equal starts go first, so intervals that only
+    touch each other are still counted as intersecting.
+   ========================================================================== */
+
+
+static int edge_cmp
+(
+    const void         *a,  /* first edge to compare */
+    const void         *b   /* second edge to compare */
+)
+{
+    const struct edge  *ea = a;
+    const struct edge  *eb = b;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (ea->t != eb->t)
+        return (ea->t > eb->t) - (ea->t < eb->t);
+
+    return eb->type - ea->type;
+}
+
+
+
+
+/* ==========================================================================
+                                        __     __ _
+                         ____   __  __ / /_   / /(_)_____
+                        / __ \ / / / // __ \ / // // ___/
+                       / /_/ // /_/ // /_/ // // // /__
+                      / .___/ \__,_//_.___//_//_/ \___/
+                     /_/
+               ____                     __   _
+              / __/__  __ ____   _____ / /_ (_)____   ____   _____
+             / /_ / / / // __ \ / ___// __// // __ \ / __ \ / ___/
+            / __// /_/ // / / // /__ / /_ / // /_/ // / / /(__  )
+           /_/   \__,_//_/ /_/ \___/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Runs intersection algorithm (Marzullo's, as used by ntp clock select)
+    on samples. Each server says that true time is within its
+    correctness interval:
+
+        [offset - rootdist - delay/2, offset + rootdist + delay/2]
+
+    Server with correct time must have true time in its interval, so
+    we look for smallest range that is contained in largest number of
+    intervals. Servers whose intervals contain that range are
+    truechimers, rest are falsetickers. Offset is taken from the middle
+    of that range.
+
+    Result is accepted only when truechimers are majority of all
+    samples, otherwise we can't tell which group is lying.
+
+    returns
+            >0      number of servers that agree, offset is set
+            0       there is no majority, offset is left untouched
+   ========================================================================== */
+
+
+int clksel_intersect
+(
+    const struct ntp_sample  *samples,  /* samples to select offset from */
+    int                       n,        /* number of samples */
+    int64_t                  *offset    /* selected offset, can be NULL */
+)
+{
+    int                       i;        /* just an iterator */
+    int                       count;    /* intervals containing current edge */
+    int                       best;     /* max count found so far */
+    int                       open;     /* best range still not closed */
+    int64_t                   r;        /* half width of an interval */
+    int64_t                   lo;       /* start of best range */
+    int64_t                   hi;       /* end of best range */
+    struct edge               edges[2 * NTP_MAX_ADDRS];  /* all edges */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (n <= 0 || n > NTP_MAX_ADDRS)
+        return 0;
+
+    for (i = 0; i != n; ++i)
+    {
+        r = samples[i].delay / 2 + samples[i].rootdist + CLKSEL_MIN_DISP;
+        edges[2 * i].t = samples[i].offset - r;
+        edges[2 * i].type = 1;
+        edges[2 * i + 1].t = samples[i].offset + r;
+        edges[2 * i + 1].type = -1;
+    }
+
+    qsort(edges, 2 * n, sizeof(edges[0]), edge_cmp);
+
+    /* sweep through edges, counting how many intervals we are
+     * in, range with max count starts at the start edge where
+     * we reach max, and ends at the very next end edge
+     */
+
+    count = 0;
+    best = 0;
+    open = 0;
+    lo = 0;
+    hi = 0;
+
+    for (i = 0; i != 2 * n; ++i)
+    {
+        count += edges[i].type;
+
+        if (edges[i].type == 1 && count > best)
+        {
+            best = count;
+            lo = edges[i].t;
+            open = 1;
+        }
+        else if (edges[i].type == -1 && open)
+        {
+            hi = edges[i].t;
+            open = 0;
+        }
+    }
+
+    if (2 * best <= n)
+        return 0;
+
+    if (offset)
+        *offset = lo + (hi - lo) / 2;
+
+    return best;
+}
@@ -0,0 +1,15 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ========================================================================== */
+
+#ifndef CLKSEL_H
+#define CLKSEL_H 1
+
+#include <stdint.h>
+
+#include "ntp.h"
+
+int clksel_intersect(const struct ntp_sample *, int, int64_t *);
+
+#endif
@@ -46,6 +46,57 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "log.h"
+
+
+/* ==========================================================================
+                  _                __           ____
+    ____   _____ (_)_   __ ____ _ / /_ ___     / __/__  __ ____   _____ _____
+   / __ \ / ___// /| | / // __ `// __// _ \   / /_ / / / // __ \ / ___// ___/
+  / /_/ // /   / / | |/ // /_/ // /_ /  __/  / __// /_/ // / / // /__ (__  )
+ / .___//_/   /_/  |___/ \__,_/ \__/ \___/  /_/   \__,_//_/ /_/ \___//____/
+/_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Checks if pid file holds pid of process that does not exist anymore.
+    Pid file is left behind, when we don't get to clean it up, like when
+    we are killed with SIGKILL or by oom killer. Supervisor (-K) keeps
+    its pid file for as long as it runs, so it's not that rare, and init
+    system that restarts us should not have to remove it first.
+
+    returns
+            1       pid file is stale
+            0       process is running, or pid file cannot be read
+   ========================================================================== */
+
+
+static int stale_pid
+(
+    int      fd        /* opened pid file */
+)
+{
+    char     buf[32];  /* contents of pid file */
+    long     pid;      /* pid read from file */
+    ssize_t  n;        /* number of bytes read */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if ((n = pread(fd, buf, sizeof(buf) - 1, 0)) <= 0)
+        return 0;
+
+    buf[n] = '\0';
+    if ((pid = strtol(buf, NULL, 10)) <= 0)
+        return 0;
+
+    /* pid may have been reused by some other process since,
+     * in which case we don't start, like without this check
+     */
+
+    return kill((pid_t)pid, 0) != 0 && errno == ESRCH;
+}
+
 
 /* ==========================================================================
                                         __     __ _
@@ -106,9 +157,9 @@ void daemonize
      * lead to lose of data
      */
 
-    if ((fd = open(pid_file, O_WRONLY | O_CREAT, 0644)) < 0)
+    if ((fd = open(pid_file, O_RDWR | O_CREAT, 0644)) < 0)
     {
-        fprintf(stderr, "couldn't create pid file %s, refusing to start: %s\n",
+        log_print("e/couldn't create pid file %s, refusing to start: %s\n",
             pid_file, strerror(errno));
         exit(2);
     }
@@ -120,18 +171,29 @@ void daemonize
      * file, in such case it truncates file to be 0 bytes in size
      */
 
-    if (lseek(fd, 0, SEEK_END) > 0)
+    if (lseek(fd, 0, SEEK_END) > 0 && !stale_pid(fd))
     {
         /* file exists AND is NOT empty, we assume pid is in there
          */
 
-        fprintf(stderr, "pid file %s already exists, check "
+        log_print("e/pid file %s already exists, check "
             "if process is running and remove pid file "
             "to start daemon\n", pid_file);
         close(fd);
         exit(1);
     }
 
+    /* stale pid file is just overwritten
+     */
+
+    if (ftruncate(fd, 0) != 0 || lseek(fd, 0, SEEK_SET) != 0)
+    {
+        log_print("e/couldn't truncate pid file %s: %s\n", pid_file,
+            strerror(errno));
+        close(fd);
+        exit(2);
+    }
+
     /* if we are root and usr and grp is set, we will be droping
      * priviliges, for the security sake.
      */
@@ -143,7 +205,7 @@ void daemonize
 
         if (uid == NULL || gid == NULL)
         {
-            fprintf(stderr, "couldn't get uid for user: %s group %s: %s\n",
+            log_print("e/couldn't get uid for user: %s group %s: %s\n",
                 usr, grp, strerror(errno));
             goto drop_privilige_failed;
         }
@@ -155,7 +217,7 @@ void daemonize
 
         if (fchown(fd, uid->pw_uid, gid->gr_gid) != 0)
         {
-            fprintf(stderr, "couldn't chown file %s to %s:%s; %s\n",
+            log_print("e/couldn't chown file %s to %s:%s; %s\n",
                 pid_file, usr, grp, strerror(errno));
             goto drop_privilige_failed;
         }
@@ -167,14 +229,14 @@ void daemonize
 
         if (setgid(gid->gr_gid) != 0)
         {
-            fprintf(stderr, "couldn't set gid to %s %s\n", grp,
+            log_print("e/couldn't set gid to %s %s\n", grp,
                 strerror(errno));
             goto drop_privilige_failed;
         }
 
         if (setuid(uid->pw_uid) != 0)
         {
-            fprintf(stderr, "couldn't set uid to %s %s\n", usr,
+            log_print("e/couldn't set uid to %s %s\n", usr,
                 strerror(errno));
             goto drop_privilige_failed;
         }
@@ -201,7 +263,7 @@ drop_privilige_finished:
 
     if (pid < 0)
     {
-        fprintf(stderr, "forking failed: %s\n", strerror(errno));
+        log_print("e/forking failed: %s\n", strerror(errno));
         close(fd);
         unlink(pid_file);
         exit(2);
@@ -225,7 +287,7 @@ drop_privilige_finished:
         if (write(fd, pids, strlen(pids)) != (ssize_t)strlen(pids))
         {
             kill(pid, SIGKILL);
-            fprintf(stderr, "error writing pid to file %s: %s\n", pid_file,
+            log_print("e/error writing pid to file %s: %s\n", pid_file,
                 strerror(errno));
         }
 
@@ -270,7 +332,7 @@ void daemonize_cleanup
 
     if (truncate(pid_file, 0) != 0)
     {
-        fprintf(stderr, "could not remove pid file %s "
+        log_print("e/could not remove pid file %s "
             "nor we could truncate pid file to 0 bytes %s\n",
             pid_file, strerror(errno));
     }
@@ -0,0 +1,286 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ==========================================================================
+         -----------------------------------------------------
+        / handoff to ntpd, leaves it drift file with measured \
+        \ frequency error, and list of the fastest servers    /
+         -----------------------------------------------------
+   ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include <netdb.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "handoff.h"
+#include "log.h"
+#include "ntp.h"
+#include "state.h"
+#include "sysclock.h"
+#include "timesrc.h"
+
+
+/* ==========================================================================
+          __             __                     __   _
+     ____/ /___   _____ / /____ _ _____ ____ _ / /_ (_)____   ____   _____
+    / __  // _ \ / ___// // __ `// ___// __ `// __// // __ \ / __ \ / ___/
+   / /_/ //  __// /__ / // /_/ // /   / /_/ // /_ / // /_/ // / / /(__  )
+   \__,_/ \___/ \___//_/ \__,_//_/    \__,_/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+/* ntpd does not accept frequency error bigger than that (ppm),
+ * bigger one means something went wrong with measurement
+ */
+
+#define HANDOFF_MAX_FREQ (500.0)
+
+
+/* measurement less accurate than that (ppm) is not worth giving
+ * to ntpd, it would have to correct it anyway
+ */
+
+#define HANDOFF_MAX_ERR (100.0)
+
+
+/* number of fastest server addresses put into server list
+ */
+
+#define HANDOFF_MAX_SERVERS (4)
+
+
+/* ==========================================================================
+                  _                __           ____
+    ____   _____ (_)_   __ ____ _ / /_ ___     / __/__  __ ____   _____ _____
+   / __ \ / ___// /| | / // __ `// __// _ \   / /_ / / / // __ \ / ___// ___/
+  / /_/ // /   / / | |/ // /_/ // /_ /  __/  / __// /_/ // / / // /__ (__  )
+ / .___//_/   /_/  |___/ \__,_/ \__/ \___/  /_/   \__,_//_/ /_/ \___//____/
+/_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    qsort() comparator for ntp samples, sorts them by round trip delay
+   ========================================================================== */
+
+
+static int delay_cmp
+(
+    const void               *a,  /* first sample to compare */
+    const void               *b   /* second sample to compare */
+)
+{
+    const struct ntp_sample  *sa = a;
+    const struct ntp_sample  *sb = b;
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    return (sa->delay > sb->delay) - (sa->delay < sb->delay);
+}
+
+
+/* ==========================================================================
+                                        __     __ _
+                         ____   __  __ / /_   / /(_)_____
+                        / __ \ / / / // __ \ / // // ___/
+                       / /_/ // /_/ // /_/ // // // /__
+                      / .___/ \__,_//_.___//_//_/ \___/
+                     /_/
+               ____                     __   _
+              / __/__  __ ____   _____ / /_ (_)____   ____   _____
+             / /_ / / / // __ \ / ___// __// // __ \ / __ \ / ___/
+            / __// /_/ // / / // /__ / /_ / // /_/ // / / /(__  )
+           /_/   \__,_//_/ /_/ \___/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Estimates frequency error of local clock from n offsets measured at
+    boot times in at. Offset changes linearly with time by frequency
+    error, so it's slope of line fitted to the points with least squares,
+    which with only two points is simply the line between them.
+
+    returns
+            frequency error in ppm, positive when local clock is slow and
+            has to run faster
+   ========================================================================== */
+
+
+double handoff_freq
+(
+    const int64_t  *at,       /* boot times offsets were measured at */
+    const int64_t  *offsets,  /* measured offsets */
+    int             n         /* number of measurements */
+)
+{
+    int             i;        /* just an iterator */
+    double          mx;       /* mean of times */
+    double          my;       /* mean of offsets */
+    double          sxy;      /* sum of products of deviations */
+    double          sxx;      /* sum of squares of time deviations */
+    double          dx;       /* deviation of time from mean */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    /* times are made relative to the first one, so big
+     * boot times don't eat precision of double
+     */
+
+    mx = 0;
+    my = 0;
+    for (i = 0; i != n; ++i)
+    {
+        mx += (double)(at[i] - at[0]);
+        my += (double)(offsets[i] - offsets[0]);
+    }
+
+    mx /= n;
+    my /= n;
+    sxy = 0;
+    sxx = 0;
+
+    for (i = 0; i != n; ++i)
+    {
+        dx = (double)(at[i] - at[0]) - mx;
+        sxy += dx * ((double)(offsets[i] - offsets[0]) - my);
+        sxx += dx * dx;
+    }
+
+    return sxx > 0 ? sxy / sxx * 1e6 : 0;
+}
+
+
+/* ==========================================================================
+    Writes drift file for ntpd at path. Frequency error measured by us
+    is relative to what kernel is set to now, so current kernel frequency
+    is added, as ntpd will set kernel to value from the file. File holds
+    single number in ppm, which both reference ntpd (ntp.drift) and
+    OpenNTPD (ntpd.drift) understand.
+
+    returns
+            0       file has been written
+           -1       frequency is out of range, measurement error is too
+                    big, or file could not be written
+   ========================================================================== */
+
+
+int handoff_drift
+(
+    const char  *path,     /* drift file to write */
+    double       ppm,      /* measured frequency error */
+    double       err       /* max error of measurement */
+)
+{
+    double       kernel;   /* current kernel frequency */
+    int          len;      /* length of data in buf */
+    char         buf[32];  /* frequency as string */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (err > HANDOFF_MAX_ERR)
+    {
+        log_print("w/frequency error is not accurate enough "
+                "(+-%.3fppm), measure it for longer\n", err);
+        return -1;
+    }
+
+    if (sysclock_freq(&kernel) == 0)
+        ppm += kernel;
+
+    if (ppm > HANDOFF_MAX_FREQ || ppm < -HANDOFF_MAX_FREQ)
+    {
+        log_print("w/frequency error %+.3fppm is out of range, "
+                "drift file not written\n", ppm);
+        return -1;
+    }
+
+    len = snprintf(buf, sizeof(buf), "%.3f\n", ppm);
+    if (state_write(path, buf, len) != 0)
+        return -1;
+
+    log_print("n/drift %+.3fppm written to %s\n", ppm, path);
+    return 0;
+}
+
+
+/* ==========================================================================
+    Writes server list for ntpd at path, with up to HANDOFF_MAX_SERVERS
+    addresses of servers that answered with the lowest round trip delay,
+    one "server <address>" line each. Format works for both ntp.conf and
+    OpenNTPD's ntpd.conf, so the file can be included from them, and ntpd
+    starts with servers known to work, without waiting for dns.
+
+    returns
+            0       file has been written
+           -1       no samples, or file could not be written
+   ========================================================================== */
+
+
+int handoff_servers
+(
+    const char               *path,     /* server list file to write */
+    const struct ntp_sample  *samples,  /* valid replies from servers */
+    int                       n         /* number of samples */
+)
+{
+    int                       i;        /* just an iterator */
+    int                       j;        /* just another iterator */
+    int                       nlisted;  /* servers written so far */
+    size_t                    len;      /* length of data in buf */
+    char                      addr[NI_MAXHOST];  /* server address */
+    char                      buf[HANDOFF_MAX_SERVERS * (NI_MAXHOST + 16)];
+    struct ntp_sample         sorted[NTP_MAX_ADDRS];  /* samples by delay */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (n <= 0)
+        return -1;
+
+    n = n > NTP_MAX_ADDRS ? NTP_MAX_ADDRS : n;
+    memcpy(sorted, samples, n * sizeof(sorted[0]));
+    qsort(sorted, n, sizeof(sorted[0]), delay_cmp);
+
+    len = 0;
+    nlisted = 0;
+
+    for (i = 0; i != n && nlisted != HANDOFF_MAX_SERVERS; ++i)
+    {
+        /* samples may come from several rounds, with the same
+         * address in each of them
+         */
+
+        for (j = 0; j != i; ++j)
+            if (sorted[j].addrlen == sorted[i].addrlen &&
+                    memcmp(&sorted[j].addr, &sorted[i].addr,
+                        sorted[i].addrlen) == 0)
+                break;
+
+        /* ntpd can only use ntp servers, not http or gps
+         */
+
+        if (j != i || sorted[i].proto != TIMESRC_NTP)
+            continue;
+
+        len += snprintf(buf + len, sizeof(buf) - len, "server %s\n",
+                ntp_addr_str(&sorted[i], addr, sizeof(addr)));
+        nlisted++;
+    }
+
+    if (state_write(path, buf, len) != 0)
+        return -1;
+
+    log_print("n/%d fastest servers written to %s\n", nlisted, path);
+    return 0;
+}
@@ -0,0 +1,22 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ========================================================================== */
+
+#ifndef HANDOFF_H
+#define HANDOFF_H 1
+
+#include <stdint.h>
+
+#include "ntp.h"
+
+/* maximum number of offset measurements for frequency estimation
+ */
+
+#define HANDOFF_MAX_SAMPLES (16)
+
+double handoff_freq(const int64_t *, const int64_t *, int);
+int handoff_drift(const char *, double, double);
+int handoff_servers(const char *, const struct ntp_sample *, int);
+
+#endif
@@ -0,0 +1,274 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ==========================================================================
+         --------------------------------------------------
+        / keeps last known good time in a file and in rtc, \
+        | so after reboot we can start with plausible time |
+        \ long before network is up                        /
+         --------------------------------------------------
+   ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include "ntpd-setwait-config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#if HAVE_LINUX_RTC_H
+#   include <linux/rtc.h>
+#endif
+
+#include "lasttime.h"
+#include "log.h"
+#include "state.h"
+#include "sysclock.h"
+
+
+/* ==========================================================================
+                  _                __           ____
+    ____   _____ (_)_   __ ____ _ / /_ ___     / __/__  __ ____   _____ _____
+   / __ \ / ___// /| | / // __ `// __// _ \   / /_ / / / // __ \ / ___// ___/
+  / /_/ // /   / / | |/ // /_/ // /_ /  __/  / __// /_/ // / / // /__ (__  )
+ / .___//_/   /_/  |___/ \__,_/ \__/ \___/  /_/   \__,_//_/ /_/ \___//____/
+/_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Reads time saved in state file by lasttime_save().
+
+    returns
+            unix time stored in file, or 0 when there is none
+   ========================================================================== */
+
+
+static time_t read_file
+(
+    const char  *path      /* state file to read time from */
+)
+{
+    FILE        *f;        /* opened state file */
+    long long    ts;       /* read timestamp */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (path == NULL || (f = fopen(path, "r")) == NULL)
+        return 0;
+
+    if (fscanf(f, "%lld", &ts) != 1 || ts < 0)
+        ts = 0;
+
+    fclose(f);
+    return (time_t)ts;
+}
+
+
+/* ==========================================================================
+    Reads time from hardware clock. Rtc is assumed to keep UTC time.
+
+    returns
+            unix time read from rtc, or 0 on error
+   ========================================================================== */
+
+
+static time_t read_rtc
+(
+    const char       *dev  /* rtc device to read time from */
+)
+{
+#if HAVE_LINUX_RTC_H
+    int               fd;  /* opened rtc device */
+    struct rtc_time   rt;  /* time read from rtc */
+    struct tm         tm;  /* rt converted to struct tm */
+    time_t            ts;  /* rt converted to unix time */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (dev == NULL || (fd = open(dev, O_RDONLY | O_CLOEXEC)) < 0)
+        return 0;
+
+    memset(&rt, 0x00, sizeof(rt));
+    if (ioctl(fd, RTC_RD_TIME, &rt) != 0)
+    {
+        /* rtc without battery that lost power returns EINVAL
+         * here, that's expected, don't make noise about it
+         */
+
+        if (errno != EINVAL)
+            error("w/ioctl(RTC_RD_TIME)");
+
+        close(fd);
+        return 0;
+    }
+
+    close(fd);
+
+    memset(&tm, 0x00, sizeof(tm));
+    tm.tm_sec = rt.tm_sec;
+    tm.tm_min = rt.tm_min;
+    tm.tm_hour = rt.tm_hour;
+    tm.tm_mday = rt.tm_mday;
+    tm.tm_mon = rt.tm_mon;
+    tm.tm_year = rt.tm_year;
+
+    ts = timegm(&tm);
+    return ts < 0 ? 0 : ts;
+#else
+    (void)dev;
+    return 0;
+#endif
+}
+
+
+/* ==========================================================================
+    Sets hardware clock to current system time, in UTC.
+   ========================================================================== */
+
+
+static void write_rtc
+(
+    const char       *dev  /* rtc device to set */
+)
+{
+#if HAVE_LINUX_RTC_H
+    int               fd;  /* opened rtc device */
+    struct rtc_time   rt;  /* time to set in rtc */
+    struct tm         tm;  /* current time broken down */
+    time_t            ts;  /* current time */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (dev == NULL || (fd = open(dev, O_RDONLY | O_CLOEXEC)) < 0)
+        return;
+
+    ts = (time_t)(sysclock_now() / NSEC_PER_SEC);
+    gmtime_r(&ts, &tm);
+
+    memset(&rt, 0x00, sizeof(rt));
+    rt.tm_sec = tm.tm_sec;
+    rt.tm_min = tm.tm_min;
+    rt.tm_hour = tm.tm_hour;
+    rt.tm_mday = tm.tm_mday;
+    rt.tm_mon = tm.tm_mon;
+    rt.tm_year = tm.tm_year;
+
+    if (ioctl(fd, RTC_SET_TIME, &rt) != 0)
+        error("w/ioctl(RTC_SET_TIME)");
+
+    close(fd);
+#else
+    (void)dev;
+#endif
+}
+
+
+
+
+/* ==========================================================================
+                                        __     __ _
+                         ____   __  __ / /_   / /(_)_____
+                        / __ \ / / / // __ \ / // // ___/
+                       / /_/ // /_/ // /_/ // // // /__
+                      / .___/ \__,_//_.___//_//_/ \___/
+                     /_/
+               ____                     __   _
+              / __/__  __ ____   _____ / /_ (_)____   ____   _____
+             / /_ / / / // __ \ / ___// __// // __ \ / __ \ / ___/
+            / __// /_/ // / / // /__ / /_ / // /_/ // / / /(__  )
+           /_/   \__,_//_/ /_/ \___/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Checks last known time, saved in state file at path and kept in rtc
+    device, and if system clock is behind the newest of them by more than
+    max_deviation seconds, system clock is stepped to that time. Time is
+    certainly not exact, but it's much closer to real time than 1970, so
+    things like certificate checks work until ntp time is set. Either
+    path or rtc can be NULL.
+
+    returns
+            1       clock has been stepped to last known time
+            0       clock is not older than last known time
+   ========================================================================== */
+
+
+int lasttime_restore
+(
+    const char  *path,           /* state file with last known time */
+    const char  *rtc,            /* rtc device */
+    int          max_deviation   /* allowed difference to last known time */
+)
+{
+    time_t       last;           /* last known time */
+    time_t       rtc_ts;         /* time read from rtc */
+    time_t       now;            /* current system time */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    last = read_file(path);
+    rtc_ts = read_rtc(rtc);
+    last = rtc_ts > last ? rtc_ts : last;
+    now = (time_t)(sysclock_now() / NSEC_PER_SEC);
+
+    /* time can only go forward, if system clock is already
+     * after last known time, it's better than what we have
+     */
+
+    if (last - now <= max_deviation)
+        return 0;
+
+    if (sysclock_step((int64_t)(last - now) * NSEC_PER_SEC) != 0)
+    {
+        error("w/sysclock_step() to last known time");
+        return 0;
+    }
+
+    log_print("n/clock set to last known time: %s", ctime(&last));
+    return 1;
+}
+
+
+/* ==========================================================================
+    Saves current system time in state file at path and in rtc device,
+    so lasttime_restore() can use it after reboot. Either path or rtc can
+    be NULL.
+   ========================================================================== */
+
+
+void lasttime_save
+(
+    const char  *path,     /* state file to save time to */
+    const char  *rtc       /* rtc device to save time to */
+)
+{
+    int          len;      /* length of data in buf */
+    char         buf[32];  /* current time as string */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (path)
+    {
+        len = snprintf(buf, sizeof(buf), "%lld\n",
+                (long long)(sysclock_now() / NSEC_PER_SEC));
+        state_write(path, buf, len);
+    }
+
+    write_rtc(rtc);
+}
@@ -0,0 +1,12 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ========================================================================== */
+
+#ifndef LASTTIME_H
+#define LASTTIME_H 1
+
+int lasttime_restore(const char *, const char *, int);
+void lasttime_save(const char *, const char *);
+
+#endif
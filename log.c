@@ -0,0 +1,499 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ==========================================================================
+         ---------------------------------------------
+        < logging functions used all over the program >
+         ---------------------------------------------
+   ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include <errno.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "sysclock.h"
+
+
+/* ==========================================================================
+          __             __                     __   _
+     ____/ /___   _____ / /____ _ _____ ____ _ / /_ (_)____   ____   _____
+    / __  // _ \ / ___// // __ `// ___// __ `// __// // __ \ / __ \ / ___/
+   / /_/ //  __// /__ / // /_/ // /   / /_/ // /_ / // /_/ // / / /(__  )
+   \__,_/ \___/ \___//_/ \__,_//_/    \__,_/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+/* number of distinct events kept in memory, older events are
+ * flushed before their slot is reused
+ */
+
+#define LOG_MAX_EVENTS (64)
+
+
+/* max length of single event text, longer ones are truncated
+ */
+
+#define LOG_MAX_MSG (192)
+
+
+/* when events are written right away (log_init() with limit 0),
+ * repeated event is printed again at most that often, counted
+ * otherwise
+ */
+
+#define LOG_REPEAT_INTERVAL (60 * NSEC_PER_SEC)
+
+
+/* single event, with all its repetitions collapsed into it, times
+ * are boot times in nanoseconds
+ */
+
+struct event
+{
+    int64_t        first;    /* time event happened first */
+    int64_t        last;     /* time event happened last */
+    int64_t        flushed;  /* time event was last written out */
+    unsigned long  count;    /* times event happened */
+    unsigned long  printed;  /* times already written out */
+    char           msg[LOG_MAX_MSG];  /* event text, without new line */
+};
+
+
+static struct
+{
+    struct event           ring[LOG_MAX_EVENTS];  /* events, oldest first */
+    int                    head;     /* slot for next new event */
+    int                    nevents;  /* number of events in ring */
+    int                    level;    /* max level of events to keep */
+    size_t                 limit;    /* flush when that much is pending */
+    size_t                 pending;  /* bytes of events not flushed yet */
+    volatile sig_atomic_t  busy;     /* ring is being modified */
+    volatile sig_atomic_t  flush;    /* signal asked to flush while busy */
+} g_log = { .level = LOG_NOTICE };
+
+
+/* ==========================================================================
+                  _                __           ____
+    ____   _____ (_)_   __ ____ _ / /_ ___     / __/__  __ ____   _____ _____
+   / __ \ / ___// /| | / // __ `// __// _ \   / /_ / / / // __ \ / ___// ___/
+  / /_/ // /   / / | |/ // /_/ // /_ /  __/  / __// /_/ // / / // /__ (__  )
+ / .___//_/   /_/  |___/ \__,_/ \__/ \___/  /_/   \__,_//_/ /_/ \___//____/
+/_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Appends string s to out, flushing out to stderr when it's full.
+    Only write() is used, so it's safe to call from signal handler.
+   ========================================================================== */
+
+
+static void out_str
+(
+    char        *out,   /* output buffer */
+    size_t      *len,   /* length of data in out */
+    size_t       size,  /* size of out */
+    const char  *s      /* string to append */
+)
+{
+    for (; *s; ++s)
+    {
+        if (*len == size)
+        {
+            if (write(STDERR_FILENO, out, *len) < 0)
+                return;
+
+            *len = 0;
+        }
+
+        out[(*len)++] = *s;
+    }
+}
+
+
+/* ==========================================================================
+    Appends boot time t as "[seconds.millis]" to out, seconds are padded
+    to 6 characters, like in kernel log. No stdio, so it's safe to call
+    from signal handler.
+   ========================================================================== */
+
+
+static void out_stamp
+(
+    char      *out,      /* output buffer */
+    size_t    *len,      /* length of data in out */
+    size_t     size,     /* size of out */
+    int64_t    t         /* boot time to append */
+)
+{
+    char       buf[32];  /* formatted stamp, built from the end */
+    char      *p;        /* current position in buf */
+    int        i;        /* just an iterator */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    p = buf + sizeof(buf);
+    *--p = '\0';
+    *--p = ']';
+
+    t /= 1000000;
+    for (i = 0; i != 3; ++i, t /= 10)
+        *--p = '0' + t % 10;
+
+    *--p = '.';
+
+    do
+        *--p = '0' + t % 10;
+    while ((t /= 10) != 0);
+
+    while (p > buf + sizeof(buf) - 12)
+        *--p = ' ';
+
+    *--p = '[';
+    out_str(out, len, size, p);
+}
+
+
+/* ==========================================================================
+    Appends decimal number n to out. Safe to call from signal handler.
+   ========================================================================== */
+
+
+static void out_num
+(
+    char           *out,      /* output buffer */
+    size_t         *len,      /* length of data in out */
+    size_t          size,     /* size of out */
+    unsigned long   n         /* number to append */
+)
+{
+    char            buf[24];  /* formatted number, built from the end */
+    char           *p;        /* current position in buf */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    p = buf + sizeof(buf);
+    *--p = '\0';
+
+    do
+        *--p = '0' + n % 10;
+    while ((n /= 10) != 0);
+
+    out_str(out, len, size, p);
+}
+
+
+/* ==========================================================================
+    Writes all events that happened since last flush to stderr, oldest
+    first, in as few write() calls as possible. Event that happened many
+    times is written once, with number of times it happened. Only
+    write() is used, so it's safe to call from signal handler.
+   ========================================================================== */
+
+
+static void flush_events(void)
+{
+    int            i;        /* just an iterator */
+    int64_t        now;      /* current boot time */
+    size_t         len;      /* length of data in out */
+    struct event  *e;        /* currently written event */
+    char           out[1024];  /* output buffer */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    len = 0;
+    now = sysclock_boottime();
+
+    for (i = 0; i != g_log.nevents; ++i)
+    {
+        e = &g_log.ring[(g_log.head - g_log.nevents + i + LOG_MAX_EVENTS) %
+            LOG_MAX_EVENTS];
+
+        if (e->count == e->printed)
+            continue;
+
+        /* [  12.345] w/poll(): Network is unreachable (x30, last [  41.2])
+         * or, when it was written out before
+         * [  41.234] w/poll(): Network is unreachable (x30 more)
+         */
+
+        out_stamp(out, &len, sizeof(out), e->printed ? e->last : e->first);
+        out_str(out, &len, sizeof(out), " ");
+        out_str(out, &len, sizeof(out), e->msg);
+
+        if (e->printed)
+        {
+            out_str(out, &len, sizeof(out), " (x");
+            out_num(out, &len, sizeof(out), e->count - e->printed);
+            out_str(out, &len, sizeof(out), " more)");
+        }
+        else if (e->count > 1)
+        {
+            out_str(out, &len, sizeof(out), " (x");
+            out_num(out, &len, sizeof(out), e->count);
+            out_str(out, &len, sizeof(out), ", last ");
+            out_stamp(out, &len, sizeof(out), e->last);
+            out_str(out, &len, sizeof(out), ")");
+        }
+
+        out_str(out, &len, sizeof(out), "\n");
+        e->printed = e->count;
+        e->flushed = now;
+    }
+
+    if (len && write(STDERR_FILENO, out, len) < 0)
+        return;
+
+    g_log.pending = 0;
+}
+
+
+/* ==========================================================================
+    Flushes events when signal arrives. On SIGUSR1 we carry on, other
+    signals terminate process, like they would without handler.
+   ========================================================================== */
+
+
+static void on_signal
+(
+    int  sig  /* signal that arrived */
+)
+{
+    int  e;   /* saved errno */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    e = errno;
+
+    /* when we interrupted log_print(), ring may be inconsistent,
+     * let it flush once it's done. Process that is going to die
+     * won't get back there, so flush anyway
+     */
+
+    if (g_log.busy && sig == SIGUSR1)
+        g_log.flush = 1;
+    else
+        flush_events();
+
+    if (sig != SIGUSR1)
+    {
+        signal(sig, SIG_DFL);
+        raise(sig);
+    }
+
+    errno = e;
+}
+
+
+/* ==========================================================================
+    Finds event with text msg in ring, or adds new one. When new event
+    needs slot of event that was not written out yet, everything is
+    flushed first, so nothing is lost.
+
+    returns
+            event with text msg
+   ========================================================================== */
+
+
+static struct event *event_get
+(
+    const char    *msg,   /* event text */
+    int64_t        now    /* current boot time */
+)
+{
+    int            i;     /* just an iterator */
+    struct event  *e;     /* found or new event */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    for (i = 0; i != g_log.nevents; ++i)
+    {
+        e = &g_log.ring[(g_log.head - 1 - i + LOG_MAX_EVENTS) %
+            LOG_MAX_EVENTS];
+
+        if (strcmp(e->msg, msg) == 0)
+            return e;
+    }
+
+    e = &g_log.ring[g_log.head];
+    if (g_log.nevents == LOG_MAX_EVENTS && e->count != e->printed)
+        flush_events();
+
+    g_log.head = (g_log.head + 1) % LOG_MAX_EVENTS;
+    if (g_log.nevents < LOG_MAX_EVENTS)
+        g_log.nevents++;
+
+    memset(e, 0x00, sizeof(*e));
+    strcpy(e->msg, msg);
+    e->first = now;
+    e->flushed = now;
+    g_log.pending += strlen(msg) + 16;
+    return e;
+}
+
+
+/* ==========================================================================
+                                        __     __ _
+                         ____   __  __ / /_   / /(_)_____
+                        / __ \ / / / // __ \ / // // ___/
+                       / /_/ // /_/ // /_/ // // // /__
+                      / .___/ \__,_//_.___//_//_/ \___/
+                     /_/
+               ____                     __   _
+              / __/__  __ ____   _____ / /_ (_)____   ____   _____
+             / /_ / / / // __ \ / ___// __// // __ \ / __ \ / ___/
+            / __// /_/ // / / // /__ / /_ / // /_/ // / / /(__  )
+           /_/   \__,_//_/ /_/ \___/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Sets up logging. Events with level higher than level are dropped.
+    Events are kept in memory, and are written to stderr only when
+    limit bytes of them is pending, at log_flush() (call it before
+    exec), at exit, or when signal arrives (SIGUSR1 flushes and we carry
+    on, SIGTERM, SIGINT and SIGHUP flush and terminate). So no matter how
+    long we wait for network, and how many times same thing fails, log
+    grows by one line per distinct event. With limit 0, events are
+    written right away, but repeated event no more often than once a
+    minute.
+
+    Until this is called, events are written right away.
+   ========================================================================== */
+
+
+void log_init
+(
+    int               level,  /* max level of events to keep */
+    size_t            limit   /* bytes of pending events to flush at */
+)
+{
+    struct sigaction  sa;     /* signal handler to install */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    g_log.level = level;
+    g_log.limit = limit;
+
+    memset(&sa, 0x00, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR1, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGHUP, &sa, NULL);
+
+    atexit(log_flush);
+}
+
+
+/* ==========================================================================
+    Logs printf-like formatted event. Level of event is taken from its
+    prefix: "e/" error, "w/" warning, "n/" notice. When the same event
+    (same text) is already in memory, only its counter and time of last
+    occurrence are updated. errno is preserved.
+   ========================================================================== */
+
+
+void log_print
+(
+    const char    *fmt,   /* printf-like format */
+                   ...    /* format arguments */
+)
+{
+    va_list        ap;    /* variadic arguments */
+    int            e;     /* saved errno */
+    int            level; /* level of event */
+    size_t         len;   /* length of msg */
+    int64_t        now;   /* current boot time */
+    struct event  *ev;    /* event msg is collapsed into */
+    char           msg[LOG_MAX_MSG];  /* formatted event */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    e = errno;
+    va_start(ap, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, ap);
+    va_end(ap);
+
+    level = msg[0] == 'e' && msg[1] == '/' ? LOG_ERROR :
+        msg[0] == 'w' && msg[1] == '/' ? LOG_WARN : LOG_NOTICE;
+
+    if (level > g_log.level)
+    {
+        errno = e;
+        return;
+    }
+
+    len = strlen(msg);
+    if (len && msg[len - 1] == '\n')
+        msg[len - 1] = '\0';
+
+    now = sysclock_boottime();
+    g_log.busy = 1;
+
+    ev = event_get(msg, now);
+    ev->count++;
+    ev->last = now;
+
+    if (g_log.limit ? g_log.pending >= g_log.limit : (ev->printed == 0 ||
+                now - ev->flushed >= LOG_REPEAT_INTERVAL))
+        flush_events();
+
+    g_log.busy = 0;
+    if (g_log.flush)
+    {
+        g_log.flush = 0;
+        flush_events();
+    }
+
+    errno = e;
+}
+
+
+/* ==========================================================================
+    Logs msg with description of errno, like perror() does. Repeated
+    failures are collapsed, see log_print(), so log does not get flooded
+    when program keeps on failing in the same way, like when there is
+    no network.
+   ========================================================================== */
+
+
+void error
+(
+    const char  *msg  /* message to print */
+)
+{
+    log_print("%s: %s\n", msg, strerror(errno));
+}
+
+
+/* ==========================================================================
+    Writes out all pending events, call before exec, as memory is lost
+    after it.
+   ========================================================================== */
+
+
+void log_flush(void)
+{
+    g_log.busy = 1;
+    flush_events();
+    g_log.busy = 0;
+    g_log.flush = 0;
+}
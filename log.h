@@ -0,0 +1,23 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ========================================================================== */
+
+#ifndef LOG_H
+#define LOG_H 1
+
+#include <stddef.h>
+
+/* levels of events, taken from prefix of their text
+ */
+
+#define LOG_ERROR  (0)  /* "e/" */
+#define LOG_WARN   (1)  /* "w/" */
+#define LOG_NOTICE (2)  /* "n/" */
+
+void log_init(int, size_t);
+void log_print(const char *, ...);
+void log_flush(void);
+void error(const char *);
+
+#endif
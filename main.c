@@ -35,30 +35,42 @@
 
 #include <errno.h>
 #include <netdb.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/socket.h>
-#include <sys/time.h>
+#include <sys/resource.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "client.h"
+#include "clksel.h"
 #include "daemonize.h"
-
-
-/* ==========================================================================
-          __             __                     __   _
-     ____/ /___   _____ / /____ _ _____ ____ _ / /_ (_)____   ____   _____
-    / __  // _ \ / ___// // __ `// ___// __ `// __// // __ \ / __ \ / ___/
-   / /_/ //  __// /__ / // /_/ // /   / /_/ // /_ / // /_/ // / / /(__  )
-   \__,_/ \___/ \___//_/ \__,_//_/    \__,_/ \__//_/ \____//_/ /_//____/
-
-   ========================================================================== */
-
-
-#define NTP_PACKET_LEN (48)
-#define NTP_TRANS_TS_S_OFFSET (40)
+#include "handoff.h"
+#include "lasttime.h"
+#include "log.h"
+#include "metrics.h"
+#include "netwait.h"
+#include "notify.h"
+#include "ntpd-setwait-status.h"
+#include "ntp.h"
+#include "rand.h"
+#include "resolv.h"
+#include "score.h"
+#include "server.h"
+#include "status.h"
+#include "supervise.h"
+#include "sysclock.h"
+#include "timesrc.h"
+
+/* simulation driver (bench/ntpsim.c) has main() of its own, and
+ * runs ours once for every simulated boot
+ */
+
+#if NTPD_SETWAIT_SIM
+#   define main ntpd_setwait_main
+#endif
 
 
 /* ==========================================================================
@@ -71,233 +83,506 @@
    ========================================================================== */
 
 
-void error
+
+/* ==========================================================================
+    qsort() comparator for ntp samples, sorts them by offset
+   ========================================================================== */
+
+
+static int offset_cmp
 (
-    const char         *msg        /* message to print */
+    const void               *a,  /* first sample to compare */
+    const void               *b   /* second sample to compare */
 )
 {
-    time_t              now;       /* current time */
-    static time_t       last_log;  /* last time when message was printed */
-    static const char  *last_msg;  /* last log that was printed */
+    const struct ntp_sample  *sa = a;
+    const struct ntp_sample  *sb = b;
     /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 
-    now = time(NULL);
 
-    /* if we are printing same message twice,
-     * and 60 seconds did not pass from last
-     * print, then do not print this log */
-    if (msg == last_msg && (now - last_log) < 10)
-        return;
-
-    perror(msg);
-    last_msg = msg;
-    last_log = now;
-    return;
+    return (sa->offset > sb->offset) - (sa->offset < sb->offset);
 }
 
+
 /* ==========================================================================
-    Reads current timestamp from random ntp server. As a source, we use time
-    at which ntp packet left server to us.
+    Reads offset of local clock to ntp servers. Request is sent to all
+    addresses of all nrv servers in rv, and replies are collected until
+    there is enough of them (see ntp_query()).
+
+    Without quorum, median of received offsets is returned, so that one
+    server with bad time does not pull result too much. When accuracy is
+    set, median is taken only of samples that are that accurate, if
+    there are any, so second-resolution sources (like http) don't spoil
+    ntp ones. With quorum set,
+    offset is selected with intersection algorithm, and it's accepted
+    only when at least quorum servers agree on it, and they are majority
+    of servers that answered.
+
+    Valid replies are stored in samples, which must be able to hold
+    NTP_MAX_ADDRS elements.
 
     returns
-            0       on successfull time read from ntp
+            >0      number of replies in samples, offset read successfully
            -1       on errors, like bad response, no response, dns lookup
-                    failure.
+                    failure, or servers that do not agree on time.
    ========================================================================== */
 
 
-static int get_ts_from_ntp
+static int get_offset_from_ntp
 (
-    time_t           *ts,       /* current timestamp will be stored here */
-    const char       *ip        /* custom ntp ip */
+    int64_t                *offset,  /* clock offset will be stored here */
+    struct ntp_sample      *samples, /* received replies stored here */
+    struct resolv          *rv,      /* ntp servers to ask */
+    int                     nrv,     /* number of servers in rv */
+    const struct ntp_opts  *opts     /* query options */
 )
 {
-    unsigned long     ts_s;     /* received transmit time from ntp */
-    int               fd;       /* file descriptor used to talk with ntp */
-    int               ret;      /* return value from various funcitons */
-    struct addrinfo   hints;    /* criteria for selecting sockaddr struct */
-    struct addrinfo  *res;      /* result from getaddrinfo() */
-    struct addrinfo  *ai;       /* address info list */
-    socklen_t         addrlen;  /* length of sockaddr in ai */
-    fd_set            readfds;  /* list of sockets to monitor */
-    struct timeval    tv;       /* sleep timeout for select() */
-    static int        errcnt;   /* getaddrinfo() error counter */
-    const char       *host;     /* ntp server host */
-    unsigned char     packet[NTP_PACKET_LEN];  /* received packet from ntp */
+    int                     n;       /* number of received replies */
+    int                     i;       /* just an iterator */
+    int                     s;       /* server index */
+    int                     ngood;   /* number of addresses in good */
+    int                     agree;   /* number of servers that agree */
+    int                     naccurate;  /* samples that are accurate */
+    struct ntp_sample       tmp;     /* sample being swapped */
+    char                    addr[NI_MAXHOST];  /* server address as string */
+    struct resolv_addr      good[NTP_MAX_ADDRS];  /* servers that replied */
     /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 
 
-    memset(packet, 0x00, sizeof(packet));
-    memset(&hints, 0x00, sizeof(hints));
+    if ((n = ntp_query(rv, nrv, samples, opts)) < 0)
+        return -1;
 
-    /* use pool.ntp.org unless user specified custom host/ip */
-    host = "pool.ntp.org";
-    if (ip[0] != '\0')  host = ip;
+    for (i = 0; i != n; ++i)
+        log_print("n/reply from %s (%s, stratum %d)%s%s, offset %+.6fs, "
+                "delay %.6fs\n", ntp_addr_str(&samples[i], addr,
+                sizeof(addr)), rv[samples[i].server].host,
+                samples[i].stratum, samples[i].ifname[0] ? " via " : "",
+                samples[i].ifname, (double)samples[i].offset / NSEC_PER_SEC,
+                (double)samples[i].delay / NSEC_PER_SEC);
 
-    /* set: li (leap indicator) - 3 (clock is unsynchronized)
-     *      ntp version - 4
-     *      mode - 3 (client)
+    /* samples are in order they came, first one tells which
+     * uplink started to pass traffic first
      */
 
-    packet[0] = 0xe3;
+    if (samples[0].ifname[0])
+    {
+        log_print("n/%s answered first\n", samples[0].ifname);
+        metrics_uplink(samples[0].ifname);
+    }
 
-    /* find ip address of 'pool.ntp.org' domain that gives
-     * random ip of ntp server
-     *
-     * if custom ip has been specified, use that ip instead
+    /* remember servers that worked, so we can talk to them
+     * right away on next boot, even if dns is not working
      */
 
-    hints.ai_socktype = SOCK_DGRAM;
-    if (getaddrinfo(host, "123", &hints, &res) < 0)
+    for (s = 0; s != nrv; ++s)
     {
-        /* faild to get address, might be that network is down
-         */
-
-        if (errcnt-- == 0)
+        ngood = 0;
+        for (i = 0; i != n; ++i)
         {
-            /* if there is no internet, this error will be popping
-             * out all the time, there is really no need to print
-             * it too frequent, so we print this once a while
-             */
+            if (samples[i].server != s)
+                continue;
 
-            errcnt = 60;
-            error("w/getaddrinfo()");
+            memcpy(&good[ngood].addr, &samples[i].addr, samples[i].addrlen);
+            good[ngood].addrlen = samples[i].addrlen;
+            ngood++;
         }
 
-        return -1;
+        resolv_save(&rv[s], good, ngood);
     }
 
-    /* attempt to create socket for returned address
+    if (opts->quorum)
+    {
+        agree = clksel_intersect(samples, n, offset);
+        if (agree < opts->quorum)
+        {
+            log_print("w/no consensus, %d of %d servers agree, "
+                    "need %d\n", agree, n, opts->quorum);
+            return -1;
+        }
+
+        log_print("n/%d of %d servers agree on offset %+.6fs\n",
+                agree, n, (double)*offset / NSEC_PER_SEC);
+        score_offsets(samples, n, *offset);
+        return n;
+    }
+
+    /* move accurate samples to the front, and take median of
+     * these only
      */
 
-    for (ai = res; ai != NULL; ai = ai->ai_next)
+    naccurate = n;
+    if (opts->accuracy)
     {
-        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
-
-        if (fd < 0)
+        for (i = naccurate = 0; i != n; ++i)
         {
-            /* that address is not correct, moving to next
-             */
+            if (samples[i].delay / 2 + samples[i].rootdist >
+                    opts->accuracy * 1000000ll)
+                continue;
 
-            continue;
+            tmp = samples[naccurate];
+            samples[naccurate++] = samples[i];
+            samples[i] = tmp;
         }
 
-        /* socket created
-         */
-
-        break;
+        naccurate = naccurate ? naccurate : n;
     }
 
-    if (ai == NULL)
+    qsort(samples, naccurate, sizeof(samples[0]), offset_cmp);
+    *offset = samples[naccurate / 2].offset;
+    score_offsets(samples, n, *offset);
+    return n;
+}
+
+
+/* ==========================================================================
+    Slews clock by offset, and keeps measuring remaining offset and
+    slewing it, until it's lower than target, so ntpd starts with clock
+    that is already close, and does not have to slew it for hours. Clock
+    never goes back while doing so. When bound is not 0, we give up after
+    that much time, and leave the rest to ntpd.
+   ========================================================================== */
+
+
+static void slew_to_target
+(
+    int64_t                 offset,    /* offset to slew clock by */
+    struct resolv          *rv,        /* ntp servers to ask */
+    int                     nrv,       /* number of servers in rv */
+    const struct ntp_opts  *opts,      /* query options */
+    int64_t                 target,    /* offset we are happy with */
+    int64_t                 bound      /* max time to slew for, or 0 */
+)
+{
+    int64_t                 deadline;  /* boot time to give up at */
+    struct ntp_sample       samples[NTP_MAX_ADDRS];  /* received replies */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    deadline = bound ? sysclock_boottime() + bound : INT64_MAX;
+
+    for (;;)
     {
-        /* we've iterated through all addresses and still could not
-         * create socket.
+        log_print("n/slewing clock by %+.6fs\n",
+                (double)offset / NSEC_PER_SEC);
+
+        if (sysclock_slew(offset, deadline - sysclock_boottime()) != 0)
+        {
+            error("w/sysclock_slew()");
+            return;
+        }
+
+        if (sysclock_boottime() >= deadline)
+            break;
+
+        /* slew is never exact, since time we sleep for is not,
+         * check how far we are now
          */
 
-        error("w/no available address found");
-        freeaddrinfo(res);
-        return -1;
+        if (get_offset_from_ntp(&offset, samples, rv, nrv, opts) < 0)
+            return;
+
+        if (offset < target && offset > -target)
+        {
+            log_print("n/remaining offset %+.6fs is within target\n",
+                    (double)offset / NSEC_PER_SEC);
+            return;
+        }
     }
 
-    /* socket created and we have all information about ntp server,
-     * let's get current time from it
-     */
+    log_print("n/could not slew clock within %.1fs, leaving the "
+            "rest to ntpd\n", (double)bound / NSEC_PER_SEC);
+}
+
+
+/* ==========================================================================
+    Measures frequency error of local clock, by reading offset n times,
+    evenly spread over window, and writes it to drift file at path, so
+    ntpd does not have to spend hours estimating it itself. Offset is
+    accurate to half of round trip delay, so the longer the window, the
+    more accurate frequency is. Query that fails is skipped, but at least
+    two offsets are needed.
+   ========================================================================== */
 
-    addrlen = sizeof(struct sockaddr_storage);
-    ret = sendto(fd, packet, sizeof(packet), 0, ai->ai_addr, addrlen);
-    if (ret != sizeof(packet))
+
+static void measure_drift
+(
+    const char             *path,     /* drift file to write */
+    struct resolv          *rv,       /* ntp servers to ask */
+    int                     nrv,      /* number of servers in rv */
+    const struct ntp_opts  *opts,     /* query options */
+    struct netwait         *nw,       /* to sleep between queries */
+    int64_t                 window,   /* time to spread queries over */
+    int                     n         /* number of queries */
+)
+{
+    int                     i;        /* just an iterator */
+    int                     j;        /* just another iterator */
+    int                     nok;      /* number of measured offsets */
+    int                     ret;      /* return value from functions */
+    int64_t                 start;    /* boot time query started at */
+    int64_t                 mindelay; /* lowest delay in single query */
+    int64_t                 maxdelay; /* highest of mindelay in all queries */
+    int64_t                 span;     /* time between first and last offset */
+    double                  ppm;      /* estimated frequency error */
+    double                  err;      /* max error of ppm */
+    int64_t                 at[HANDOFF_MAX_SAMPLES];  /* times of offsets */
+    int64_t                 offsets[HANDOFF_MAX_SAMPLES];  /* offsets */
+    struct ntp_sample       samples[NTP_MAX_ADDRS];  /* received replies */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    log_print("n/measuring frequency error for %.0fs\n",
+            (double)window / NSEC_PER_SEC);
+
+    nok = 0;
+    maxdelay = 0;
+
+    for (i = 0; i != n; ++i)
     {
-        /* couldn't send whole packet
+        if (i != 0)
+            netwait_sleep(nw, (long)(window / (n - 1) / 1000000));
+
+        start = sysclock_boottime();
+        ret = get_offset_from_ntp(&offsets[nok], samples, rv, nrv, opts);
+        if (ret < 0)
+            continue;
+
+        /* we don't know exactly when reply used for offset came
+         * in, middle of the query is close enough
          */
 
-        error("w/sendto() ntp request");
-        freeaddrinfo(res);
-        close(fd);
-        return -1;
+        at[nok] = start + (sysclock_boottime() - start) / 2;
+
+        mindelay = samples[0].delay;
+        for (j = 1; j != ret; ++j)
+            if (samples[j].delay < mindelay)
+                mindelay = samples[j].delay;
+
+        maxdelay = mindelay > maxdelay ? mindelay : maxdelay;
+        nok++;
     }
 
-    /* request sent, let's receive reply, it's possible that we
-     * don't get reply - it's UDP after all, so packets can get
-     * lost. We use select() to make sure we don't hang
+    if (nok < 2 || (span = at[nok - 1] - at[0]) <= 0)
+    {
+        log_print("w/not enough offsets to estimate frequency\n");
+        return;
+    }
+
+    /* each offset can be off by half of its delay, so
+     * frequency can be off by that much
      */
 
-    FD_ZERO(&readfds);
-    FD_SET(fd, &readfds);
+    ppm = handoff_freq(at, offsets, nok);
+    err = (double)maxdelay / span * 1e6;
+    log_print("n/frequency error %+.3fppm (+-%.3fppm) from %d "
+            "offsets\n", ppm, err, nok);
 
-    /* we'll be waiting maximum of 15 seconds for message to
-     * arrive
-     */
+    handoff_drift(path, ppm, err);
+}
 
-    tv.tv_sec = 15;
-    tv.tv_usec = 0;
 
-    ret = select(fd + 1, &readfds, NULL, NULL, &tv);
+/* ==========================================================================
+    Keeps time ourselves, instead of executing ntpd, for devices that
+    cannot spare memory for it. Servers are polled with adaptive interval
+    (see client_update()), and whenever someone sets the clock behind
+    our back. Memory is not allocated here, so footprint stays the same
+    as during the initial sync, and it's logged with every poll.
 
-    if (ret == -1)
-    {
-        /* select() failed in a bad way
-         */
+    returns
+            only on fatal error
+   ========================================================================== */
+
+
+static void run_client
+(
+    long                    min,      /* min poll interval in seconds */
+    long                    max,      /* max poll interval in seconds */
+    struct resolv          *rv,       /* ntp servers to ask */
+    int                     nrv,      /* number of servers in rv */
+    const struct ntp_opts  *opts,     /* query options */
+    const char             *timefile  /* last known time file, or NULL */
+)
+{
+    int                     i;        /* just an iterator */
+    int                     n;        /* number of received replies */
+    int                     ret;      /* return value from functions */
+    int64_t                 offset;   /* offset between ntp and localtime */
+    int64_t                 err;      /* lowest error of replies */
+    int64_t                 saved;    /* boot time of last time save */
+    unsigned long           nreq;     /* requests we've answered */
+    unsigned long           nkod;     /* requests we've rate limited */
+    struct client           c;        /* client poll state */
+    struct rusage           ru;       /* to report memory used */
+    struct ntp_sample       samples[NTP_MAX_ADDRS];  /* received replies */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 
-        error("w/select()");
-        freeaddrinfo(res);
-        close(fd);
-        return -1;
-    }
 
-    if (ret == 0)
+    if (client_init(&c, min, max) != 0)
+        return;
+
+    status_state(NTPD_SETWAIT_STATE_CLIENT);
+    log_print("n/staying resident, polling servers every %ld to %lds\n",
+            min, max);
+    log_flush();
+    saved = sysclock_boottime();
+
+    for (;;)
     {
-        /* no activity for specified time
-         */
+        if ((ret = client_wait(&c)) < 0)
+            return;
 
-        fprintf(stderr, "w/no response from ntp server\n");
-        freeaddrinfo(res);
-        close(fd);
-        return -1;
+        if (ret == 1)
+            log_print("w/clock has been set by someone else, "
+                    "checking it\n");
+
+        status_attempt();
+        if ((n = get_offset_from_ntp(&offset, samples, rv, nrv, opts)) < 0)
+        {
+            client_failed(&c);
+            log_print("w/poll failed, next in %.0fs\n",
+                    (double)c.interval / NSEC_PER_SEC);
+            continue;
+        }
+
+        err = INT64_MAX;
+        for (i = 0; i != n; ++i)
+            if (samples[i].delay / 2 + samples[i].rootdist < err)
+                err = samples[i].delay / 2 + samples[i].rootdist;
+
+        client_update(&c, offset, err);
+        status_synced(samples, n, rv, offset, 0);
+        status_state(NTPD_SETWAIT_STATE_CLIENT);
+        server_synced(samples, n);
+
+        getrusage(RUSAGE_SELF, &ru);
+        log_print("n/offset %+.6fs (+-%.6fs), next poll in %.0fs, "
+                "max rss %ldkB\n", (double)offset / NSEC_PER_SEC,
+                (double)err / NSEC_PER_SEC,
+                (double)c.interval / NSEC_PER_SEC, ru.ru_maxrss);
+
+        server_stats(&nreq, &nkod);
+        if (nreq)
+            log_print("n/served %lu requests, %lu rate limited\n",
+                    nreq, nkod);
+
+        if (timefile && sysclock_boottime() - saved > 600 * NSEC_PER_SEC)
+        {
+            lasttime_save(timefile, NULL);
+            score_save();
+            saved = sysclock_boottime();
+        }
     }
+}
+
+
+/* ==========================================================================
+    Sleeps for this device's slot of spread milliseconds. Slot is taken
+    from machine-id, so devices that start (or get network) at the same
+    moment, send their first requests evenly spread over spread, and
+    each device always gets the same slot, no matter how many times it
+    boots. Sleep is not cut short by network changes, as they happen on
+    all devices at the same time too.
+   ========================================================================== */
+
+
+static void herd_sleep
+(
+    struct netwait  *nw,      /* to sleep with */
+    long             spread   /* time to spread devices over */
+)
+{
+    int64_t          end;     /* boot time to wake up at */
+    int64_t          left;    /* time left to sleep */
+    long             slot;    /* our slot in spread */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    slot = (long)(rand_device() % (uint32_t)spread);
+    log_print("n/waiting %ldms for our slot, to not ask servers at once "
+            "with whole fleet\n", slot);
+
+    end = sysclock_boottime() + slot * 1000000ll;
+    while ((left = end - sysclock_boottime()) > 0)
+        netwait_sleep(nw, (long)((left + 999999) / 1000000));
+}
 
-    /* read() can not be issued without blocking
-     */
 
-    ret = read(fd, packet, sizeof(packet));
-    if (ret != sizeof(packet))
+/* ==========================================================================
+    Parses comma separated list of up to n numbers, like "50,4000,3" into
+    vals. Numbers that are not in str are left untouched in vals, so
+    caller can set defaults before calling this.
+
+    returns
+            0       list parsed
+           -1       str is not a valid list of non negative numbers
+   ========================================================================== */
+
+
+static int parse_list
+(
+    const char  *str,   /* string to parse */
+    long        *vals,  /* parsed numbers will be stored here */
+    int          n      /* max number of elements to parse */
+)
+{
+    char        *end;   /* first character after parsed number */
+    int          i;     /* just an iterator */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    for (i = 0; i != n && *str != '\0'; ++i)
     {
-        /* couldn't receive whole packet
-         */
+        if (*str != ',')
+        {
+            vals[i] = strtol(str, &end, 10);
+            if (end == str || vals[i] < 0)
+                return -1;
 
-        error("w/read() ntp response");
-        freeaddrinfo(res);
-        close(fd);
-        return -1;
+            str = end;
+        }
+
+        if (*str == ',')
+            str++;
+        else if (*str != '\0')
+            return -1;
     }
 
-    /* read timestamp from the server, data comes in network (big)
-     * endian so we convert it to host endianess.
-     *
-     * We use transmit timestamp, that is timestamp at which
-     * message has left server to us
-     */
+    return *str == '\0' ? 0 : -1;
+}
 
-    ts_s = 0;
-    ts_s += (unsigned long)packet[NTP_TRANS_TS_S_OFFSET + 0] << 24;
-    ts_s += (unsigned long)packet[NTP_TRANS_TS_S_OFFSET + 1] << 16;
-    ts_s += (unsigned long)packet[NTP_TRANS_TS_S_OFFSET + 2] << 8;
-    ts_s += (unsigned long)packet[NTP_TRANS_TS_S_OFFSET + 3];
 
-    /* ntp sends time with epoch set to 01.01.1900, and unix time
-     * has epoch set to 01.01.1970, so we subtract 70 years from
-     * ntp result to get unix time. 70 years according to RFC 868
-     * (Time Protocol) is 2208988800 seconds.
-     */
+#if NTPD_SETWAIT_BENCH
+
+
+/* ==========================================================================
+    Benchmark build does not start ntpd, instead it prints single line
+    with time it took to get time, cpu time used, number of times
+    process went to sleep (voluntary context switches) and number of
+    syscalls made to ask servers, for bench.sh to collect.
+   ========================================================================== */
 
-    ts_s -= 2208988800ul;
-    *ts = ts_s;
 
-    freeaddrinfo(res);
-    close(fd);
-    return 0;
+static void bench_report
+(
+    int64_t        start  /* boot time program started at */
+)
+{
+    struct rusage  ru;    /* resources used by us */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    getrusage(RUSAGE_SELF, &ru);
+    printf("bench sync %lld cpu %lld wakeups %ld syscalls %lu\n",
+            (long long)(sysclock_boottime() - start),
+            (long long)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000 +
+            ru.ru_utime.tv_usec + ru.ru_stime.tv_usec, ru.ru_nvcsw,
+            metrics_syscalls(0));
 }
 
 
+#endif /* NTPD_SETWAIT_BENCH */
+
+
 /* ==========================================================================
     Prints programs help.
    ========================================================================== */
@@ -308,12 +593,72 @@ static void print_help
     const char  *name  /* name of program (argv[0]) */
 )
 {
-    fprintf(stderr, "usage: %s [-f] [-i<ip>] <max-deviation> "
-            "<ntpd-bin> [<ntpd-opts>]\n\n", name);
+    fprintf(stderr, "usage: %s [-f] [-w] [-i<src>...] [-n<num>] [-q<num>] "
+            "[-d<dir>] "
+            "[-t<ms>] [-r<min>,<max>,<retries>,<init>] [-b<min>,<max>] "
+            "[-C<rtc>] [-m<path>] [-s<ms>,<sec>] [-B<num>,<ms>] [-D<path>] "
+            "[-F<sec>,<num>] [-S<path>] [-N<path>...] [-R<fd>] [-M<path>] "
+            "[-A<ms>] [-L<level>[,<bytes>]] [-P<min>,<max>] "
+            "[-K<min>,<max>] [-X<port>,<threads>,<rate>] "
+            "[-H<devices>,<ms>] [-I[<if>,...]] "
+            "<max-deviation> <ntpd-bin> "
+            "[<ntpd-opts>]\n\n", name);
 
     fprintf(stderr, "all arguments are positional\n\n");
     fprintf(stderr, "-f     run in foreground\n");
-    fprintf(stderr, "-i<ip> specify custom ip for ntp\n\n");
+    fprintf(stderr, "-w     sleep until network is up (linux only)\n");
+    fprintf(stderr, "-i<src> specify custom ip for ntp, can be given up to "
+            "%d times,\n    time://host[:port], http://host[:port][/path] "
+            "and nmea://tty[,baud]\n    sources can be used too\n",
+            NTP_MAX_SERVERS);
+    fprintf(stderr, "-n<num> use first num replies from ntp servers\n");
+    fprintf(stderr, "-q<num> step only when num servers agree on time\n");
+    fprintf(stderr, "-d<dir> directory to keep state between runs in\n");
+    fprintf(stderr, "-t<ms> max time to wait for ntp replies\n");
+    fprintf(stderr, "-r<min>,<max>,<retries>,<init> retransmission "
+            "timeout bounds (ms),\n    max retransmissions and timeout for "
+            "unknown server (ms)\n");
+    fprintf(stderr, "-b<min>,<max> bounds of backoff (ms) between "
+            "failed attempts\n");
+    fprintf(stderr, "-C<rtc> keep last known time in rtc device\n");
+    fprintf(stderr, "-m<path> send metrics to file or unix socket\n");
+    fprintf(stderr, "-s<ms>,<sec> slew offsets below max-deviation until "
+            "they are lower\n    than ms, for at most sec seconds (0 - no "
+            "limit)\n");
+    fprintf(stderr, "-B<num>,<ms> send burst of num requests, ms apart, to "
+            "each server\n    address, and use reply with the lowest "
+            "delay\n");
+    fprintf(stderr, "-D<path> measure frequency error and write it to ntpd "
+            "drift file\n");
+    fprintf(stderr, "-F<sec>,<num> measure frequency with num queries over "
+            "sec seconds\n");
+    fprintf(stderr, "-S<path> write fastest servers to ntpd config "
+            "include file\n");
+    fprintf(stderr, "-N<path> create flag file (or write to fifo) when time "
+            "is synchronized,\n    can be given up to %d times\n",
+            NOTIFY_MAX_FLAGS);
+    fprintf(stderr, "-R<fd> write new line to fd when time is "
+            "synchronized\n");
+    fprintf(stderr, "-M<path> publish sync status in file for other "
+            "processes to mmap\n");
+    fprintf(stderr, "-A<ms> count only replies with error lower than ms "
+            "towards -n\n");
+    fprintf(stderr, "-L<level>,<bytes> log level (e, w or n), and how much "
+            "log to keep in memory\n    before writing it out (0 - write "
+            "right away)\n");
+    fprintf(stderr, "-P<min>,<max> do not start ntpd, stay resident and "
+            "poll servers every\n    min to max seconds, ntpd-bin is not "
+            "needed then\n");
+    fprintf(stderr, "-K<min>,<max> keep watch over ntpd, restart it "
+            "min to max seconds\n    after it dies, and sync time again "
+            "when clock is set\n");
+    fprintf(stderr, "-X<port>,<threads>,<rate> with -P, answer sntp "
+            "requests on port (123),\n    with threads (one per cpu), "
+            "limiting clients to rate requests/s (0 - no limit)\n");
+    fprintf(stderr, "-H<devices>,<ms> spread first requests of fleet of "
+            "devices 1ms apart,\n    but over no more than ms in total\n");
+    fprintf(stderr, "-I<if>,... ask ntp servers over all listed interfaces "
+            "at once,\n    or all that are up, when none is listed\n\n");
 
     fprintf(stderr, "when deviation between localtime and time read\n");
     fprintf(stderr, "from ntp is bigger than this value \n");
@@ -338,22 +683,108 @@ static void print_help
 
 int main
 (
-    int     argc,               /* number of arguments in argv list */
-    char   *argv[]              /* list of program arguments */
+    int              argc,           /* number of arguments in argv list */
+    char            *argv[]          /* list of program arguments */
 )
 {
-    int     daemonise;          /* to run as daemon or not */
-    int     max_deviation;      /* max deviation of time to set system time */
-    int     optind;             /* current argument being parsed */
-    time_t  ntp_ts;             /* ntp server timestamp */
-    time_t  local_ts;           /* local timestamp */
-    time_t  diff_ts;            /* differance between ntp and localtime */
-    char    ip[15 + 1];         /* custom ntp ip address */
-    char   *envp[] = { NULL };  /* environment for ntpd process */
+    int              daemonise;      /* to run as daemon or not */
+    int              max_deviation;  /* max deviation of time to set time */
+    int              optind;         /* current argument being parsed */
+    int              waitnet;        /* wait for network with netlink */
+    int              loglevel;       /* max level of logged events */
+    long             loglimit;       /* pending log to flush at, or -1 */
+    int              failures;       /* consecutive failed attempts */
+    long             delay;          /* time to next attempt */
+    long             rto[4];         /* rto bounds, retries and initial */
+    long             backoff[2];     /* bounds of backoff delay */
+    long             slew[2];        /* slew target and bound */
+    long             burst[2];       /* burst size and gap */
+    long             freq[2];        /* frequency window and queries */
+    long             poll[2];        /* client poll bounds, or 0 */
+    long             restart[2];     /* ntpd restart delay bounds, or 0 */
+    long             serve[3];       /* server port, threads and rate */
+    int              serving;        /* answer sntp requests */
+    struct supervise sv;             /* ntpd supervisor */
+    long             fleet[2];       /* devices in fleet, max spread */
+    long             spread;         /* time to spread fleet over, or 0 */
+    int              herd;           /* wait for our slot before query */
+    struct ntp_opts  nopts;          /* ntp query options */
+    struct netwait   nw;             /* network waiting state */
+    struct notify    nt;             /* readiness notification */
+    int64_t          offset;         /* offset between ntp and localtime */
+    int64_t          diff;           /* absolute value of offset */
+    time_t           ntp_ts;         /* ntp server timestamp */
+    time_t           local_ts;       /* local timestamp */
+    struct timesrc   hosts[NTP_MAX_SERVERS];  /* time sources to ask */
+    int              nhosts;         /* number of elements in hosts */
+    int              i;              /* just an iterator */
+    const char      *p;              /* found character */
+    const char      *statedir;       /* directory to keep state in */
+    const char      *rtc;            /* rtc device to keep time in */
+    const char      *metrics;        /* where to send metrics to */
+    const char      *drift;          /* ntpd drift file to write */
+    const char      *servers;        /* ntpd server list to write */
+    const char      *status;         /* status file to publish */
+    int              nsamples;       /* number of elements in samples */
+    struct resolv    rv[NTP_MAX_SERVERS];  /* ntp server resolvers */
+    int64_t          saved;          /* boot time of last time save */
+    int64_t          start;          /* boot time program started at */
+    int64_t          slept;          /* boot time backoff sleep started */
+    char             cache[NTP_MAX_SERVERS][4096];  /* dns cache files */
+    char             timefile[4096];  /* path to last known time file */
+    char             scorefile[4096];  /* path to server scores file */
+    struct ntp_sample samples[NTP_MAX_ADDRS];  /* replies from last query */
+    char            *envp[] = { NULL };  /* environment for ntpd process */
     /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 
 
-    ip[0] = '\0';
+    start = sysclock_boottime();
+
+    /* use pool.ntp.org unless user specified custom host/ip */
+    timesrc_parse(&hosts[0], "pool.ntp.org");
+    nhosts = 0;
+    statedir = NULL;
+    rtc = NULL;
+    metrics = NULL;
+    drift = NULL;
+    servers = NULL;
+    status = NULL;
+    waitnet = 0;
+    loglevel = LOG_NOTICE;
+    loglimit = -1;
+
+    /* default ntp query options, rto is taken from RFC 6298,
+     * but minimum is much lower than tcp uses, as lan ntp
+     * servers answer within a few ms
+     */
+
+    memset(&nopts, 0x00, sizeof(nopts));
+    memset(&nt, 0x00, sizeof(nt));
+    nt.fd = -1;
+    nopts.nsamples = 1;
+    nopts.timeout = 15 * 1000;
+    rto[0] = 50;
+    rto[1] = 4000;
+    rto[2] = 3;
+    rto[3] = 1000;
+    backoff[0] = 100;
+    backoff[1] = 10 * 1000;
+    slew[0] = 0;
+    slew[1] = 0;
+    burst[0] = 1;
+    burst[1] = 10;
+    freq[0] = 60;
+    freq[1] = 4;
+    poll[0] = 0;
+    poll[1] = 0;
+    restart[0] = 0;
+    restart[1] = 0;
+    serve[0] = 123;
+    serve[1] = 0;
+    serve[2] = 0;
+    serving = 0;
+    fleet[0] = 0;
+    fleet[1] = 10 * 1000;
     optind = 1;
     daemonise = 1;
 
@@ -369,14 +800,235 @@ int main
             daemonise = 0;
             break;
 
+        case 'w':
+            waitnet = 1;
+            break;
+
         case 'i':
-            strncpy(ip, &argv[optind][2], sizeof(ip));
-            ip[sizeof(ip) - 1] = '\0';
+            if (nhosts == NTP_MAX_SERVERS)
+            {
+                fprintf(stderr, "too many servers, max is %d\n",
+                        NTP_MAX_SERVERS);
+                return 1;
+            }
+
+            if (timesrc_parse(&hosts[nhosts], &argv[optind][2]) != 0)
+            {
+                fprintf(stderr, "invalid time source %s\n", argv[optind]);
+                return 1;
+            }
+
+            nhosts++;
+            break;
+
+        case 'L':
+            p = strchr("ewn", argv[optind][2]);
+            if (p == NULL || argv[optind][2] == '\0' ||
+                    (argv[optind][3] != '\0' && argv[optind][3] != ','))
+            {
+                fprintf(stderr, "invalid log level %s\n", argv[optind]);
+                return 1;
+            }
+
+            loglevel = (int)(p - "ewn");
+            if (argv[optind][3] == ',' &&
+                    (loglimit = atol(&argv[optind][4])) < 0)
+            {
+                fprintf(stderr, "invalid log size %s\n", argv[optind]);
+                return 1;
+            }
+            break;
+
+        case 'A':
+            if ((nopts.accuracy = atol(&argv[optind][2])) <= 0)
+            {
+                fprintf(stderr, "invalid accuracy %s\n", argv[optind]);
+                return 1;
+            }
+            break;
+
+        case 'q':
+            nopts.quorum = atoi(&argv[optind][2]);
+            if (nopts.quorum < 1 || nopts.quorum > NTP_MAX_ADDRS)
+            {
+                fprintf(stderr, "quorum must be between 1 and %d\n",
+                        NTP_MAX_ADDRS);
+                return 1;
+            }
+            break;
+
+        case 'd':
+            statedir = &argv[optind][2];
+            break;
+
+        case 'C':
+            rtc = &argv[optind][2];
+            break;
+
+        case 'm':
+            metrics = &argv[optind][2];
+            break;
+
+        case 's':
+            if (parse_list(&argv[optind][2], slew, 2) != 0 || slew[0] == 0)
+            {
+                fprintf(stderr, "invalid slew %s\n", argv[optind]);
+                return 1;
+            }
+            break;
+
+        case 'B':
+            if (parse_list(&argv[optind][2], burst, 2) != 0 ||
+                    burst[0] < 1 || burst[0] > NTP_MAX_BURST || burst[1] == 0)
+            {
+                fprintf(stderr, "invalid burst %s, size must be between "
+                        "1 and %d\n", argv[optind], NTP_MAX_BURST);
+                return 1;
+            }
+            break;
+
+        case 'D':
+            drift = &argv[optind][2];
+            break;
+
+        case 'F':
+            if (parse_list(&argv[optind][2], freq, 2) != 0 || freq[0] == 0 ||
+                    freq[1] < 2 || freq[1] > HANDOFF_MAX_SAMPLES)
+            {
+                fprintf(stderr, "invalid frequency window %s, number of "
+                        "queries must be between 2 and %d\n", argv[optind],
+                        HANDOFF_MAX_SAMPLES);
+                return 1;
+            }
+            break;
+
+        case 'S':
+            servers = &argv[optind][2];
+            break;
+
+        case 'N':
+            if (nt.nflags == NOTIFY_MAX_FLAGS)
+            {
+                fprintf(stderr, "too many flag files, max is %d\n",
+                        NOTIFY_MAX_FLAGS);
+                return 1;
+            }
+
+            nt.flags[nt.nflags++] = &argv[optind][2];
+            break;
+
+        case 'M':
+            status = &argv[optind][2];
+            break;
+
+        case 'R':
+            if ((nt.fd = atoi(&argv[optind][2])) < 3)
+            {
+                fprintf(stderr, "invalid readiness fd %s\n", argv[optind]);
+                return 1;
+            }
+            break;
+
+        case 'P':
+            poll[0] = 64;
+            poll[1] = 1024;
+            if (parse_list(&argv[optind][2], poll, 2) != 0 || poll[0] == 0 ||
+                    poll[1] < poll[0])
+            {
+                fprintf(stderr, "invalid poll interval %s\n", argv[optind]);
+                return 1;
+            }
+            break;
+
+        case 'H':
+            if (parse_list(&argv[optind][2], fleet, 2) != 0)
+            {
+                fprintf(stderr, "invalid fleet size %s\n", argv[optind]);
+                return 1;
+            }
+            break;
+
+        case 'I':
+            /* names are checked against interfaces that are
+             * up on each query, they come and go
+             */
+
+            nopts.ifaces = &argv[optind][2];
+            break;
+
+        case 'X':
+            if (parse_list(&argv[optind][2], serve, 3) != 0 ||
+                    serve[0] == 0 || serve[0] > 65535 ||
+                    serve[1] > SERVER_MAX_THREADS)
+            {
+                fprintf(stderr, "invalid server option %s\n", argv[optind]);
+                return 1;
+            }
+            serving = 1;
+            break;
+
+        case 'K':
+            restart[0] = 1;
+            restart[1] = 600;
+            if (parse_list(&argv[optind][2], restart, 2) != 0 ||
+                    restart[0] == 0 || restart[1] < restart[0])
+            {
+                fprintf(stderr, "invalid restart delay %s\n", argv[optind]);
+                return 1;
+            }
+            break;
+
+        case 'n':
+            nopts.nsamples = atoi(&argv[optind][2]);
+            if (nopts.nsamples < 1 || nopts.nsamples > NTP_MAX_ADDRS)
+            {
+                fprintf(stderr, "number of replies must be between "
+                        "1 and %d\n", NTP_MAX_ADDRS);
+                return 1;
+            }
+            break;
+
+        case 't':
+            if ((nopts.timeout = atol(&argv[optind][2])) <= 0)
+            {
+                fprintf(stderr, "invalid timeout %s\n", argv[optind]);
+                return 1;
+            }
+            break;
+
+        case 'r':
+            if (parse_list(&argv[optind][2], rto, 4) != 0 ||
+                    rto[0] == 0 || rto[0] > rto[1])
+            {
+                fprintf(stderr, "invalid rto %s\n", argv[optind]);
+                return 1;
+            }
+            break;
+
+        case 'b':
+            if (parse_list(&argv[optind][2], backoff, 2) != 0 ||
+                    backoff[0] == 0 || backoff[0] > backoff[1])
+            {
+                fprintf(stderr, "invalid backoff %s\n", argv[optind]);
+                return 1;
+            }
             break;
         }
         optind++;
     }
 
+    if (poll[0] && restart[0])
+    {
+        fprintf(stderr, "-P and -K cannot be used together\n");
+        return 1;
+    }
+
+    if (serving && poll[0] == 0)
+    {
+        fprintf(stderr, "-X needs -P, ntpd serves time itself\n");
+        return 1;
+    }
+
     /* parse next argument, which should be max deviation in seconds */
     if (argv[optind] == NULL)
     {
@@ -388,8 +1040,11 @@ int main
     max_deviation = atoi(argv[optind]);
     optind++;
 
-    /* now we expect argument which is path to ntpd binary */
-    if (argv[optind] == NULL)
+    /* now we expect argument which is path to ntpd binary,
+     * unless we are to keep time ourselves
+     */
+
+    if (argv[optind] == NULL && poll[0] == 0)
     {
         fprintf(stderr, "missing path to ntpd\n");
         print_help(argv[0]);
@@ -397,96 +1052,331 @@ int main
     }
 
     /* check if ntpd binary exists and we can execute it */
-    if (access(argv[optind], R_OK | X_OK) != 0)
+    if (poll[0] == 0 && access(argv[optind], R_OK | X_OK) != 0)
     {
         fprintf(stderr, "cannot access ntpd binary: %s: %s\n",
                 argv[optind], strerror(errno));
         return 1;
     }
 
+    /* device has no battery backed rtc, so its clock may be in
+     * 1970 now, set it to last time we know was good, before
+     * anything else, this has to be done as early in boot as
+     * possible, before anything starts to check certificates
+     * or log with timestamps
+     */
+
+    if (statedir)
+    {
+        snprintf(timefile, sizeof(timefile), "%s/time", statedir);
+        snprintf(scorefile, sizeof(scorefile), "%s/servers", statedir);
+    }
+
+    /* when logging to file, events are kept in memory and
+     * written together, so waiting for network for days does not
+     * wear flash with stream of small writes, on terminal they
+     * are shown right away
+     */
+
+    if (loglimit < 0)
+        loglimit = isatty(STDERR_FILENO) ? 0 : 4096;
+
+    log_init(loglevel, (size_t)loglimit);
+    lasttime_restore(statedir ? timefile : NULL, rtc, max_deviation);
+    score_load(statedir ? scorefile : NULL);
+    saved = sysclock_boottime();
+
     if (daemonise)
     {
         /* daemonization enabled, fork into background
          */
 
+        log_flush();
         daemonize("/var/run/ntpd-setwait.pid", NULL, NULL);
     }
 
+    nopts.rto_min = rto[0];
+    nopts.rto_max = rto[1];
+    nopts.retries = (int)rto[2];
+    nopts.rto_init = rto[3];
+    nopts.burst = (int)burst[0];
+    nopts.burst_gap = burst[1];
+    if (nopts.rto_init < nopts.rto_min)
+        nopts.rto_init = nopts.rto_min;
+    if (nopts.rto_init > nopts.rto_max)
+        nopts.rto_init = nopts.rto_max;
+
+    netwait_init(&nw, waitnet);
+    if (restart[0])
+        supervise_init(&sv, restart[0], restart[1]);
+    notify_init(&nt);
+
+    if (status)
+        status_open(status);
+
+    /* addresses of ntp servers that worked last time are kept
+     * in state directory, so we can reach them even if dns is
+     * not working yet, each server has its own cache file
+     */
+
+    if (nhosts == 0)
+        nhosts = 1;
+
+    for (i = 0; i != nhosts; ++i)
+    {
+        if (statedir && i == 0)
+            snprintf(cache[i], sizeof(cache[i]), "%s/dns.cache", statedir);
+        else if (statedir)
+            snprintf(cache[i], sizeof(cache[i]), "%s/dns.cache.%d",
+                    statedir, i);
+
+        resolv_init(&rv[i], hosts[i].host, statedir ? cache[i] : NULL);
+    }
+
+    nopts.src = hosts;
+
+    /* devices of fleet are spread 1ms apart, but not more
+     * than fleet[1] in total, so time to sync stays bounded
+     */
+
+    spread = fleet[0] > fleet[1] ? fleet[1] : fleet[0];
+    herd = spread > 1;
+
     /* now run the code until we sucessfully get time from ntp,
      * set system time and start ntpd daemon.
      *
-     * execve() will not return upon successfull call
+     * execve() will not return upon successfull call, supervisor
+     * (-K) comes back here, when ntpd dies or clock is set
      */
 
     for (;;)
     {
         /* probe for ntp time until we receive valid timestamp from
-         * ntp server, do not probe more often than once every 100ms,
-         * to not hog CPU in case network is no available at all,
-         * and get_ts_from_ntp() returns in an instant
+         * ntp server. After each failed attempt we wait twice as
+         * long as before (from backoff min up to max), to not hog
+         * CPU in case network is no available at all, and
+         * get_offset_from_ntp() returns in an instant, and to not
+         * hammer servers on slow links. Delay is randomized, so
+         * many devices don't retry in lockstep.
+         *
+         * When network is down (and we know it thanks to netlink)
+         * do not probe at all, just sleep until it comes up, and
+         * start over with short delays, since things changed.
          */
 
-        while (get_ts_from_ntp(&ntp_ts, ip) != 0) usleep(100 * 1000ul);
-        fprintf(stderr, "n/ntp time is: %s", ctime(&ntp_ts));
+        failures = 0;
+        for (;;)
+        {
+            if (netwait_for_link(&nw))
+            {
+                failures = 0;
+                herd = spread > 1;
+            }
+
+            /* whole site boots at once after power outage, or gets
+             * network back at once, take our slot in time
+             */
+
+            if (herd)
+            {
+                herd_sleep(&nw, spread);
+                herd = 0;
+            }
+
+            status_attempt();
+            nsamples = get_offset_from_ntp(&offset, samples, rv, nhosts,
+                    &nopts);
+            metrics_attempt(nsamples > 0);
+            if (nsamples > 0)
+                break;
+
+            /* while we wait, keep last known time fresh, so if
+             * we get rebooted before network comes up, we won't
+             * go back in time too much, scores are not saved
+             * here, they are kept in realtime, which is not
+             * known yet
+             */
+
+            if (statedir && sysclock_boottime() - saved > 600 * NSEC_PER_SEC)
+            {
+                lasttime_save(timefile, NULL);
+                saved = sysclock_boottime();
+            }
+
+            delay = backoff[0] << (failures < 16 ? failures : 16);
+            delay = delay > backoff[1] ? backoff[1] : delay;
+            failures++;
+
+            /* devices that failed together (server was down), retry
+             * spread over the same time as they've started
+             */
+
+            delay = delay < spread ? spread : delay;
 
-        /* what is localtime now?
+            slept = sysclock_boottime();
+            if (netwait_sleep(&nw, rand_jitter(delay)))
+                failures = 0;
+
+            metrics_backoff(sysclock_boottime() - slept);
+        }
+
+        /* what is localtime now and what is ntp time?
          */
 
-        local_ts = time(NULL);
-        fprintf(stderr, "n/localtime is: %s", ctime(&local_ts));
+        local_ts = (time_t)(sysclock_now() / NSEC_PER_SEC);
+        ntp_ts = local_ts + offset / NSEC_PER_SEC;
+        log_print("n/ntp time is: %s", ctime(&ntp_ts));
+        log_print("n/localtime is: %s", ctime(&local_ts));
 
         /* calculate absolute deviation between localtime and
          * current time from ntp
          */
 
-        diff_ts = ntp_ts - local_ts;
-        diff_ts = diff_ts < 0 ? -diff_ts : diff_ts;
+        diff = offset < 0 ? -offset : offset;
 
         /* is deviation big enough?
          */
 
-        if (diff_ts >= max_deviation)
+        if (diff >= max_deviation * NSEC_PER_SEC)
         {
-            struct timeval  tv;  /* time to set to system */
-            /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+            /* yes, deviation is too big, step system time by
+             * offset received from ntp, it will cause big time
+             * jump. Step is relative, so it doesn't matter how
+             * much time passed since we got the offset.
+             */
 
+            log_print("n/time deviation is bigger than %d (%+.6f), "
+                    "setting system time from ntp\n", max_deviation,
+                    (double)offset / NSEC_PER_SEC);
 
-            /* yes, deviation is too big, set current system time
-             * to that received from ntp, it will cause big time
-             * jump
+            /* supervised ntpd would fight us, it's started
+             * again once time is good
              */
 
-            fprintf(stderr, "n/time deviation is bigger than %d (%ld), "
-                    "setting system time from ntp\n", max_deviation,
-                    (long)diff_ts);
-            tv.tv_sec = ntp_ts;
-            tv.tv_usec = 0;
+            if (restart[0])
+                supervise_stop(&sv);
 
-            if (settimeofday(&tv, NULL) != 0)
+            if (sysclock_step(offset) != 0)
             {
                 /* couldn't set the time, go back to start
                  */
 
-                error("w/settimeofday()");
+                error("w/sysclock_step()");
                 continue;
             }
 
-            local_ts = time(NULL);
-            fprintf(stderr, "n/updated localtime is: %s", ctime(&local_ts));
+            local_ts = (time_t)(sysclock_now() / NSEC_PER_SEC);
+            log_print("n/updated localtime is: %s", ctime(&local_ts));
+        }
+
+        /* time is within max deviation now, and that is what
+         * services waiting for us need, don't make them wait
+         * for slew nor ntpd
+         */
+
+        status_synced(samples, nsamples, rv, offset,
+                diff >= max_deviation * NSEC_PER_SEC);
+        notify_ready(&nt, offset);
+
+        if (diff < max_deviation * NSEC_PER_SEC &&
+                slew[0] && diff >= slew[0] * 1000000ll)
+        {
+            /* deviation is not that big, but ntpd would need
+             * hours to correct it, so slew it quickly ourselves
+             */
+
+            if (restart[0])
+                supervise_stop(&sv);
+
+            slew_to_target(offset, rv, nhosts, &nopts, slew[0] * 1000000ll,
+                    slew[1] * NSEC_PER_SEC);
         }
 
-        if (daemonise)
+        metrics_offset(offset, diff >= max_deviation * NSEC_PER_SEC);
+
+        if (daemonise && poll[0] == 0 && restart[0] == 0)
         {
-            /* remove lock file created by daemonize() function
+            /* remove lock file created by daemonize() function,
+             * in client and supervisor mode we keep running, and
+             * so does lock
              */
 
             daemonize_cleanup("/var/run/ntpd-setwait.pid");
         }
 
-        /* current time is set in the system, but we surely are
-         * behind some milliseconds from world time, but we don't
-         * care, we start ntpd now and let it worry about that,
-         * ntpd will sync us to valid time, nice and slow.
+        /* time is good now, remember it for the next boot
+         */
+
+        lasttime_save(statedir ? timefile : NULL, rtc);
+        score_save();
+
+        netwait_report(&nw);
+
+        /* last chance to tell how we did, there is no way to
+         * report anything after execve()
+         */
+
+        metrics_report(metrics, sysclock_boottime() - start, nw.offline);
+
+        /* give ntpd head start, so it locks sooner, with servers
+         * that answered fastest, and clock frequency, which it
+         * would otherwise spend hours estimating
+         */
+
+        if (servers)
+            handoff_servers(servers, samples, nsamples);
+
+        /* restarted ntpd has drift file it kept itself, and
+         * it needs to be started fast
+         */
+
+        if (drift && (restart[0] == 0 || sv.starts == 0))
+            measure_drift(drift, rv, nhosts, &nopts, &nw,
+                    freq[0] * NSEC_PER_SEC, (int)freq[1]);
+
+        if (poll[0])
+        {
+            /* no ntpd, we keep time ourselves from now on, and
+             * when asked to, give it to others
+             */
+
+            if (serving && server_start((int)serve[0], (int)serve[1],
+                        serve[2]) != 0)
+                return 1;
+
+            server_synced(samples, nsamples);
+            run_client(poll[0], poll[1], rv, nhosts, &nopts,
+                    statedir ? timefile : NULL);
+            return 1;
+        }
+
+        if (restart[0])
+        {
+            /* keep watch over ntpd, it's restarted when it
+             * dies, and time is checked again before that, and
+             * whenever clock is set
+             */
+
+            status_state(NTPD_SETWAIT_STATE_NTPD);
+            supervise_watch(&sv, &argv[optind], envp);
+            continue;
+        }
+
+#if NTPD_SETWAIT_BENCH
+        bench_report(start);
+        return 0;
+#elif NTPD_SETWAIT_SIM
+        /* simulated boot ends when time is set, driver takes
+         * results from simulated clock and network
+         */
+
+        return 0;
+#endif
+
+        /* current time is set in the system, accurate to what
+         * round trip delay let us measure, we start ntpd now and
+         * let it worry about the rest, ntpd will keep us in sync
+         * with world time, nice and slow.
          *
          * argv[optind] contains path to ntpd to run
          *
@@ -494,7 +1384,9 @@ int main
          * and after that are arguments for ntpd itself.
          */
 
-        fprintf(stderr, "n/executing ntpd: %s\n", argv[optind]);
+        status_state(NTPD_SETWAIT_STATE_NTPD);
+        log_print("n/executing ntpd: %s\n", argv[optind]);
+        log_flush();
         execve(argv[optind], &argv[optind], envp);
     }
 }
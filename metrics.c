@@ -0,0 +1,596 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ==========================================================================
+         ---------------------------------------------------------
+        / counters and histograms of how we got time, exported as \
+        \ single json record before ntpd is started               /
+         ---------------------------------------------------------
+   ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <net/if.h>
+#include <netdb.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "metrics.h"
+#include "resolv.h"
+#include "sysclock.h"
+
+
+/* ==========================================================================
+          __             __                     __   _
+     ____/ /___   _____ / /____ _ _____ ____ _ / /_ (_)____   ____   _____
+    / __  // _ \ / ___// // __ `// ___// __ `// __// // __ \ / __ \ / ___/
+   / /_/ //  __// /__ / // /_/ // /   / /_/ // /_ / // /_/ // / / /(__  )
+   \__,_/ \___/ \___//_/ \__,_//_/    \__,_/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+/* histogram bucket i counts values lower than 2^i milliseconds,
+ * last bucket counts everything bigger
+ */
+
+#define METRICS_HIST_LEN (24)
+
+/* max number of servers we keep stats for
+ */
+
+#define METRICS_MAX_SERVERS (32)
+
+/* max length of exported record
+ */
+
+#define METRICS_RECORD_LEN (8192)
+
+
+struct hist
+{
+    unsigned long  b[METRICS_HIST_LEN];  /* buckets */
+};
+
+
+/* stats of single server address
+ */
+
+struct server
+{
+    struct resolv_addr  ra;       /* address of the server */
+    unsigned long       sent;     /* requests sent */
+    unsigned long       replies;  /* valid replies received */
+    int64_t             rtt_min;  /* lowest round trip time */
+    int64_t             rtt_max;  /* highest round trip time */
+    int64_t             rtt_sum;  /* sum of all round trip times */
+};
+
+
+/* record being built
+ */
+
+struct record
+{
+    char    buf[METRICS_RECORD_LEN];  /* record text */
+    size_t  len;                      /* length of text in buf */
+};
+
+
+static struct
+{
+    unsigned long  attempts;      /* attempts to get time */
+    unsigned long  failed;        /* attempts that failed */
+    unsigned long  dns_queries;   /* finished dns queries */
+    unsigned long  dns_failed;    /* dns queries without answer */
+    unsigned long  sent;          /* ntp requests sent */
+    unsigned long  replies;       /* valid ntp replies received */
+    unsigned long  syscalls;      /* syscalls made to ask servers */
+    int64_t        backoff;       /* time slept between attempts */
+    int64_t        offset;        /* offset used to set time */
+    int            stepped;       /* clock was stepped */
+    char           uplink[IF_NAMESIZE];  /* interface that answered first */
+    struct hist    dns;           /* dns latency */
+    struct hist    rtt;           /* ntp round trip times */
+    struct hist    offsets;       /* absolute offsets of all replies */
+    struct server  servers[METRICS_MAX_SERVERS];  /* per server stats */
+    int            nservers;      /* number of servers in servers */
+} g_metrics;
+
+
+/* ==========================================================================
+                  _                __           ____
+    ____   _____ (_)_   __ ____ _ / /_ ___     / __/__  __ ____   _____ _____
+   / __ \ / ___// /| | / // __ `// __// _ \   / /_ / / / // __ \ / ___// ___/
+  / /_/ // /   / / | |/ // /_/ // /_ /  __/  / __// /_/ // / / // /__ (__  )
+ / .___//_/   /_/  |___/ \__,_/ \__/ \___/  /_/   \__,_//_/ /_/ \___//____/
+/_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Adds value v (nanoseconds) to histogram h.
+   ========================================================================== */
+
+
+static void hist_add
+(
+    struct hist  *h,   /* histogram to add value to */
+    int64_t       v    /* value to add */
+)
+{
+    int           i;   /* bucket index */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    v = v < 0 ? -v : v;
+    v /= 1000000;
+
+    for (i = 0; i != METRICS_HIST_LEN - 1 && v >= (1ll << i); ++i)
+        ;
+
+    h->b[i]++;
+}
+
+
+/* ==========================================================================
+    Finds stats of server ra, new entry is created when server is not
+    known yet.
+
+    returns
+            server stats, or NULL when there is no space for new server
+   ========================================================================== */
+
+
+static struct server *server_get
+(
+    const struct resolv_addr  *ra   /* server to find */
+)
+{
+    int                        i;   /* just an iterator */
+    struct server             *s;   /* found server */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    for (i = 0; i != g_metrics.nservers; ++i)
+    {
+        s = &g_metrics.servers[i];
+        if (s->ra.addrlen == ra->addrlen &&
+                memcmp(&s->ra.addr, &ra->addr, ra->addrlen) == 0)
+            return s;
+    }
+
+    if (g_metrics.nservers == METRICS_MAX_SERVERS)
+        return NULL;
+
+    s = &g_metrics.servers[g_metrics.nservers++];
+    memset(s, 0x00, sizeof(*s));
+    s->ra = *ra;
+    s->rtt_min = INT64_MAX;
+    return s;
+}
+
+
+/* ==========================================================================
+    Appends printf-like formatted text to record. Text that does not
+    fit is silently truncated, caller checks that at the end.
+   ========================================================================== */
+
+
+static void rec_printf
+(
+    struct record  *r,     /* record to append text to */
+    const char     *fmt,   /* printf-like format */
+                    ...    /* format arguments */
+)
+{
+    va_list         ap;    /* variadic arguments */
+    int             n;     /* number of printed characters */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (r->len >= sizeof(r->buf))
+        return;
+
+    va_start(ap, fmt);
+    n = vsnprintf(r->buf + r->len, sizeof(r->buf) - r->len, fmt, ap);
+    va_end(ap);
+
+    r->len += n > 0 ? (size_t)n : 0;
+}
+
+
+/* ==========================================================================
+    Appends histogram as json array, trailing empty buckets are not
+    printed, so record stays small.
+   ========================================================================== */
+
+
+static void rec_hist
+(
+    struct record      *r,     /* record to append histogram to */
+    const char         *name,  /* name of the json field */
+    const struct hist  *h      /* histogram to append */
+)
+{
+    int                 n;     /* number of buckets to print */
+    int                 i;     /* just an iterator */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    for (n = METRICS_HIST_LEN; n > 0 && h->b[n - 1] == 0; --n)
+        ;
+
+    rec_printf(r, ",\"%s\":[", name);
+    for (i = 0; i != n; ++i)
+        rec_printf(r, "%s%lu", i ? "," : "", h->b[i]);
+    rec_printf(r, "]");
+}
+
+
+/* ==========================================================================
+    Sends record to path. When path is unix socket, record is sent as
+    single datagram (or written to stream socket), otherwise it's
+    appended to file as single line.
+
+    returns
+            0       record sent
+           -1       on error, errno is set
+   ========================================================================== */
+
+
+static int rec_send
+(
+    const struct record  *r,     /* record to send */
+    const char           *path   /* file or unix socket to send record to */
+)
+{
+    int                   fd;    /* file or socket to write record to */
+    int                   ret;   /* return value from functions */
+    struct stat           st;    /* info about path */
+    struct sockaddr_un    sun;   /* unix socket address */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (stat(path, &st) != 0 || !S_ISSOCK(st.st_mode))
+    {
+        fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0)
+            return -1;
+
+        ret = write(fd, r->buf, r->len) == (ssize_t)r->len ? 0 : -1;
+        close(fd);
+        return ret;
+    }
+
+    if (strlen(path) >= sizeof(sun.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    memset(&sun, 0x00, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strcpy(sun.sun_path, path);
+
+    /* collectors usually listen on datagram socket, like
+     * syslog does, but try stream one too
+     */
+
+    if ((fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0)
+        return -1;
+
+    if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) != 0)
+    {
+        close(fd);
+        if (errno != EPROTOTYPE)
+            return -1;
+
+        if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+            return -1;
+
+        if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) != 0)
+        {
+            close(fd);
+            return -1;
+        }
+    }
+
+    ret = send(fd, r->buf, r->len, MSG_NOSIGNAL) == (ssize_t)r->len ? 0 : -1;
+    close(fd);
+    return ret;
+}
+
+
+
+
+/* ==========================================================================
+                                        __     __ _
+                         ____   __  __ / /_   / /(_)_____
+                        / __ \ / / / // __ \ / // // ___/
+                       / /_/ // /_/ // /_/ // // // /__
+                      / .___/ \__,_//_.___//_//_/ \___/
+                     /_/
+               ____                     __   _
+              / __/__  __ ____   _____ / /_ (_)____   ____   _____
+             / /_ / / / // __ \ / ___// __// // __ \ / __ \ / ___/
+            / __// /_/ // / / // /__ / /_ / // /_/ // / / /(__  )
+           /_/   \__,_//_/ /_/ \___/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Records attempt to get time from ntp, ok is 1 when attempt
+    succeeded.
+   ========================================================================== */
+
+
+void metrics_attempt
+(
+    int  ok   /* attempt succeeded */
+)
+{
+    g_metrics.attempts++;
+    g_metrics.failed += !ok;
+}
+
+
+/* ==========================================================================
+    Records dns query that took latency nanoseconds, ok is 1 when query
+    was answered, 0 when it failed or was cancelled.
+   ========================================================================== */
+
+
+void metrics_dns
+(
+    int64_t  latency,  /* time it took to get answer */
+    int      ok        /* dns answered */
+)
+{
+    g_metrics.dns_queries++;
+    g_metrics.dns_failed += !ok;
+    hist_add(&g_metrics.dns, latency);
+}
+
+
+/* ==========================================================================
+    Records ntp request sent to server ra, retransmissions included.
+   ========================================================================== */
+
+
+void metrics_sent
+(
+    const struct resolv_addr  *ra  /* server request was sent to */
+)
+{
+    struct server             *s;  /* server stats */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    g_metrics.sent++;
+    if ((s = server_get(ra)))
+        s->sent++;
+}
+
+
+/* ==========================================================================
+    Records valid reply from server ra, with measured round trip time
+    rtt and clock offset.
+   ========================================================================== */
+
+
+void metrics_reply
+(
+    const struct resolv_addr  *ra,      /* server that replied */
+    int64_t                    rtt,     /* measured round trip time */
+    int64_t                    offset   /* measured clock offset */
+)
+{
+    struct server             *s;       /* server stats */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    g_metrics.replies++;
+    hist_add(&g_metrics.rtt, rtt);
+    hist_add(&g_metrics.offsets, offset);
+
+    if ((s = server_get(ra)) == NULL)
+        return;
+
+    s->replies++;
+    s->rtt_sum += rtt;
+    s->rtt_min = rtt < s->rtt_min ? rtt : s->rtt_min;
+    s->rtt_max = rtt > s->rtt_max ? rtt : s->rtt_max;
+}
+
+
+/* ==========================================================================
+    Records n syscalls made to ask ntp servers: sockets, sends, receives
+    and waits (dns and other time sources are not counted).
+
+    returns
+            number of syscalls recorded so far
+   ========================================================================== */
+
+
+unsigned long metrics_syscalls
+(
+    int  n    /* number of syscalls made */
+)
+{
+    return g_metrics.syscalls += n;
+}
+
+
+/* ==========================================================================
+    Records time slept between failed attempts.
+   ========================================================================== */
+
+
+void metrics_backoff
+(
+    int64_t  t   /* time slept */
+)
+{
+    g_metrics.backoff += t;
+}
+
+
+/* ==========================================================================
+    Records offset that was used to set time, and whether clock has
+    been stepped with it.
+   ========================================================================== */
+
+
+void metrics_offset
+(
+    int64_t  offset,   /* selected clock offset */
+    int      stepped   /* clock was stepped */
+)
+{
+    g_metrics.offset = offset;
+    g_metrics.stepped = stepped;
+}
+
+
+/* ==========================================================================
+    Records interface over which ntp server answered first, when requests
+    are raced over all interfaces.
+   ========================================================================== */
+
+
+void metrics_uplink
+(
+    const char  *ifname  /* interface that won */
+)
+{
+    snprintf(g_metrics.uplink, sizeof(g_metrics.uplink), "%s", ifname);
+}
+
+
+/* ==========================================================================
+    Prints summary of collected metrics to stderr, and when path is not
+    NULL, sends them as single line json record to path, which can be
+    regular file (record is appended to it) or unix socket. Record looks
+    like this (wrapped here):
+
+        {"sync_ms":1234.5,"attempts":2,"failed":1,"offline_ms":0.0,
+         "backoff_ms":80.1,"offset_ms":-12.3,"stepped":0,
+         "dns":{"queries":1,"failed":0},"sent":5,"replies":3,"lost":2,
+         "syscalls":41,"ctxsw":12,"uplink":"eth0",
+         "dns_ms":[0,0,0,0,1],"rtt_ms":[0,0,0,0,0,2,1],"offset_abs_ms":[3],
+         "servers":[{"addr":"192.0.2.1","sent":2,"replies":1,
+         "rtt_min_ms":20.1,"rtt_avg_ms":20.1,"rtt_max_ms":20.1},...]}
+
+    Histograms are arrays where element i is number of values lower than
+    2^i milliseconds (and at least 2^(i-1)), last element of 24 counts
+    also all bigger values.
+
+    returns
+            0       metrics exported, or path is NULL
+           -1       on error
+   ========================================================================== */
+
+
+int metrics_report
+(
+    const char           *path,    /* file or unix socket to send record to */
+    int64_t               sync,    /* time it took to get time */
+    int64_t               offline  /* time spent waiting for network */
+)
+{
+    int                   i;       /* just an iterator */
+    long                  ctxsw;   /* context switches we've made */
+    struct server        *s;       /* server stats */
+    struct rusage         ru;      /* resources used by us */
+    char                  addr[NI_MAXHOST];  /* server address as string */
+    static struct record  r;       /* record to send */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    getrusage(RUSAGE_SELF, &ru);
+    ctxsw = ru.ru_nvcsw + ru.ru_nivcsw;
+
+    log_print("n/synced in %.3fs, %lu attempts (%lu failed), "
+            "%lu dns queries (%lu failed), %lu requests, %lu replies, "
+            "%lu syscalls, %ld context switches, offline %.1fs\n",
+            (double)sync / NSEC_PER_SEC, g_metrics.attempts,
+            g_metrics.failed, g_metrics.dns_queries, g_metrics.dns_failed,
+            g_metrics.sent, g_metrics.replies, g_metrics.syscalls, ctxsw,
+            (double)offline / NSEC_PER_SEC);
+
+    if (path == NULL)
+        return 0;
+
+    r.len = 0;
+    rec_printf(&r, "{\"sync_ms\":%.1f,\"attempts\":%lu,\"failed\":%lu,"
+            "\"offline_ms\":%.1f,\"backoff_ms\":%.1f,\"offset_ms\":%.3f,"
+            "\"stepped\":%d,\"dns\":{\"queries\":%lu,\"failed\":%lu},"
+            "\"sent\":%lu,\"replies\":%lu,\"lost\":%lu,\"syscalls\":%lu,"
+            "\"ctxsw\":%ld",
+            sync / 1e6, g_metrics.attempts, g_metrics.failed, offline / 1e6,
+            g_metrics.backoff / 1e6, g_metrics.offset / 1e6,
+            g_metrics.stepped, g_metrics.dns_queries, g_metrics.dns_failed,
+            g_metrics.sent, g_metrics.replies,
+            g_metrics.sent - g_metrics.replies, g_metrics.syscalls, ctxsw);
+
+    if (g_metrics.uplink[0])
+        rec_printf(&r, ",\"uplink\":\"%s\"", g_metrics.uplink);
+
+    rec_hist(&r, "dns_ms", &g_metrics.dns);
+    rec_hist(&r, "rtt_ms", &g_metrics.rtt);
+    rec_hist(&r, "offset_abs_ms", &g_metrics.offsets);
+
+    rec_printf(&r, ",\"servers\":[");
+    for (i = 0; i != g_metrics.nservers; ++i)
+    {
+        s = &g_metrics.servers[i];
+        if (getnameinfo((const struct sockaddr *)&s->ra.addr,
+                    s->ra.addrlen, addr, sizeof(addr), NULL, 0,
+                    NI_NUMERICHOST) != 0)
+            strcpy(addr, "?");
+
+        rec_printf(&r, "%s{\"addr\":\"%s\",\"sent\":%lu,\"replies\":%lu",
+                i ? "," : "", addr, s->sent, s->replies);
+
+        if (s->replies)
+            rec_printf(&r, ",\"rtt_min_ms\":%.3f,\"rtt_avg_ms\":%.3f,"
+                    "\"rtt_max_ms\":%.3f", s->rtt_min / 1e6,
+                    s->rtt_sum / 1e6 / s->replies, s->rtt_max / 1e6);
+
+        rec_printf(&r, "}");
+    }
+
+    rec_printf(&r, "]}\n");
+
+    if (r.len >= sizeof(r.buf))
+    {
+        log_print("w/metrics record too long, not sent\n");
+        return -1;
+    }
+
+    if (rec_send(&r, path) != 0)
+    {
+        error("w/metrics export");
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,23 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ========================================================================== */
+
+#ifndef METRICS_H
+#define METRICS_H 1
+
+#include <stdint.h>
+
+#include "resolv.h"
+
+void metrics_attempt(int);
+void metrics_dns(int64_t, int);
+void metrics_sent(const struct resolv_addr *);
+void metrics_reply(const struct resolv_addr *, int64_t, int64_t);
+unsigned long metrics_syscalls(int);
+void metrics_backoff(int64_t);
+void metrics_offset(int64_t, int);
+void metrics_uplink(const char *);
+int metrics_report(const char *, int64_t, int64_t);
+
+#endif
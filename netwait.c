@@ -0,0 +1,496 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ==========================================================================
+         ------------------------------------------------
+        / waiting for network to come up, without waking \
+        \ up cpu when there is nothing to do             /
+         ------------------------------------------------
+   ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include "ntpd-setwait-config.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#if HAVE_LINUX_RTNETLINK_H
+#   include <linux/netlink.h>
+#   include <linux/rtnetlink.h>
+#endif
+
+#if HAVE_SYS_PRCTL_H
+#   include <sys/prctl.h>
+#endif
+
+#if HAVE_SYS_TIMERFD_H
+#   include <sys/timerfd.h>
+#endif
+
+#include "backend.h"
+#include "log.h"
+#include "netwait.h"
+#include "sysclock.h"
+
+
+/* ==========================================================================
+                  _                __           ____
+    ____   _____ (_)_   __ ____ _ / /_ ___     / __/__  __ ____   _____ _____
+   / __ \ / ___// /| | / // __ `// __// _ \   / /_ / / / // __ \ / ___// ___/
+  / /_/ // /   / / | |/ // /_/ // /_ /  __/  / __// /_/ // / / // /__ (__  )
+ / .___//_/   /_/  |___/ \__,_/ \__/ \___/  /_/   \__,_//_/ /_/ \___//____/
+/_/
+   ========================================================================== */
+
+
+#if HAVE_LINUX_RTNETLINK_H
+
+
+/* ==========================================================================
+    Checks if netlink message describes something that can get us to ntp
+    server, that is default route in main table or globally scoped
+    address that finished duplicate address detection.
+
+    returns
+            1       message describes usable route or address
+            0       message is of no use to us
+   ========================================================================== */
+
+
+static int is_usable
+(
+    struct nlmsghdr   *nh   /* netlink message to check */
+)
+{
+    struct rtmsg      *rt;  /* route information */
+    struct ifaddrmsg  *ifa; /* address information */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (nh->nlmsg_type == RTM_NEWROUTE)
+    {
+        rt = NLMSG_DATA(nh);
+        return rt->rtm_dst_len == 0 && rt->rtm_table == RT_TABLE_MAIN &&
+            rt->rtm_type == RTN_UNICAST;
+    }
+
+    if (nh->nlmsg_type == RTM_NEWADDR)
+    {
+        ifa = NLMSG_DATA(nh);
+        return ifa->ifa_scope == RT_SCOPE_UNIVERSE &&
+            (ifa->ifa_flags & (IFA_F_TENTATIVE | IFA_F_DADFAILED)) == 0;
+    }
+
+    return 0;
+}
+
+
+/* ==========================================================================
+    Dumps kernel route or address table and checks if there is anything
+    usable in it. Dump is done over its own short lived socket, so dump
+    replies do not mix with events on subscribed socket.
+
+    returns
+            1       usable route or address exists
+            0       nothing usable in the table
+           -1       on error
+   ========================================================================== */
+
+
+static int dump_has_usable
+(
+    int                 type       /* RTM_GETROUTE or RTM_GETADDR */
+)
+{
+    int                 fd;        /* netlink socket for the dump */
+    int                 found;     /* usable entry found */
+    ssize_t             n;         /* bytes received from kernel */
+    struct nlmsghdr    *nh;        /* currently parsed message */
+    struct
+    {
+        struct nlmsghdr  nh;
+        struct rtgenmsg  g;
+    }                   req;       /* dump request */
+    union
+    {
+        struct nlmsghdr  nh;
+        char             buf[8192];
+    }                   rsp;       /* dump response, aligned for nlmsghdr */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if ((fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE)) < 0)
+        return -1;
+
+    memset(&req, 0x00, sizeof(req));
+    req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(req.g));
+    req.nh.nlmsg_type = type;
+    req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.nh.nlmsg_seq = 1;
+    req.g.rtgen_family = AF_UNSPEC;
+
+    if (send(fd, &req, req.nh.nlmsg_len, 0) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    found = 0;
+    for (;;)
+    {
+        if ((n = recv(fd, &rsp, sizeof(rsp), 0)) <= 0)
+        {
+            if (n < 0 && errno == EINTR)
+                continue;
+
+            close(fd);
+            return -1;
+        }
+
+        for (nh = &rsp.nh; NLMSG_OK(nh, n); nh = NLMSG_NEXT(nh, n))
+        {
+            if (nh->nlmsg_type == NLMSG_DONE)
+            {
+                close(fd);
+                return found;
+            }
+
+            if (nh->nlmsg_type == NLMSG_ERROR)
+            {
+                close(fd);
+                return -1;
+            }
+
+            found |= is_usable(nh);
+        }
+    }
+}
+
+
+/* ==========================================================================
+    Checks if network is configured well enough to try to reach ntp
+    server.
+
+    returns
+            1       there is default route or global address
+            0       network is down
+   ========================================================================== */
+
+
+static int is_online(void)
+{
+    /* when we can't dump tables for whatever reason, we
+     * assume network is there, worst case we will just try
+     * to reach ntp server like we'd do without netlink
+     */
+
+    if (dump_has_usable(RTM_GETROUTE) != 0)
+        return 1;
+
+    return dump_has_usable(RTM_GETADDR) != 0;
+}
+
+
+/* ==========================================================================
+    Reads and discards all pending events from subscribed socket, we only
+    care that something changed, table is dumped again anyway.
+   ========================================================================== */
+
+
+static void drain
+(
+    int   fd         /* netlink socket to drain */
+)
+{
+    char  buf[4096]; /* discarded events */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    while (recv(fd, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+        ;
+}
+
+
+#endif /* HAVE_LINUX_RTNETLINK_H */
+
+
+
+
+/* ==========================================================================
+                                        __     __ _
+                         ____   __  __ / /_   / /(_)_____
+                        / __ \ / / / // __ \ / // // ___/
+                       / /_/ // /_/ // /_/ // // // /__
+                      / .___/ \__,_//_.___//_//_/ \___/
+                     /_/
+               ____                     __   _
+              / __/__  __ ____   _____ / /_ (_)____   ____   _____
+             / /_ / / / // __ \ / ___// __// // __ \ / __ \ / ___/
+            / __// /_/ // / / // /__ / /_ / // /_/ // / / /(__  )
+           /_/   \__,_//_/ /_/ \___/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Initializes nw object. When use_netlink is set, rtnetlink socket is
+    opened and subscribed to link, address and route changes, so we can
+    sleep until network configuration changes instead of checking for it
+    periodically. If netlink is not available (not Linux, or old kernel),
+    nw works as if network was always up.
+   ========================================================================== */
+
+
+void netwait_init
+(
+    struct netwait      *nw,          /* object to initialize */
+    int                  use_netlink  /* wait for network with netlink */
+)
+{
+#if HAVE_LINUX_RTNETLINK_H
+    struct sockaddr_nl   sa;          /* netlink groups to subscribe to */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+#endif
+
+
+    memset(nw, 0x00, sizeof(*nw));
+    nw->nlfd = -1;
+    nw->tfd = -1;
+    nw->online = 1;
+    nw->start = sysclock_boottime();
+
+#if HAVE_SYS_TIMERFD_H && defined(CLOCK_BOOTTIME)
+    /* poll() timeout runs on monotonic clock, which stops in
+     * suspend, timer on boot clock does not
+     */
+
+    nw->tfd = backend_timerfd_create(CLOCK_BOOTTIME, TFD_CLOEXEC);
+    if (nw->tfd < 0 && errno != ENOSYS)
+        error("w/timerfd_create(), sleep in suspend won't count");
+#endif
+
+#if HAVE_LINUX_RTNETLINK_H
+    if (use_netlink == 0)
+        return;
+
+    nw->nlfd = backend_socket(AF_NETLINK,
+            SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (nw->nlfd < 0)
+    {
+        error("w/netlink socket()");
+        return;
+    }
+
+    memset(&sa, 0x00, sizeof(sa));
+    sa.nl_family = AF_NETLINK;
+    sa.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR |
+        RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_ROUTE;
+
+    if (bind(nw->nlfd, (struct sockaddr *)&sa, sizeof(sa)) != 0)
+    {
+        error("w/netlink bind()");
+        backend_close(nw->nlfd);
+        nw->nlfd = -1;
+    }
+#else
+    (void)use_netlink;
+#endif
+}
+
+
+/* ==========================================================================
+    Blocks until network has default route or global address. Process
+    sleeps in poll() without timeout, so cpu is woken only when network
+    configuration changes. Returns immediately when netlink is not used.
+
+    returns
+            1       network was down and we had to wait for it
+            0       network is up (or we don't know)
+   ========================================================================== */
+
+
+int netwait_for_link
+(
+    struct netwait  *nw       /* netwait object */
+)
+{
+#if HAVE_LINUX_RTNETLINK_H
+    struct pollfd    pfd;     /* netlink socket to wait on */
+    int              waited;  /* we had to wait for network */
+    int64_t          since;   /* boot time we started waiting at */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (nw->nlfd < 0)
+        return 0;
+
+    waited = 0;
+    pfd.fd = nw->nlfd;
+    pfd.events = POLLIN;
+
+    /* drain before the dump, so any change that happens after
+     * dump will wake us up
+     */
+
+    drain(nw->nlfd);
+    since = sysclock_boottime();
+
+    while (is_online() == 0)
+    {
+        if (nw->online)
+            log_print("n/network is down, waiting for it\n");
+
+        nw->online = 0;
+        waited = 1;
+        if (backend_poll(&pfd, 1, -1) < 0 && errno != EINTR)
+        {
+            error("w/netlink poll()");
+            return waited;
+        }
+
+        nw->wakeups++;
+        drain(nw->nlfd);
+    }
+
+    if (waited)
+        nw->offline += sysclock_boottime() - since;
+
+    if (nw->online == 0)
+        log_print("n/network is up\n");
+
+    nw->online = 1;
+    return waited;
+#else
+    (void)nw;
+    return 0;
+#endif
+}
+
+
+/* ==========================================================================
+    Sleeps for ms milliseconds before next attempt to reach ntp server.
+    Timer slack is set to tenth of sleep time, so kernel can coalesce our
+    wakeup with other timers in the system. Sleep is timerfd armed on
+    boot clock, so time spent in suspend counts towards the sleep. When
+    timerfd is not available, poll() timeout is used, and suspend is not
+    counted. When netlink is used, sleep is interrupted early if network
+    configuration changes, as ntp server may be reachable now.
+
+    returns
+            1       sleep was interrupted by network configuration change
+            0       slept for whole ms
+   ========================================================================== */
+
+
+int netwait_sleep
+(
+    struct netwait     *nw,        /* netwait object */
+    long                ms         /* time to sleep */
+)
+{
+    int64_t             deadline;  /* boot time at which sleep ends */
+    int64_t             left;      /* time left to sleep (ns) */
+    int                 changed;   /* network configuration changed */
+    int                 timeout;   /* poll() timeout in ms */
+    struct pollfd       pfd[2];    /* netlink socket and timer */
+#if HAVE_SYS_TIMERFD_H
+    struct itimerspec   its;       /* time timer expires at */
+#endif
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    pfd[0].fd = nw->nlfd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = nw->tfd;
+    pfd[1].events = POLLIN;
+
+#if HAVE_SYS_PRCTL_H
+    prctl(PR_SET_TIMERSLACK, ms * 1000000l / 10, 0, 0, 0);
+#endif
+
+    changed = 0;
+    deadline = sysclock_boottime() + ms * 1000000ll;
+
+#if HAVE_SYS_TIMERFD_H
+    /* deadline is absolute on boot clock, so timer that is
+     * armed again after early wakeup does not drift
+     */
+
+    memset(&its, 0x00, sizeof(its));
+    its.it_value.tv_sec = deadline / NSEC_PER_SEC;
+    its.it_value.tv_nsec = deadline % NSEC_PER_SEC;
+    if (nw->tfd >= 0 &&
+            timerfd_settime(nw->tfd, TFD_TIMER_ABSTIME, &its, NULL) != 0)
+    {
+        error("w/timerfd_settime()");
+        pfd[1].fd = -1;
+    }
+#else
+    pfd[1].fd = -1;
+#endif
+
+    while ((left = deadline - sysclock_boottime()) > 0)
+    {
+        /* poll() ignores negative fd, so this is just a sleep
+         * when netlink is not used, timer wakes us up when it's
+         * there, timeout is only for when it's not
+         */
+
+        timeout = pfd[1].fd >= 0 ? -1 : (int)((left + 999999) / 1000000);
+        if (backend_poll(pfd, 2, timeout) > 0 && pfd[0].revents)
+        {
+#if HAVE_LINUX_RTNETLINK_H
+            drain(nw->nlfd);
+#endif
+            nw->wakeups++;
+            changed = 1;
+            break;
+        }
+
+        nw->wakeups++;
+    }
+
+#if HAVE_SYS_PRCTL_H
+    /* zero restores default slack
+     */
+
+    prctl(PR_SET_TIMERSLACK, 0, 0, 0, 0);
+#endif
+
+    return changed;
+}
+
+
+/* ==========================================================================
+    Prints how long we've been waiting and how many times we woke up
+    during that time, to confirm we let cpu sleep while waiting.
+   ========================================================================== */
+
+
+void netwait_report
+(
+    struct netwait  *nw        /* netwait object */
+)
+{
+    double           elapsed;  /* seconds we've been waiting */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    elapsed = (double)(sysclock_boottime() - nw->start) / NSEC_PER_SEC;
+    log_print("n/waited %.1fs, %lu wakeups (%.1f wakeups/hour)\n",
+            elapsed, nw->wakeups,
+            elapsed > 0 ? nw->wakeups * 3600.0 / elapsed : 0.0);
+}
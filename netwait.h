@@ -0,0 +1,26 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ========================================================================== */
+
+#ifndef NETWAIT_H
+#define NETWAIT_H 1
+
+#include <stdint.h>
+
+struct netwait
+{
+    int            nlfd;     /* rtnetlink socket, -1 when not used */
+    int            tfd;      /* boot clock timer for sleeps, or -1 */
+    int            online;   /* last known state of network */
+    unsigned long  wakeups;  /* number of times we woke up to do work */
+    int64_t        start;    /* boot time when we started waiting */
+    int64_t        offline;  /* time spent waiting for network */
+};
+
+void netwait_init(struct netwait *, int);
+int netwait_for_link(struct netwait *);
+int netwait_sleep(struct netwait *, long);
+void netwait_report(struct netwait *);
+
+#endif
@@ -0,0 +1,263 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ==========================================================================
+         -----------------------------------------------
+        / tells init system and services waiting for us \
+        \ that time is synchronized                     /
+         -----------------------------------------------
+   ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include "ntpd-setwait-config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "notify.h"
+#include "state.h"
+#include "sysclock.h"
+
+
+/* ==========================================================================
+                  _                __           ____
+    ____   _____ (_)_   __ ____ _ / /_ ___     / __/__  __ ____   _____ _____
+   / __ \ / ___// /| | / // __ `// __// _ \   / /_ / / / // __ \ / ___// ___/
+  / /_/ // /   / / | |/ // /_/ // /_ /  __/  / __// /_/ // / / // /__ (__  )
+ / .___//_/   /_/  |___/ \__,_/ \__/ \___/  /_/   \__,_//_/ /_/ \___//____/
+/_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Sends readiness notification to systemd (or anything else that talks
+    sd_notify protocol), over unix datagram socket from NOTIFY_SOCKET
+    environment variable. Socket name starting with '@' is in abstract
+    namespace. Nothing is done when variable is not set.
+   ========================================================================== */
+
+
+static void notify_socket
+(
+    const char          *msg       /* status message */
+)
+{
+    int                  fd;       /* socket to send notification over */
+    int                  len;      /* length of notification */
+    size_t               pathlen;  /* length of socket name */
+    socklen_t            addrlen;  /* length of addr */
+    const char          *path;     /* socket name from environment */
+    struct sockaddr_un   addr;     /* socket to send notification to */
+    char                 buf[256]; /* notification to send */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if ((path = getenv("NOTIFY_SOCKET")) == NULL || path[0] == '\0')
+        return;
+
+    if ((pathlen = strlen(path)) >= sizeof(addr.sun_path) ||
+            (path[0] != '/' && path[0] != '@'))
+    {
+        log_print("w/invalid NOTIFY_SOCKET %s\n", path);
+        return;
+    }
+
+    memset(&addr, 0x00, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path, pathlen);
+    addrlen = offsetof(struct sockaddr_un, sun_path) + pathlen;
+
+    /* abstract socket name starts with null byte, and is not
+     * null terminated
+     */
+
+    if (path[0] == '@')
+        addr.sun_path[0] = '\0';
+    else
+        addrlen++;
+
+    if ((fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0)
+    {
+        error("w/socket() for NOTIFY_SOCKET");
+        return;
+    }
+
+    len = snprintf(buf, sizeof(buf), "READY=1\nSTATUS=%s\n", msg);
+    if (sendto(fd, buf, len, 0, (struct sockaddr *)&addr, addrlen) != len)
+        error("w/sendto() NOTIFY_SOCKET");
+
+    close(fd);
+}
+
+
+/* ==========================================================================
+    Writes notification to flag at path. When path is a fifo, line is
+    written to it, to wake up whoever waits on the other end, without
+    blocking when nobody does. Otherwise regular file is created, for
+    anyone that checks for it later, unless path was a fifo when we
+    started, and is gone now.
+   ========================================================================== */
+
+
+static void notify_flag
+(
+    const char   *path,     /* flag file or fifo */
+    int           fifo,     /* path was fifo in notify_init() */
+    const char   *msg       /* status message */
+)
+{
+    int           fd;       /* opened fifo */
+    int           len;      /* length of data in buf */
+    struct stat   st;       /* info about path */
+    char          buf[256]; /* notification to write */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    len = snprintf(buf, sizeof(buf), "%lld %s\n",
+            (long long)(sysclock_now() / NSEC_PER_SEC), msg);
+
+    if (stat(path, &st) != 0 || !S_ISFIFO(st.st_mode))
+    {
+        /* whoever waited on fifo gave up on us and removed it,
+         * regular file in its place would only confuse next boot
+         */
+
+        if (!fifo)
+            state_write(path, buf, len);
+
+        return;
+    }
+
+    /* with O_NONBLOCK open() fails with ENXIO, when there is
+     * no reader, instead of waiting for one
+     */
+
+    if ((fd = open(path, O_WRONLY | O_NONBLOCK | O_CLOEXEC)) < 0)
+    {
+        if (errno != ENXIO)
+            error("w/open() notify fifo");
+
+        return;
+    }
+
+    if (write(fd, buf, len) != len)
+        error("w/write() notify fifo");
+
+    close(fd);
+}
+
+
+/* ==========================================================================
+                                        __     __ _
+                         ____   __  __ / /_   / /(_)_____
+                        / __ \ / / / // __ \ / // // ___/
+                       / /_/ // /_/ // /_/ // // // /__
+                      / .___/ \__,_//_.___//_//_/ \___/
+                     /_/
+               ____                     __   _
+              / __/__  __ ____   _____ / /_ (_)____   ____   _____
+             / /_ / / / // __ \ / ___// __// // __ \ / __ \ / ___/
+            / __// /_/ // / / // /__ / /_ / // /_/ // / / /(__  )
+           /_/   \__,_//_/ /_/ \___/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Prepares notify object. Flag files left from previous run are
+    removed, so no one takes them as sign that time is synchronized
+    now, and it's remembered which of them are fifos. Readiness fd is marked close-on-exec, so ntpd does not inherit
+    it, when we never got to notify.
+   ========================================================================== */
+
+
+void notify_init
+(
+    struct notify  *n      /* notify object with flags and fd set */
+)
+{
+    int             i;     /* just an iterator */
+    struct stat     st;    /* info about flag */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    for (i = 0; i != n->nflags; ++i)
+    {
+        n->fifo[i] = 0;
+        if (stat(n->flags[i], &st) != 0)
+            continue;
+
+        if (S_ISREG(st.st_mode))
+            unlink(n->flags[i]);
+
+        n->fifo[i] = S_ISFIFO(st.st_mode);
+    }
+
+    if (n->fd >= 0 && fcntl(n->fd, F_SETFD, FD_CLOEXEC) != 0)
+    {
+        error("w/fcntl() readiness fd");
+        n->fd = -1;
+    }
+}
+
+
+/* ==========================================================================
+    Tells everyone who waits for us, that time is synchronized now,
+    every way that was configured: sd_notify socket, readiness fd (a new
+    line is written and fd is closed, like s6 expects it) and flag files.
+    Function does nothing, when called again.
+   ========================================================================== */
+
+
+void notify_ready
+(
+    struct notify  *n,       /* notify object */
+    int64_t         offset   /* offset time was synchronized with */
+)
+{
+    int             i;       /* just an iterator */
+    char            msg[64]; /* status message */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (n->ready)
+        return;
+
+    snprintf(msg, sizeof(msg), "time synchronized, offset %+.6fs",
+            (double)offset / NSEC_PER_SEC);
+
+    notify_socket(msg);
+
+    if (n->fd >= 0)
+    {
+        if (write(n->fd, "\n", 1) != 1)
+            error("w/write() readiness fd");
+
+        close(n->fd);
+        n->fd = -1;
+    }
+
+    for (i = 0; i != n->nflags; ++i)
+        notify_flag(n->flags[i], n->fifo[i], msg);
+
+    n->ready = 1;
+    log_print("n/notified that %s\n", msg);
+}
@@ -0,0 +1,28 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ========================================================================== */
+
+#ifndef NOTIFY_H
+#define NOTIFY_H 1
+
+#include <stdint.h>
+
+/* maximum number of flag files to notify
+ */
+
+#define NOTIFY_MAX_FLAGS (4)
+
+struct notify
+{
+    const char  *flags[NOTIFY_MAX_FLAGS];  /* flag files or fifos */
+    int          fifo[NOTIFY_MAX_FLAGS];   /* flag was fifo at init */
+    int          nflags;  /* number of elements in flags */
+    int          fd;      /* readiness fd, -1 when not used */
+    int          ready;   /* notification has been sent */
+};
+
+void notify_init(struct notify *);
+void notify_ready(struct notify *, int64_t);
+
+#endif
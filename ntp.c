@@ -0,0 +1,2048 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ==========================================================================
+         ----------------------------------------------------
+        / ntp client side of the protocol, sends requests to \
+        \ all servers at once and collects their replies     /
+         ----------------------------------------------------
+   ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include "ntpd-setwait-config.h"
+
+#include <errno.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#if HAVE_LINUX_NET_TSTAMP_H
+#   include <linux/net_tstamp.h>
+#endif
+
+#include "backend.h"
+#include "clksel.h"
+#include "log.h"
+#include "metrics.h"
+#include "ntp.h"
+#include "rand.h"
+#include "resolv.h"
+#include "score.h"
+#include "sysclock.h"
+#include "timesrc.h"
+#include "uring.h"
+
+
+/* ==========================================================================
+          __             __                     __   _
+     ____/ /___   _____ / /____ _ _____ ____ _ / /_ (_)____   ____   _____
+    / __  // _ \ / ___// // __ `// ___// __ `// __// // __ \ / __ \ / ___/
+   / /_/ //  __// /__ / // /_/ // /   / /_/ // /_ / // /_/ // / / /(__  )
+   \__,_/ \___/ \___//_/ \__,_//_/    \__,_/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+#define NTP_PACKET_LEN (48)
+#define NTP_ROOT_DELAY_OFFSET (4)
+#define NTP_ROOT_DISP_OFFSET (8)
+#define NTP_REFID_OFFSET (12)
+#define NTP_ORG_TS_OFFSET (24)
+#define NTP_REC_TS_OFFSET (32)
+#define NTP_XMT_TS_OFFSET (40)
+
+/* servers that are further than that from their reference
+ * clock are not trusted (MAXDIST from RFC 5905)
+ */
+
+#define NTP_MAX_DIST (1000000000ll)
+
+
+/* number of servers we remember round trip times for
+ */
+
+#define NTP_RTT_TABLE (32)
+
+
+/* burst to single address ends early, when that many of its
+ * replies agree with the one with the lowest delay
+ */
+
+#define NTP_BURST_AGREE (3)
+
+
+/* replies of burst agree, when their delay is not much worse
+ * than the lowest one, and their offsets are within their
+ * delays, widened by that much, of the best one
+ */
+
+#define NTP_BURST_JITTER (1000000ll)
+
+
+/* server that sends RATE kiss-o'-death is not asked for that long,
+ * doubled each time it sends it again, up to max
+ */
+
+#define NTP_KOD_MIN (16 * 1000000000ll)
+#define NTP_KOD_MAX (1024 * 1000000000ll)
+
+
+/* round trip time estimation for single server, computed like
+ * tcp does it (RFC 6298), all times are in nanoseconds
+ */
+
+struct rtt
+{
+    struct resolv_addr  ra;       /* server this estimation is for */
+    int64_t             srtt;     /* smoothed round trip time */
+    int64_t             rttvar;   /* round trip time variation */
+    int64_t             rto;      /* retransmission timeout */
+    int64_t             used;     /* last time entry was used */
+    int64_t             holdoff;  /* boot time not to ask server before */
+    int64_t             kodgap;   /* last hold off after RATE */
+    int                 fd;       /* socket to server, or -1 */
+    int                 txstamp;  /* kernel tells when requests left fd */
+    char                ifname[IF_NAMESIZE];  /* interface fd is bound to */
+};
+
+
+/* requests that have been sent to single server address, all
+ * requests of the burst go over the same socket, request n has
+ * its timestamps in slot n % NTP_MAX_BURST
+ */
+
+struct probe
+{
+    struct resolv_addr  ra;       /* server request was sent to */
+    char                ifname[IF_NAMESIZE];  /* interface, "" for any */
+    struct rtt         *rtt;      /* rtt estimation for the server */
+    int                 server;   /* index of server address is of */
+    int64_t             org[NTP_MAX_BURST];    /* our timestamps in requests */
+    int64_t             t1[NTP_MAX_BURST];     /* times requests left us */
+    int64_t             t1_hw[NTP_MAX_BURST];  /* same, from nic clock, or 0 */
+    int64_t             offset[NTP_MAX_BURST]; /* offsets of valid replies */
+    int64_t             delay[NTP_MAX_BURST];  /* delays of valid replies */
+    int                 nsent;    /* requests sent so far */
+    int                 nreplies; /* valid replies received so far */
+    int                 done;     /* nothing more to wait for */
+    int                 sibling;  /* other interface got reply first */
+    struct ntp_sample   best;     /* valid reply with the lowest delay */
+    int64_t             deadline; /* boot time to send next request at */
+    int64_t             rto;      /* current retransmission timeout */
+    int                 retries;  /* retransmissions done so far */
+    int                 proto;    /* TIMESRC_* probe talks with */
+    struct timesrc_conn tc;       /* connection, for non-ntp probes */
+};
+
+
+/* rtt estimations of servers we talked to, kept between calls
+ * to ntp_query() so next round starts with good timeouts, together
+ * with sockets to them, so retries don't create them all over
+ */
+
+static struct rtt  g_rtt[NTP_RTT_TABLE];
+
+
+/* ==========================================================================
+                  _                __           ____
+    ____   _____ (_)_   __ ____ _ / /_ ___     / __/__  __ ____   _____ _____
+   / __ \ / ___// /| | / // __ `// __// _ \   / /_ / / / // __ \ / ___// ___/
+  / /_/ // /   / / | |/ // /_/ // /_ /  __/  / __// /_/ // / / // /__ (__  )
+ / .___//_/   /_/  |___/ \__,_/ \__/ \___/  /_/   \__,_//_/ /_/ \___//____/
+/_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Reads 64bit ntp timestamp stored at buf and converts it to unix time
+    in nanoseconds. Data comes in network (big) endian, first 32 bits are
+    seconds and next 32 bits are fraction of a second.
+
+    Seconds field overflows in 2036, we assume that time with highest bit
+    cleared is from after that (era 1) as RFC 4330 suggests - ntp has not
+    been around before 1968, so time could not have been sent then.
+
+    returns
+            nanoseconds since unix epoch, or 0 when timestamp is not set
+   ========================================================================== */
+
+
+static int64_t ntp_to_ns
+(
+    const unsigned char  *buf   /* timestamp in ntp format */
+)
+{
+    int64_t               sec;  /* seconds part of timestamp */
+    uint64_t              frac; /* fraction part of timestamp */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    sec = (int64_t)buf[0] << 24 | (int64_t)buf[1] << 16 |
+        (int64_t)buf[2] << 8 | (int64_t)buf[3];
+    frac = (uint64_t)buf[4] << 24 | (uint64_t)buf[5] << 16 |
+        (uint64_t)buf[6] << 8 | (uint64_t)buf[7];
+
+    if (sec == 0 && frac == 0)
+        return 0;
+
+    if ((sec & 0x80000000ll) == 0)
+        sec += 0x100000000ll;
+
+    return (sec - NTP_UNIX_EPOCH_DIFF) * NSEC_PER_SEC +
+        (int64_t)((frac * NSEC_PER_SEC) >> 32);
+}
+
+
+/* ==========================================================================
+    Reads 32bit ntp short format stored at buf (16 bits of seconds and
+    16 bits of fraction, as root delay and dispersion are sent) and
+    converts it to nanoseconds.
+   ========================================================================== */
+
+
+static int64_t short_to_ns
+(
+    const unsigned char  *buf   /* value in ntp short format */
+)
+{
+    uint64_t              v;    /* value in 1/65536 of second */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    v = (uint64_t)buf[0] << 24 | (uint64_t)buf[1] << 16 |
+        (uint64_t)buf[2] << 8 | (uint64_t)buf[3];
+
+    return (int64_t)((v * NSEC_PER_SEC) >> 16);
+}
+
+
+/* ==========================================================================
+    Checks if packet is sane ntp server response to our request and
+    computes clock offset and round trip delay from it, as described in
+    RFC 5905, with the 4 timestamps:
+
+        t1 - org, time request left us (our clock)
+        t2 - rec, time request arrived at server (server clock)
+        t3 - xmt, time reply left server (server clock)
+        t4 - dst, time reply arrived to us (our clock)
+
+        offset = ((t2 - t1) + (t3 - t4)) / 2
+        delay  = (t4 - t1) - (t3 - t2)
+
+    Before parsing, sample must have org and dst set. Timestamp we've
+    put into request is passed in sent, it's usually a bit earlier than
+    org, when kernel told us when request really left.
+
+    Reply to our request can still be useless, when server is not
+    synchronized itself (leap indicator 3, stratum 16), is too far from
+    its reference clock, or sent us kiss-o'-death (stratum 0) with
+    reason in reference id, like RATE or DENY. Such server won't
+    answer any better to retransmission.
+
+    returns
+            0       packet is valid, sample is filled
+           -1       packet is not a valid response to our request
+           -2       packet is response to our request, but server is not
+                    fit for synchronization
+   ========================================================================== */
+
+
+static int parse_reply
+(
+    const unsigned char  *packet,  /* packet received from server */
+    int64_t               sent,    /* timestamp sent in request */
+    struct ntp_sample    *sample   /* parsed timestamps will be stored here */
+)
+{
+    unsigned char         org[8];  /* org timestamp as we've sent it */
+    char                  kiss[5]; /* kiss code, printable */
+    int                   i;       /* just an iterator */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    /* 3 lowest bits is mode, and server must respond with
+     * mode 4 (server), next 3 bits is version, we talk v4
+     * but v3 servers are still around
+     */
+
+    if ((packet[0] & 0x07) != 4)
+        return -1;
+
+    if (((packet[0] >> 3) & 0x07) < 3 || ((packet[0] >> 3) & 0x07) > 4)
+        return -1;
+
+    /* server copies our transmit timestamp into origin field,
+     * if it doesn't match, this is not reply to our request,
+     * but maybe some old, duplicated or spoofed packet
+     */
+
+    ntp_ns_to_ts(sent, org);
+    if (memcmp(org, packet + NTP_ORG_TS_OFFSET, sizeof(org)) != 0)
+        return -1;
+
+    sample->rec = ntp_to_ns(packet + NTP_REC_TS_OFFSET);
+    sample->xmt = ntp_to_ns(packet + NTP_XMT_TS_OFFSET);
+
+    /* server that does not know time sends 0 here
+     */
+
+    if (sample->rec == 0 || sample->xmt == 0)
+        return -2;
+
+    sample->stratum = packet[1];
+
+    if (sample->stratum == 0)
+    {
+        /* kiss-o'-death, reference id holds 4 ascii letters
+         * telling why server does not want to talk to us
+         */
+
+        for (i = 0; i != 4; ++i)
+        {
+            kiss[i] = (char)packet[NTP_REFID_OFFSET + i];
+            if (kiss[i] < 'A' || kiss[i] > 'Z')
+                kiss[i] = '?';
+        }
+
+        kiss[4] = '\0';
+        log_print("w/kiss-o'-death %s from ntp server\n", kiss);
+        return -2;
+    }
+
+    /* two highest bits is leap indicator, 3 means server
+     * clock is not synchronized
+     */
+
+    if ((packet[0] >> 6) == 3 || sample->stratum >= 16)
+    {
+        log_print("w/ntp server is not synchronized\n");
+        return -2;
+    }
+
+    sample->rootdist = short_to_ns(packet + NTP_ROOT_DELAY_OFFSET) / 2 +
+        short_to_ns(packet + NTP_ROOT_DISP_OFFSET);
+
+    if (sample->rootdist > NTP_MAX_DIST)
+    {
+        log_print("w/ntp server is too far from its reference\n");
+        return -2;
+    }
+
+    sample->offset = ((sample->rec - sample->org) +
+            (sample->xmt - sample->dst)) / 2;
+    sample->delay = (sample->dst - sample->org) -
+        (sample->xmt - sample->rec);
+
+    /* negative delay is possible on very fast networks when
+     * server clock has worse precision than ours, clamp it
+     */
+
+    if (sample->delay < 0)
+        sample->delay = 0;
+
+    return 0;
+}
+
+
+/* ==========================================================================
+    Updates rtt estimation with new round trip measurement r, and
+    computes new retransmission timeout, as RFC 6298 does.
+   ========================================================================== */
+
+
+static void rtt_update
+(
+    struct rtt             *rtt,    /* estimation to update */
+    int64_t                 r,      /* measured round trip time */
+    const struct ntp_opts  *opts    /* query options */
+)
+{
+    int64_t                 diff;   /* difference between srtt and r */
+    int64_t                 min;    /* minimum allowed rto */
+    int64_t                 max;    /* maximum allowed rto */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (rtt->srtt == 0)
+    {
+        /* first measurement for this server
+         */
+
+        rtt->srtt = r;
+        rtt->rttvar = r / 2;
+    }
+    else
+    {
+        diff = rtt->srtt - r;
+        diff = diff < 0 ? -diff : diff;
+        rtt->rttvar = (3 * rtt->rttvar + diff) / 4;
+        rtt->srtt = (7 * rtt->srtt + r) / 8;
+    }
+
+    rtt->rto = rtt->srtt + 4 * rtt->rttvar;
+
+    min = opts->rto_min * 1000000ll;
+    max = opts->rto_max * 1000000ll;
+    rtt->rto = rtt->rto < min ? min : rtt->rto > max ? max : rtt->rto;
+}
+
+
+/* ==========================================================================
+    Finds rtt estimation for server ra, reached over interface ifname
+    ("" when routing table picks it), path over each interface has
+    its own entry and socket. If server is not known, least recently
+    used entry is taken over and initialized with initial timeout from
+    opts, and socket of server it was for is closed.
+   ========================================================================== */
+
+
+static struct rtt *rtt_lookup
+(
+    const struct resolv_addr  *ra,     /* server to find estimation for */
+    const char                *ifname, /* interface server is reached over */
+    const struct ntp_opts     *opts    /* query options */
+)
+{
+    int                        i;      /* just an iterator */
+    int64_t                    r;      /* known round trip to server */
+    struct rtt                *rtt;    /* found entry */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    rtt = &g_rtt[0];
+    for (i = 0; i != NTP_RTT_TABLE; ++i)
+    {
+        if (g_rtt[i].ra.addrlen == ra->addrlen &&
+                memcmp(&g_rtt[i].ra.addr, &ra->addr, ra->addrlen) == 0 &&
+                strcmp(g_rtt[i].ifname, ifname) == 0)
+        {
+            rtt = &g_rtt[i];
+            rtt->used = sysclock_boottime();
+            return rtt;
+        }
+
+        if (g_rtt[i].used < rtt->used)
+            rtt = &g_rtt[i];
+    }
+
+    if (rtt->ra.addrlen && rtt->fd >= 0)
+    {
+        uring_forget(rtt->fd);
+        backend_close(rtt->fd);
+        metrics_syscalls(1);
+    }
+
+    memset(rtt, 0x00, sizeof(*rtt));
+    rtt->ra = *ra;
+    rtt->fd = -1;
+    strcpy(rtt->ifname, ifname);
+    rtt->rto = opts->rto_init * 1000000ll;
+    rtt->used = sysclock_boottime();
+
+    /* server we talked to before (maybe on previous boot) starts
+     * with rto from its known round trip, not from rto_init
+     */
+
+    if ((r = score_rtt(ra)) > 0)
+        rtt_update(rtt, r, opts);
+
+    return rtt;
+}
+
+
+/* ==========================================================================
+    Asks kernel to timestamp packets sent and received over fd, so time
+    spent by the packet in kernel and our process waiting for cpu does
+    not count as network delay. On loaded board, that can be
+    milliseconds. SO_TIMESTAMPING gives us both send and receive times,
+    from software and from nic clock, when nic supports it and has it
+    enabled. Older kernels have only SO_TIMESTAMPNS, with receive time.
+    When none works, times are read in user space, as before.
+
+    returns
+            1       send timestamps are enabled
+            0       they are not, time request left has to be read in
+                    user space
+   ========================================================================== */
+
+
+static int stamps_enable
+(
+    int  fd     /* socket to enable timestamps on */
+)
+{
+    int  flags;  /* timestamping flags */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+#if HAVE_LINUX_NET_TSTAMP_H
+    /* send timestamps are delivered on socket error queue,
+     * without copy of the packet (OPT_TSONLY), we know what
+     * we've sent
+     */
+
+    flags = SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_RAW_HARDWARE |
+        SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_RX_HARDWARE |
+        SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_TX_HARDWARE |
+        SOF_TIMESTAMPING_OPT_TSONLY;
+
+    metrics_syscalls(1);
+    if (backend_setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING,
+                &flags, sizeof(flags)) == 0)
+        return 1;
+#endif
+
+#ifdef SO_TIMESTAMPNS
+    flags = 1;
+    metrics_syscalls(1);
+    backend_setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &flags,
+            sizeof(flags));
+#else
+    (void)fd;
+    (void)flags;
+#endif
+    return 0;
+}
+
+
+/* ==========================================================================
+    Reads kernel timestamps from control messages of msg. Software
+    timestamp is taken from realtime clock, same one sysclock_now()
+    reads, hardware one is taken from nic clock, which may run on
+    its own, so it's only good to measure intervals.
+
+    returns
+            software timestamp, or 0 when there is none, hardware timestamp
+            is stored in hw, 0 when there is none
+   ========================================================================== */
+
+
+static int64_t cmsg_stamp
+(
+    struct msghdr   *msg,  /* received message */
+    int64_t         *hw    /* hardware timestamp will be stored here */
+)
+{
+    struct cmsghdr  *c;    /* single control message */
+    struct timespec  ts[3];  /* timestamps from kernel */
+    int64_t          sw;   /* software timestamp */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    sw = 0;
+    *hw = 0;
+
+    for (c = CMSG_FIRSTHDR(msg); c; c = CMSG_NXTHDR(msg, c))
+    {
+        if (c->cmsg_level != SOL_SOCKET)
+            continue;
+
+#ifdef SCM_TIMESTAMPING
+        if (c->cmsg_type == SCM_TIMESTAMPING)
+        {
+            /* ts[0] is software timestamp, ts[1] is deprecated
+             * and ts[2] is raw hardware timestamp
+             */
+
+            memcpy(ts, CMSG_DATA(c), sizeof(ts));
+            sw = (int64_t)ts[0].tv_sec * NSEC_PER_SEC + ts[0].tv_nsec;
+            *hw = (int64_t)ts[2].tv_sec * NSEC_PER_SEC + ts[2].tv_nsec;
+        }
+#endif
+
+#ifdef SCM_TIMESTAMPNS
+        if (c->cmsg_type == SCM_TIMESTAMPNS)
+        {
+            memcpy(ts, CMSG_DATA(c), sizeof(ts[0]));
+            sw = (int64_t)ts[0].tv_sec * NSEC_PER_SEC + ts[0].tv_nsec;
+        }
+#endif
+    }
+
+    return sw;
+}
+
+
+/* ==========================================================================
+    Reads send timestamps of probe's requests from socket error queue,
+    all that are waiting with single syscall, where recvmmsg() is
+    available. Timestamp belongs to the latest request we've put earlier
+    time into, timestamp that came later than rto after it, is ignored.
+
+    returns
+            number of timestamps read from error queue, 0 means POLLERR
+            was reported for other reason, like icmp error
+   ========================================================================== */
+
+
+static int recv_tx_stamp
+(
+    int              fd,      /* socket to read error queue of */
+    struct probe    *probe    /* request timestamp is for */
+)
+{
+    int              n;       /* number of read messages */
+    int              total;   /* number of all read messages */
+    int              batch;   /* messages read with single syscall */
+    int              i;       /* just an iterator */
+    int              j;       /* just another iterator */
+    int              slot;    /* slot of request timestamp is for */
+    int64_t          sw;      /* software timestamp */
+    int64_t          hw;      /* hardware timestamp */
+    struct msghdr   *msg[NTP_MAX_BURST];  /* messages from error queue */
+    char             control[NTP_MAX_BURST][256];  /* control messages */
+#if HAVE_RECVMMSG
+    struct mmsghdr   mmsg[NTP_MAX_BURST];  /* messages for recvmmsg() */
+#else
+    struct msghdr    single;  /* the only message we receive */
+#endif
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+#if HAVE_RECVMMSG
+    batch = NTP_MAX_BURST;
+    for (i = 0; i != batch; ++i)
+        msg[i] = &mmsg[i].msg_hdr;
+#else
+    batch = 1;
+    msg[0] = &single;
+#endif
+
+    for (total = 0;; total += n)
+    {
+        for (i = 0; i != batch; ++i)
+        {
+            memset(msg[i], 0x00, sizeof(*msg[i]));
+            msg[i]->msg_control = control[i];
+            msg[i]->msg_controllen = sizeof(control[i]);
+        }
+
+        metrics_syscalls(1);
+#if HAVE_RECVMMSG
+        n = backend_recvmmsg(fd, mmsg, batch, MSG_ERRQUEUE | MSG_DONTWAIT,
+                NULL);
+#else
+        n = backend_recvmsg(fd, &single, MSG_ERRQUEUE | MSG_DONTWAIT) < 0 ?
+            -1 : 1;
+#endif
+
+        if (n <= 0)
+            return total;
+
+        for (j = 0; j != n; ++j)
+        {
+            sw = cmsg_stamp(msg[j], &hw);
+            slot = -1;
+
+            for (i = 0; i != NTP_MAX_BURST; ++i)
+                if (probe->org[i] && probe->org[i] <= sw &&
+                        (slot == -1 || probe->org[i] > probe->org[slot]))
+                    slot = i;
+
+            if (slot == -1 || sw - probe->org[slot] > probe->rto)
+                continue;
+
+            probe->t1[slot] = sw;
+            probe->t1_hw[slot] = hw;
+        }
+
+        /* batch was not filled, so queue is empty, no need to
+         * ask kernel again just to hear that
+         */
+
+        if (n < batch)
+            return total + n;
+    }
+}
+
+
+/* ==========================================================================
+    Receives up to n replies waiting on socket, into packets, with single
+    syscall where recvmmsg() is available, as replies to burst tend to
+    arrive together. Time each reply arrived is stored in dst, taken from
+    kernel timestamp when possible, and read in user space otherwise.
+    Hardware timestamp is stored in dst_hw, 0 when there is none. Length
+    of reply that did not fit into packet is set to 0.
+
+    returns
+            number of received replies, 0 when there was none waiting,
+            or -1 on error
+   ========================================================================== */
+
+
+static int recv_replies
+(
+    int              fd,      /* socket to receive replies from */
+    unsigned char  (*packets)[NTP_PACKET_LEN],  /* replies stored here */
+    int             *lens,    /* lengths of received replies */
+    int64_t         *dst,     /* times replies arrived */
+    int64_t         *dst_hw,  /* same, from nic clock, or 0 */
+    int              n        /* max number of replies to receive */
+)
+{
+    int              ret;     /* return value from functions */
+    int              i;       /* just an iterator */
+    int64_t          now;     /* user space time of reception */
+    struct iovec     iov[NTP_MAX_BURST];  /* where to store replies */
+    struct msghdr   *msg[NTP_MAX_BURST];  /* received messages */
+    char             control[NTP_MAX_BURST][256];  /* control messages */
+#if HAVE_RECVMMSG
+    struct mmsghdr   mmsg[NTP_MAX_BURST];  /* messages for recvmmsg() */
+#else
+    struct msghdr    single;  /* the only message we receive */
+#endif
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+#if HAVE_RECVMMSG
+    memset(mmsg, 0x00, sizeof(mmsg));
+    for (i = 0; i != n; ++i)
+        msg[i] = &mmsg[i].msg_hdr;
+#else
+    memset(&single, 0x00, sizeof(single));
+    msg[0] = &single;
+    n = 1;
+#endif
+
+    for (i = 0; i != n; ++i)
+    {
+        iov[i].iov_base = packets[i];
+        iov[i].iov_len = NTP_PACKET_LEN;
+        msg[i]->msg_iov = &iov[i];
+        msg[i]->msg_iovlen = 1;
+        msg[i]->msg_control = control[i];
+        msg[i]->msg_controllen = sizeof(control[i]);
+    }
+
+    metrics_syscalls(1);
+
+#if HAVE_RECVMMSG
+    ret = backend_recvmmsg(fd, mmsg, n, MSG_DONTWAIT, NULL);
+    for (i = 0; i < ret; ++i)
+        lens[i] = (int)mmsg[i].msg_len;
+#else
+    lens[0] = (int)backend_recvmsg(fd, &single, MSG_DONTWAIT);
+    ret = lens[0] < 0 ? -1 : 1;
+#endif
+
+    now = sysclock_now();
+
+    if (ret < 0)
+        return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+
+    for (i = 0; i != ret; ++i)
+    {
+        if (msg[i]->msg_flags & MSG_TRUNC)
+            lens[i] = 0;
+
+        if ((dst[i] = cmsg_stamp(msg[i], &dst_hw[i])) == 0)
+        {
+            /* no kernel timestamp, user space time has to do
+             */
+
+            dst[i] = now;
+        }
+    }
+
+    return ret;
+}
+
+
+/* ==========================================================================
+    Finds request that reply is for, by origin timestamp server copied
+    from our request. Slot is cleared, so duplicated reply is not taken
+    twice.
+
+    returns
+            slot of request reply is for, or -1 when reply is not for any
+            request we still wait reply for
+   ========================================================================== */
+
+
+static int match_reply
+(
+    struct probe         *probe,   /* requests we've sent */
+    const unsigned char  *packet,  /* received reply */
+    int64_t              *sent     /* timestamp we've sent in request */
+)
+{
+    int                   i;       /* just an iterator */
+    unsigned char         org[8];  /* org timestamp as we've sent it */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    for (i = 0; i != NTP_MAX_BURST; ++i)
+    {
+        if (probe->org[i] == 0)
+            continue;
+
+        ntp_ns_to_ts(probe->org[i], org);
+        if (memcmp(org, packet + NTP_ORG_TS_OFFSET, sizeof(org)) == 0)
+        {
+            *sent = probe->org[i];
+            probe->org[i] = 0;
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+
+/* ==========================================================================
+    Checks if replies to burst agree with the one with the lowest delay.
+    Reply agrees when its delay is not much worse than the lowest one,
+    so it was not queued for long, and offsets of both are within half
+    of their delays from each other.
+
+    returns
+            1       there are NTP_BURST_AGREE agreeing replies (or as many
+                    as there are requests in burst), no need to wait for
+                    the rest
+            0       keep waiting
+   ========================================================================== */
+
+
+static int burst_agree
+(
+    const struct probe     *probe,  /* probe to check replies of */
+    const struct ntp_opts  *opts    /* query options */
+)
+{
+    int                     i;      /* just an iterator */
+    int                     n;      /* number of stored replies */
+    int                     need;   /* agreeing replies we need */
+    int                     agree;  /* replies that agree with best */
+    int64_t                 diff;   /* difference of offsets */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (probe->nreplies >= opts->burst)
+        return 1;
+
+    need = opts->burst < NTP_BURST_AGREE ? opts->burst : NTP_BURST_AGREE;
+    n = probe->nreplies < NTP_MAX_BURST ? probe->nreplies : NTP_MAX_BURST;
+    agree = 0;
+
+    for (i = 0; i != n; ++i)
+    {
+        diff = probe->offset[i] - probe->best.offset;
+        diff = diff < 0 ? -diff : diff;
+
+        if (probe->delay[i] <= 2 * probe->best.delay + NTP_BURST_JITTER &&
+                diff <= (probe->delay[i] + probe->best.delay) / 2 +
+                NTP_BURST_JITTER)
+            agree++;
+    }
+
+    return agree >= need;
+}
+
+
+/* ==========================================================================
+    Obeys kiss-o'-death server sent us. RATE means we ask too often,
+    server is left alone for a while, longer each time it says so, and
+    random part is added, so devices it limited at once don't come back
+    at once. DENY and RSTR mean it will never talk to us, so it's not
+    asked again. Other codes are not about us, they are ignored.
+   ========================================================================== */
+
+
+static void kiss_off
+(
+    struct probe         *probe,   /* probe that got kiss-o'-death */
+    const unsigned char  *packet   /* kiss-o'-death reply */
+)
+{
+    const unsigned char  *code;    /* kiss code */
+    struct rtt           *rtt;     /* server state */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    code = packet + NTP_REFID_OFFSET;
+    rtt = probe->rtt;
+
+    if (memcmp(code, "DENY", 4) == 0 || memcmp(code, "RSTR", 4) == 0)
+    {
+        log_print("w/ntp server denies us access, not asking it again\n");
+        rtt->holdoff = INT64_MAX;
+        return;
+    }
+
+    if (memcmp(code, "RATE", 4) != 0)
+        return;
+
+    rtt->kodgap = rtt->kodgap ? rtt->kodgap * 2 : NTP_KOD_MIN;
+    rtt->kodgap = rtt->kodgap > NTP_KOD_MAX ? NTP_KOD_MAX : rtt->kodgap;
+    rtt->holdoff = sysclock_boottime() + rtt->kodgap +
+        (int64_t)(rand_u32() % (uint32_t)(rtt->kodgap / 1000000 + 1)) *
+        1000000;
+
+    log_print("w/ntp server asks us to slow down, not asking it for "
+            "%.0fs\n", (double)(rtt->holdoff - sysclock_boottime()) /
+            NSEC_PER_SEC);
+}
+
+
+/* ==========================================================================
+    Processes single reply to probe's request. Of all valid replies to
+    the burst, the one with the lowest delay is kept (minimum delay clock
+    filter from RFC 5905), since it spent the least time in queues, which
+    are the main source of asymmetry, so its offset is the most accurate.
+    When both request and reply have hardware timestamps, interval
+    measured by nic clock is added to t1, as it's not affected by
+    interrupt latency at all.
+
+    Probe is marked done when burst replies agree, or server answered,
+    but is not fit for synchronization.
+   ========================================================================== */
+
+
+static void burst_reply
+(
+    struct probe           *probe,   /* probe reply is for */
+    const unsigned char    *packet,  /* received reply */
+    int                     len,     /* length of reply */
+    int64_t                 dst,     /* time reply arrived */
+    int64_t                 dst_hw,  /* same, from nic clock, or 0 */
+    const struct ntp_opts  *opts     /* query options */
+)
+{
+    int                     ret;     /* return value from functions */
+    int                     slot;    /* slot of request reply is for */
+    int64_t                 sent;    /* timestamp we've sent in request */
+    struct ntp_sample       s;       /* parsed reply */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    slot = len == NTP_PACKET_LEN ? match_reply(probe, packet, &sent) : -1;
+    ret = -1;
+
+    if (slot != -1)
+    {
+        s.org = probe->t1[slot];
+        s.dst = dst;
+
+        if (dst_hw && probe->t1_hw[slot] && dst_hw > probe->t1_hw[slot])
+            s.dst = s.org + (dst_hw - probe->t1_hw[slot]);
+
+        ret = parse_reply(packet, sent, &s);
+    }
+
+    if (ret == -1)
+    {
+        /* this may be late reply to request that we've already
+         * retransmitted, or a duplicate, keep waiting for
+         * reply to the others
+         */
+
+        log_print("w/invalid response from ntp server\n");
+        return;
+    }
+
+    if (ret != 0)
+    {
+        /* server answered, but we cannot use its time, rest
+         * of the burst won't be any better
+         */
+
+        if (packet[1] == 0)
+            kiss_off(probe, packet);
+
+        probe->done = 1;
+        return;
+    }
+
+    metrics_reply(&probe->ra, s.delay, s.offset);
+
+    if (probe->nreplies < NTP_MAX_BURST)
+    {
+        probe->offset[probe->nreplies] = s.offset;
+        probe->delay[probe->nreplies] = s.delay;
+    }
+
+    if (probe->nreplies == 0 || s.delay < probe->best.delay)
+        probe->best = s;
+
+    probe->nreplies++;
+    probe->done = burst_agree(probe, opts);
+}
+
+
+/* ==========================================================================
+    Processes activity on connection of non-ntp probe. Source sends time
+    once, so probe is done as soon as it did, or failed.
+   ========================================================================== */
+
+
+static void source_input
+(
+    struct pollfd      *pfd,    /* connection of probe */
+    struct probe       *probe   /* probe activity is for */
+)
+{
+    int                 ret;    /* return value from functions */
+    struct ntp_sample   s;      /* time read from source */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if ((ret = timesrc_input(&probe->tc, &s)) == 1)
+    {
+        pfd->events = timesrc_events(&probe->tc);
+        return;
+    }
+
+    probe->done = 1;
+    if (ret != 0)
+    {
+        log_print("w/no time from %s source\n",
+                probe->proto == TIMESRC_NMEA ? "nmea" :
+                probe->proto == TIMESRC_HTTP ? "http" : "time");
+        return;
+    }
+
+    if (probe->ra.addrlen)
+        metrics_reply(&probe->ra, s.delay, s.offset);
+
+    probe->best = s;
+    probe->nreplies = 1;
+}
+
+
+/* ==========================================================================
+    Closes connection of probe, and stores its best reply in sample, if
+    server sent any valid one. Socket of ntp probe stays open for next
+    query, it belongs to server's rtt entry.
+
+    returns
+            1       sample has been stored
+            0       there was no valid reply
+   ========================================================================== */
+
+
+static int finish_probe
+(
+    struct pollfd          *pfd,     /* socket of probe */
+    struct probe           *probe,   /* probe to finish */
+    struct ntp_sample      *sample,  /* best reply will be stored here */
+    const struct ntp_opts  *opts     /* query options */
+)
+{
+    if (probe->proto != TIMESRC_NTP)
+    {
+        uring_forget(pfd->fd);
+        backend_close(pfd->fd);
+    }
+
+    pfd->fd = -1;
+
+    /* server that did not answer within its rto is scored as
+     * miss, but not one we stopped waiting for earlier, because
+     * we got enough replies from others
+     */
+
+    if (probe->proto == TIMESRC_NTP && probe->sibling == 0)
+    {
+        if (probe->nreplies)
+            score_probe(&probe->ra, &probe->best);
+        else if (probe->retries || probe->deadline <= sysclock_boottime())
+            score_probe(&probe->ra, NULL);
+    }
+
+    if (probe->nreplies == 0)
+        return 0;
+
+    if (probe->proto == TIMESRC_NTP)
+        rtt_update(probe->rtt, probe->best.delay, opts);
+
+    *sample = probe->best;
+    sample->proto = probe->proto;
+    memcpy(&sample->addr, &probe->ra.addr, probe->ra.addrlen);
+    sample->addrlen = probe->ra.addrlen;
+    sample->server = probe->server;
+    strcpy(sample->ifname, probe->ifname);
+    return 1;
+}
+
+
+/* ==========================================================================
+    Checks if interface name is on comma separated list of names.
+
+    returns
+            1       name is on the list
+            0       it's not
+   ========================================================================== */
+
+
+static int iface_listed
+(
+    const char  *list,  /* comma separated names */
+    const char  *name   /* name to look for */
+)
+{
+    size_t       len;   /* length of name */
+    const char  *w;     /* current name on list */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    len = strlen(name);
+    for (w = list; w; w = (w = strchr(w, ',')) ? w + 1 : NULL)
+        if (strncmp(w, name, len) == 0 && (w[len] == ',' || w[len] == '\0'))
+            return 1;
+
+    return 0;
+}
+
+
+/* ==========================================================================
+    Lists interfaces requests should be raced over. With want NULL,
+    routing table decides, and single "" name is returned. Otherwise,
+    interfaces that are up, have carrier and ip address are taken, all
+    of them but loopback when want is "", or only these on comma
+    separated want list. Interfaces are checked on every query, as they
+    come up one by one during boot. When none is up, routing table is
+    used, as before.
+
+    returns
+            number of names stored in ifs
+   ========================================================================== */
+
+
+static int list_ifaces
+(
+    const char       *want,  /* interfaces to race over */
+    char            (*ifs)[IF_NAMESIZE]  /* interface names stored here */
+)
+{
+    int               n;     /* number of names in ifs */
+    int               i;     /* just an iterator */
+    struct ifaddrs   *ifa;   /* addresses of all interfaces */
+    struct ifaddrs   *a;     /* current address */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    n = 0;
+    if (want && getifaddrs(&ifa) == 0)
+    {
+        for (a = ifa; a && n != NTP_MAX_IFACES; a = a->ifa_next)
+        {
+            if (a->ifa_addr == NULL || (a->ifa_addr->sa_family != AF_INET &&
+                        a->ifa_addr->sa_family != AF_INET6) ||
+                    (a->ifa_flags & (IFF_UP | IFF_RUNNING)) !=
+                    (IFF_UP | IFF_RUNNING) ||
+                    strlen(a->ifa_name) >= IF_NAMESIZE)
+                continue;
+
+            if (want[0] ? !iface_listed(want, a->ifa_name) :
+                    (a->ifa_flags & IFF_LOOPBACK) != 0)
+                continue;
+
+            /* interface is listed once for each of its addresses
+             */
+
+            for (i = 0; i != n && strcmp(ifs[i], a->ifa_name); ++i)
+                ;
+
+            if (i == n)
+                strcpy(ifs[n++], a->ifa_name);
+        }
+
+        freeifaddrs(ifa);
+        if (n == 0)
+            log_print("w/no interface to race requests over is up, "
+                    "using default route\n");
+    }
+
+    if (n == 0)
+        ifs[n++][0] = '\0';
+
+    return n;
+}
+
+
+/* ==========================================================================
+    Binds socket to network interface, so packets are sent through it,
+    and only packets that came through it are received. Needs
+    CAP_NET_RAW on kernels older than 5.7.
+
+    returns
+            0       socket bound
+           -1       on error
+   ========================================================================== */
+
+
+static int bind_iface
+(
+    int          fd,      /* socket to bind */
+    const char  *ifname   /* interface to bind socket to */
+)
+{
+#ifdef SO_BINDTODEVICE
+    metrics_syscalls(1);
+    if (backend_setsockopt(fd, SOL_SOCKET, SO_BINDTODEVICE, ifname,
+                strlen(ifname) + 1) == 0)
+        return 0;
+#else
+    (void)fd;
+    errno = ENOSYS;
+#endif
+
+    log_print("w/cannot bind socket to %s: %s\n", ifname, strerror(errno));
+    return -1;
+}
+
+
+/* ==========================================================================
+    Drops probes of the same server as winner over other interfaces, as
+    winner's path answered first. Server gives single sample, so it
+    does not vote more than once in clock selection.
+   ========================================================================== */
+
+
+static void drop_siblings
+(
+    struct probe        *probes,  /* all probes */
+    int                  first,   /* index of first probe */
+    int                  nfds,    /* number of elements in probes */
+    const struct probe  *winner   /* probe that gave sample */
+)
+{
+    int                  i;       /* just an iterator */
+    struct probe        *p;       /* current probe */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    for (i = first; i != nfds; ++i)
+    {
+        p = &probes[i];
+        if (p == winner || p->proto != winner->proto ||
+                p->ra.addrlen != winner->ra.addrlen ||
+                memcmp(&p->ra.addr, &winner->ra.addr, p->ra.addrlen) != 0)
+            continue;
+
+        p->done = 1;
+        p->nreplies = 0;
+        p->sibling = 1;
+    }
+}
+
+
+/* ==========================================================================
+    Sends ntp request over already connected socket fd. Local time at
+    which request was sent is stored in next slot of probe, server will
+    send it back to us in the reply. Until kernel tells us when request
+    really left, the same time is used as t1. With io_uring, request is
+    only queued, and all requests of the round go out with single
+    submit, t1 is then corrected from send timestamp. Socket without send
+    timestamps submits right away, so t1 is as close as with send().
+
+    returns
+            0       request sent
+           -1       on error
+   ========================================================================== */
+
+
+static int send_packet
+(
+    int            fd,    /* socket to send request over */
+    struct probe  *probe  /* time request was sent is stored here */
+)
+{
+    int            slot;  /* slot to keep timestamps in */
+    unsigned char  packet[NTP_PACKET_LEN];  /* request to send */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    memset(packet, 0x00, sizeof(packet));
+    slot = probe->nsent++ % NTP_MAX_BURST;
+
+    /* set: li (leap indicator) - 3 (clock is unsynchronized)
+     *      ntp version - 4
+     *      mode - 3 (client)
+     */
+
+    packet[0] = 0xe3;
+
+    /* our time goes into transmit timestamp, server will
+     * copy it into origin timestamp of the reply, take time
+     * as late as possible, so it's accurate
+     */
+
+    probe->org[slot] = sysclock_now();
+    probe->t1[slot] = probe->org[slot];
+    probe->t1_hw[slot] = 0;
+    ntp_ns_to_ts(probe->org[slot], packet + NTP_XMT_TS_OFFSET);
+
+    if (uring_send(fd, packet, sizeof(packet)) != 0)
+        return -1;
+
+    if (probe->rtt->txstamp == 0)
+        uring_flush();
+
+    return 0;
+}
+
+
+/* ==========================================================================
+    Sends first ntp request to address in probe, over socket of that
+    server, which is created on first use and then kept open, so
+    attempts repeated while we are offline, or polls of resident client,
+    don't pay for socket setup again. Socket of probe with interface set
+    is bound to it, so request goes out that way, whatever default route
+    says. Socket is connected to the server,
+    so only packets from that server will be received on it. Rest of the
+    burst is sent over the same socket by retransmit(), opts->burst_gap
+    apart.
+
+    returns
+            >=0     file descriptor of socket that request was sent over
+           -1       on errors, like address family not supported or
+                    network for that family unreachable, or when server
+                    sent us kiss-o'-death
+   ========================================================================== */
+
+
+static int send_request
+(
+    struct probe           *probe,  /* request to send */
+    const struct ntp_opts  *opts    /* query options */
+)
+{
+    int                     fd;     /* socket to send request over */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    /* server told us to go away (kiss-o'-death), for now or
+     * for good
+     */
+
+    probe->rtt = rtt_lookup(&probe->ra, probe->ifname, opts);
+    if (probe->rtt->holdoff > sysclock_boottime())
+        return -1;
+
+    if ((fd = probe->rtt->fd) < 0)
+    {
+        metrics_syscalls(1);
+        fd = backend_socket(probe->ra.addr.ss_family,
+                SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+            return -1;
+
+        if (probe->ifname[0] && bind_iface(fd, probe->ifname) != 0)
+        {
+            backend_close(fd);
+            return -1;
+        }
+
+        probe->rtt->txstamp = stamps_enable(fd);
+        probe->rtt->fd = fd;
+    }
+
+    memset(probe->org, 0x00, sizeof(probe->org));
+    probe->nsent = 0;
+    probe->nreplies = 0;
+    probe->done = 0;
+    probe->sibling = 0;
+    probe->retries = 0;
+
+    /* connect() on udp socket does not send anything, it only
+     * sets default destination and filters out packets that
+     * did not come from that address. It will also fail right
+     * away when there is no route to the host (like ipv6 address
+     * on ipv4 only network), so we don't wait for nothing. It's
+     * done on every query, as route and our address may have
+     * changed since socket was created.
+     */
+
+    metrics_syscalls(1);
+    if (backend_connect(fd, (const struct sockaddr *)&probe->ra.addr,
+                probe->ra.addrlen) != 0)
+        return -1;
+
+    if (send_packet(fd, probe) != 0)
+        return -1;
+
+    metrics_sent(&probe->ra);
+
+    probe->rto = probe->rtt->rto;
+    probe->deadline = sysclock_boottime() + (opts->burst > 1 ?
+            opts->burst_gap * 1000000ll : probe->rto);
+    return fd;
+}
+
+
+/* ==========================================================================
+    Starts talking to time source other than ntp, over tcp to address in
+    probe, or to gps on tty. There is nothing to retransmit, tcp does it
+    for us, so probe waits until source sends time, or query times out.
+
+    returns
+            >=0     file descriptor to poll for events of the source
+           -1       on errors
+   ========================================================================== */
+
+
+static int send_source
+(
+    struct probe          *probe,  /* probe to start */
+    const struct timesrc  *src     /* source to talk to */
+)
+{
+    int                    fd;     /* socket or tty of source */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if ((fd = timesrc_open(&probe->tc, src, &probe->ra)) < 0)
+        return -1;
+
+    probe->proto = src->proto;
+    probe->nsent = 1;
+    probe->nreplies = 0;
+    probe->done = 0;
+    probe->sibling = 0;
+    probe->retries = 0;
+    probe->deadline = INT64_MAX;
+
+    if (probe->ra.addrlen)
+        metrics_sent(&probe->ra);
+
+    return fd;
+}
+
+
+/* ==========================================================================
+    Sends request to every address of server rv[server], that we did not
+    send request to yet in this round. New sockets are added to pfd and
+    probes arrays, starting at index nfds. First nrv elements of these
+    arrays are reserved for dns queries.
+
+    Each server gets its share of NTP_MAX_ADDRS, so pool with many
+    addresses does not starve other servers. Address is never asked
+    twice, even if it belongs to two servers, so single machine cannot
+    vote twice in clock selection. With more than one interface in ifs,
+    ntp address is asked over each of them at the same time, and the
+    first one to answer wins, see drop_siblings(). Servers that are not
+    ntp are asked with their own protocol, over default route, see
+    send_source().
+
+    returns
+            new number of elements in pfd and probes
+   ========================================================================== */
+
+
+static int send_all
+(
+    struct resolv          *rv,      /* resolvers with addresses */
+    int                     nrv,     /* number of elements in rv */
+    int                     server,  /* index of server to send to */
+    struct pollfd          *pfd,     /* sockets requests has been sent over */
+    struct probe           *probes,  /* requests that has been sent */
+    int                     nfds,    /* number of elements in pfd */
+    char                  (*ifs)[IF_NAMESIZE],  /* interfaces to send over */
+    int                     nifs,    /* number of elements in ifs */
+    const struct ntp_opts  *opts     /* query options */
+)
+{
+    int                     i;       /* just an iterator */
+    int                     j;       /* just another iterator */
+    int                     k;       /* index of address and interface */
+    int                     nif;     /* interfaces server is asked over */
+    int                     nsent;   /* requests sent to that server */
+    int                     proto;   /* protocol server talks */
+    const char             *ifname;  /* interface to send over */
+    struct resolv          *r;       /* server we send requests to */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    r = &rv[server];
+    proto = opts->src ? opts->src[server].proto : TIMESRC_NTP;
+    nsent = 0;
+    for (j = nrv; j != nfds; ++j)
+        if (probes[j].server == server)
+            nsent++;
+
+    if (proto == TIMESRC_NMEA)
+    {
+        /* gps has no addresses, there is single tty to read
+         */
+
+        if (nsent || nfds == NTP_MAX_ADDRS + nrv)
+            return nfds;
+
+        memset(&probes[nfds].ra, 0x00, sizeof(probes[nfds].ra));
+        probes[nfds].ifname[0] = '\0';
+        probes[nfds].server = server;
+        if ((pfd[nfds].fd = send_source(&probes[nfds],
+                        &opts->src[server])) < 0)
+            return nfds;
+
+        pfd[nfds].events = timesrc_events(&probes[nfds].tc);
+        return nfds + 1;
+    }
+
+    /* best servers from previous queries go first, when there
+     * are more addresses than we can ask, flaky ones are left out
+     */
+
+    if (proto == TIMESRC_NTP)
+        score_sort(r->addrs, r->naddrs);
+
+    nif = proto == TIMESRC_NTP ? nifs : 1;
+    for (k = 0; k != r->naddrs * nif && nfds < NTP_MAX_ADDRS + nrv &&
+            nsent < NTP_MAX_ADDRS / nrv; ++k)
+    {
+        i = k / nif;
+        ifname = proto == TIMESRC_NTP ? ifs[k % nif] : "";
+
+        /* dns may return addresses we already sent request to,
+         * from cache, or other server may resolve to the same
+         * address, don't send it twice
+         */
+
+        for (j = nrv; j != nfds; ++j)
+            if (probes[j].proto == proto &&
+                    probes[j].ra.addrlen == r->addrs[i].addrlen &&
+                    memcmp(&probes[j].ra.addr, &r->addrs[i].addr,
+                        r->addrs[i].addrlen) == 0 &&
+                    strcmp(probes[j].ifname, ifname) == 0)
+                break;
+
+        if (j != nfds)
+            continue;
+
+        probes[nfds].ra = r->addrs[i];
+        strcpy(probes[nfds].ifname, ifname);
+        probes[nfds].server = server;
+        probes[nfds].proto = proto;
+        pfd[nfds].fd = proto == TIMESRC_NTP ?
+            send_request(&probes[nfds], opts) :
+            send_source(&probes[nfds], &opts->src[server]);
+
+        if (pfd[nfds].fd < 0)
+        {
+            /* that address is not correct, moving to next
+             */
+
+            continue;
+        }
+
+        pfd[nfds].events = proto == TIMESRC_NTP ?
+            POLLIN : timesrc_events(&probes[nfds].tc);
+        nsent++;
+        nfds++;
+    }
+
+    return nfds;
+}
+
+
+/* ==========================================================================
+    Checks if we have enough samples to stop waiting for more. We need
+    at least opts->nsamples of them, and when quorum is set, at least
+    quorum servers that agree on time, and are majority of all that
+    answered. When opts->accuracy is set, only samples with error lower
+    than that count towards nsamples, less accurate sources (like http)
+    can still confirm time in quorum, as their wide error intervals
+    intersect with accurate ones.
+
+    returns
+            1       we have enough samples
+            0       keep waiting for more
+   ========================================================================== */
+
+
+static int enough
+(
+    const struct ntp_sample  *samples,  /* valid replies received so far */
+    int                       nvalid,   /* number of samples */
+    const struct ntp_opts    *opts      /* query options */
+)
+{
+    int                       i;        /* just an iterator */
+    int                       naccurate;  /* samples that are accurate */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    naccurate = nvalid;
+    if (opts->accuracy)
+        for (i = naccurate = 0; i != nvalid; ++i)
+            naccurate += samples[i].delay / 2 + samples[i].rootdist <=
+                opts->accuracy * 1000000ll;
+
+    if (naccurate < opts->nsamples)
+        return 0;
+
+    if (opts->quorum == 0)
+        return 1;
+
+    return clksel_intersect(samples, nvalid, NULL) >= opts->quorum;
+}
+
+
+/* ==========================================================================
+    Sends next requests of bursts, and retransmits requests for which we
+    did not get any reply within their retransmission timeout. Timeout is
+    doubled on each retransmission (for the server too, until it
+    answers), so we don't flood server that is overloaded. Probe that got
+    replies is marked done, once its whole burst was sent, and the last
+    request had its rto to get answered.
+
+    returns
+            boot time of the nearest deadline, or INT64_MAX when nothing
+            more will be sent
+   ========================================================================== */
+
+
+static int64_t retransmit
+(
+    struct pollfd          *pfd,      /* sockets requests were sent over */
+    struct probe           *probes,   /* sent requests */
+    int                     first,    /* index of first request in pfd */
+    int                     nfds,     /* number of elements in pfd */
+    const struct ntp_opts  *opts      /* query options */
+)
+{
+    int                     i;        /* just an iterator */
+    int64_t                 now;      /* current boot time */
+    int64_t                 next;     /* nearest deadline */
+    int64_t                 max;      /* maximum allowed rto */
+    struct probe           *p;        /* currently processed probe */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    now = sysclock_boottime();
+    next = INT64_MAX;
+    max = opts->rto_max * 1000000ll;
+
+    for (i = first; i < nfds; ++i)
+    {
+        p = &probes[i];
+        if (pfd[i].fd < 0 || p->done || p->deadline > now)
+        {
+            if (pfd[i].fd >= 0 && !p->done && p->deadline < next)
+                next = p->deadline;
+
+            continue;
+        }
+
+        if (p->nsent < opts->burst)
+        {
+            /* next request of the burst, after the last one
+             * we wait full rto for replies
+             */
+
+            p->deadline = now + (p->nsent + 1 < opts->burst ?
+                    opts->burst_gap * 1000000ll : p->rto);
+        }
+        else if (p->nreplies > 0)
+        {
+            p->done = 1;
+            next = now;
+            continue;
+        }
+        else if (p->retries < opts->retries)
+        {
+            p->rto = p->rto * 2 > max ? max : p->rto * 2;
+            p->rtt->rto = p->rto;
+
+            /* up to quarter of rto is added at random, so clients
+             * that lost requests at the same time (server was
+             * overloaded) don't retransmit them at the same time
+             */
+
+            p->deadline = now + p->rto +
+                (int64_t)(rand_u32() % (uint32_t)(p->rto / 4000 + 1)) * 1000;
+            p->retries++;
+        }
+        else
+        {
+            /* out of retransmissions, late reply still may come
+             * until query times out
+             */
+
+            continue;
+        }
+
+        if (send_packet(pfd[i].fd, p) != 0)
+            error("w/send() ntp retransmission");
+        else
+            metrics_sent(&p->ra);
+
+        if (p->deadline < next)
+            next = p->deadline;
+    }
+
+    return next;
+}
+
+
+/* ==========================================================================
+                                        __     __ _
+                         ____   __  __ / /_   / /(_)_____
+                        / __ \ / / / // __ \ / // // ___/
+                       / /_/ // /_/ // /_/ // // // /__
+                      / .___/ \__,_//_.___//_//_/ \___/
+                     /_/
+               ____                     __   _
+              / __/__  __ ____   _____ / /_ (_)____   ____   _____
+             / /_ / / / // __ \ / ___// __// // __ \ / __ \ / ___/
+            / __// /_/ // / / // /__ / /_ / // /_/ // / / /(__  )
+           /_/   \__,_//_/ /_/ \___/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Reads current time offset from ntp servers. Ntp request is sent to
+    every address each of nrv servers in rv resolves to (both ipv4 and
+    ipv6) at the same time. Then we wait for replies until we have
+    enough of them, see enough(), so time it takes to get time depends
+    on the fastest servers, and not on the first one returned by
+    resolver, nor on stragglers. Request is retransmitted to servers that
+    did not answer within their retransmission timeout, estimated from
+    their previous round trips.
+
+    With opts->burst > 1, each address gets burst of requests over single
+    socket, and only its reply with the lowest delay becomes a sample.
+    Burst ends early, when enough of its replies agree, see burst_agree().
+
+    When opts->src is set, servers can be other time sources too (RFC 868
+    time, http, nmea gps), they are raced in the same loop with ntp ones,
+    and their samples carry their own error estimation.
+
+    When opts->ifaces is set, ntp servers are asked over every interface
+    that is up at the same time ("" for all, or comma separated list of
+    names), and not only over the one default route points to, which
+    may not pass traffic yet. Sample of each server comes from interface
+    that answered first, and carries its name.
+
+    Valid replies are stored in samples array, which must be able to
+    hold NTP_MAX_ADDRS elements. Function waits at most opts->timeout
+    milliseconds for replies. If not enough replies arrived within that
+    time, function returns whatever it managed to collect.
+
+    returns
+            >0      number of valid replies stored in samples
+           -1       on errors, like no response from any server, dns
+                    lookup failure.
+   ========================================================================== */
+
+
+int ntp_query
+(
+    struct resolv          *rv,        /* ntp servers to ask */
+    int                     nrv,       /* number of servers in rv */
+    struct ntp_sample      *samples,   /* valid replies will be stored here */
+    const struct ntp_opts  *opts       /* query options */
+)
+{
+    int                     ret;       /* return value from funcitons */
+    int                     nfds;      /* number of elements in pfd */
+    int                     nactive;   /* sockets still waiting for reply */
+    int                     ndns;      /* dns queries still pending */
+    int                     nvalid;    /* number of valid replies received */
+    int                     done;      /* we have enough replies */
+    int                     i;         /* just an iterator */
+    int                     j;         /* just another iterator */
+    int                     n;         /* number of elements before send */
+    int                     fd;        /* socket of dns query */
+    int                     nifs;      /* number of elements in ifs */
+    int64_t                 now;       /* current boot time */
+    int64_t                 deadline;  /* boot time to stop waiting at */
+    int64_t                 wakeup;    /* boot time to wake up at */
+    int64_t                 dnsstart[NTP_MAX_SERVERS];  /* dns sent at */
+    struct pollfd           pfd[NTP_MAX_SERVERS + NTP_MAX_ADDRS];  /* fds */
+    struct probe            probes[NTP_MAX_SERVERS + NTP_MAX_ADDRS];  /* sent */
+    unsigned char           packets[NTP_MAX_BURST][NTP_PACKET_LEN];  /* rx */
+    int                     lens[NTP_MAX_BURST];    /* lengths of packets */
+    int64_t                 dst[NTP_MAX_BURST];     /* times packets came */
+    int64_t                 dst_hw[NTP_MAX_BURST];  /* same, nic clock */
+    char                    ifs[NTP_MAX_IFACES][IF_NAMESIZE];  /* to race */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    nifs = list_ifaces(opts->ifaces, ifs);
+
+    /* first nrv elements of pfd are reserved for dns queries. If
+     * addresses we know have expired, dns is asked for new
+     * ones, but we don't wait for answer, requests are sent
+     * to addresses we already have (maybe from cache on disk)
+     * while dns is working, and to new addresses as soon as
+     * they arrive
+     */
+
+    nfds = nrv;
+    ndns = 0;
+
+    for (i = 0; i != nrv; ++i)
+    {
+        pfd[i].fd = opts->src && opts->src[i].proto == TIMESRC_NMEA ?
+            -1 : resolv_start(&rv[i]);
+        pfd[i].events = POLLIN;
+        dnsstart[i] = sysclock_boottime();
+        ndns += pfd[i].fd >= 0;
+    }
+
+    for (i = 0; i != nrv; ++i)
+        nfds = send_all(rv, nrv, i, pfd, probes, nfds, ifs, nifs, opts);
+
+    if (nfds == nrv && ndns == 0)
+    {
+        /* we've iterated through all addresses and still could not
+         * send request to any of them, and dns is not working
+         */
+
+        error("w/no available address found");
+        return -1;
+    }
+
+    /* requests sent, let's receive replies, it's possible that we
+     * don't get any reply - it's UDP after all, so packets can get
+     * lost. Each server has its own retransmission timeout based
+     * on how fast it answered before, and we wake up to retransmit
+     * request when it passes.
+     */
+
+    deadline = sysclock_boottime() + opts->timeout * 1000000ll;
+    nactive = nfds - nrv;
+    nvalid = 0;
+    done = 0;
+
+    while (!done && (nactive > 0 || ndns > 0))
+    {
+        /* probes that got all replies they will get, hand their
+         * best reply over as sample
+         */
+
+        for (i = nrv; i < nfds && !done; ++i)
+        {
+            if (pfd[i].fd < 0 || probes[i].done == 0)
+                continue;
+
+            if (finish_probe(&pfd[i], &probes[i], &samples[nvalid], opts))
+            {
+                drop_siblings(probes, nrv, nfds, &probes[i]);
+                nvalid++;
+            }
+
+            nactive--;
+            done = enough(samples, nvalid, opts);
+        }
+
+        if (done || (nactive == 0 && ndns == 0))
+            break;
+
+        wakeup = retransmit(pfd, probes, nrv, nfds, opts);
+        wakeup = wakeup < deadline ? wakeup : deadline;
+
+        if ((now = sysclock_boottime()) >= deadline)
+            break;
+
+        ret = uring_wait(pfd, nfds,
+                (int)((wakeup - now + 999999) / 1000000));
+
+        if (ret == -1)
+        {
+            if (errno == EINTR)
+                continue;
+
+            /* poll() failed in a bad way
+             */
+
+            error("w/poll()");
+            break;
+        }
+
+        if (ret == 0)
+        {
+            /* no activity, time to retransmit or give up
+             */
+
+            continue;
+        }
+
+        for (i = 0; i != nrv; ++i)
+        {
+            if (pfd[i].fd < 0 || pfd[i].revents == 0)
+                continue;
+
+            /* dns answered, send requests to any new addresses
+             * it gave us
+             */
+
+            fd = pfd[i].fd;
+            ret = resolv_input(&rv[i]);
+            if (ret != 1)
+            {
+                uring_forget(fd);
+                metrics_dns(sysclock_boottime() - dnsstart[i], ret == 0);
+                pfd[i].fd = -1;
+                ndns--;
+            }
+
+            if (ret == 0)
+            {
+                n = nfds;
+                nfds = send_all(rv, nrv, i, pfd, probes, nfds, ifs, nifs,
+                        opts);
+                nactive += nfds - n;
+            }
+        }
+
+        for (i = nrv; i < nfds && !done; ++i)
+        {
+            if (pfd[i].fd < 0 || pfd[i].revents == 0)
+                continue;
+
+            if (probes[i].proto != TIMESRC_NTP)
+            {
+                source_input(&pfd[i], &probes[i]);
+                continue;
+            }
+
+            /* with kernel timestamps, poll() reports error when
+             * send timestamp is waiting in error queue
+             */
+
+            if (pfd[i].revents & POLLERR &&
+                    recv_tx_stamp(pfd[i].fd, &probes[i]) > 0 &&
+                    (pfd[i].revents & POLLIN) == 0)
+                continue;
+
+            ret = recv_replies(pfd[i].fd, packets, lens, dst, dst_hw,
+                    opts->burst);
+
+            if (ret < 0)
+            {
+                /* got icmp error, like port unreachable, there
+                 * is no point waiting for this server anymore
+                 */
+
+                error("w/recv() ntp response");
+                probes[i].done = 1;
+                continue;
+            }
+
+            for (j = 0; j != ret && !probes[i].done; ++j)
+                burst_reply(&probes[i], packets[j], lens[j], dst[j],
+                        dst_hw[j], opts);
+        }
+    }
+
+    /* burst to some servers may not be finished, but their
+     * best replies so far are still good samples
+     */
+
+    for (i = nrv; i < nfds; ++i)
+    {
+        if (pfd[i].fd >= 0 &&
+                finish_probe(&pfd[i], &probes[i], &samples[nvalid], opts))
+        {
+            drop_siblings(probes, nrv, nfds, &probes[i]);
+            nvalid++;
+        }
+    }
+
+    /* dns did not answer in time, we will ask next nameserver
+     * next time
+     */
+
+    for (i = 0; i != nrv; ++i)
+    {
+        if (pfd[i].fd >= 0)
+        {
+            uring_forget(pfd[i].fd);
+            metrics_dns(sysclock_boottime() - dnsstart[i], 0);
+        }
+
+        resolv_cancel(&rv[i]);
+    }
+
+    /* requests queued after the last wait still have to go out,
+     * as they would with plain send()
+     */
+
+    uring_flush();
+
+    if (nvalid == 0)
+    {
+        log_print("w/no response from ntp server\n");
+        return -1;
+    }
+
+    return nvalid;
+}
+
+/* ==========================================================================
+    Converts address of server that sent sample into printable string,
+    works for both ipv4 and ipv6. buf should be at least NI_MAXHOST long
+    to fit any address.
+
+    returns
+            buf with address, or "?" string when address can't be
+            converted
+   ========================================================================== */
+
+
+const char *ntp_addr_str
+(
+    const struct ntp_sample  *sample,  /* sample to get address from */
+    char                     *buf,     /* buffer where to store address */
+    size_t                    buflen   /* length of buf */
+)
+{
+    if (getnameinfo((const struct sockaddr *)&sample->addr, sample->addrlen,
+                buf, buflen, NULL, 0, NI_NUMERICHOST) != 0)
+        return "?";
+
+    return buf;
+}
+
+
+/* ==========================================================================
+    Converts unix time in nanoseconds into ntp timestamp and stores it in
+    buf in network endian. This is reverse of ntp_to_ns().
+   ========================================================================== */
+
+
+void ntp_ns_to_ts
+(
+    int64_t         ns,    /* unix time to convert */
+    unsigned char  *buf    /* timestamp in ntp format will be stored here */
+)
+{
+    uint32_t        sec;   /* seconds part of timestamp */
+    uint32_t        frac;  /* fraction part of timestamp */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    /* overflow of 32bit is what we want here for era 1
+     */
+
+    sec = (uint32_t)(ns / NSEC_PER_SEC + NTP_UNIX_EPOCH_DIFF);
+    frac = (uint32_t)(((uint64_t)(ns % NSEC_PER_SEC) << 32) / NSEC_PER_SEC);
+
+    buf[0] = sec >> 24;
+    buf[1] = sec >> 16;
+    buf[2] = sec >> 8;
+    buf[3] = sec;
+    buf[4] = frac >> 24;
+    buf[5] = frac >> 16;
+    buf[6] = frac >> 8;
+    buf[7] = frac;
+}
@@ -0,0 +1,91 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ========================================================================== */
+
+#ifndef NTP_H
+#define NTP_H 1
+
+#include <net/if.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "resolv.h"
+
+struct timesrc;
+
+/* ntp sends time with epoch set to 01.01.1900, and unix time
+ * has epoch set to 01.01.1970, 70 years according to RFC 868
+ * (Time Protocol) is 2208988800 seconds.
+ */
+
+#define NTP_UNIX_EPOCH_DIFF (2208988800ll)
+
+/* maximum number of addresses that will be queried in parallel,
+ * for all servers together
+ */
+
+#define NTP_MAX_ADDRS (32)
+
+/* maximum number of servers (host names or ips) to ask
+ */
+
+#define NTP_MAX_SERVERS (8)
+
+/* maximum number of requests sent to single address in one burst
+ */
+
+#define NTP_MAX_BURST (8)
+
+/* maximum number of network interfaces requests are raced over
+ */
+
+#define NTP_MAX_IFACES (8)
+
+/* options for single ntp query, all times are in milliseconds
+ */
+
+struct ntp_opts
+{
+    int                    nsamples;  /* number of replies to wait for */
+    long                   timeout;   /* max time to wait for replies */
+    long                   rto_init;  /* rto for unknown server */
+    long                   rto_min;   /* min retransmission timeout */
+    long                   rto_max;   /* max retransmission timeout */
+    int                    retries;   /* max retransmissions to server */
+    int                    quorum;    /* agreeing servers to wait for, or 0 */
+    int                    burst;     /* requests sent to each address */
+    long                   burst_gap; /* time between requests in burst */
+    long                   accuracy;  /* max error of sample to count, or 0 */
+    const struct timesrc  *src;       /* protocols of servers, NULL for ntp */
+    const char            *ifaces;    /* interfaces to race, see ntp_query() */
+};
+
+/* all times in sample are in nanoseconds, timestamps are counted
+ * since unix epoch
+ */
+
+struct ntp_sample
+{
+    struct sockaddr_storage  addr;     /* address of server that replied */
+    socklen_t                addrlen;  /* length of addr */
+    int                      server;   /* index of server address is of */
+    int                      stratum;  /* stratum of the server */
+    int                      proto;    /* TIMESRC_* sample was taken with */
+    int64_t                  org;      /* t1, local time request was sent */
+    int64_t                  rec;      /* t2, server time request arrived */
+    int64_t                  xmt;      /* t3, server time reply was sent */
+    int64_t                  dst;      /* t4, local time reply arrived */
+    int64_t                  offset;   /* offset of local clock to server */
+    int64_t                  delay;    /* round trip delay */
+    int64_t                  rootdist; /* root delay/2 + root dispersion */
+    char                     ifname[IF_NAMESIZE];  /* interface, or "" */
+};
+
+int ntp_query(struct resolv *, int, struct ntp_sample *,
+    const struct ntp_opts *);
+const char *ntp_addr_str(const struct ntp_sample *, char *, size_t);
+void ntp_ns_to_ts(int64_t, unsigned char *);
+
+#endif
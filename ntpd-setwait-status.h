@@ -0,0 +1,294 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ==========================================================================
+
+    Client side of ntpd-setwait status file (-M option). ntpd-setwait
+    publishes struct ntpd_setwait_status in a small file, which readers
+    mmap(), so checking if time is valid costs just a few memory reads,
+    no syscalls, no log parsing. File keeps its last values after
+    ntpd-setwait executes ntpd.
+
+    Writer updates the struct under seqlock, readers take consistent
+    copy with ntpd_setwait_status_read(), which never blocks writer, and
+    gives up (instead of spinning forever) when writer was killed in the
+    middle of update.
+    synced word flips from 0 to 1 when time becomes valid, and readers
+    can sleep on it with ntpd_setwait_status_wait() (futex, linux only).
+
+    Example:
+
+        const struct ntpd_setwait_status  *shm;
+        struct ntpd_setwait_status         st;
+
+        if (ntpd_setwait_status_open(NTPD_SETWAIT_STATUS_PATH, &shm) != 0)
+            return -1;
+
+        ntpd_setwait_status_wait(shm, 30000);
+        if (ntpd_setwait_status_read(shm, &st) == 0 && st.synced)
+            printf("synced from %s +-%lldns\n", st.host, st.error);
+
+   ========================================================================== */
+
+#ifndef NTPD_SETWAIT_STATUS_H
+#define NTPD_SETWAIT_STATUS_H 1
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#   include <linux/futex.h>
+#   include <sys/syscall.h>
+#endif
+
+#define NTPD_SETWAIT_STATUS_PATH "/var/run/ntpd-setwait.status"
+#define NTPD_SETWAIT_STATUS_MAGIC (0x6e737773u)  /* "nsws" */
+#define NTPD_SETWAIT_STATUS_VERSION (1)
+
+/* reader tries that many times to take consistent copy, and yields
+ * cpu after the first few, update takes microseconds, so only dead
+ * writer can make it give up
+ */
+
+#define NTPD_SETWAIT_STATUS_TRIES (1000)
+#define NTPD_SETWAIT_STATUS_SPINS (16)
+
+/* what ntpd-setwait is doing now
+ */
+
+#define NTPD_SETWAIT_STATE_STARTING (0)  /* not asked ntp servers yet */
+#define NTPD_SETWAIT_STATE_QUERYING (1)  /* trying to get time */
+#define NTPD_SETWAIT_STATE_SYNCED   (2)  /* time is valid, finishing up */
+#define NTPD_SETWAIT_STATE_NTPD     (3)  /* ntpd has been executed */
+#define NTPD_SETWAIT_STATE_CLIENT   (4)  /* we keep time ourselves (-P) */
+
+/* layout is fixed, new fields are only added at the end, with version
+ * bumped, all times are in nanoseconds
+ */
+
+struct ntpd_setwait_status
+{
+    uint32_t  magic;      /* NTPD_SETWAIT_STATUS_MAGIC */
+    uint32_t  version;    /* NTPD_SETWAIT_STATUS_VERSION */
+    uint32_t  seq;        /* seqlock counter, odd while writer updates */
+    uint32_t  synced;     /* futex word, 1 once time is valid */
+    int32_t   state;      /* one of NTPD_SETWAIT_STATE_* */
+    int32_t   attempts;   /* attempts to get time made so far */
+    int32_t   stepped;    /* 1 when clock was stepped */
+    int32_t   stratum;    /* stratum of server time came from */
+    int64_t   updated;    /* realtime of last update */
+    int64_t   synced_at;  /* realtime at which time became valid */
+    int64_t   offset;     /* offset measured to ntp time */
+    int64_t   error;      /* max error of time (delay / 2 + rootdist) */
+    char      host[64];   /* server time came from, as given to us */
+    char      addr[48];   /* numeric address of that server */
+};
+
+
+/* ==========================================================================
+    Maps status file at path for reading.
+
+    returns
+            0       file mapped, pointer to shared status stored in shm
+           -1       on error, errno is set, EPROTO when file is not
+                    ntpd-setwait status file
+   ========================================================================== */
+
+
+static inline int ntpd_setwait_status_open
+(
+    const char                          *path,  /* status file */
+    const struct ntpd_setwait_status   **shm    /* mapped status */
+)
+{
+    int                                  fd;    /* opened status file */
+    struct stat                          st;    /* size of file */
+    void                                *p;     /* mapped memory */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+        return -1;
+
+    if (fstat(fd, &st) != 0 ||
+            st.st_size < (off_t)sizeof(struct ntpd_setwait_status))
+    {
+        close(fd);
+        errno = EPROTO;
+        return -1;
+    }
+
+    p = mmap(NULL, sizeof(struct ntpd_setwait_status), PROT_READ,
+            MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (p == MAP_FAILED)
+        return -1;
+
+    *shm = p;
+    if ((*shm)->magic != NTPD_SETWAIT_STATUS_MAGIC)
+    {
+        munmap(p, sizeof(struct ntpd_setwait_status));
+        errno = EPROTO;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* ==========================================================================
+    Takes consistent copy of shared status into st. Reader never blocks
+    writer, it just tries again when writer was updating status in the
+    meantime, which is rare and short. Writer that died in the middle of
+    update leaves status inconsistent for good, so number of tries is
+    bounded.
+
+    returns
+            0       st holds consistent status
+           -1       on error, errno is set to EAGAIN when consistent copy
+                    could not be taken, EPROTO when status was written by
+                    incompatible version
+   ========================================================================== */
+
+
+static inline int ntpd_setwait_status_read
+(
+    const struct ntpd_setwait_status  *shm,  /* mapped status */
+    struct ntpd_setwait_status        *st    /* copy will be stored here */
+)
+{
+    uint32_t                           seq;  /* seq before copy */
+    int                                i;    /* just an iterator */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    for (i = 0; i != NTPD_SETWAIT_STATUS_TRIES; ++i)
+    {
+        /* writer may be preempted in the middle of update, let
+         * it finish, instead of burning its cpu
+         */
+
+        if (i >= NTPD_SETWAIT_STATUS_SPINS)
+            sched_yield();
+
+        seq = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+            continue;
+
+        memcpy(st, (const void *)shm, sizeof(*st));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        if (__atomic_load_n(&shm->seq, __ATOMIC_RELAXED) != seq)
+            continue;
+
+        if (st->version < NTPD_SETWAIT_STATUS_VERSION)
+        {
+            errno = EPROTO;
+            return -1;
+        }
+
+        return 0;
+    }
+
+    errno = EAGAIN;
+    return -1;
+}
+
+
+/* ==========================================================================
+    Checks if time is valid. Single memory read, safe to call on hot
+    paths.
+
+    returns
+            1       time is synchronized
+            0       not yet
+   ========================================================================== */
+
+
+static inline int ntpd_setwait_status_synced
+(
+    const struct ntpd_setwait_status  *shm  /* mapped status */
+)
+{
+    return __atomic_load_n(&shm->synced, __ATOMIC_ACQUIRE) != 0;
+}
+
+
+/* ==========================================================================
+    Sleeps until time becomes valid, but at most timeout milliseconds
+    (-1 waits forever). Without futex (not linux), it polls every 100ms.
+
+    returns
+            1       time is synchronized
+            0       timeout
+   ========================================================================== */
+
+
+static inline int ntpd_setwait_status_wait
+(
+    const struct ntpd_setwait_status  *shm,      /* mapped status */
+    int                                timeout   /* max time to wait */
+)
+{
+    struct timespec                    now;      /* current time */
+    struct timespec                    ts;       /* time to sleep */
+    int64_t                            left;     /* time left to wait */
+    int64_t                            deadline; /* time to give up at */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    deadline = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec +
+        (int64_t)timeout * 1000000;
+
+    while (!ntpd_setwait_status_synced(shm))
+    {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        left = deadline - ((int64_t)now.tv_sec * 1000000000 + now.tv_nsec);
+        if (timeout < 0)
+            left = INT64_MAX;
+        else if (left <= 0)
+            return 0;
+
+#ifdef __linux__
+        /* futex returns right away, when word is not 0 anymore,
+         * so wake up cannot be missed
+         */
+
+        ts.tv_sec = left / 1000000000;
+        ts.tv_nsec = left % 1000000000;
+        syscall(SYS_futex, &shm->synced, FUTEX_WAIT, 0,
+                timeout >= 0 ? &ts : NULL, NULL, 0);
+#else
+        ts.tv_sec = 0;
+        ts.tv_nsec = left < 100000000 ? left : 100000000;
+        nanosleep(&ts, NULL);
+#endif
+    }
+
+    return 1;
+}
+
+
+/* ==========================================================================
+    Unmaps status mapped with ntpd_setwait_status_open()
+   ========================================================================== */
+
+
+static inline void ntpd_setwait_status_close
+(
+    const struct ntpd_setwait_status  *shm  /* mapped status */
+)
+{
+    munmap((void *)shm, sizeof(struct ntpd_setwait_status));
+}
+
+#endif
@@ -0,0 +1,138 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ==========================================================================
+         -----------------------------------------------
+        < random numbers for query ids and retry jitter >
+         -----------------------------------------------
+   ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include "ntpd-setwait-config.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "backend.h"
+#include "rand.h"
+
+
+
+
+/* ==========================================================================
+                                        __     __ _
+                         ____   __  __ / /_   / /(_)_____
+                        / __ \ / / / // __ \ / // // ___/
+                       / /_/ // /_/ // /_/ // // // /__
+                      / .___/ \__,_//_.___//_//_/ \___/
+                     /_/
+               ____                     __   _
+              / __/__  __ ____   _____ / /_ (_)____   ____   _____
+             / /_ / / / // __ \ / ___// __// // __ \ / __ \ / ___/
+            / __// /_/ // / / // /__ / /_ / // /_/ // / / /(__  )
+           /_/   \__,_//_/ /_/ \___/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Returns random 32bit number. Generator is seeded from /dev/urandom on
+    first call (with fallback to pid and time, when it's not available),
+    then xorshift is used, so we don't do syscall for every number. This
+    is not cryptographically secure, but is good enough for dns query ids
+    and for spreading retries in time.
+   ========================================================================== */
+
+
+uint32_t rand_u32(void)
+{
+    static uint32_t  state;  /* generator state */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (state == 0 && (state = backend_entropy()) == 0)
+        state = 0x5eed;
+
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+
+/* ==========================================================================
+    Returns random value between v / 2 and v (inclusive), so periodic
+    events of many processes don't end up happening at the same time.
+   ========================================================================== */
+
+
+long rand_jitter
+(
+    long  v   /* value to jitter */
+)
+{
+    if (v < 2)
+        return v;
+
+    return v / 2 + (long)(rand_u32() % (uint32_t)(v / 2 + 1));
+}
+
+
+/* ==========================================================================
+    Returns number that is different on each device, but the same on
+    every boot of it, so devices that start at the same moment can
+    spread in time deterministically, each in its own slot. It's hash of
+    machine-id, or random number when there is none.
+   ========================================================================== */
+
+
+uint32_t rand_device(void)
+{
+    int                 fd;      /* machine-id file */
+    ssize_t             n;       /* bytes read from file */
+    ssize_t             i;       /* just an iterator */
+    size_t              p;       /* path being tried */
+    uint32_t            h;       /* hash of machine-id */
+    char                id[64];  /* machine-id */
+    static const char  *paths[] = { "/etc/machine-id",
+        "/var/lib/dbus/machine-id" };
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    for (p = 0; p != sizeof(paths) / sizeof(*paths); ++p)
+    {
+        if ((fd = open(paths[p], O_RDONLY | O_CLOEXEC)) < 0)
+            continue;
+
+        n = read(fd, id, sizeof(id));
+        close(fd);
+
+        /* empty machine-id is what image has, before it's
+         * generated on first boot, useless for us
+         */
+
+        if (n < 8)
+            continue;
+
+        /* fnv-1a, ids are random hex strings already, hash
+         * only spreads them over all 32 bits
+         */
+
+        h = 2166136261u;
+        for (i = 0; i != n; ++i)
+            h = (h ^ (unsigned char)id[i]) * 16777619u;
+
+        return h;
+    }
+
+    return rand_u32();
+}
@@ -0,0 +1,15 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ========================================================================== */
+
+#ifndef RAND_H
+#define RAND_H 1
+
+#include <stdint.h>
+
+uint32_t rand_u32(void);
+long rand_jitter(long);
+uint32_t rand_device(void);
+
+#endif
@@ -0,0 +1,816 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ==========================================================================
+         -----------------------------------------------------
+        / minimal non-blocking dns stub resolver, so we don't \
+        \ block on getaddrinfo() and don't pull nss modules   /
+         -----------------------------------------------------
+   ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "rand.h"
+#include "resolv.h"
+#include "state.h"
+#include "sysclock.h"
+
+
+/* ==========================================================================
+          __             __                     __   _
+     ____/ /___   _____ / /____ _ _____ ____ _ / /_ (_)____   ____   _____
+    / __  // _ \ / ___// // __ `// ___// __ `// __// // __ \ / __ \ / ___/
+   / /_/ //  __// /__ / // /_/ // /   / /_/ // /_ / // /_/ // / / /(__  )
+   \__,_/ \___/ \___//_/ \__,_//_/    \__,_/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+#define DNS_HDR_LEN (12)
+#define DNS_MAX_PACKET (512)
+#define DNS_TYPE_A (1)
+#define DNS_TYPE_AAAA (28)
+#define DNS_CLASS_IN (1)
+
+/* bits in resolv.pending field
+ */
+
+#define PENDING_A (1 << 0)
+#define PENDING_AAAA (1 << 1)
+
+/* we don't want to ask dns server every time, even if it tells
+ * us record is valid for 0 seconds
+ */
+
+#define RESOLV_MIN_TTL (10)
+
+/* cache file that we've already written is not written again
+ * sooner than that, even if addresses that answered changed, pool
+ * servers take turns, and flash does not like being written every
+ * poll
+ */
+
+#define RESOLV_SAVE_GAP (600 * NSEC_PER_SEC)
+
+
+/* ==========================================================================
+                  _                __           ____
+    ____   _____ (_)_   __ ____ _ / /_ ___     / __/__  __ ____   _____ _____
+   / __ \ / ___// /| | / // __ `// __// _ \   / /_ / / / // __ \ / ___// ___/
+  / /_/ // /   / / | |/ // /_/ // /_ /  __/  / __// /_/ // / / // /__ (__  )
+ / .___//_/   /_/  |___/ \__,_/ \__/ \___/  /_/   \__,_//_/ /_/ \___//____/
+/_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Adds address, as string, to hash of address set. Addresses are hashed
+    one by one, and added, so order they come in does not matter.
+
+    returns
+            hash of set with address added
+   ========================================================================== */
+
+
+static uint32_t hash_addr
+(
+    uint32_t     set,   /* hash of set so far */
+    const char  *ip     /* address to add */
+)
+{
+    uint32_t     h;     /* hash of address */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    for (h = 2166136261u; *ip; ++ip)
+        h = (h ^ (unsigned char)*ip) * 16777619u;
+
+    return set + h;
+}
+
+
+/* ==========================================================================
+    Looks for host in /etc/hosts, so names defined there still work even
+    though we don't go through nss.
+
+    returns
+            number of addresses found for host
+   ========================================================================== */
+
+
+static int lookup_hosts
+(
+    struct resolv  *rv,        /* resolver object */
+    const char     *path       /* path to hosts file */
+)
+{
+    FILE           *f;         /* opened hosts file */
+    char           *tok;       /* currently parsed token */
+    char           *save;      /* strtok_r() state */
+    char           *ip;        /* ip address of the line */
+    char            line[512]; /* single line from hosts file */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if ((f = fopen(path, "r")) == NULL)
+        return 0;
+
+    while (rv->naddrs < RESOLV_MAX_ADDRS && fgets(line, sizeof(line), f))
+    {
+        line[strcspn(line, "#\n")] = '\0';
+
+        if ((ip = strtok_r(line, " \t", &save)) == NULL)
+            continue;
+
+        while ((tok = strtok_r(NULL, " \t", &save)) != NULL)
+        {
+            if (strcasecmp(tok, rv->host) != 0)
+                continue;
+
+            if (resolv_numeric(ip, &rv->addrs[rv->naddrs]) == 0)
+                rv->naddrs++;
+
+            break;
+        }
+    }
+
+    fclose(f);
+    return rv->naddrs;
+}
+
+
+/* ==========================================================================
+    Loads addresses saved by resolv_save() from previous run. They are
+    loaded as already expired, so dns is still asked, but we can talk
+    to these servers before dns answers, or when it doesn't answer at
+    all.
+   ========================================================================== */
+
+
+static void load_cache
+(
+    struct resolv  *rv         /* resolver object */
+)
+{
+    FILE           *f;         /* opened cache file */
+    char            line[128]; /* single line from cache file */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (rv->cache == NULL || (f = fopen(rv->cache, "r")) == NULL)
+        return;
+
+    /* first line is host name addresses are for, if that does
+     * not match, user changed server and cache is useless
+     */
+
+    if (fgets(line, sizeof(line), f) == NULL)
+    {
+        fclose(f);
+        return;
+    }
+
+    line[strcspn(line, "\n")] = '\0';
+    if (strcmp(line, rv->host) != 0)
+    {
+        fclose(f);
+        return;
+    }
+
+    while (rv->naddrs < RESOLV_MAX_ADDRS && fgets(line, sizeof(line), f))
+    {
+        line[strcspn(line, "\n")] = '\0';
+        if (resolv_numeric(line, &rv->addrs[rv->naddrs]) == 0)
+        {
+            rv->saved = hash_addr(rv->saved, line);
+            rv->naddrs++;
+        }
+    }
+
+    fclose(f);
+
+    if (rv->naddrs)
+        log_print("n/loaded %d cached addresses for %s\n",
+                rv->naddrs, rv->host);
+}
+
+
+/* ==========================================================================
+    Reads address of nameserver number idx from /etc/resolv.conf. File is
+    read each time, as it's usually written by dhcp client after network
+    comes up, possibly after we've started.
+
+    returns
+            0       address of nameserver stored in ra
+           -1       no such nameserver
+   ========================================================================== */
+
+
+static int get_nameserver
+(
+    int                  idx,       /* index of nameserver to get */
+    struct resolv_addr  *ra         /* nameserver address will be here */
+)
+{
+    FILE                *f;         /* opened resolv.conf */
+    char                *tok;       /* currently parsed token */
+    char                *save;      /* strtok_r() state */
+    int                  ret;       /* return code */
+    char                 line[256]; /* single line from resolv.conf */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if ((f = fopen("/etc/resolv.conf", "r")) == NULL)
+        return -1;
+
+    ret = -1;
+    while (fgets(line, sizeof(line), f))
+    {
+        tok = strtok_r(line, " \t\n", &save);
+        if (tok == NULL || strcmp(tok, "nameserver") != 0)
+            continue;
+
+        if ((tok = strtok_r(NULL, " \t\n", &save)) == NULL)
+            continue;
+
+        if (idx-- != 0)
+            continue;
+
+        ret = resolv_numeric(tok, ra);
+        break;
+    }
+
+    fclose(f);
+
+    if (ret == 0)
+    {
+        /* resolv_numeric() sets ntp port, we need dns one
+         */
+
+        if (ra->addr.ss_family == AF_INET)
+            ((struct sockaddr_in *)&ra->addr)->sin_port = htons(53);
+        else
+            ((struct sockaddr_in6 *)&ra->addr)->sin6_port = htons(53);
+    }
+
+    return ret;
+}
+
+
+/* ==========================================================================
+    Builds dns query for host and qtype into buf.
+
+    returns
+            >0      length of the query
+           -1       host name is invalid
+   ========================================================================== */
+
+
+static int build_query
+(
+    unsigned char  *buf,    /* buffer for the query */
+    uint16_t        id,     /* id of the query */
+    const char     *host,   /* host to ask about */
+    int             qtype   /* type of record we want */
+)
+{
+    size_t          len;    /* length of currently processed label */
+    unsigned char  *p;      /* current write position in buf */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (strlen(host) > 253)
+        return -1;
+
+    /* header: id, flags with recursion desired bit set,
+     * single question, no answers or other records
+     */
+
+    memset(buf, 0x00, DNS_HDR_LEN);
+    buf[0] = id >> 8;
+    buf[1] = id;
+    buf[2] = 0x01;
+    buf[5] = 1;
+    p = buf + DNS_HDR_LEN;
+
+    /* host name is encoded as list of labels, each prefixed
+     * with its length, "pool.ntp.org" becomes "4pool3ntp3org0"
+     */
+
+    while (*host)
+    {
+        len = strcspn(host, ".");
+        if (len == 0 || len > 63)
+            return -1;
+
+        *p++ = len;
+        memcpy(p, host, len);
+        p += len;
+        host += len;
+        if (*host == '.')
+            host++;
+    }
+
+    *p++ = 0;
+    *p++ = qtype >> 8;
+    *p++ = qtype;
+    *p++ = DNS_CLASS_IN >> 8;
+    *p++ = DNS_CLASS_IN;
+
+    return p - buf;
+}
+
+
+/* ==========================================================================
+    Skips over (possibly compressed) name in dns packet.
+
+    returns
+            offset of first byte after name
+           -1       name runs past end of packet
+   ========================================================================== */
+
+
+static int skip_name
+(
+    const unsigned char  *buf,  /* dns packet */
+    int                   len,  /* length of buf */
+    int                   pos   /* offset where name starts */
+)
+{
+    while (pos < len)
+    {
+        if ((buf[pos] & 0xc0) == 0xc0)
+            return pos + 2 <= len ? pos + 2 : -1;
+
+        if (buf[pos] == 0)
+            return pos + 1;
+
+        pos += buf[pos] + 1;
+    }
+
+    return -1;
+}
+
+
+/* ==========================================================================
+    Parses dns response, and stores all A and AAAA records from answer
+    section in rv->fresh. We ask recursive resolver, so we don't care
+    about CNAMEs, it gives us final records anyway.
+
+    returns
+            0       packet parsed, rv->pending updated
+           -1       packet is not a response to our query
+   ========================================================================== */
+
+
+static int parse_response
+(
+    struct resolv        *rv,       /* resolver object */
+    const unsigned char  *buf,      /* received packet */
+    int                   len       /* length of buf */
+)
+{
+    int                   pending;  /* query type this answer is for */
+    int                   ancount;  /* number of answer records */
+    int                   pos;      /* current parse position in buf */
+    int                   type;     /* type of answer record */
+    int                   class;    /* class of answer record */
+    uint32_t              ttl;      /* ttl of answer record */
+    int                   rdlen;    /* length of answer data */
+    struct resolv_addr   *ra;       /* address to fill */
+    uint16_t              id;       /* id of response */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (len < DNS_HDR_LEN || (buf[2] & 0x80) == 0)
+        return -1;
+
+    id = buf[0] << 8 | buf[1];
+    if (id == rv->id)
+        pending = PENDING_A;
+    else if (id == (uint16_t)(rv->id + 1))
+        pending = PENDING_AAAA;
+    else
+        return -1;
+
+    if ((rv->pending & pending) == 0)
+        return -1;
+
+    /* we got answer for this query, no matter if it contains
+     * any addresses or is an error
+     */
+
+    rv->pending &= ~pending;
+    if ((buf[3] & 0x0f) != 0)
+        return 0;
+
+    ancount = buf[6] << 8 | buf[7];
+
+    /* skip question section, we've sent only one question
+     */
+
+    if ((pos = skip_name(buf, len, DNS_HDR_LEN)) < 0)
+        return 0;
+
+    pos += 4;
+
+    while (ancount-- > 0)
+    {
+        if ((pos = skip_name(buf, len, pos)) < 0 || pos + 10 > len)
+            return 0;
+
+        type = buf[pos] << 8 | buf[pos + 1];
+        class = buf[pos + 2] << 8 | buf[pos + 3];
+        ttl = (uint32_t)buf[pos + 4] << 24 | (uint32_t)buf[pos + 5] << 16 |
+            (uint32_t)buf[pos + 6] << 8 | (uint32_t)buf[pos + 7];
+        rdlen = buf[pos + 8] << 8 | buf[pos + 9];
+        pos += 10;
+
+        if (pos + rdlen > len)
+            return 0;
+
+        if (class != DNS_CLASS_IN || rv->nfresh == RESOLV_MAX_ADDRS)
+        {
+            pos += rdlen;
+            continue;
+        }
+
+        ra = &rv->fresh[rv->nfresh];
+        memset(ra, 0x00, sizeof(*ra));
+
+        if (type == DNS_TYPE_A && rdlen == 4)
+        {
+            struct sockaddr_in  *sin = (struct sockaddr_in *)&ra->addr;
+            /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+            sin->sin_family = AF_INET;
+            sin->sin_port = htons(RESOLV_NTP_PORT);
+            memcpy(&sin->sin_addr, buf + pos, 4);
+            ra->addrlen = sizeof(*sin);
+        }
+        else if (type == DNS_TYPE_AAAA && rdlen == 16)
+        {
+            struct sockaddr_in6  *sin6 = (struct sockaddr_in6 *)&ra->addr;
+            /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+            sin6->sin6_family = AF_INET6;
+            sin6->sin6_port = htons(RESOLV_NTP_PORT);
+            memcpy(&sin6->sin6_addr, buf + pos, 16);
+            ra->addrlen = sizeof(*sin6);
+        }
+
+        if (ra->addrlen)
+        {
+            rv->nfresh++;
+            if (ttl < rv->ttl)
+                rv->ttl = ttl;
+        }
+
+        pos += rdlen;
+    }
+
+    return 0;
+}
+
+
+/* ==========================================================================
+                                        __     __ _
+                         ____   __  __ / /_   / /(_)_____
+                        / __ \ / / / // __ \ / // // ___/
+                       / /_/ // /_/ // /_/ // // // /__
+                      / .___/ \__,_//_.___//_//_/ \___/
+                     /_/
+               ____                     __   _
+              / __/__  __ ____   _____ / /_ (_)____   ____   _____
+             / /_ / / / // __ \ / ___// __// // __ \ / __ \ / ___/
+            / __// /_/ // / / // /__ / /_ / // /_/ // / / /(__  )
+           /_/   \__,_//_/ /_/ \___/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Initializes resolver for host. If host is numeric address, or is
+    defined in /etc/hosts, it will never be asked from dns. Otherwise
+    addresses that worked last time are loaded from cache file, if
+    cache is not NULL.
+   ========================================================================== */
+
+
+void resolv_init
+(
+    struct resolv  *rv,     /* resolver to initialize */
+    const char     *host,   /* host to resolve */
+    const char     *cache   /* path to cache file or NULL */
+)
+{
+    memset(rv, 0x00, sizeof(*rv));
+    rv->host = host;
+    rv->cache = cache;
+    rv->fd = -1;
+
+    if (resolv_numeric(host, &rv->addrs[0]) == 0)
+    {
+        rv->naddrs = 1;
+        rv->expire = INT64_MAX;
+        return;
+    }
+
+    if (lookup_hosts(rv, "/etc/hosts"))
+    {
+        rv->expire = INT64_MAX;
+        return;
+    }
+
+    load_cache(rv);
+}
+
+
+/* ==========================================================================
+    Sends dns queries for A and AAAA records of host, unless addresses we
+    have did not expire yet. Queries are sent to one nameserver, if it
+    does not respond, resolv_cancel() will make us try next one next time.
+
+    returns
+            >=0     socket to wait on for resolv_input()
+           -1       no need to query, or query could not be sent
+   ========================================================================== */
+
+
+int resolv_start
+(
+    struct resolv       *rv        /* resolver object */
+)
+{
+    int                  len;      /* length of query */
+    int                  i;        /* just an iterator */
+    struct resolv_addr   ns;       /* nameserver to ask */
+    static int           errcnt;   /* error counter */
+    unsigned char        buf[DNS_MAX_PACKET];  /* query to send */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (rv->fd >= 0)
+        return rv->fd;
+
+    if (sysclock_boottime() < rv->expire)
+        return -1;
+
+    /* if there is no nameserver at idx (anymore), start
+     * over from the first one
+     */
+
+    if (get_nameserver(rv->ns, &ns) != 0)
+    {
+        rv->ns = 0;
+        if (get_nameserver(rv->ns, &ns) != 0)
+        {
+            if (errcnt-- == 0)
+            {
+                errcnt = 60;
+                log_print("w/no nameserver in /etc/resolv.conf\n");
+            }
+
+            return -1;
+        }
+    }
+
+    rv->fd = socket(ns.addr.ss_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (rv->fd < 0)
+        return -1;
+
+    if (connect(rv->fd, (struct sockaddr *)&ns.addr, ns.addrlen) != 0)
+        goto error;
+
+    rv->id = (uint16_t)rand_u32();
+    rv->pending = PENDING_A | PENDING_AAAA;
+    rv->ttl = UINT32_MAX;
+    rv->nfresh = 0;
+
+    for (i = 0; i != 2; ++i)
+    {
+        len = build_query(buf, rv->id + i, rv->host,
+                i == 0 ? DNS_TYPE_A : DNS_TYPE_AAAA);
+        if (len < 0)
+        {
+            log_print("e/invalid host name %s\n", rv->host);
+            goto error;
+        }
+
+        if (send(rv->fd, buf, len, 0) != len)
+            goto error;
+    }
+
+    return rv->fd;
+
+error:
+    if (errcnt-- == 0)
+    {
+        /* if there is no internet, this error will be popping
+         * out all the time, there is really no need to print
+         * it too frequent, so we print this once a while
+         */
+
+        errcnt = 60;
+        error("w/dns query");
+    }
+
+    resolv_cancel(rv);
+    return -1;
+}
+
+
+/* ==========================================================================
+    Reads response from dns server when its socket is readable. Once
+    answers to both queries arrive, received addresses replace ones we
+    had, and are valid for as long as dns told us.
+
+    returns
+            1       still waiting for answers
+            0       resolving finished, rv->addrs is updated
+           -1       resolving failed, rv->addrs still holds old addresses
+   ========================================================================== */
+
+
+int resolv_input
+(
+    struct resolv  *rv       /* resolver object */
+)
+{
+    ssize_t         n;       /* number of bytes received */
+    uint32_t        ttl;     /* time for which addresses are valid */
+    unsigned char   buf[DNS_MAX_PACKET];  /* received response */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    while ((n = recv(rv->fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+        parse_response(rv, buf, n);
+
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+    {
+        /* most likely icmp port unreachable, this nameserver
+         * is of no use to us
+         */
+
+        resolv_cancel(rv);
+        return -1;
+    }
+
+    if (rv->pending)
+        return 1;
+
+    close(rv->fd);
+    rv->fd = -1;
+
+    if (rv->nfresh == 0)
+    {
+        log_print("w/no addresses found for %s\n", rv->host);
+        return -1;
+    }
+
+    memcpy(rv->addrs, rv->fresh, rv->nfresh * sizeof(rv->fresh[0]));
+    rv->naddrs = rv->nfresh;
+
+    ttl = rv->ttl < RESOLV_MIN_TTL ? RESOLV_MIN_TTL : rv->ttl;
+    rv->expire = sysclock_boottime() + (int64_t)ttl * NSEC_PER_SEC;
+    return 0;
+}
+
+
+/* ==========================================================================
+    Abandons pending query. Nameserver did not answer in time, so next
+    query will go to the next one from /etc/resolv.conf.
+   ========================================================================== */
+
+
+void resolv_cancel
+(
+    struct resolv  *rv   /* resolver object */
+)
+{
+    if (rv->fd < 0)
+        return;
+
+    if (rv->pending)
+        rv->ns++;
+
+    close(rv->fd);
+    rv->fd = -1;
+    rv->pending = 0;
+}
+
+
+/* ==========================================================================
+    Saves addresses in cache file, so we can use them right away on next
+    boot. File is written only when set of addresses differs from the
+    one in the file, and at most once per RESOLV_SAVE_GAP, as resident
+    client calls it after every poll, and each write is fsync() to flash.
+   ========================================================================== */
+
+
+void resolv_save
+(
+    struct resolv             *rv,        /* resolver object */
+    const struct resolv_addr  *addrs,     /* addresses to save */
+    int                        naddrs     /* number of addresses in addrs */
+)
+{
+    int                        i;         /* just an iterator */
+    size_t                     len;       /* length of data in buf */
+    uint32_t                   hash;      /* hash of saved addresses */
+    char                       ip[NI_MAXHOST];  /* address as string */
+    char                       buf[256 + RESOLV_MAX_ADDRS * 64];  /* file */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    /* no point to cache numeric address or /etc/hosts entry
+     */
+
+    if (rv->cache == NULL || rv->expire == INT64_MAX || naddrs == 0)
+        return;
+
+    hash = 0;
+    len = snprintf(buf, sizeof(buf), "%s\n", rv->host);
+    for (i = 0; i != naddrs && len < sizeof(buf); ++i)
+    {
+        if (getnameinfo((const struct sockaddr *)&addrs[i].addr,
+                    addrs[i].addrlen, ip, sizeof(ip), NULL, 0,
+                    NI_NUMERICHOST) != 0)
+            continue;
+
+        len += snprintf(buf + len, sizeof(buf) - len, "%s\n", ip);
+        hash = hash_addr(hash, ip);
+    }
+
+    if (len >= sizeof(buf) || hash == rv->saved || (rv->saved_at &&
+                sysclock_boottime() - rv->saved_at < RESOLV_SAVE_GAP))
+        return;
+
+    if (state_write(rv->cache, buf, len) == 0)
+    {
+        rv->saved = hash;
+        rv->saved_at = sysclock_boottime();
+    }
+}
+
+
+/* ==========================================================================
+    Converts numeric address (ipv4 or ipv6, with scope) into sockaddr with
+    ntp port set. No dns lookup is done here.
+
+    returns
+            0       address converted and stored in ra
+           -1       str is not numeric address
+   ========================================================================== */
+
+
+int resolv_numeric
+(
+    const char          *str,    /* address to convert */
+    struct resolv_addr  *ra      /* converted address will be stored here */
+)
+{
+    struct addrinfo      hints;  /* criteria for selecting sockaddr */
+    struct addrinfo     *res;    /* result from getaddrinfo() */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    memset(&hints, 0x00, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_NUMERICHOST;
+
+    if (getaddrinfo(str, NULL, &hints, &res) != 0)
+        return -1;
+
+    memcpy(&ra->addr, res->ai_addr, res->ai_addrlen);
+    ra->addrlen = res->ai_addrlen;
+    freeaddrinfo(res);
+
+    if (ra->addr.ss_family == AF_INET)
+        ((struct sockaddr_in *)&ra->addr)->sin_port = htons(RESOLV_NTP_PORT);
+    else
+        ((struct sockaddr_in6 *)&ra->addr)->sin6_port =
+            htons(RESOLV_NTP_PORT);
+
+    return 0;
+}
@@ -0,0 +1,56 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ========================================================================== */
+
+#ifndef RESOLV_H
+#define RESOLV_H 1
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+/* maximum number of addresses kept for single host
+ */
+
+#define RESOLV_MAX_ADDRS (16)
+
+/* port ntp servers listen on, benchmark overrides it at compile
+ * time, so fake server does not need to run as root
+ */
+
+#ifndef RESOLV_NTP_PORT
+#define RESOLV_NTP_PORT (123)
+#endif
+
+struct resolv_addr
+{
+    struct sockaddr_storage  addr;     /* address of the host */
+    socklen_t                addrlen;  /* length of addr */
+};
+
+struct resolv
+{
+    const char          *host;      /* host to resolve */
+    const char          *cache;     /* path to on-disk cache or NULL */
+    struct resolv_addr   addrs[RESOLV_MAX_ADDRS];  /* known addresses */
+    int                  naddrs;    /* number of known addresses */
+    int64_t              expire;    /* boot time when addrs expire */
+    int                  fd;        /* socket with pending query or -1 */
+    uint16_t             id;        /* id of pending A query */
+    int                  pending;   /* query types still waiting answer */
+    int                  ns;        /* index of nameserver to ask */
+    uint32_t             ttl;       /* smallest ttl of received answers */
+    struct resolv_addr   fresh[RESOLV_MAX_ADDRS];  /* pending answers */
+    int                  nfresh;    /* number of addresses in fresh */
+    uint32_t             saved;     /* hash of addresses in cache file */
+    int64_t              saved_at;  /* boot time we wrote cache at, or 0 */
+};
+
+void resolv_init(struct resolv *, const char *, const char *);
+int resolv_start(struct resolv *);
+int resolv_input(struct resolv *);
+void resolv_cancel(struct resolv *);
+void resolv_save(struct resolv *, const struct resolv_addr *, int);
+int resolv_numeric(const char *, struct resolv_addr *);
+
+#endif
@@ -0,0 +1,548 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ==========================================================================
+         -------------------------------------------------------------
+        / keeps score of ntp servers between boots, so the fastest    \
+        \ and most reliable ones are asked first, and flaky ones last /
+         -------------------------------------------------------------
+   ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include "ntpd-setwait-config.h"
+
+#include <netdb.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "log.h"
+#include "ntp.h"
+#include "resolv.h"
+#include "score.h"
+#include "state.h"
+#include "sysclock.h"
+
+
+/* ==========================================================================
+          __             __                     __   _
+     ____/ /___   _____ / /____ _ _____ ____ _ / /_ (_)____   ____   _____
+    / __  // _ \ / ___// // __ `// ___// __ `// __// // __ \ / __ \ / ___/
+   / /_/ //  __// /__ / // /_/ // /   / /_/ // /_ / // /_/ // / / /(__  )
+   \__,_/ \___/ \___//_/ \__,_//_/    \__,_/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+/* max number of servers we keep score of, when table is full,
+ * server that was not asked for the longest time is forgotten
+ */
+
+#define SCORE_MAX_SERVERS (32)
+
+/* number of last round trip times median is taken of
+ */
+
+#define SCORE_NRTT (5)
+
+/* number of last queries success rate is counted over, each
+ * one is single bit of reach, like in ntp
+ */
+
+#define SCORE_NQUERIES (8)
+
+/* server not asked for that many seconds is dropped from file
+ */
+
+#define SCORE_MAX_AGE (30 * 86400ll)
+
+/* cost of server we know nothing about, new servers are asked
+ * after ones that worked well, but before ones that did not
+ */
+
+#define SCORE_UNKNOWN (100 * 1000000ll)
+
+
+/* score of single server address, all times are in nanoseconds,
+ * except for asked and seen, which are in unix seconds. Servers are
+ * asked before clock is set, so realtime is not known then, times of
+ * this run are kept on boot clock, and turned into realtime on save
+ */
+
+struct score
+{
+    struct resolv_addr  ra;       /* address of the server */
+    unsigned            reach;    /* bit per query, 1 when server answered */
+    int                 nasked;   /* queries counted in reach */
+    int                 stratum;  /* stratum from the last reply */
+    int64_t             jitter;   /* smoothed distance to selected offset */
+    int64_t             rtt[SCORE_NRTT];  /* last round trips, 0 for none */
+    unsigned            next;     /* slot in rtt for next round trip */
+    int64_t             asked;    /* realtime server was last asked at */
+    int64_t             seen;     /* realtime server last answered at */
+    int64_t             asked_bt; /* boottime of asked in this run, or 0 */
+    int64_t             seen_bt;  /* boottime of seen in this run, or 0 */
+};
+
+
+static struct
+{
+    const char    *path;      /* file scores are kept in, or NULL */
+    struct score   servers[SCORE_MAX_SERVERS];  /* known servers */
+    int            nservers;  /* number of elements in servers */
+} g_score;
+
+
+/* ==========================================================================
+                  _                __           ____
+    ____   _____ (_)_   __ ____ _ / /_ ___     / __/__  __ ____   _____ _____
+   / __ \ / ___// /| | / // __ `// __// _ \   / /_ / / / // __ \ / ___// ___/
+  / /_/ // /   / / | |/ // /_/ // /_ /  __/  / __// /_/ // / / // /__ (__  )
+ / .___//_/   /_/  |___/ \__,_/ \__/ \___/  /_/   \__,_//_/ /_/ \___//____/
+/_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Tells when server was last asked, for finding the one that was not
+    asked for the longest time. Servers asked in this run are newer than
+    any loaded from file, and are ordered by boot clock.
+
+    returns
+            key to compare, lower is older
+   ========================================================================== */
+
+
+static int64_t asked_key
+(
+    const struct score  *s    /* server to get key of */
+)
+{
+    return s->asked_bt ? INT64_MAX / 2 + s->asked_bt / NSEC_PER_SEC :
+        s->asked;
+}
+
+
+/* ==========================================================================
+    Looks for score of server at ra. When there is none, and add is set,
+    new entry is created, in place of server that was not asked for the
+    longest time, when table is full.
+
+    returns
+            score of the server, or NULL when not found and add is 0
+   ========================================================================== */
+
+
+static struct score *find
+(
+    const struct resolv_addr  *ra,   /* server to look for */
+    int                        add   /* create entry if it does not exist */
+)
+{
+    int                        i;    /* just an iterator */
+    struct score              *s;    /* found or evicted entry */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    for (i = 0; i != g_score.nservers; ++i)
+    {
+        s = &g_score.servers[i];
+        if (s->ra.addrlen == ra->addrlen &&
+                memcmp(&s->ra.addr, &ra->addr, ra->addrlen) == 0)
+            return s;
+    }
+
+    if (add == 0)
+        return NULL;
+
+    if (g_score.nservers != SCORE_MAX_SERVERS)
+        s = &g_score.servers[g_score.nservers++];
+    else
+        for (s = &g_score.servers[0], i = 1; i != SCORE_MAX_SERVERS; ++i)
+            if (asked_key(&g_score.servers[i]) < asked_key(s))
+                s = &g_score.servers[i];
+
+    memset(s, 0x00, sizeof(*s));
+    s->ra = *ra;
+    return s;
+}
+
+
+/* ==========================================================================
+    Computes median of last round trip times to server, so single slow
+    reply (retransmitted on the way, or server busy) does not make it
+    look slow.
+
+    returns
+            median round trip time, or 0 when server never answered
+   ========================================================================== */
+
+
+static int64_t median_rtt
+(
+    const struct score  *s         /* server to compute median for */
+)
+{
+    int                  i;        /* just an iterator */
+    int                  j;        /* just another iterator */
+    int                  n;        /* number of known round trips */
+    int64_t              v;        /* round trip being inserted */
+    int64_t              sorted[SCORE_NRTT];  /* known round trips, sorted */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    for (i = n = 0; i != SCORE_NRTT; ++i)
+    {
+        if ((v = s->rtt[i]) == 0)
+            continue;
+
+        for (j = n++; j > 0 && sorted[j - 1] > v; --j)
+            sorted[j] = sorted[j - 1];
+
+        sorted[j] = v;
+    }
+
+    return n ? sorted[n / 2] : 0;
+}
+
+
+/* ==========================================================================
+    Computes how much asking server costs us. That's roughly time it
+    takes to get good reply from it: its median round trip (plus its
+    jitter, since offset that wanders is worth less, and a bit for each
+    stratum), multiplied by how many times it has to be asked to answer
+    once.
+
+    returns
+            cost of server, lower is better
+   ========================================================================== */
+
+
+static int64_t cost
+(
+    const struct score  *s         /* server to compute cost of, or NULL */
+)
+{
+    int                  i;        /* just an iterator */
+    int                  answered; /* queries server answered */
+    int64_t              c;        /* computed cost */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (s == NULL || s->nasked == 0)
+        return SCORE_UNKNOWN;
+
+    for (i = answered = 0; i != s->nasked; ++i)
+        answered += (s->reach >> i) & 1;
+
+    if ((c = median_rtt(s)) == 0)
+        c = SCORE_UNKNOWN;
+
+    c += 2 * s->jitter + s->stratum * 1000000ll;
+    return c * (s->nasked + 1) / (answered + 1);
+}
+
+
+/* ==========================================================================
+                                        __     __ _
+                         ____   __  __ / /_   / /(_)_____
+                        / __ \ / / / // __ \ / // // ___/
+                       / /_/ // /_/ // /_/ // // // /__
+                      / .___/ \__,_//_.___//_//_/ \___/
+                     /_/
+               ____                     __   _
+              / __/__  __ ____   _____ / /_ (_)____   ____   _____
+             / /_ / / / // __ \ / ___// __// // __ \ / __ \ / ___/
+            / __// /_/ // / / // /__ / /_ / // /_/ // / / /(__  )
+           /_/   \__,_//_/ /_/ \___/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Loads scores saved by score_save() from path. When path is NULL,
+    scores are kept only in memory, which still helps when we keep
+    asking servers (-P).
+
+    Each line of file holds single server: address, reach, number of
+    queries in reach, stratum, jitter in us, unix times of last query
+    and last reply, and last round trips in us.
+   ========================================================================== */
+
+
+void score_load
+(
+    const char          *path      /* file to load scores from, or NULL */
+)
+{
+    FILE                *f;        /* opened score file */
+    struct score        *s;        /* score being loaded */
+    struct resolv_addr   ra;       /* address of server */
+    char                 line[256];  /* single line from file */
+    char                 ip[64];   /* address of server, as string */
+    unsigned             reach;    /* reach from file */
+    int                  nasked;   /* number of queries in reach */
+    int                  stratum;  /* stratum from file */
+    long long            v[3 + SCORE_NRTT];  /* jitter, times and rtts */
+    int                  i;        /* just an iterator */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    g_score.path = path;
+    if (path == NULL || (f = fopen(path, "r")) == NULL)
+        return;
+
+    while (fgets(line, sizeof(line), f))
+    {
+        if (sscanf(line, "%63s %x %d %d %lld %lld %lld %lld %lld %lld %lld "
+                    "%lld", ip, &reach, &nasked, &stratum, &v[0], &v[1],
+                    &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]) != 12)
+            continue;
+
+        if (nasked < 0 || nasked > SCORE_NQUERIES ||
+                resolv_numeric(ip, &ra) != 0)
+            continue;
+
+        s = find(&ra, 1);
+        s->reach = reach & ((1u << SCORE_NQUERIES) - 1);
+        s->nasked = nasked;
+        s->stratum = stratum;
+        s->jitter = v[0] * 1000;
+        s->asked = v[1];
+        s->seen = v[2];
+
+        for (i = 0; i != SCORE_NRTT; ++i)
+            if (v[3 + i] > 0)
+                s->rtt[s->next++ % SCORE_NRTT] = v[3 + i] * 1000;
+    }
+
+    fclose(f);
+
+    if (g_score.nservers)
+        log_print("n/loaded scores of %d servers\n", g_score.nservers);
+}
+
+
+/* ==========================================================================
+    Records result of single query to server at ra. sample is its best
+    reply, or NULL when server did not answer in time.
+   ========================================================================== */
+
+
+void score_probe
+(
+    const struct resolv_addr  *ra,      /* server that was asked */
+    const struct ntp_sample   *sample   /* its reply, or NULL */
+)
+{
+    struct score              *s;       /* score of the server */
+    int64_t                    now;     /* current boottime */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    /* realtime may still be far off, it's what we are about
+     * to fix, boot clock is right, and is converted on save
+     */
+
+    now = sysclock_boottime();
+    s = find(ra, 1);
+    s->reach = (s->reach << 1 | (sample != NULL)) &
+        ((1u << SCORE_NQUERIES) - 1);
+    s->nasked += s->nasked < SCORE_NQUERIES;
+    s->asked_bt = now;
+
+    if (sample == NULL)
+        return;
+
+    s->rtt[s->next++ % SCORE_NRTT] = sample->delay > 0 ? sample->delay : 1;
+    s->stratum = sample->stratum;
+    s->seen_bt = now;
+}
+
+
+/* ==========================================================================
+    Records how far offset of each sample was from offset that has been
+    selected from all of them. Server that keeps being away from others
+    has wrong or unstable time, and it's demoted.
+   ========================================================================== */
+
+
+void score_offsets
+(
+    const struct ntp_sample  *samples,  /* replies of single query */
+    int                       n,        /* number of elements in samples */
+    int64_t                   offset    /* offset selected from samples */
+)
+{
+    int                       i;        /* just an iterator */
+    int64_t                   d;        /* distance to selected offset */
+    struct score             *s;        /* score of server */
+    struct resolv_addr        ra;       /* address of server */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    for (i = 0; i != n; ++i)
+    {
+        memcpy(&ra.addr, &samples[i].addr, samples[i].addrlen);
+        ra.addrlen = samples[i].addrlen;
+        if ((s = find(&ra, 0)) == NULL)
+            continue;
+
+        d = samples[i].offset - offset;
+        d = d < 0 ? -d : d;
+        s->jitter = (3 * s->jitter + d) / 4;
+    }
+}
+
+
+/* ==========================================================================
+    Sorts addresses so the cheapest servers come first, see cost(). Sort
+    is stable, so servers we know nothing about stay in order resolver
+    gave them.
+   ========================================================================== */
+
+
+void score_sort
+(
+    struct resolv_addr  *addrs,    /* addresses to sort */
+    int                  naddrs    /* number of elements in addrs */
+)
+{
+    int                  i;        /* just an iterator */
+    int                  j;        /* just another iterator */
+    int64_t              c;        /* cost of address being inserted */
+    struct resolv_addr   ra;       /* address being inserted */
+    int64_t              costs[RESOLV_MAX_ADDRS];  /* cost of each address */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (g_score.nservers == 0)
+        return;
+
+    naddrs = naddrs < RESOLV_MAX_ADDRS ? naddrs : RESOLV_MAX_ADDRS;
+    for (i = 0; i != naddrs; ++i)
+    {
+        ra = addrs[i];
+        c = cost(find(&ra, 0));
+
+        for (j = i; j > 0 && costs[j - 1] > c; --j)
+        {
+            addrs[j] = addrs[j - 1];
+            costs[j] = costs[j - 1];
+        }
+
+        addrs[j] = ra;
+        costs[j] = c;
+    }
+}
+
+
+/* ==========================================================================
+    Tells round trip time to server we know from previous queries, so
+    its first request can have rto close to it, and not the one for
+    unknown servers.
+
+    returns
+            median round trip time to server, or 0 when not known
+   ========================================================================== */
+
+
+int64_t score_rtt
+(
+    const struct resolv_addr  *ra       /* server to get round trip of */
+)
+{
+    const struct score        *s;       /* score of the server */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    return (s = find(ra, 0)) ? median_rtt(s) : 0;
+}
+
+
+/* ==========================================================================
+    Saves scores to file given to score_load(). Must be called after
+    clock has been set, as times are stored in realtime. Servers that
+    were not asked for SCORE_MAX_AGE are forgotten, so pool addresses
+    that are long gone don't stay there forever. File is replaced
+    atomically, so crash in the middle of save leaves the old one.
+
+    returns
+            0       scores saved, or there is no file to save them to
+           -1       on error
+   ========================================================================== */
+
+
+int score_save(void)
+{
+    int                  i;        /* just an iterator */
+    int                  j;        /* just another iterator */
+    int                  n;        /* servers that are kept */
+    size_t               len;      /* length of data in buf */
+    int64_t              now;      /* current realtime in seconds */
+    int64_t              delta;    /* realtime minus boottime */
+    struct score        *s;        /* currently saved server */
+    char                 ip[NI_MAXHOST];  /* address as string */
+    char                 buf[SCORE_MAX_SERVERS * 160];  /* file */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (g_score.path == NULL)
+        return 0;
+
+    /* we are called after clock has been set, so realtime is
+     * right now, and boot clock times of this run can be turned
+     * into it
+     */
+
+    now = sysclock_now();
+    delta = now - sysclock_boottime();
+    now /= NSEC_PER_SEC;
+    len = 0;
+
+    for (i = n = 0; i != g_score.nservers; ++i)
+    {
+        s = &g_score.servers[i];
+        if (s->asked_bt)
+            s->asked = (s->asked_bt + delta) / NSEC_PER_SEC;
+
+        if (s->seen_bt)
+            s->seen = (s->seen_bt + delta) / NSEC_PER_SEC;
+
+        if (now - s->asked > SCORE_MAX_AGE)
+            continue;
+
+        g_score.servers[n++] = *s;
+        s = &g_score.servers[n - 1];
+
+        if (getnameinfo((const struct sockaddr *)&s->ra.addr, s->ra.addrlen,
+                    ip, sizeof(ip), NULL, 0, NI_NUMERICHOST) != 0)
+            continue;
+
+        len += snprintf(buf + len, sizeof(buf) - len, "%s %x %d %d %lld "
+                "%lld %lld", ip, s->reach, s->nasked, s->stratum,
+                (long long)(s->jitter / 1000), (long long)s->asked,
+                (long long)s->seen);
+
+        for (j = 0; j != SCORE_NRTT && len < sizeof(buf); ++j)
+            len += snprintf(buf + len, sizeof(buf) - len, " %lld",
+                    (long long)(s->rtt[j] / 1000));
+
+        if (len < sizeof(buf))
+            len += snprintf(buf + len, sizeof(buf) - len, "\n");
+
+        if (len >= sizeof(buf))
+            return -1;
+    }
+
+    g_score.nservers = n;
+    return state_write(g_score.path, buf, len);
+}
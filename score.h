@@ -0,0 +1,21 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ========================================================================== */
+
+#ifndef SCORE_H
+#define SCORE_H 1
+
+#include <stdint.h>
+
+#include "ntp.h"
+#include "resolv.h"
+
+void score_load(const char *);
+void score_probe(const struct resolv_addr *, const struct ntp_sample *);
+void score_offsets(const struct ntp_sample *, int, int64_t);
+void score_sort(struct resolv_addr *, int);
+int64_t score_rtt(const struct resolv_addr *);
+int score_save(void);
+
+#endif
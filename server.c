@@ -0,0 +1,829 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ==========================================================================
+         ----------------------------------------------------------------
+        / sntp responder for fleets that all ask for time at once,       \
+        | worker thread per core, each with its own SO_REUSEPORT socket, |
+        \ batching requests with recvmmsg() and replies with sendmmsg()  /
+         ----------------------------------------------------------------
+   ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include "ntpd-setwait-config.h"
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#if HAVE_SYS_EPOLL_H
+#   include <sys/epoll.h>
+#endif
+
+#include "log.h"
+#include "ntp.h"
+#include "server.h"
+#include "sysclock.h"
+
+
+/* ==========================================================================
+          __             __                     __   _
+     ____/ /___   _____ / /____ _ _____ ____ _ / /_ (_)____   ____   _____
+    / __  // _ \ / ___// // __ `// ___// __ `// __// // __ \ / __ \ / ___/
+   / /_/ //  __// /__ / // /_/ // /   / /_/ // /_ / // /_/ // / / /(__  )
+   \__,_/ \___/ \___//_/ \__,_//_/    \__,_/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+#define SERVER_PACKET_LEN (48)
+
+
+/* number of requests received, and replies sent, with single syscall
+ */
+
+#define SERVER_BATCH (64)
+
+
+/* size of table used to track request rate of clients, it's per
+ * thread, and direct mapped, client that collides with another one
+ * just starts over, which only makes limit less strict
+ */
+
+#define SERVER_RATE_TABLE (4096)
+
+
+/* requests client can send at once, before it's limited, ntp client
+ * sends burst of a few at start
+ */
+
+#define SERVER_RATE_BURST (8)
+
+
+/* limited client gets at most one kiss-o'-death in that time, other
+ * requests are dropped, so we are not used for amplification
+ */
+
+#define SERVER_KOD_GAP (NSEC_PER_SEC)
+
+
+/* dispersion grows by 15ppm of time since last sync, as in RFC 5905
+ */
+
+#define SERVER_PHI_PPM (15)
+
+
+/* highest stratum that is still valid, 16 means unsynchronized
+ */
+
+#define SERVER_MAX_STRATUM (15)
+
+
+/* times worker tries to take consistent copy of reference time before
+ * it gives up on batch, and after how many of them it starts yielding
+ * cpu to writer that got preempted in the middle of update
+ */
+
+#define SERVER_REF_TRIES (1000)
+#define SERVER_REF_SPINS (16)
+
+
+/* time we report, as received from upstream, readers take consistent
+ * copy under seqlock, as it's written by other thread
+ */
+
+struct ref
+{
+    uint32_t  seq;        /* seqlock counter, odd while writer updates */
+    int       synced;     /* 1 once we have time from upstream */
+    int       stratum;    /* our stratum, upstream one + 1 */
+    int64_t   reftime;    /* realtime of last sync */
+    int64_t   rootdelay;  /* round trip delay to reference clock */
+    int64_t   rootdisp;   /* dispersion to reference clock */
+    uint8_t   refid[4];   /* upstream server we sync with */
+};
+
+
+/* single client that sends us requests
+ */
+
+struct rate
+{
+    uint32_t  key;    /* hash of client address */
+    int64_t   last;   /* time of last request */
+    int64_t   score;  /* how far over the rate client is */
+    int64_t   kod;    /* time of last kiss-o'-death sent */
+};
+
+
+/* worker thread, each has its own socket and rate table, so they
+ * share nothing but ref
+ */
+
+struct worker
+{
+    pthread_t      thread;    /* worker thread */
+    int            fd;        /* socket bound to ntp port */
+    int            epfd;      /* epoll to sleep on fd */
+    int            cpu;       /* cpu thread is pinned to */
+    unsigned long  nreq;      /* requests answered */
+    unsigned long  nkod;      /* requests rate limited */
+    struct rate    rates[SERVER_RATE_TABLE];  /* rate of clients */
+};
+
+
+static struct
+{
+    struct ref      ref;       /* time we serve */
+    int64_t         interval;  /* min average request interval, or 0 */
+    int             nworkers;  /* number of elements in workers */
+    struct worker  *workers[SERVER_MAX_THREADS];  /* running workers */
+} g_server;
+
+
+/* ==========================================================================
+                  _                __           ____
+    ____   _____ (_)_   __ ____ _ / /_ ___     / __/__  __ ____   _____ _____
+   / __ \ / ___// /| | / // __ `// __// _ \   / /_ / / / // __ \ / ___// ___/
+  / /_/ // /   / / | |/ // /_/ // /_ /  __/  / __// /_/ // / / // /__ (__  )
+ / .___//_/   /_/  |___/ \__,_/ \__/ \___/  /_/   \__,_//_/ /_/ \___//____/
+/_/
+   ========================================================================== */
+
+
+#if HAVE_SYS_EPOLL_H && HAVE_RECVMMSG && HAVE_SENDMMSG
+
+
+/* ==========================================================================
+    Stores ns in ntp short format (16 bits of seconds and 16 bits of
+    fraction), as root delay and dispersion are sent.
+   ========================================================================== */
+
+
+static void ns_to_short
+(
+    int64_t         ns,   /* time to convert */
+    unsigned char  *buf   /* short will be stored here */
+)
+{
+    uint32_t        v;    /* value in 1/65536 of second */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    v = ns >= 65536 * NSEC_PER_SEC ? UINT32_MAX :
+        (uint32_t)(((uint64_t)ns << 16) / NSEC_PER_SEC);
+
+    buf[0] = v >> 24;
+    buf[1] = v >> 16;
+    buf[2] = v >> 8;
+    buf[3] = v;
+}
+
+
+/* ==========================================================================
+    Takes consistent copy of time we serve, writer never waits for
+    readers, so they just try again, when it was updating in meantime.
+
+    returns
+            0       ref holds consistent copy
+           -1       writer kept updating for SERVER_REF_TRIES tries
+   ========================================================================== */
+
+
+static int ref_read
+(
+    struct ref  *ref  /* copy will be stored here */
+)
+{
+    uint32_t     seq; /* seq before copy */
+    int          i;   /* just an iterator */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    for (i = 0; i != SERVER_REF_TRIES; ++i)
+    {
+        /* writer may be preempted in the middle of update, let
+         * it finish, instead of burning its cpu
+         */
+
+        if (i >= SERVER_REF_SPINS)
+            sched_yield();
+
+        seq = __atomic_load_n(&g_server.ref.seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+            continue;
+
+        memcpy(ref, &g_server.ref, sizeof(*ref));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        if (__atomic_load_n(&g_server.ref.seq, __ATOMIC_RELAXED) == seq)
+            return 0;
+    }
+
+    return -1;
+}
+
+
+/* ==========================================================================
+    Checks if client at addr sends requests faster than allowed. Each
+    request adds min interval to client's score, and time that passed
+    since previous one is taken from it, so client can send burst of
+    requests, but on average, not more often than interval.
+
+    returns
+            0       request is to be answered
+            1       client is limited, send it kiss-o'-death
+           -1       client is limited, and got kiss-o'-death recently,
+                    drop request
+   ========================================================================== */
+
+
+static int rate_check
+(
+    struct worker                  *w,     /* worker request came to */
+    const struct sockaddr_storage  *addr,  /* client's address */
+    int64_t                         now    /* time request arrived */
+)
+{
+    uint32_t                        key;   /* hash of address */
+    const unsigned char            *p;     /* address bytes */
+    size_t                          len;   /* length of address bytes */
+    size_t                          i;     /* just an iterator */
+    struct rate                    *r;     /* client's entry */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (g_server.interval == 0)
+        return 0;
+
+    /* port is not part of the key, client may use new port
+     * with each request
+     */
+
+    if (addr->ss_family == AF_INET6)
+    {
+        p = ((const struct sockaddr_in6 *)addr)->sin6_addr.s6_addr;
+        len = 16;
+    }
+    else
+    {
+        p = (const unsigned char *)
+            &((const struct sockaddr_in *)addr)->sin_addr.s_addr;
+        len = 4;
+    }
+
+    /* fnv-1a
+     */
+
+    key = 2166136261u;
+    for (i = 0; i != len; ++i)
+        key = (key ^ p[i]) * 16777619u;
+
+    r = &w->rates[key % SERVER_RATE_TABLE];
+    if (r->key != key || r->last == 0)
+    {
+        r->key = key;
+        r->score = 0;
+        r->kod = 0;
+    }
+    else
+    {
+        r->score -= now - r->last;
+        r->score = r->score < 0 ? 0 : r->score;
+    }
+
+    r->last = now;
+    r->score += g_server.interval;
+
+    if (r->score <= SERVER_RATE_BURST * g_server.interval)
+        return 0;
+
+    if (now - r->kod < SERVER_KOD_GAP)
+        return -1;
+
+    r->kod = now;
+    return 1;
+}
+
+
+/* ==========================================================================
+    Builds reply to client request. Request is received at rec, reply is
+    timestamped right before it's built, so time it waits in our batch
+    is not counted as network delay. Limited client gets RATE
+    kiss-o'-death, telling it to ask less often.
+
+    returns
+            0       reply is in rep
+           -1       request is not ntp client request
+   ========================================================================== */
+
+
+static int build_reply
+(
+    const unsigned char  *req,      /* request from client */
+    int                   len,      /* length of req */
+    int64_t               rec,      /* time request arrived */
+    const struct ref     *ref,      /* time we serve */
+    int                   kod,      /* send kiss-o'-death */
+    unsigned char        *rep       /* reply will be stored here */
+)
+{
+    int                   version;  /* version of client */
+    int64_t               now;      /* time reply is sent */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    version = req[0] >> 3 & 0x07;
+    if (len < SERVER_PACKET_LEN || (req[0] & 0x07) != 3 ||
+            version < 1 || version > 4)
+        return -1;
+
+    now = sysclock_now();
+    memset(rep, 0x00, SERVER_PACKET_LEN);
+
+    /* leap indicator is 0 (or 3 for kiss-o'-death), we answer
+     * in the same version client asked, mode 4 is server
+     */
+
+    rep[0] = (kod ? 3 : 0) << 6 | version << 3 | 4;
+    rep[1] = kod ? 0 : (unsigned char)ref->stratum;
+    rep[2] = kod && req[2] < 10 ? 10 : req[2];
+    rep[3] = 0xec;  /* precision, ~60ns, clock_gettime() resolution */
+
+    ns_to_short(ref->rootdelay, rep + 4);
+    ns_to_short(ref->rootdisp +
+            (now - ref->reftime) / 1000000 * SERVER_PHI_PPM, rep + 8);
+    memcpy(rep + 12, kod ? (const unsigned char *)"RATE" : ref->refid, 4);
+    ntp_ns_to_ts(ref->reftime, rep + 16);
+    memcpy(rep + 24, req + 40, 8);  /* origin is client's transmit */
+    ntp_ns_to_ts(rec, rep + 32);
+    ntp_ns_to_ts(now, rep + 40);
+    return 0;
+}
+
+
+/* ==========================================================================
+    Reads kernel receive timestamp from control messages of msg.
+
+    returns
+            receive time, or 0 when there is none
+   ========================================================================== */
+
+
+static int64_t rx_stamp
+(
+    struct msghdr   *msg  /* received message */
+)
+{
+    struct cmsghdr  *c;   /* single control message */
+    struct timespec  ts;  /* timestamp from kernel */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    for (c = CMSG_FIRSTHDR(msg); c; c = CMSG_NXTHDR(msg, c))
+    {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPNS)
+        {
+            memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+            return (int64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+        }
+    }
+
+    return 0;
+}
+
+
+/* ==========================================================================
+    Worker thread, answers requests that arrive on its socket, for as
+    long as program runs. Everything that can be received at once is
+    received with single recvmmsg(), and replies go out with single
+    sendmmsg(), so under load, cost of syscalls is shared by many
+    requests. Requests are timestamped by kernel when they arrive, so
+    time they wait in socket queue for us does not make reply less
+    accurate. Thread touches no memory of other workers.
+   ========================================================================== */
+
+
+static void *worker_run
+(
+    void                *arg     /* worker to run */
+)
+{
+    struct worker       *w;      /* worker we run */
+    int                  n;      /* number of received requests */
+    int                  nrep;   /* number of replies to send */
+    int                  i;      /* just an iterator */
+    int                  ret;    /* return value from functions */
+    int                  kod;    /* request is rate limited */
+    int64_t              rec;    /* time request arrived */
+    int64_t              now;    /* time batch was received */
+    struct ref           ref;    /* time we serve */
+    struct epoll_event   ev;     /* event on socket */
+    struct mmsghdr       in[SERVER_BATCH];   /* received requests */
+    struct mmsghdr       out[SERVER_BATCH];  /* replies to send */
+    struct iovec         iin[SERVER_BATCH];  /* buffers for requests */
+    struct iovec         iout[SERVER_BATCH]; /* buffers for replies */
+    struct sockaddr_storage  addr[SERVER_BATCH];  /* clients' addresses */
+    unsigned char        req[SERVER_BATCH][SERVER_PACKET_LEN + 16];
+    unsigned char        rep[SERVER_BATCH][SERVER_PACKET_LEN];
+    char                 control[SERVER_BATCH][64];  /* timestamps */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    w = arg;
+
+#if HAVE_PTHREAD_SETAFFINITY_NP
+    {
+        cpu_set_t  set;  /* cpu we run on */
+        /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+        /* socket and its queue stay hot in cache of one
+         * cpu, not pinning is not fatal
+         */
+
+        CPU_ZERO(&set);
+        CPU_SET(w->cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+#endif
+
+    memset(in, 0x00, sizeof(in));
+    memset(out, 0x00, sizeof(out));
+
+    for (;;)
+    {
+        if (epoll_wait(w->epfd, &ev, 1, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            return NULL;
+        }
+
+        for (;;)
+        {
+            for (i = 0; i != SERVER_BATCH; ++i)
+            {
+                iin[i].iov_base = req[i];
+                iin[i].iov_len = sizeof(req[i]);
+                in[i].msg_hdr.msg_name = &addr[i];
+                in[i].msg_hdr.msg_namelen = sizeof(addr[i]);
+                in[i].msg_hdr.msg_iov = &iin[i];
+                in[i].msg_hdr.msg_iovlen = 1;
+                in[i].msg_hdr.msg_control = control[i];
+                in[i].msg_hdr.msg_controllen = sizeof(control[i]);
+            }
+
+            if ((n = recvmmsg(w->fd, in, SERVER_BATCH, MSG_DONTWAIT,
+                            NULL)) <= 0)
+                break;
+
+            now = sysclock_now();
+
+            /* no time to give yet, or it's being changed all the
+             * time, client will ask again
+             */
+
+            if (ref_read(&ref) != 0 || !ref.synced)
+                n = 0;
+
+            for (i = 0, nrep = 0; i != n; ++i)
+            {
+                if ((rec = rx_stamp(&in[i].msg_hdr)) == 0)
+                    rec = now;
+
+                if ((kod = rate_check(w, &addr[i], rec)) < 0 ||
+                        build_reply(req[i], (int)in[i].msg_len, rec, &ref,
+                            kod, rep[nrep]) != 0)
+                    continue;
+
+                iout[nrep].iov_base = rep[nrep];
+                iout[nrep].iov_len = SERVER_PACKET_LEN;
+                out[nrep].msg_hdr.msg_name = &addr[i];
+                out[nrep].msg_hdr.msg_namelen = in[i].msg_hdr.msg_namelen;
+                out[nrep].msg_hdr.msg_iov = &iout[nrep];
+                out[nrep].msg_hdr.msg_iovlen = 1;
+                nrep++;
+
+                if (kod)
+                    __atomic_fetch_add(&w->nkod, 1, __ATOMIC_RELAXED);
+            }
+
+            /* send buffer may be full, rest of replies is
+             * dropped then, client will ask again
+             */
+
+            for (i = 0; i < nrep; i += ret)
+                if ((ret = sendmmsg(w->fd, out + i, nrep - i, 0)) <= 0)
+                    break;
+
+            __atomic_fetch_add(&w->nreq, nrep, __ATOMIC_RELAXED);
+
+            if (n < SERVER_BATCH)
+                break;
+        }
+    }
+}
+
+
+/* ==========================================================================
+    Opens socket bound to ntp port. It's ipv6 socket, that takes ipv4
+    requests too, unless ipv6 is not available. SO_REUSEPORT lets each
+    worker have its own socket, and kernel spreads clients between them.
+
+    returns
+            opened socket, or -1 on error
+   ========================================================================== */
+
+
+static int open_socket
+(
+    int                   port  /* port to listen on */
+)
+{
+    int                   fd;   /* opened socket */
+    int                   one;  /* value for setsockopt() */
+    int                   off;  /* value for setsockopt() */
+    struct sockaddr_in6   sin6; /* ipv6 address to bind to */
+    struct sockaddr_in    sin;  /* ipv4 address to bind to */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    one = 1;
+    off = 0;
+
+    if ((fd = socket(AF_INET6, SOCK_DGRAM | SOCK_CLOEXEC, 0)) >= 0)
+    {
+        memset(&sin6, 0x00, sizeof(sin6));
+        sin6.sin6_family = AF_INET6;
+        sin6.sin6_port = htons(port);
+        sin6.sin6_addr = in6addr_any;
+
+        setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+        setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one));
+
+        if (bind(fd, (struct sockaddr *)&sin6, sizeof(sin6)) == 0)
+            return fd;
+
+        close(fd);
+        if (errno != EADDRNOTAVAIL && errno != EAFNOSUPPORT)
+            return -1;
+    }
+
+    if ((fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0)
+        return -1;
+
+    memset(&sin, 0x00, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(port);
+    sin.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+    setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one));
+
+    if (bind(fd, (struct sockaddr *)&sin, sizeof(sin)) == 0)
+        return fd;
+
+    close(fd);
+    return -1;
+}
+
+
+#endif /* HAVE_SYS_EPOLL_H && HAVE_RECVMMSG && HAVE_SENDMMSG */
+
+
+/* ==========================================================================
+                                        __     __ _
+                         ____   __  __ / /_   / /(_)_____
+                        / __ \ / / / // __ \ / // // ___/
+                       / /_/ // /_/ // /_/ // // // /__
+                      / .___/ \__,_//_.___//_//_/ \___/
+                     /_/
+               ____                     __   _
+              / __/__  __ ____   _____ / /_ (_)____   ____   _____
+             / /_ / / / // __ \ / ___// __// // __ \ / __ \ / ___/
+            / __// /_/ // / / // /__ / /_ / // /_/ // / / /(__  )
+           /_/   \__,_//_/ /_/ \___/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Starts answering sntp requests on port, with n worker threads, each
+    pinned to its own cpu (0 means one per online cpu). Clients that ask
+    more often than rate requests per second on average (0 - no limit),
+    get RATE kiss-o'-death. Rate is counted per address, so keep it off,
+    or high, when many clients are behind nat.
+
+    Requests are not answered until server_synced() is called, clients
+    that get no reply will ask again, but those that get reply from
+    unsynchronized server may give up on it.
+
+    returns
+            0       server started
+           -1       on error
+   ========================================================================== */
+
+
+int server_start
+(
+    int                  port,  /* port to listen on */
+    int                  n,     /* number of worker threads, or 0 */
+    long                 rate   /* max request rate per client, or 0 */
+)
+{
+#if HAVE_SYS_EPOLL_H && HAVE_RECVMMSG && HAVE_SENDMMSG
+    int                  i;     /* just an iterator */
+    int                  ncpu;  /* number of online cpus */
+    struct worker       *w;     /* worker being started */
+    struct epoll_event   ev;    /* event to wait for */
+    sigset_t             all;   /* signals blocked in workers */
+    sigset_t             old;   /* signals blocked before */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    ncpu = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    ncpu = ncpu < 1 ? 1 : ncpu;
+    n = n ? n : ncpu;
+    n = n > SERVER_MAX_THREADS ? SERVER_MAX_THREADS : n;
+    g_server.interval = rate ? NSEC_PER_SEC / rate : 0;
+
+    /* signals are handled by main thread only, log is not
+     * safe to be flushed from other threads
+     */
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+
+    for (i = 0; i != n; ++i)
+    {
+        /* rate table is big, don't keep it on stack
+         */
+
+        if ((w = calloc(1, sizeof(*w))) == NULL)
+            break;
+
+        w->cpu = i % ncpu;
+        if ((w->fd = open_socket(port)) < 0)
+        {
+            error("e/server socket");
+            free(w);
+            break;
+        }
+
+        ev.events = EPOLLIN;
+        ev.data.ptr = w;
+        if ((w->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+                epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->fd, &ev) != 0 ||
+                pthread_create(&w->thread, NULL, worker_run, w) != 0)
+        {
+            error("e/server worker");
+            close(w->fd);
+            if (w->epfd >= 0)
+                close(w->epfd);
+            free(w);
+            break;
+        }
+
+        g_server.workers[g_server.nworkers++] = w;
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (g_server.nworkers == 0)
+        return -1;
+
+    log_print("n/serving time on port %d with %d workers\n", port,
+            g_server.nworkers);
+    return 0;
+#else
+    (void)port;
+    (void)n;
+    (void)rate;
+    log_print("e/server is not supported on this system\n");
+    return -1;
+#endif
+}
+
+
+/* ==========================================================================
+    Updates time we serve with samples we've got from upstream servers,
+    sample with the lowest error is our reference. We are one stratum
+    further than it, and our distance to reference clock is what we've
+    measured plus its distance. Must be called after offset has been
+    applied to the clock. First call makes us answer requests.
+   ========================================================================== */
+
+
+void server_synced
+(
+    const struct ntp_sample  *samples,  /* replies time came from */
+    int                       n         /* number of samples */
+)
+{
+    int                       i;        /* just an iterator */
+    int                       best;     /* sample with the lowest error */
+    const struct ntp_sample  *s;        /* best sample */
+    uint32_t                  h;        /* hash of ipv6 address */
+    const unsigned char      *p;        /* address bytes */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (g_server.nworkers == 0 || n <= 0)
+        return;
+
+    best = 0;
+    for (i = 1; i < n; ++i)
+        if (samples[i].delay / 2 + samples[i].rootdist <
+                samples[best].delay / 2 + samples[best].rootdist)
+            best = i;
+
+    s = &samples[best];
+
+    __atomic_fetch_add(&g_server.ref.seq, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    /* upstream that does not speak ntp (http, nmea) reports
+     * stratum 0, it's unknown, not reference clock, so we don't
+     * claim to be stratum 1, but the lowest valid stratum
+     */
+
+    g_server.ref.synced = 1;
+    g_server.ref.stratum = s->stratum == 0 || s->stratum + 1 > 15 ?
+        SERVER_MAX_STRATUM : s->stratum + 1;
+
+    /* we are called after offset has been applied, so reference
+     * time is taken from corrected clock, local receive time of
+     * sample may still be from before the clock was stepped
+     */
+
+    g_server.ref.reftime = sysclock_now();
+    g_server.ref.rootdelay = s->delay;
+    g_server.ref.rootdisp = s->rootdist;
+
+    /* refid is ipv4 address of upstream server, or hash of ipv6
+     * one, as RFC 5905 says
+     */
+
+    if (s->addr.ss_family == AF_INET)
+    {
+        memcpy(g_server.ref.refid,
+                &((const struct sockaddr_in *)&s->addr)->sin_addr, 4);
+    }
+    else
+    {
+        p = ((const struct sockaddr_in6 *)&s->addr)->sin6_addr.s6_addr;
+        for (h = 2166136261u, i = 0; i != 16; ++i)
+            h = (h ^ p[i]) * 16777619u;
+
+        memcpy(g_server.ref.refid, &h, 4);
+    }
+
+    __atomic_store_n(&g_server.ref.seq, g_server.ref.seq + 1,
+            __ATOMIC_RELEASE);
+}
+
+
+/* ==========================================================================
+    Reads how many requests were answered so far, and how many of them
+    were rate limited.
+   ========================================================================== */
+
+
+void server_stats
+(
+    unsigned long  *nreq,  /* number of requests will be stored here */
+    unsigned long  *nkod   /* number of limited requests stored here */
+)
+{
+    int             i;     /* just an iterator */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    *nreq = 0;
+    *nkod = 0;
+
+    for (i = 0; i != g_server.nworkers; ++i)
+    {
+        *nreq += __atomic_load_n(&g_server.workers[i]->nreq,
+                __ATOMIC_RELAXED);
+        *nkod += __atomic_load_n(&g_server.workers[i]->nkod,
+                __ATOMIC_RELAXED);
+    }
+}
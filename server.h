@@ -0,0 +1,20 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ========================================================================== */
+
+#ifndef SERVER_H
+#define SERVER_H 1
+
+#include "ntp.h"
+
+/* maximum number of worker threads
+ */
+
+#define SERVER_MAX_THREADS (64)
+
+int server_start(int, int, long);
+void server_synced(const struct ntp_sample *, int);
+void server_stats(unsigned long *, unsigned long *);
+
+#endif
@@ -0,0 +1,96 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ==========================================================================
+         ------------------------------------------------
+        < helpers for files that keep state between runs >
+         ------------------------------------------------
+   ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "state.h"
+
+
+
+
+/* ==========================================================================
+                                        __     __ _
+                         ____   __  __ / /_   / /(_)_____
+                        / __ \ / / / // __ \ / // // ___/
+                       / /_/ // /_/ // /_/ // // // /__
+                      / .___/ \__,_//_.___//_//_/ \___/
+                     /_/
+               ____                     __   _
+              / __/__  __ ____   _____ / /_ (_)____   ____   _____
+             / /_ / / / // __ \ / ___// __// // __ \ / __ \ / ___/
+            / __// /_/ // / / // /__ / /_ / // /_/ // / / /(__  )
+           /_/   \__,_//_/ /_/ \___/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Writes len bytes of data into file at path. Data is first written to
+    temporary file, synced to disk and then renamed over path, so we never
+    leave half written file when power is cut in the middle of write -
+    there is either old or new file.
+
+    returns
+            0       file has been written
+           -1       on error, path is not modified
+   ========================================================================== */
+
+
+int state_write
+(
+    const char  *path,      /* file to write data to */
+    const void  *data,      /* data to write */
+    size_t       len        /* length of data */
+)
+{
+    int          fd;        /* temporary file */
+    char         tmp[4096]; /* path to temporary file */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if ((size_t)snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= sizeof(tmp))
+        return -1;
+
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        error("w/open() state file");
+        return -1;
+    }
+
+    if (write(fd, data, len) != (ssize_t)len || fsync(fd) != 0)
+    {
+        error("w/write() state file");
+        close(fd);
+        unlink(tmp);
+        return -1;
+    }
+
+    close(fd);
+    if (rename(tmp, path) != 0)
+    {
+        error("w/rename() state file");
+        unlink(tmp);
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,13 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ========================================================================== */
+
+#ifndef STATE_H
+#define STATE_H 1
+
+#include <stddef.h>
+
+int state_write(const char *, const void *, size_t);
+
+#endif
@@ -0,0 +1,290 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ==========================================================================
+         -------------------------------------------------
+        / publishes sync status in mmaped file, for other \
+        \ processes to read without syscalls              /
+         -------------------------------------------------
+   ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include "ntpd-setwait-config.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <netdb.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if HAVE_LINUX_FUTEX_H
+#   include <linux/futex.h>
+#   include <sys/syscall.h>
+#endif
+
+#include "log.h"
+#include "ntp.h"
+#include "ntpd-setwait-status.h"
+#include "resolv.h"
+#include "status.h"
+#include "sysclock.h"
+
+
+/* ==========================================================================
+          __             __                     __   _
+     ____/ /___   _____ / /____ _ _____ ____ _ / /_ (_)____   ____   _____
+    / __  // _ \ / ___// // __ `// ___// __ `// __// // __ \ / __ \ / ___/
+   / /_/ //  __// /__ / // /_/ // /   / /_/ // /_ / // /_/ // / / /(__  )
+   \__,_/ \___/ \___//_/ \__,_//_/    \__,_/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+/* shared status, NULL when it's not published
+ */
+
+static struct ntpd_setwait_status  *g_status;
+
+
+/* ==========================================================================
+                  _                __           ____
+    ____   _____ (_)_   __ ____ _ / /_ ___     / __/__  __ ____   _____ _____
+   / __ \ / ___// /| | / // __ `// __// _ \   / /_ / / / // __ \ / ___// ___/
+  / /_/ // /   / / | |/ // /_/ // /_ /  __/  / __// /_/ // / / // /__ (__  )
+ / .___//_/   /_/  |___/ \__,_/ \__/ \___/  /_/   \__,_//_/ /_/ \___//____/
+/_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Starts update of shared status. Odd sequence tells readers that
+    status is being changed, and they have to try again. Fence keeps
+    stores to status from being seen before sequence is odd.
+   ========================================================================== */
+
+
+static void write_begin(void)
+{
+    __atomic_store_n(&g_status->seq, g_status->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    g_status->updated = sysclock_now();
+}
+
+
+/* ==========================================================================
+    Ends update of shared status, even sequence makes it consistent
+    again.
+   ========================================================================== */
+
+
+static void write_end(void)
+{
+    __atomic_store_n(&g_status->seq, g_status->seq + 1, __ATOMIC_RELEASE);
+}
+
+
+/* ==========================================================================
+                                        __     __ _
+                         ____   __  __ / /_   / /(_)_____
+                        / __ \ / / / // __ \ / // // ___/
+                       / /_/ // /_/ // /_/ // // // /__
+                      / .___/ \__,_//_.___//_//_/ \___/
+                     /_/
+               ____                     __   _
+              / __/__  __ ____   _____ / /_ (_)____   ____   _____
+             / /_ / / / // __ \ / ___// __// // __ \ / __ \ / ___/
+            / __// /_/ // / / // /__ / /_ / // /_/ // / / /(__  )
+           /_/   \__,_//_/ /_/ \___/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Creates status file at path, and maps it to memory, so later updates
+    are just memory writes. File is updated in place, and never replaced,
+    so readers that have it mapped from previous run see new values, and
+    keep seeing the last ones after we execute ntpd. Status is reset to
+    not synchronized.
+
+    returns
+            0       status is published
+           -1       on error
+   ========================================================================== */
+
+
+int status_open
+(
+    const char  *path  /* file to publish status in */
+)
+{
+    int          fd;   /* status file */
+    void        *p;    /* mapped file */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        error("w/open() status file");
+        return -1;
+    }
+
+    if (ftruncate(fd, sizeof(*g_status)) != 0)
+    {
+        error("w/ftruncate() status file");
+        close(fd);
+        return -1;
+    }
+
+    p = mmap(NULL, sizeof(*g_status), PROT_READ | PROT_WRITE, MAP_SHARED,
+            fd, 0);
+    close(fd);
+
+    if (p == MAP_FAILED)
+    {
+        error("w/mmap() status file");
+        return -1;
+    }
+
+    g_status = p;
+
+    /* previous writer may have died in the middle of update,
+     * leaving seq odd, so write_begin() would make it even,
+     * and readers would take half reset status as consistent,
+     * seq is made odd no matter what it was
+     */
+
+    __atomic_store_n(&g_status->seq, g_status->seq | 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    g_status->updated = sysclock_now();
+
+    /* magic goes last, so reader that opens file we've just
+     * created does not take zeroes as valid status
+     */
+
+    __atomic_store_n(&g_status->synced, 0, __ATOMIC_RELAXED);
+    g_status->version = NTPD_SETWAIT_STATUS_VERSION;
+    g_status->state = NTPD_SETWAIT_STATE_STARTING;
+    g_status->attempts = 0;
+    g_status->stepped = 0;
+    g_status->stratum = 0;
+    g_status->synced_at = 0;
+    g_status->offset = 0;
+    g_status->error = 0;
+    g_status->host[0] = '\0';
+    g_status->addr[0] = '\0';
+    __atomic_store_n(&g_status->magic, NTPD_SETWAIT_STATUS_MAGIC,
+            __ATOMIC_RELAXED);
+    write_end();
+    return 0;
+}
+
+
+/* ==========================================================================
+    Publishes what we are doing now, one of NTPD_SETWAIT_STATE_*.
+   ========================================================================== */
+
+
+void status_state
+(
+    int  state  /* new state */
+)
+{
+    if (g_status == NULL)
+        return;
+
+    write_begin();
+    g_status->state = state;
+    write_end();
+}
+
+
+/* ==========================================================================
+    Counts attempt to get time from ntp.
+   ========================================================================== */
+
+
+void status_attempt(void)
+{
+    if (g_status == NULL)
+        return;
+
+    write_begin();
+    g_status->state = NTPD_SETWAIT_STATE_QUERYING;
+    g_status->attempts++;
+    write_end();
+}
+
+
+/* ==========================================================================
+    Publishes that time is valid now, and wakes up everyone that waits
+    for it. Of all replies, the one with the lowest max error (half of
+    round trip delay, plus distance of server to its reference clock)
+    is published as source of time, with that error as estimated error
+    of our clock.
+   ========================================================================== */
+
+
+void status_synced
+(
+    const struct ntp_sample  *samples,  /* replies time came from */
+    int                       n,        /* number of samples */
+    const struct resolv      *rv,       /* servers samples came from */
+    int64_t                   offset,   /* offset clock was set with */
+    int                       stepped   /* clock was stepped */
+)
+{
+    int                       i;        /* just an iterator */
+    int                       best;     /* sample with the lowest error */
+    char                      addr[NI_MAXHOST];  /* address of server */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (g_status == NULL)
+        return;
+
+    best = 0;
+    for (i = 1; i < n; ++i)
+        if (samples[i].delay / 2 + samples[i].rootdist <
+                samples[best].delay / 2 + samples[best].rootdist)
+            best = i;
+
+    write_begin();
+    g_status->state = NTPD_SETWAIT_STATE_SYNCED;
+    g_status->stepped = stepped;
+    g_status->synced_at = sysclock_now();
+    g_status->offset = offset;
+
+    if (n > 0)
+    {
+        g_status->error = samples[best].delay / 2 + samples[best].rootdist;
+        g_status->stratum = samples[best].stratum;
+        snprintf(g_status->host, sizeof(g_status->host), "%s",
+                rv[samples[best].server].host);
+        snprintf(g_status->addr, sizeof(g_status->addr), "%s",
+                ntp_addr_str(&samples[best], addr, sizeof(addr)));
+    }
+
+    write_end();
+
+    /* synced is set after status is consistent, so reader
+     * that sees it, reads final values
+     */
+
+    __atomic_store_n(&g_status->synced, 1, __ATOMIC_RELEASE);
+
+#if HAVE_LINUX_FUTEX_H
+    syscall(SYS_futex, &g_status->synced, FUTEX_WAKE, INT_MAX,
+            NULL, NULL, 0);
+#endif
+}
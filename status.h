@@ -0,0 +1,20 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ========================================================================== */
+
+#ifndef STATUS_H
+#define STATUS_H 1
+
+#include <stdint.h>
+
+#include "ntp.h"
+#include "resolv.h"
+
+int status_open(const char *);
+void status_state(int);
+void status_attempt(void);
+void status_synced(const struct ntp_sample *, int, const struct resolv *,
+        int64_t, int);
+
+#endif
@@ -0,0 +1,374 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ==========================================================================
+         --------------------------------------------------------
+        / keeps watch over ntpd, restarts it when it dies,       \
+        \ and asks for re-sync when someone knocks the clock off /
+         --------------------------------------------------------
+   ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include "ntpd-setwait-config.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#if HAVE_SYS_PRCTL_H
+#   include <sys/prctl.h>
+#endif
+
+#ifdef __linux__
+#   include <sys/syscall.h>
+#endif
+
+#include "log.h"
+#include "supervise.h"
+#include "sysclock.h"
+
+
+/* ==========================================================================
+          __             __                     __   _
+     ____/ /___   _____ / /____ _ _____ ____ _ / /_ (_)____   ____   _____
+    / __  // _ \ / ___// // __ `// ___// __ `// __// // __ \ / __ \ / ___/
+   / /_/ //  __// /__ / // /_/ // /   / /_/ // /_ / // /_/ // / / /(__  )
+   \__,_/ \___/ \___//_/ \__,_//_/    \__,_/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+/* time ntpd has to exit after SIGTERM, before it's killed
+ */
+
+#define SUPERVISE_STOP_MS (5000)
+
+
+/* without pidfd, ntpd is checked with waitpid() that often
+ */
+
+#define SUPERVISE_CHECK_MS (1000)
+
+
+/* ==========================================================================
+                  _                __           ____
+    ____   _____ (_)_   __ ____ _ / /_ ___     / __/__  __ ____   _____ _____
+   / __ \ / ___// /| | / // __ `// __// _ \   / /_ / / / // __ \ / ___// ___/
+  / /_/ // /   / / | |/ // /_/ // /_ /  __/  / __// /_/ // / / // /__ (__  )
+ / .___//_/   /_/  |___/ \__,_/ \__/ \___/  /_/   \__,_//_/ /_/ \___//____/
+/_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Opens pidfd of process, which becomes readable when process exits, so
+    we can sleep on it with poll(), together with clock jump timer.
+
+    returns
+            >=0     pidfd
+           -1       not supported (linux older than 5.3)
+   ========================================================================== */
+
+
+static int open_pidfd
+(
+    pid_t  pid  /* process to open pidfd for */
+)
+{
+#ifdef SYS_pidfd_open
+    return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void)pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+
+/* ==========================================================================
+    Reaps ntpd that has exited, logs why it did, and computes delay
+    before it is started again. When ntpd ran for shorter than max delay,
+    it's probably crashing on start, so delay is doubled each time, up to
+    max, otherwise it starts over from min.
+
+    returns
+            1       ntpd has exited, and was reaped
+            0       ntpd is still running
+   ========================================================================== */
+
+
+static int reap
+(
+    struct supervise  *s,       /* supervisor of ntpd */
+    int                options  /* options for waitpid() */
+)
+{
+    int                st;      /* exit status of ntpd */
+    int64_t            ran;     /* time ntpd ran for */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (waitpid(s->pid, &st, options) <= 0)
+        return 0;
+
+    ran = sysclock_boottime() - s->started;
+
+    if (WIFSIGNALED(st))
+        log_print("w/ntpd killed by signal %d (%s) after %.0fs\n",
+                WTERMSIG(st), strsignal(WTERMSIG(st)),
+                (double)ran / NSEC_PER_SEC);
+    else
+        log_print("w/ntpd exited with status %d after %.0fs\n",
+                WEXITSTATUS(st), (double)ran / NSEC_PER_SEC);
+
+    if (s->pidfd >= 0)
+        close(s->pidfd);
+
+    s->pid = -1;
+    s->pidfd = -1;
+
+    if (ran >= s->max || s->delay == 0)
+        s->delay = s->min;
+    else
+        s->delay = s->delay * 2 > s->max ? s->max : s->delay * 2;
+
+    return 1;
+}
+
+
+/* ==========================================================================
+    Starts ntpd, after restart delay, if it exited before. ntpd must
+    stay in foreground (-n or -d), otherwise we will take its fork for
+    exit. Child gets SIGTERM when supervisor dies, so ntpd does not
+    outlive us and end up running twice after init system restarts us.
+
+    returns
+            0       ntpd started
+           -1       on error
+   ========================================================================== */
+
+
+static int start
+(
+    struct supervise  *s,      /* supervisor of ntpd */
+    char              *argv[], /* ntpd path followed by its arguments */
+    char              *envp[]  /* environment for ntpd */
+)
+{
+    struct timespec    ts;     /* time to sleep */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (s->starts && s->delay)
+    {
+        log_print("n/restarting ntpd in %.1fs\n",
+                (double)s->delay / NSEC_PER_SEC);
+
+        ts.tv_sec = s->delay / NSEC_PER_SEC;
+        ts.tv_nsec = s->delay % NSEC_PER_SEC;
+        while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+            ;
+    }
+
+    log_print("n/executing ntpd: %s\n", argv[0]);
+
+    /* whatever is in log buffer, would be written by child
+     * too, if it failed to execute ntpd
+     */
+
+    log_flush();
+    s->started = sysclock_boottime();
+    s->starts++;
+
+    if ((s->pid = fork()) < 0)
+    {
+        error("e/fork() ntpd");
+        s->delay = s->delay * 2 > s->max ? s->max : s->delay * 2;
+        s->delay = s->delay ? s->delay : s->min;
+        return -1;
+    }
+
+    if (s->pid == 0)
+    {
+#if HAVE_SYS_PRCTL_H
+        prctl(PR_SET_PDEATHSIG, SIGTERM, 0, 0, 0);
+#endif
+        execve(argv[0], argv, envp);
+
+        /* parent will tell about it, when it reaps us
+         */
+
+        _exit(127);
+    }
+
+    s->pidfd = open_pidfd(s->pid);
+
+    /* our own step before start is not a reason to wake up
+     */
+
+    sysclock_jumped(s->jfd);
+    return 0;
+}
+
+
+/* ==========================================================================
+                                        __     __ _
+                         ____   __  __ / /_   / /(_)_____
+                        / __ \ / / / // __ \ / // // ___/
+                       / /_/ // /_/ // /_/ // // // /__
+                      / .___/ \__,_//_.___//_//_/ \___/
+                     /_/
+               ____                     __   _
+              / __/__  __ ____   _____ / /_ (_)____   ____   _____
+             / /_ / / / // __ \ / ___// __// // __ \ / __ \ / ___/
+            / __// /_/ // / / // /__ / /_ / // /_/ // / / /(__  )
+           /_/   \__,_//_/ /_/ \___/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Prepares supervisor, that restarts ntpd no sooner than min and no
+    later than max seconds after it exits.
+   ========================================================================== */
+
+
+void supervise_init
+(
+    struct supervise  *s,    /* supervisor to initialize */
+    long               min,  /* min restart delay in seconds */
+    long               max   /* max restart delay in seconds */
+)
+{
+    memset(s, 0x00, sizeof(*s));
+    s->pid = -1;
+    s->pidfd = -1;
+    s->min = min * NSEC_PER_SEC;
+    s->max = max * NSEC_PER_SEC;
+
+    /* without it, we won't know about clock being set, but
+     * can still restart ntpd
+     */
+
+    if ((s->jfd = sysclock_jump_open()) < 0)
+        error("w/sysclock_jump_open()");
+}
+
+
+/* ==========================================================================
+    Starts ntpd, unless it's already running, and sleeps until it exits,
+    or until someone sets the clock (like user with date, or clock being
+    set after resume). Clock can be set by ntpd itself too, so it's up
+    to caller to check if time is still good, and to stop ntpd with
+    supervise_stop() when it's not.
+
+    returns
+            SUPERVISE_EXITED    ntpd has exited (or could not start), it
+                                is to be started again with next call
+            SUPERVISE_JUMPED    clock has been set
+   ========================================================================== */
+
+
+int supervise_watch
+(
+    struct supervise  *s,       /* supervisor of ntpd */
+    char              *argv[],  /* ntpd path followed by its arguments */
+    char              *envp[]   /* environment for ntpd */
+)
+{
+    struct pollfd      pfd[2];  /* ntpd and clock jump timer */
+    int                timeout; /* poll timeout without pidfd */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (s->pid < 0 && start(s, argv, envp) != 0)
+        return SUPERVISE_EXITED;
+
+    pfd[0].fd = s->pidfd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = s->jfd;
+    pfd[1].events = POLLIN;
+    timeout = s->pidfd < 0 ? SUPERVISE_CHECK_MS : -1;
+
+    for (;;)
+    {
+        if (poll(pfd, 2, timeout) < 0 && errno != EINTR)
+        {
+            /* should not happen, but don't spin, if it does
+             */
+
+            error("w/poll() supervisor");
+            pfd[0].fd = -1;
+            timeout = SUPERVISE_CHECK_MS;
+            continue;
+        }
+
+        if (reap(s, WNOHANG))
+            return SUPERVISE_EXITED;
+
+        if (pfd[1].revents && sysclock_jumped(s->jfd))
+        {
+            log_print("w/clock has been set, checking time\n");
+            return SUPERVISE_JUMPED;
+        }
+    }
+}
+
+
+/* ==========================================================================
+    Stops ntpd, if it's running, so we can set time without it fighting
+    us. It gets SIGTERM, and SIGKILL if it does not exit in time. It is
+    started again with next supervise_watch(), right away.
+   ========================================================================== */
+
+
+void supervise_stop
+(
+    struct supervise  *s      /* supervisor of ntpd */
+)
+{
+    int                i;     /* just an iterator */
+    struct timespec    ts;    /* time to sleep */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (s->pid < 0)
+        return;
+
+    log_print("n/stopping ntpd to set time\n");
+    kill(s->pid, SIGTERM);
+
+    ts.tv_sec = 0;
+    ts.tv_nsec = 10 * 1000000l;
+    for (i = 0; i != SUPERVISE_STOP_MS / 10; ++i)
+    {
+        if (reap(s, WNOHANG))
+            break;
+
+        nanosleep(&ts, NULL);
+    }
+
+    if (s->pid >= 0)
+    {
+        kill(s->pid, SIGKILL);
+        reap(s, 0);
+    }
+
+    /* we stopped it, it did not crash
+     */
+
+    s->delay = 0;
+}
@@ -0,0 +1,37 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ========================================================================== */
+
+#ifndef SUPERVISE_H
+#define SUPERVISE_H 1
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/* reasons supervise_watch() returns for
+ */
+
+#define SUPERVISE_EXITED (0)  /* ntpd is not running anymore */
+#define SUPERVISE_JUMPED (1)  /* clock was set, ntpd is still running */
+
+/* state of ntpd supervisor (-K option), all times are in nanoseconds
+ */
+
+struct supervise
+{
+    pid_t    pid;      /* pid of running ntpd, or -1 */
+    int      pidfd;    /* pidfd of running ntpd, or -1 */
+    int      jfd;      /* timer cancelled when clock is set, or -1 */
+    int      starts;   /* number of times ntpd was started */
+    int64_t  started;  /* boot time ntpd was last started at */
+    int64_t  delay;    /* delay before next start of ntpd */
+    int64_t  min;      /* min restart delay */
+    int64_t  max;      /* max restart delay */
+};
+
+void supervise_init(struct supervise *, long, long);
+int supervise_watch(struct supervise *, char *[], char *[]);
+void supervise_stop(struct supervise *);
+
+#endif
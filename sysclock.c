@@ -0,0 +1,565 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ==========================================================================
+         --------------------------------------------
+        / reading and setting system wall clock with \
+        \ nanosecond precision                       /
+         --------------------------------------------
+   ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include "ntpd-setwait-config.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if HAVE_CLOCK_ADJTIME
+#   include <sys/timex.h>
+#endif
+
+#if HAVE_SYS_TIMERFD_H
+#   include <sys/timerfd.h>
+#endif
+
+#include "backend.h"
+#include "sysclock.h"
+
+
+/* ==========================================================================
+          __             __                     __   _
+     ____/ /___   _____ / /____ _ _____ ____ _ / /_ (_)____   ____   _____
+    / __  // _ \ / ___// // __ `// ___// __ `// __// // __ \ / __ \ / ___/
+   / /_/ //  __// /__ / // /_/ // /   / /_/ // /_ / // /_/ // / / /(__  )
+   \__,_/ \___/ \___//_/ \__,_//_/    \__,_/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+/* CLOCK_BOOTTIME keeps counting when system is suspended, so
+ * we don't oversleep after resume on battery devices
+ */
+
+#ifdef CLOCK_BOOTTIME
+#   define SYSCLOCK_BOOTTIME CLOCK_BOOTTIME
+#else
+#   define SYSCLOCK_BOOTTIME CLOCK_MONOTONIC
+#endif
+
+
+/* while slewing, clock runs faster or slower by this many percents,
+ * 10% is the most kernel allows to change tick length by
+ */
+
+#define SYSCLOCK_SLEW_PERCENT (10)
+
+
+/* ==========================================================================
+                  _                __           ____
+    ____   _____ (_)_   __ ____ _ / /_ ___     / __/__  __ ____   _____ _____
+   / __ \ / ___// /| | / // __ `// __// _ \   / /_ / / / // __ \ / ___// ___/
+  / /_/ // /   / / | |/ // /_/ // /_ /  __/  / __// /_/ // / / // /__ (__  )
+ / .___//_/   /_/  |___/ \__,_/ \__/ \___/  /_/   \__,_//_/ /_/ \___//____/
+/_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Arms realtime timer, that is cancelled when someone sets the clock.
+    It expires a year from now, which is as good as never.
+
+    returns
+            0       timer armed
+           -1       on error, errno is set
+   ========================================================================== */
+
+
+#if HAVE_SYS_TIMERFD_H
+
+
+static int jump_arm
+(
+    int                 fd    /* timerfd to arm */
+)
+{
+    struct itimerspec   its;  /* time to expire at */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    memset(&its, 0x00, sizeof(its));
+    its.it_value.tv_sec = time(NULL) + 365 * 86400;
+
+    return timerfd_settime(fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET,
+            &its, NULL);
+}
+
+
+#endif /* HAVE_SYS_TIMERFD_H */
+
+
+/* ==========================================================================
+                                        __     __ _
+                         ____   __  __ / /_   / /(_)_____
+                        / __ \ / / / // __ \ / // // ___/
+                       / /_/ // /_/ // /_/ // // // /__
+                      / .___/ \__,_//_.___//_//_/ \___/
+                     /_/
+               ____                     __   _
+              / __/__  __ ____   _____ / /_ (_)____   ____   _____
+             / /_ / / / // __ \ / ___// __// // __ \ / __ \ / ___/
+            / __// /_/ // / / // /__ / /_ / // /_/ // / / /(__  )
+           /_/   \__,_//_/ /_/ \___/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Returns current wall clock time as number of nanoseconds since unix
+    epoch. 64 bits of nanoseconds are enough to hold dates up to year 2262.
+   ========================================================================== */
+
+
+int64_t sysclock_now(void)
+{
+    struct timespec  ts;  /* current wall clock time */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    backend_clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+
+/* ==========================================================================
+    Returns time since boot in nanoseconds, including time system spent in
+    suspend. Use it to measure time intervals, as it is not affected by
+    wall clock steps.
+   ========================================================================== */
+
+
+int64_t sysclock_boottime(void)
+{
+    struct timespec  ts;  /* current boot time */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    backend_clock_gettime(SYSCLOCK_BOOTTIME, &ts);
+    return (int64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+
+/* ==========================================================================
+    Reads frequency correction kernel currently applies to system clock,
+    as set by ntpd that ran before us, or left from previous boot on some
+    systems.
+
+    returns
+            0       frequency is stored in ppm
+           -1       on error, errno is set
+   ========================================================================== */
+
+
+int sysclock_freq
+(
+    double        *ppm  /* frequency correction will be stored here */
+)
+{
+#if HAVE_CLOCK_ADJTIME
+    struct timex   tx;  /* kernel clock parameters */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    memset(&tx, 0x00, sizeof(tx));
+    if (backend_clock_adjtime(CLOCK_REALTIME, &tx) < 0)
+        return -1;
+
+    /* freq is in ppm with 16 bit fraction
+     */
+
+    *ppm = (double)tx.freq / 65536;
+    return 0;
+#else
+    (void)ppm;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+
+/* ==========================================================================
+    Opens timer that becomes readable when realtime clock is set by
+    anyone (including us), so sleeping program learns about clock jump
+    right away, be it date command or clock set after resume. Check it
+    with sysclock_jumped().
+
+    returns
+            >=0     timer to poll() for POLLIN
+           -1       on error (kernel older than 3.0, or not linux)
+   ========================================================================== */
+
+
+int sysclock_jump_open(void)
+{
+#if HAVE_SYS_TIMERFD_H
+    int  fd;  /* opened timer */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if ((fd = timerfd_create(CLOCK_REALTIME,
+                    TFD_CLOEXEC | TFD_NONBLOCK)) < 0)
+        return -1;
+
+    if (jump_arm(fd) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+
+/* ==========================================================================
+    Checks if clock has been set since last check, and re-arms timer,
+    as cancelled one stays readable until then. Does not block, so it
+    can be called after our own step, to not take it for someone else's.
+
+    returns
+            1       clock has been set
+            0       not set, or fd is -1
+   ========================================================================== */
+
+
+int sysclock_jumped
+(
+    int       fd      /* timer from sysclock_jump_open() */
+)
+{
+#if HAVE_SYS_TIMERFD_H
+    uint64_t  n;      /* expirations of timer */
+    int       jumped; /* clock has been set */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (fd < 0)
+        return 0;
+
+    if (read(fd, &n, sizeof(n)) < 0)
+    {
+        if (errno == EAGAIN)
+            return 0;
+
+        jumped = errno == ECANCELED;
+    }
+    else
+    {
+        /* year has passed without anyone setting the clock
+         */
+
+        jumped = 0;
+    }
+
+    jump_arm(fd);
+    return jumped;
+#else
+    (void)fd;
+    return 0;
+#endif
+}
+
+
+#if NTPD_SETWAIT_BENCH
+
+
+/* ==========================================================================
+    Benchmark build runs against fake ntp servers with skewed clocks, so
+    real clock is never touched, step is only pretended.
+
+    returns
+            0       always
+   ========================================================================== */
+
+
+int sysclock_step
+(
+    int64_t  offset  /* nanoseconds to add to current time */
+)
+{
+    (void)offset;
+    return 0;
+}
+
+
+/* ==========================================================================
+    Same as sysclock_step(), slew is only pretended, and it's done in no
+    time.
+
+    returns
+            0       always
+   ========================================================================== */
+
+
+int sysclock_slew
+(
+    int64_t  offset,  /* nanoseconds to add to current time */
+    int64_t  max      /* max time to slew for */
+)
+{
+    (void)offset;
+    (void)max;
+    return 0;
+}
+
+
+/* ==========================================================================
+    Same as sysclock_step(), clock is not disciplined in benchmark.
+
+    returns
+            0       always
+   ========================================================================== */
+
+
+int sysclock_discipline
+(
+    int64_t  offset,  /* measured offset of clock */
+    int64_t  error,   /* max error of offset */
+    int      tc       /* time constant of kernel pll */
+)
+{
+    (void)offset;
+    (void)error;
+    (void)tc;
+    return 0;
+}
+
+
+#else /* NTPD_SETWAIT_BENCH */
+
+
+/* ==========================================================================
+    Steps system clock by offset nanoseconds (positive offset moves clock
+    forward). Where clock_adjtime() is available, kernel is asked to add
+    offset to the clock with ADJ_SETOFFSET, which is atomic - no time
+    passes between reading current time and setting new one. Otherwise
+    current time is read and set again with clock_settime() as quickly
+    as possible.
+
+    returns
+            0       clock has been stepped
+           -1       on error, errno is set
+   ========================================================================== */
+
+
+int sysclock_step
+(
+    int64_t          offset  /* nanoseconds to add to current time */
+)
+{
+    int64_t          sec;    /* whole seconds part of offset */
+    int64_t          nsec;   /* nanoseconds part of offset, always >= 0 */
+#if HAVE_CLOCK_ADJTIME
+    struct timex     tx;     /* offset to pass to kernel */
+#else
+    struct timespec  ts;     /* new time to set */
+    int64_t          now;    /* current time */
+#endif
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+#if HAVE_CLOCK_ADJTIME
+    /* kernel expects nanoseconds part to be always positive,
+     * so -1.5s must be passed as -2s + 0.5s
+     */
+
+    sec = offset / NSEC_PER_SEC;
+    nsec = offset % NSEC_PER_SEC;
+    if (nsec < 0)
+    {
+        sec -= 1;
+        nsec += NSEC_PER_SEC;
+    }
+
+    memset(&tx, 0x00, sizeof(tx));
+    tx.modes = ADJ_SETOFFSET | ADJ_NANO;
+    tx.time.tv_sec = sec;
+    tx.time.tv_usec = nsec;  /* with ADJ_NANO this holds nanoseconds */
+
+    return backend_clock_adjtime(CLOCK_REALTIME, &tx) < 0 ? -1 : 0;
+#else
+    now = sysclock_now() + offset;
+    sec = now / NSEC_PER_SEC;
+    nsec = now % NSEC_PER_SEC;
+
+    ts.tv_sec = sec;
+    ts.tv_nsec = nsec;
+
+    return backend_clock_settime(CLOCK_REALTIME, &ts);
+#endif
+}
+
+
+/* ==========================================================================
+    Slews system clock by offset nanoseconds, without jumps. Length of
+    kernel tick is changed by SYSCLOCK_SLEW_PERCENT, so clock runs
+    faster (positive offset) or slower, and after enough time passes,
+    tick is set back to nominal. 1 second takes 10 seconds to slew.
+    That is way faster than ntpd does it, since it's limited to 500ppm
+    and 1 second would take more than half an hour.
+
+    Function blocks for the time of slew, but at most max nanoseconds
+    (of monotonic time), in which case only part of offset is slewed.
+    Termination signals are held during that time, so clock is never
+    left running with changed tick, but they end the slew early and
+    are delivered again right after tick is restored.
+
+    returns
+            0       clock has been slewed
+           -1       on error, errno is set
+   ========================================================================== */
+
+
+int sysclock_slew
+(
+    int64_t          offset,  /* nanoseconds to add to current time */
+    int64_t          max      /* max time to slew for */
+)
+{
+#if HAVE_CLOCK_ADJTIME
+    long             nominal; /* nominal tick length in us */
+    long             delta;   /* change of tick length in us */
+    int64_t          abs;     /* absolute value of offset */
+    int64_t          t;       /* monotonic time slew will take */
+    int              ret;     /* return value from functions */
+    int              sig;     /* signal that arrived during slew */
+    struct timex     tx;      /* tick to set */
+    struct timespec  ts;      /* time to wait for */
+    sigset_t         set;     /* signals to hold during slew */
+    sigset_t         old;     /* signal mask before slew */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    nominal = 1000000 / sysconf(_SC_CLK_TCK);
+    delta = nominal * SYSCLOCK_SLEW_PERCENT / 100;
+    abs = offset < 0 ? -offset : offset;
+
+    /* clock gains abs after abs * nominal / delta of real time,
+     * but monotonic clock (which we wait with) is slewed too,
+     * and during that time it gains or loses abs as well
+     */
+
+    t = abs * nominal / delta + (offset < 0 ? -abs : abs);
+    t = t > max ? max : t;
+
+    if (t <= 0)
+        return 0;
+
+    sig = 0;
+    sigemptyset(&set);
+    sigaddset(&set, SIGTERM);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGHUP);
+    sigprocmask(SIG_BLOCK, &set, &old);
+
+    memset(&tx, 0x00, sizeof(tx));
+    tx.modes = ADJ_TICK;
+    tx.tick = nominal + (offset < 0 ? -delta : delta);
+
+    if ((ret = backend_clock_adjtime(CLOCK_REALTIME, &tx)) >= 0)
+    {
+        ts.tv_sec = t / NSEC_PER_SEC;
+        ts.tv_nsec = t % NSEC_PER_SEC;
+
+        /* sigtimedwait() returns when time is up, or takes
+         * signal that arrived, we raise it again once tick is
+         * restored
+         */
+
+        while ((sig = backend_sigtimedwait(&set, NULL, &ts)) < 0 &&
+                errno == EINTR)
+            ;
+
+        tx.tick = nominal;
+        ret = backend_clock_adjtime(CLOCK_REALTIME, &tx);
+    }
+
+    sigprocmask(SIG_SETMASK, &old, NULL);
+    if (sig > 0)
+        raise(sig);
+
+    return ret < 0 ? -1 : 0;
+#else
+    (void)offset;
+    (void)max;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+
+/* ==========================================================================
+    Passes measured offset to kernel clock discipline (phase locked loop
+    from RFC 5905, implemented in kernel), which slews it out gradually,
+    and estimates frequency error of the clock along the way, so we can
+    poll server rarely. Time constant tc sets how fast loop reacts, it
+    should grow with poll interval (log2 of interval in seconds - 4).
+    Kernel is also told clock is synchronized, with error, so it copies
+    time to rtc every 11 minutes, and other programs can see we are in
+    sync with adjtimex().
+
+    Offset must be lower than 0.5s, which is the most kernel slews,
+    larger ones should be stepped.
+
+    returns
+            0       offset passed to kernel
+           -1       on error, errno is set
+   ========================================================================== */
+
+
+int sysclock_discipline
+(
+    int64_t       offset,  /* measured offset of clock */
+    int64_t       error,   /* max error of offset */
+    int           tc       /* time constant of kernel pll */
+)
+{
+#if HAVE_CLOCK_ADJTIME
+    struct timex  tx;      /* discipline parameters */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    memset(&tx, 0x00, sizeof(tx));
+    tx.modes = ADJ_OFFSET | ADJ_STATUS | ADJ_TIMECONST | ADJ_MAXERROR |
+        ADJ_ESTERROR | ADJ_NANO;
+    tx.offset = (long)offset;  /* with ADJ_NANO this holds nanoseconds */
+    tx.status = STA_PLL;
+    tx.constant = tc;
+    tx.maxerror = (long)(error / 1000);
+    tx.esterror = (long)(error / 1000);
+
+    return backend_clock_adjtime(CLOCK_REALTIME, &tx) < 0 ? -1 : 0;
+#else
+    (void)offset;
+    (void)error;
+    (void)tc;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+
+#endif /* NTPD_SETWAIT_BENCH */
@@ -0,0 +1,22 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ========================================================================== */
+
+#ifndef SYSCLOCK_H
+#define SYSCLOCK_H 1
+
+#include <stdint.h>
+
+#define NSEC_PER_SEC (1000000000ll)
+
+int64_t sysclock_now(void);
+int64_t sysclock_boottime(void);
+int sysclock_step(int64_t);
+int sysclock_slew(int64_t, int64_t);
+int sysclock_freq(double *);
+int sysclock_discipline(int64_t, int64_t, int);
+int sysclock_jump_open(void);
+int sysclock_jumped(int);
+
+#endif
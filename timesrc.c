@@ -0,0 +1,764 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ==========================================================================
+         ----------------------------------------------------
+        / time sources other than ntp: rfc 868 time and http \
+        \ date header over tcp, and nmea gps on serial port  /
+         ----------------------------------------------------
+   ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include "ntpd-setwait-config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "ntp.h"
+#include "resolv.h"
+#include "sysclock.h"
+#include "timesrc.h"
+
+
+/* ==========================================================================
+          __             __                     __   _
+     ____/ /___   _____ / /____ _ _____ ____ _ / /_ (_)____   ____   _____
+    / __  // _ \ / ___// // __ `// ___// __ `// __// // __ \ / __ \ / ___/
+   / /_/ //  __// /__ / // /_/ // /   / /_/ // /_ / // /_/ // / / /(__  )
+   \__,_/ \___/ \___//_/ \__,_//_/    \__,_/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+/* all these sources tell time with resolution of 1 second, time
+ * they send is truncated, so real time is anywhere within next
+ * second, we take middle of it, and half a second as error
+ */
+
+#define TIMESRC_HALF_SEC (NSEC_PER_SEC / 2)
+
+
+/* ==========================================================================
+                  _                __           ____
+    ____   _____ (_)_   __ ____ _ / /_ ___     / __/__  __ ____   _____ _____
+   / __ \ / ___// /| | / // __ `// __// _ \   / /_ / / / // __ \ / ___// ___/
+  / /_/ // /   / / | |/ // /_/ // /_ /  __/  / __// /_/ // / / // /__ (__  )
+ / .___//_/   /_/  |___/ \__,_/ \__/ \___/  /_/   \__,_//_/ /_/ \___//____/
+/_/
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Computes number of days since unix epoch for civil date, for any date
+    in gregorian calendar (algorithm by Howard Hinnant). Used instead of
+    timegm(), which is not standard, and mktime(), which works in local
+    time zone.
+
+    returns
+            days since 01.01.1970
+   ========================================================================== */
+
+
+static int64_t days_from_civil
+(
+    int64_t   y,    /* year */
+    int       m,    /* month, 1..12 */
+    int       d     /* day of month, 1..31 */
+)
+{
+    int64_t   era;  /* 400 year era */
+    int64_t   yoe;  /* year of era */
+    int64_t   doy;  /* day of year, starting from march */
+    int64_t   doe;  /* day of era */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    y -= m <= 2;
+    era = (y >= 0 ? y : y - 399) / 400;
+    yoe = y - era * 400;
+    doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+
+/* ==========================================================================
+    Fills sample from time server sent us (whole seconds, truncated), t1
+    and t4 stored in sample. Since we don't know when exactly server read
+    its clock, we assume it was in the middle of round trip, as ntp does.
+    Error of such sample (delay / 2 + rootdist) is never lower than half
+    a second.
+   ========================================================================== */
+
+
+static void fill_sample
+(
+    struct ntp_sample  *sample,  /* sample with org and dst set */
+    int64_t             sec      /* unix time server sent */
+)
+{
+    sample->rec = sec * NSEC_PER_SEC + TIMESRC_HALF_SEC;
+    sample->xmt = sample->rec;
+    sample->offset = sample->rec - (sample->org + sample->dst) / 2;
+    sample->delay = sample->dst - sample->org;
+    sample->rootdist = TIMESRC_HALF_SEC;
+
+    /* stratum is not known, 0 means unspecified in ntp too
+     */
+
+    sample->stratum = 0;
+}
+
+
+/* ==========================================================================
+    Parses http Date header value in IMF-fixdate format (RFC 7231), like
+    "Sun, 06 Nov 1994 08:49:37 GMT".
+
+    returns
+            0       date parsed, unix time stored in sec
+           -1       date is not valid
+   ========================================================================== */
+
+
+static int parse_http_date
+(
+    const char        *str,       /* header value */
+    int64_t           *sec        /* unix time will be stored here */
+)
+{
+    int                d;         /* day of month */
+    int                m;         /* month */
+    int                y;         /* year */
+    int                hh;        /* hour */
+    int                mm;        /* minute */
+    int                ss;        /* second */
+    char               mon[4];    /* month name */
+    const char        *p;         /* day of month in str */
+    static const char  months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if ((p = strchr(str, ',')) == NULL)
+        return -1;
+
+    if (sscanf(p + 1, "%d %3s %d %d:%d:%d", &d, mon, &y, &hh, &mm, &ss) != 6)
+        return -1;
+
+    for (m = 0; m != 12; ++m)
+        if (strncmp(mon, months + m * 3, 3) == 0)
+            break;
+
+    if (m == 12 || d < 1 || d > 31 || hh > 23 || mm > 59 || ss > 60)
+        return -1;
+
+    *sec = days_from_civil(y, m + 1, d) * 86400 + hh * 3600 + mm * 60 + ss;
+    return 0;
+}
+
+
+/* ==========================================================================
+    Parses single NMEA sentence. Only RMC (recommended minimum) sentence
+    is used, from any talker (GP, GN, GL...), and only when receiver says
+    its fix is valid. Checksum is verified.
+
+    returns
+            0       sentence is valid RMC, unix time stored in sec
+           -1       sentence is not valid RMC, or has no valid time
+   ========================================================================== */
+
+
+static int parse_nmea
+(
+    char     *line,    /* sentence, without line ending */
+    int64_t  *sec      /* unix time will be stored here */
+)
+{
+    char     *f[10];   /* fields of sentence */
+    char     *p;       /* current character */
+    int       n;       /* number of fields */
+    unsigned  sum;     /* computed checksum */
+    unsigned  hh;      /* hour */
+    unsigned  mm;      /* minute */
+    unsigned  ss;      /* second */
+    unsigned  d;       /* day of month */
+    unsigned  m;       /* month */
+    unsigned  y;       /* year */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (line[0] != '$' || strlen(line) < 7 || strncmp(line + 3, "RMC,", 4))
+        return -1;
+
+    /* checksum is xor of everything between $ and *
+     */
+
+    sum = 0;
+    for (p = line + 1; *p && *p != '*'; ++p)
+        sum ^= (unsigned char)*p;
+
+    if (*p != '*' || strtoul(p + 1, NULL, 16) != sum)
+        return -1;
+
+    *p = '\0';
+
+    /* $GPRMC,hhmmss.ss,A,lat,N,lon,E,speed,course,ddmmyy,...
+     */
+
+    n = 0;
+    for (p = line; p && n != 10; ++n)
+    {
+        f[n] = p;
+        if ((p = strchr(p, ',')) != NULL)
+            *p++ = '\0';
+    }
+
+    if (n != 10 || f[2][0] != 'A')
+        return -1;
+
+    if (sscanf(f[1], "%2u%2u%2u", &hh, &mm, &ss) != 3 ||
+            sscanf(f[9], "%2u%2u%2u", &d, &m, &y) != 3)
+        return -1;
+
+    if (m < 1 || m > 12 || d < 1 || d > 31 || hh > 23 || mm > 59 || ss > 60)
+        return -1;
+
+    /* year has 2 digits, gps receivers exist since 1980s
+     */
+
+    y += y < 80 ? 2000 : 1900;
+    *sec = days_from_civil(y, m, d) * 86400 + hh * 3600 + mm * 60 + ss;
+    return 0;
+}
+
+
+/* ==========================================================================
+    Converts baud rate into termios speed constant, only speeds used by
+    gps receivers are supported.
+
+    returns
+            speed constant, or B0 when baud is not supported
+   ========================================================================== */
+
+
+static speed_t baud_speed
+(
+    long  baud   /* speed in bauds */
+)
+{
+    switch (baud)
+    {
+    case 4800:   return B4800;
+    case 9600:   return B9600;
+    case 19200:  return B19200;
+    case 38400:  return B38400;
+    case 57600:  return B57600;
+    case 115200: return B115200;
+    default:     return B0;
+    }
+}
+
+
+/* ==========================================================================
+    Configures tty for raw reading with given speed.
+
+    returns
+            0       tty configured
+           -1       on error
+   ========================================================================== */
+
+
+static int tty_setup
+(
+    int             fd,    /* opened tty */
+    long            baud   /* speed of tty */
+)
+{
+    speed_t         s;     /* speed constant for termios */
+    struct termios  tio;   /* tty settings */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    s = baud_speed(baud);
+    if (tcgetattr(fd, &tio) != 0)
+        return -1;
+
+    cfmakeraw(&tio);
+    cfsetispeed(&tio, s);
+    cfsetospeed(&tio, s);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+
+    if (tcsetattr(fd, TCSANOW, &tio) != 0)
+        return -1;
+
+    /* drop whatever was waiting there, it's old
+     */
+
+    tcflush(fd, TCIFLUSH);
+    return 0;
+}
+
+
+/* ==========================================================================
+    Looks for complete line in received data, and removes it from buffer.
+    Line ending (\n or \r\n) is stripped.
+
+    returns
+            1       line has been copied to line
+            0       there is no complete line yet
+   ========================================================================== */
+
+
+static int next_line
+(
+    struct timesrc_conn  *tc,     /* connection with received data */
+    char                 *line,   /* line will be stored here */
+    size_t                size    /* size of line */
+)
+{
+    char                 *nl;     /* end of line */
+    size_t                len;    /* length of line */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if ((nl = memchr(tc->buf, '\n', tc->len)) == NULL)
+    {
+        /* line that does not fit into buffer is not
+         * anything we care about, drop it
+         */
+
+        if (tc->len == sizeof(tc->buf))
+            tc->len = 0;
+
+        return 0;
+    }
+
+    len = nl - tc->buf;
+    if (len > 0 && tc->buf[len - 1] == '\r')
+        len--;
+
+    len = len < size - 1 ? len : size - 1;
+    memcpy(line, tc->buf, len);
+    line[len] = '\0';
+
+    tc->len -= nl + 1 - tc->buf;
+    memmove(tc->buf, nl + 1, tc->len);
+    return 1;
+}
+
+
+/* ==========================================================================
+    Finishes non-blocking connect(), and for http sends the request.
+    Time we send request at is t1, for RFC 868 it's time of connect(),
+    as server sends time as soon as connection is accepted.
+
+    returns
+            0       connected
+           -1       on error
+   ========================================================================== */
+
+
+static int tcp_connected
+(
+    struct timesrc_conn  *tc      /* connection */
+)
+{
+    int                   err;    /* result of connect() */
+    int                   len;    /* length of request */
+    socklen_t             elen;   /* size of err */
+    char                  req[512];  /* http request */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    elen = sizeof(err);
+    if (getsockopt(tc->fd, SOL_SOCKET, SO_ERROR, &err, &elen) != 0 || err)
+        return -1;
+
+    tc->connected = 1;
+    if (tc->src->proto != TIMESRC_HTTP)
+        return 0;
+
+    /* HEAD, since we need only headers, server sends Date
+     * with every response, even error one
+     */
+
+    len = snprintf(req, sizeof(req), "HEAD %s HTTP/1.1\r\nHost: %s\r\n"
+            "User-Agent: ntpd-setwait\r\nConnection: close\r\n\r\n",
+            tc->src->path, tc->src->host);
+
+    if (len >= (int)sizeof(req))
+        return -1;
+
+    tc->t1 = sysclock_now();
+    return send(tc->fd, req, len, MSG_NOSIGNAL) == len ? 0 : -1;
+}
+
+
+/* ==========================================================================
+                                        __     __ _
+                         ____   __  __ / /_   / /(_)_____
+                        / __ \ / / / // __ \ / // // ___/
+                       / /_/ // /_/ // /_/ // // // /__
+                      / .___/ \__,_//_.___//_//_/ \___/
+                     /_/
+               ____                     __   _
+              / __/__  __ ____   _____ / /_ (_)____   ____   _____
+             / /_ / / / // __ \ / ___// __// // __ \ / __ \ / ___/
+            / __// /_/ // / / // /__ / /_ / // /_/ // / / /(__  )
+           /_/   \__,_//_/ /_/ \___/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Parses time source spec given by user. Spec is one of:
+
+        host                    ntp server
+        ntp://host              ntp server
+        time://host[:port]      RFC 868 time server, port 37 by default
+        http://host[:port][/path]  http server, port 80 by default
+        nmea://tty[,baud]       gps on serial port, 9600 baud by default
+
+    ipv6 address with port has to be enclosed in brackets, like
+    http://[::1]:8080/.
+
+    returns
+            0       spec parsed into src
+           -1       spec is not valid
+   ========================================================================== */
+
+
+int timesrc_parse
+(
+    struct timesrc  *src,    /* parsed spec will be stored here */
+    const char      *spec    /* spec to parse */
+)
+{
+    const char      *host;   /* start of host in spec */
+    const char      *end;    /* end of host in spec */
+    const char      *p;      /* port or path in spec */
+    char            *e;      /* end of parsed number */
+    unsigned long    port;   /* parsed port */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    memset(src, 0x00, sizeof(*src));
+    strcpy(src->path, "/");
+
+    if (strncmp(spec, "time://", 7) == 0)
+    {
+        src->proto = TIMESRC_TIME;
+        src->port = 37;
+        host = spec + 7;
+    }
+    else if (strncmp(spec, "http://", 7) == 0)
+    {
+        src->proto = TIMESRC_HTTP;
+        src->port = 80;
+        host = spec + 7;
+    }
+    else if (strncmp(spec, "nmea://", 7) == 0)
+    {
+        src->proto = TIMESRC_NMEA;
+        src->baud = 9600;
+        host = spec + 7;
+
+        if ((p = strchr(host, ',')) != NULL)
+        {
+            src->baud = strtol(p + 1, &e, 10);
+            if (*e != '\0' || baud_speed(src->baud) == B0)
+                return -1;
+        }
+        else
+        {
+            p = host + strlen(host);
+        }
+
+        if (p == host || p - host >= (int)sizeof(src->host))
+            return -1;
+
+        memcpy(src->host, host, p - host);
+        return 0;
+    }
+    else if (strncmp(spec, "https://", 8) == 0)
+    {
+        /* no tls library, and it would cost more than it's
+         * worth, Date header is accurate to a second anyway
+         */
+
+        log_print("w/https is not supported, use http\n");
+        return -1;
+    }
+    else
+    {
+        src->proto = TIMESRC_NTP;
+        host = strncmp(spec, "ntp://", 6) == 0 ? spec + 6 : spec;
+
+        if (*host == '\0' || strlen(host) >= sizeof(src->host))
+            return -1;
+
+        strcpy(src->host, host);
+        return 0;
+    }
+
+    /* host[:port][/path] or [ipv6][:port][/path]
+     */
+
+    if (*host == '[')
+    {
+        if ((end = strchr(++host, ']')) == NULL)
+            return -1;
+
+        p = end + 1;
+    }
+    else
+    {
+        end = host + strcspn(host, ":/");
+        p = end;
+    }
+
+    if (end == host || end - host >= (int)sizeof(src->host))
+        return -1;
+
+    memcpy(src->host, host, end - host);
+
+    if (*p == ':')
+    {
+        port = strtoul(p + 1, &e, 10);
+        if (e == p + 1 || port == 0 || port > 65535)
+            return -1;
+
+        src->port = (uint16_t)port;
+        p = e;
+    }
+
+    if (*p == '/' && src->proto == TIMESRC_HTTP &&
+            strlen(p) < sizeof(src->path))
+        strcpy(src->path, p);
+    else if (*p != '\0')
+        return -1;
+
+    return 0;
+}
+
+
+/* ==========================================================================
+    Starts talking to time source src. For tcp sources, non-blocking
+    connection is started to address ra, with port changed to the one of
+    source. For nmea, tty is opened (ra is not used), plain file or fifo
+    works too, which is useful with gpsd pipe.
+
+    returns
+            >=0     file descriptor to wait on with timesrc_events()
+           -1       on error
+   ========================================================================== */
+
+
+int timesrc_open
+(
+    struct timesrc_conn       *tc,   /* connection to initialize */
+    const struct timesrc      *src,  /* source to talk to */
+    const struct resolv_addr  *ra    /* address of source */
+)
+{
+    struct sockaddr_storage    ss;   /* address with port of source */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    memset(tc, 0x00, sizeof(*tc));
+    tc->src = src;
+
+    if (src->proto == TIMESRC_NMEA)
+    {
+        tc->fd = open(src->host, O_RDONLY | O_NOCTTY | O_NONBLOCK |
+                O_CLOEXEC);
+        if (tc->fd < 0)
+        {
+            error("w/open() nmea tty");
+            return -1;
+        }
+
+        if (tty_setup(tc->fd, src->baud) != 0 && errno != ENOTTY)
+        {
+            error("w/failed to configure nmea tty");
+            close(tc->fd);
+            return -1;
+        }
+
+        tc->connected = 1;
+        return tc->fd;
+    }
+
+    memcpy(&ss, &ra->addr, ra->addrlen);
+    if (ss.ss_family == AF_INET)
+        ((struct sockaddr_in *)&ss)->sin_port = htons(src->port);
+    else
+        ((struct sockaddr_in6 *)&ss)->sin6_port = htons(src->port);
+
+    tc->fd = socket(ss.ss_family, SOCK_STREAM | SOCK_NONBLOCK |
+            SOCK_CLOEXEC, 0);
+    if (tc->fd < 0)
+        return -1;
+
+    /* RFC 868 server sends time as soon as it accepts
+     * connection, so connect() is our t1
+     */
+
+    tc->t1 = sysclock_now();
+    if (connect(tc->fd, (const struct sockaddr *)&ss, ra->addrlen) == 0)
+    {
+        if (tcp_connected(tc) == 0)
+            return tc->fd;
+    }
+    else if (errno == EINPROGRESS)
+    {
+        return tc->fd;
+    }
+
+    close(tc->fd);
+    return -1;
+}
+
+
+/* ==========================================================================
+    Tells what connection waits for, end of connect() or data.
+
+    returns
+            events to poll() connection for
+   ========================================================================== */
+
+
+short timesrc_events
+(
+    const struct timesrc_conn  *tc  /* connection to poll */
+)
+{
+    return tc->connected ? POLLIN : POLLOUT;
+}
+
+
+/* ==========================================================================
+    Processes data waiting on connection, when poll() reported activity
+    on it. Sample gets time read from source, with its error estimated
+    from round trip (delay / 2 + rootdist). Caller closes fd when
+    function returns anything but 1.
+
+    returns
+            1       more data is needed, keep polling
+            0       sample has been stored
+           -1       on error, or when source did not send time
+   ========================================================================== */
+
+
+int timesrc_input
+(
+    struct timesrc_conn  *tc,      /* connection with pending data */
+    struct ntp_sample    *sample   /* time will be stored here */
+)
+{
+    ssize_t               n;       /* number of bytes read */
+    int64_t               now;     /* time data arrived */
+    int64_t               sec;     /* unix time source sent */
+    const unsigned char  *b;       /* received data */
+    char                  line[sizeof(tc->buf)];  /* single line of data */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (!tc->connected)
+        return tcp_connected(tc) == 0 ? 1 : -1;
+
+    n = read(tc->fd, tc->buf + tc->len, sizeof(tc->buf) - tc->len);
+    now = sysclock_now();
+
+    if (n < 0)
+        return errno == EAGAIN || errno == EINTR ? 1 : -1;
+
+    if (n == 0)
+        return -1;
+
+    tc->len += n;
+    sample->org = tc->t1;
+    sample->dst = now;
+
+    switch (tc->src->proto)
+    {
+    case TIMESRC_TIME:
+        if (tc->len < 4)
+            return 1;
+
+        /* same era rules as for ntp timestamps apply
+         */
+
+        b = (const unsigned char *)tc->buf;
+        sec = (int64_t)b[0] << 24 | (int64_t)b[1] << 16 |
+            (int64_t)b[2] << 8 | (int64_t)b[3];
+
+        if ((sec & 0x80000000ll) == 0)
+            sec += 0x100000000ll;
+
+        fill_sample(sample, sec - NTP_UNIX_EPOCH_DIFF);
+        return 0;
+
+    case TIMESRC_HTTP:
+        while (next_line(tc, line, sizeof(line)))
+        {
+            if (line[0] == '\0')
+            {
+                /* end of headers, and there was no Date
+                 */
+
+                return -1;
+            }
+
+            if (strncasecmp(line, "date:", 5) == 0)
+            {
+                if (parse_http_date(line + 5, &sec) != 0)
+                    return -1;
+
+                fill_sample(sample, sec);
+                return 0;
+            }
+        }
+
+        return 1;
+
+    case TIMESRC_NMEA:
+        while (next_line(tc, line, sizeof(line)))
+        {
+            if (parse_nmea(line, &sec) != 0)
+                continue;
+
+            /* gps sends sentence some time after second it is
+             * for has started, we don't know how long, so it's
+             * just like one way trip of unknown length
+             */
+
+            sample->org = now;
+            fill_sample(sample, sec);
+            return 0;
+        }
+
+        return 1;
+    }
+
+    return -1;
+}
@@ -0,0 +1,54 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ========================================================================== */
+
+#ifndef TIMESRC_H
+#define TIMESRC_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ntp.h"
+#include "resolv.h"
+
+/* protocols time can be taken with
+ */
+
+#define TIMESRC_NTP  (0)  /* ntp, the default */
+#define TIMESRC_TIME (1)  /* RFC 868 time protocol over tcp */
+#define TIMESRC_HTTP (2)  /* Date header of http response */
+#define TIMESRC_NMEA (3)  /* RMC sentences from gps on serial port */
+
+/* time source, as given by user in -i option
+ */
+
+struct timesrc
+{
+    int       proto;      /* one of TIMESRC_* */
+    char      host[256];  /* host to ask, or tty for nmea */
+    char      path[256];  /* http path to ask for */
+    uint16_t  port;       /* tcp port, 0 for default of protocol */
+    long      baud;       /* speed of nmea tty */
+};
+
+/* single connection to time source, all times are in nanoseconds
+ */
+
+struct timesrc_conn
+{
+    const struct timesrc  *src;        /* source we talk to */
+    int                    fd;         /* socket or tty */
+    int                    connected;  /* tcp connection is established */
+    int64_t                t1;         /* local time request was sent */
+    size_t                 len;        /* length of data in buf */
+    char                   buf[512];   /* received, not yet parsed data */
+};
+
+int timesrc_parse(struct timesrc *, const char *);
+int timesrc_open(struct timesrc_conn *, const struct timesrc *,
+    const struct resolv_addr *);
+short timesrc_events(const struct timesrc_conn *);
+int timesrc_input(struct timesrc_conn *, struct ntp_sample *);
+
+#endif
@@ -0,0 +1,812 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ==========================================================================
+         ------------------------------------------------------
+        / event loop of ntp queries, single io_uring carries   \
+        | all sends and waits of the round, poll() where there |
+        \ is no io_uring                                       /
+         ------------------------------------------------------
+   ==========================================================================
+          _               __            __         ____ _  __
+         (_)____   _____ / /__  __ ____/ /___     / __/(_)/ /___   _____
+        / // __ \ / ___// // / / // __  // _ \   / /_ / // // _ \ / ___/
+       / // / / // /__ / // /_/ // /_/ //  __/  / __// // //  __/(__  )
+      /_//_/ /_/ \___//_/ \__,_/ \__,_/ \___/  /_/  /_//_/ \___//____/
+
+   ========================================================================== */
+
+
+#include "ntpd-setwait-config.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#if HAVE_LINUX_IO_URING_H
+#   include <endian.h>
+#   include <linux/io_uring.h>
+#   include <sys/mman.h>
+#   include <sys/syscall.h>
+#   include <sys/uio.h>
+#endif
+
+#include "backend.h"
+#include "log.h"
+#include "metrics.h"
+#include "sysclock.h"
+#include "uring.h"
+
+
+/* ==========================================================================
+          __             __                     __   _
+     ____/ /___   _____ / /____ _ _____ ____ _ / /_ (_)____   ____   _____
+    / __  // _ \ / ___// // __ `// ___// __ `// __// // __ \ / __ \ / ___/
+   / /_/ //  __// /__ / // /_/ // /   / /_/ // /_ / // /_/ // / / /(__  )
+   \__,_/ \___/ \___//_/ \__,_//_/    \__,_/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+#if HAVE_LINUX_IO_URING_H
+
+
+/* size of submission queue, fits poll of every socket of the query,
+ * every long-lived ntp socket, and whole round of sends
+ */
+
+#define URING_ENTRIES (256)
+
+
+/* max number of fds polled at the same time
+ */
+
+#define URING_MAX_WATCH (128)
+
+
+/* sends not yet completed by kernel, each has its own slot in
+ * registered buffer, so it's not copied on every send
+ */
+
+#define URING_SEND_SLOTS (64)
+#define URING_SEND_LEN (64)
+
+
+/* top bits of user_data tell what completion is for, rest is index
+ * of watch or send slot, and for polls, generation of the poll
+ */
+
+#define URING_POLL   (1ull << 62)
+#define URING_WRITE  (2ull << 62)
+#define URING_CANCEL (3ull << 62)
+#define URING_TYPE   (3ull << 62)
+#define URING_INDEX  (0xffffull)
+
+
+/* fd polled with io_uring. Poll stays in kernel until it fires,
+ * so fd polled in every wait costs nothing to submit, until it has
+ * events. Closing fd does not remove the poll (kernel keeps file
+ * open), that's what uring_forget() is for.
+ */
+
+struct watch
+{
+    int       fd;       /* polled fd, or -1 when watch is free */
+    short     events;   /* events poll waits for */
+    short     revents;  /* events that fired and were not taken yet */
+    int       armed;    /* poll is in kernel */
+    uint64_t  key;      /* user_data of armed poll */
+};
+
+
+/* the only io_uring of the process, set up on first use
+ */
+
+static struct
+{
+    int                   state;     /* 0 - not set up, 1 - ready, -1 - n/a */
+    int                   fd;        /* io_uring instance */
+    int                   fixed;     /* send buffers are registered */
+    unsigned             *sq_head;   /* first sqe not taken by kernel */
+    unsigned             *sq_tail;   /* next sqe to fill */
+    unsigned             *sq_mask;   /* mask of sq indexes */
+    unsigned             *sq_array;  /* indexes of sqes to submit */
+    unsigned             *cq_head;   /* first cqe not reaped */
+    unsigned             *cq_tail;   /* next cqe kernel will fill */
+    unsigned             *cq_mask;   /* mask of cq indexes */
+    struct io_uring_sqe  *sqes;      /* submission queue entries */
+    struct io_uring_cqe  *cqes;      /* completion queue entries */
+    uint64_t              gen;       /* generation of last armed poll */
+    struct watch          w[URING_MAX_WATCH];  /* polled fds */
+    int                   busy[URING_SEND_SLOTS];  /* slot is being sent */
+    unsigned char         buf[URING_SEND_SLOTS][URING_SEND_LEN];  /* sends */
+} g_uring;
+
+
+#endif /* HAVE_LINUX_IO_URING_H */
+
+
+/* ==========================================================================
+                  _                __           ____
+    ____   _____ (_)_   __ ____ _ / /_ ___     / __/__  __ ____   _____ _____
+   / __ \ / ___// /| | / // __ `// __// _ \   / /_ / / / // __ \ / ___// ___/
+  / /_/ // /   / / | |/ // /_/ // /_ /  __/  / __// /_/ // / / // /__ (__  )
+ / .___//_/   /_/  |___/ \__,_/ \__/ \___/  /_/   \__,_//_/ /_/ \___//____/
+/_/
+   ========================================================================== */
+
+
+#if HAVE_LINUX_IO_URING_H
+
+
+/* ==========================================================================
+    Sets up io_uring, maps its queues and registers send buffers. Timeout
+    passed straight to io_uring_enter() (linux 5.11) is required, as
+    without it, every wait would have to submit and then cancel timeout
+    request. Registered buffers are optional, they may not fit into
+    locked memory limit on older kernels.
+
+    returns
+            0       io_uring is ready
+           -1       io_uring is not available, errno is set
+   ========================================================================== */
+
+
+static int ring_setup(void)
+{
+    struct io_uring_params  p;       /* ring parameters */
+    struct iovec            iov;     /* send buffers to register */
+    size_t                  sqlen;   /* size of sq ring */
+    size_t                  cqlen;   /* size of cq ring */
+    unsigned char          *sq;      /* mapped sq ring */
+    unsigned char          *cq;      /* mapped cq ring */
+    int                     i;       /* just an iterator */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    memset(&p, 0x00, sizeof(p));
+    sq = MAP_FAILED;
+    cq = MAP_FAILED;
+    g_uring.sqes = MAP_FAILED;
+
+    metrics_syscalls(1);
+    if ((g_uring.fd = backend_io_uring_setup(URING_ENTRIES, &p)) < 0)
+        return -1;
+
+    if ((p.features & IORING_FEAT_EXT_ARG) == 0)
+    {
+        errno = ENOSYS;
+        goto error;
+    }
+
+    sqlen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cqlen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        sqlen = cqlen = sqlen > cqlen ? sqlen : cqlen;
+
+    metrics_syscalls(3);
+    sq = mmap(NULL, sqlen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            g_uring.fd, IORING_OFF_SQ_RING);
+    cq = p.features & IORING_FEAT_SINGLE_MMAP ? sq : mmap(NULL, cqlen,
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, g_uring.fd,
+            IORING_OFF_CQ_RING);
+    g_uring.sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, g_uring.fd,
+            IORING_OFF_SQES);
+
+    if (sq == MAP_FAILED || cq == MAP_FAILED || g_uring.sqes == MAP_FAILED)
+        goto error;
+
+    g_uring.sq_head = (unsigned *)(sq + p.sq_off.head);
+    g_uring.sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    g_uring.sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    g_uring.sq_array = (unsigned *)(sq + p.sq_off.array);
+    g_uring.cq_head = (unsigned *)(cq + p.cq_off.head);
+    g_uring.cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    g_uring.cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    g_uring.cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    for (i = 0; i != URING_MAX_WATCH; ++i)
+        g_uring.w[i].fd = -1;
+
+    iov.iov_base = g_uring.buf;
+    iov.iov_len = sizeof(g_uring.buf);
+    metrics_syscalls(1);
+    g_uring.fixed = syscall(__NR_io_uring_register, g_uring.fd,
+            IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+    return 0;
+
+error:
+    if (g_uring.sqes != MAP_FAILED)
+        munmap(g_uring.sqes, p.sq_entries * sizeof(struct io_uring_sqe));
+    if (cq != MAP_FAILED && cq != sq)
+        munmap(cq, cqlen);
+    if (sq != MAP_FAILED)
+        munmap(sq, sqlen);
+
+    close(g_uring.fd);
+    return -1;
+}
+
+
+/* ==========================================================================
+    Sets up io_uring on first use.
+
+    returns
+            0       io_uring is ready
+           -1       io_uring is not available, fall back to syscalls
+   ========================================================================== */
+
+
+static int ring_ready(void)
+{
+    if (g_uring.state == 0)
+    {
+        g_uring.state = ring_setup() == 0 ? 1 : -1;
+        if (g_uring.state == -1)
+            error("n/no io_uring, falling back to poll()");
+    }
+
+    return g_uring.state == 1 ? 0 : -1;
+}
+
+
+/* ==========================================================================
+    Submits queued sqes, and waits for at least min completions, but no
+    longer than timeout nanoseconds (-1 waits forever). All of that is
+    single syscall.
+
+    returns
+            0       sqes submitted, and completions arrived when asked
+           -1       on error, or timeout (ETIME), errno is set
+   ========================================================================== */
+
+
+static int ring_enter
+(
+    unsigned                        min,      /* completions to wait for */
+    int64_t                         timeout   /* max time to wait */
+)
+{
+    unsigned                        nsubmit;  /* sqes to submit */
+    unsigned                        flags;    /* io_uring_enter() flags */
+    struct __kernel_timespec        ts;       /* timeout of wait */
+    struct io_uring_getevents_arg   arg;      /* wait arguments */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    nsubmit = *g_uring.sq_tail -
+        __atomic_load_n(g_uring.sq_head, __ATOMIC_ACQUIRE);
+    if (nsubmit == 0 && min == 0)
+        return 0;
+
+    memset(&arg, 0x00, sizeof(arg));
+    flags = 0;
+
+    if (min)
+    {
+        flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+        ts.tv_sec = timeout / NSEC_PER_SEC;
+        ts.tv_nsec = timeout % NSEC_PER_SEC;
+        arg.ts = timeout >= 0 ? (uint64_t)(uintptr_t)&ts : 0;
+    }
+
+    metrics_syscalls(1);
+    if (syscall(__NR_io_uring_enter, g_uring.fd, nsubmit, min, flags,
+                min ? &arg : NULL, sizeof(arg)) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+/* ==========================================================================
+    Takes next free sqe, and fills it with opcode, fd and user_data. When
+    submission queue is full, queued sqes are submitted first. Sqe is
+    queued by sqe_push(), when caller is done filling it.
+
+    returns
+            sqe to fill, or NULL when queue cannot be emptied
+   ========================================================================== */
+
+
+static struct io_uring_sqe *sqe_get
+(
+    int                   op,    /* IORING_OP_* */
+    int                   fd,    /* fd operation is on */
+    uint64_t              data   /* user_data of completion */
+)
+{
+    unsigned              tail;  /* tail of sq */
+    unsigned              i;     /* index of sqe */
+    struct io_uring_sqe  *sqe;   /* sqe to fill */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    tail = *g_uring.sq_tail;
+    if (tail - __atomic_load_n(g_uring.sq_head, __ATOMIC_ACQUIRE) >
+            *g_uring.sq_mask)
+    {
+        if (ring_enter(0, 0) != 0 || tail -
+                __atomic_load_n(g_uring.sq_head, __ATOMIC_ACQUIRE) >
+                *g_uring.sq_mask)
+            return NULL;
+    }
+
+    i = tail & *g_uring.sq_mask;
+    sqe = &g_uring.sqes[i];
+    memset(sqe, 0x00, sizeof(*sqe));
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->user_data = data;
+    g_uring.sq_array[i] = i;
+    return sqe;
+}
+
+
+/* ==========================================================================
+    Queues sqe taken with sqe_get(), it will be submitted with the next
+    ring_enter().
+   ========================================================================== */
+
+
+static void sqe_push(void)
+{
+    __atomic_store_n(g_uring.sq_tail, *g_uring.sq_tail + 1,
+            __ATOMIC_RELEASE);
+}
+
+
+/* ==========================================================================
+    Finds watch of fd.
+
+    returns
+            watch of fd, or NULL when fd is not polled
+   ========================================================================== */
+
+
+static struct watch *watch_find
+(
+    int  fd    /* fd to find watch of */
+)
+{
+    int  i;    /* just an iterator */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    for (i = 0; i != URING_MAX_WATCH; ++i)
+        if (g_uring.w[i].fd == fd)
+            return &g_uring.w[i];
+
+    return NULL;
+}
+
+
+/* ==========================================================================
+    Arms oneshot poll of watch in kernel. Oneshot, and not multishot,
+    because poll that fires again for fd that is still readable is what
+    gives us poll() semantics, callers don't always read everything.
+
+    returns
+            0       poll queued
+           -1       submission queue is full
+   ========================================================================== */
+
+
+static int poll_arm
+(
+    struct watch         *w,     /* watch to arm */
+    short                 events /* events to wait for */
+)
+{
+    uint32_t              mask;  /* events, as kernel wants them */
+    struct io_uring_sqe  *sqe;   /* poll request */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    /* each poll gets new generation, so late completion of poll
+     * that was cancelled, or of fd that was forgotten, is not
+     * taken for completion of new one
+     */
+
+    g_uring.gen++;
+    if ((sqe = sqe_get(IORING_OP_POLL_ADD, w->fd, URING_POLL |
+                    (g_uring.gen << 16) | (uint64_t)(w - g_uring.w))) == NULL)
+        return -1;
+
+    mask = (uint16_t)events;
+#if __BYTE_ORDER == __BIG_ENDIAN
+    mask = mask << 16 | mask >> 16;
+#endif
+    sqe->poll32_events = mask;
+    sqe_push();
+
+    w->key = sqe->user_data;
+    w->events = events;
+    w->armed = 1;
+    return 0;
+}
+
+
+/* ==========================================================================
+    Cancels armed poll of watch. Result of cancel and of cancelled poll
+    are ignored, poll's generation is not current anymore.
+   ========================================================================== */
+
+
+static void poll_cancel
+(
+    struct watch         *w     /* watch with armed poll */
+)
+{
+    struct io_uring_sqe  *sqe;  /* cancel request */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    w->armed = 0;
+    if ((sqe = sqe_get(IORING_OP_POLL_REMOVE, -1, URING_CANCEL)) == NULL)
+        return;
+
+    sqe->addr = w->key;
+    sqe_push();
+}
+
+
+/* ==========================================================================
+    Reaps all completions. Events of fired polls are stored in their
+    watches, until uring_wait() hands them over. Send slots of completed
+    sends are freed.
+   ========================================================================== */
+
+
+static void ring_reap(void)
+{
+    unsigned              head;  /* first cqe to reap */
+    unsigned              tail;  /* last cqe kernel filled */
+    struct io_uring_cqe  *cqe;   /* current completion */
+    struct watch         *w;     /* watch completion is for */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    head = *g_uring.cq_head;
+    tail = __atomic_load_n(g_uring.cq_tail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; ++head)
+    {
+        cqe = &g_uring.cqes[head & *g_uring.cq_mask];
+
+        switch (cqe->user_data & URING_TYPE)
+        {
+        case URING_POLL:
+            w = &g_uring.w[cqe->user_data & URING_INDEX];
+            if (!w->armed || w->key != cqe->user_data)
+                break;
+
+            /* poll that failed (it should not) is reported as
+             * error, owner of fd will find out what's wrong
+             */
+
+            w->armed = 0;
+            w->revents = cqe->res < 0 ? POLLERR : (short)cqe->res;
+            break;
+
+        case URING_WRITE:
+            g_uring.busy[cqe->user_data & URING_INDEX] = 0;
+            if (cqe->res < 0)
+            {
+                errno = -cqe->res;
+                error("w/send() ntp request");
+            }
+            break;
+        }
+    }
+
+    __atomic_store_n(g_uring.cq_head, head, __ATOMIC_RELEASE);
+}
+
+
+/* ==========================================================================
+    Counts fds in pfd that have events waiting in their watches.
+
+    returns
+            number of ready fds
+   ========================================================================== */
+
+
+static int ring_nready
+(
+    const struct pollfd  *pfd,   /* polled fds */
+    int                   nfds   /* number of elements in pfd */
+)
+{
+    int                   i;     /* just an iterator */
+    int                   n;     /* ready fds */
+    struct watch         *w;     /* watch of fd */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    for (i = n = 0; i != nfds; ++i)
+        if (pfd[i].fd >= 0 && (w = watch_find(pfd[i].fd)) && w->revents)
+            n++;
+
+    return n;
+}
+
+
+/* ==========================================================================
+    Waits for events on pfd, like poll() does, but with io_uring. Polls
+    are armed only for fds that don't have one in kernel already, and
+    together with sends queued since last wait, they are submitted in
+    the same syscall that waits for completions.
+
+    returns
+            number of fds with events, 0 on timeout, -1 on error
+   ========================================================================== */
+
+
+static int ring_wait
+(
+    struct pollfd  *pfd,       /* fds to wait for */
+    int             nfds,      /* number of elements in pfd */
+    int             timeout    /* max time to wait, -1 forever */
+)
+{
+    int             i;         /* just an iterator */
+    int             n;         /* number of ready fds */
+    int64_t         deadline;  /* boot time to stop waiting at */
+    int64_t         left;      /* time left to wait */
+    struct watch   *w;         /* watch of current fd */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    for (i = 0; i != nfds; ++i)
+    {
+        pfd[i].revents = 0;
+        if (pfd[i].fd < 0)
+            continue;
+
+        if ((w = watch_find(pfd[i].fd)) == NULL &&
+                (w = watch_find(-1)) == NULL)
+        {
+            /* more fds than we can watch, should not happen,
+             * but poll() can still do it
+             */
+
+            metrics_syscalls(1);
+            return backend_poll(pfd, nfds, timeout);
+        }
+
+        if (w->fd == pfd[i].fd && w->events != pfd[i].events)
+        {
+            /* connection waited for connect() to finish, and
+             * now waits for data
+             */
+
+            if (w->armed)
+                poll_cancel(w);
+
+            w->revents = 0;
+        }
+
+        w->fd = pfd[i].fd;
+        if (!w->armed && w->revents == 0 && poll_arm(w, pfd[i].events) != 0)
+            return -1;
+    }
+
+    deadline = timeout < 0 ? INT64_MAX :
+        sysclock_boottime() + timeout * 1000000ll;
+
+    for (;;)
+    {
+        ring_reap();
+        if ((n = ring_nready(pfd, nfds)))
+            break;
+
+        left = timeout < 0 ? -1 : deadline - sysclock_boottime();
+        if (timeout >= 0 && left <= 0)
+            break;
+
+        /* completions of cancels may wake us up with nothing
+         * ready, we just wait again then
+         */
+
+        if (ring_enter(1, left) != 0 && errno != ETIME)
+            return -1;
+    }
+
+    /* there was something ready right away, sends queued for
+     * this wait still have to go out
+     */
+
+    if (ring_enter(0, 0) != 0)
+        return -1;
+
+    for (i = 0; i != nfds; ++i)
+    {
+        if (pfd[i].fd < 0 || (w = watch_find(pfd[i].fd)) == NULL)
+            continue;
+
+        pfd[i].revents = w->revents;
+        w->revents = 0;
+    }
+
+    return n;
+}
+
+
+/* ==========================================================================
+    Queues send of buf over connected socket fd, it's submitted with the
+    next wait, or uring_flush(). Data is copied to registered buffer.
+
+    returns
+            0       send queued
+           -1       there is no free send slot, or buf does not fit
+   ========================================================================== */
+
+
+static int ring_send
+(
+    int                   fd,    /* connected socket to send over */
+    const void           *buf,   /* data to send */
+    size_t                len    /* length of buf */
+)
+{
+    int                   slot;  /* send slot */
+    struct io_uring_sqe  *sqe;   /* write request */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (len > URING_SEND_LEN)
+        return -1;
+
+    for (slot = 0; slot != URING_SEND_SLOTS; ++slot)
+        if (!g_uring.busy[slot])
+            break;
+
+    if (slot == URING_SEND_SLOTS)
+        return -1;
+
+    /* write() on connected udp socket is send(), and unlike
+     * send, it can use registered buffer
+     */
+
+    if ((sqe = sqe_get(g_uring.fixed ? IORING_OP_WRITE_FIXED :
+                    IORING_OP_WRITE, fd, URING_WRITE | slot)) == NULL)
+        return -1;
+
+    memcpy(g_uring.buf[slot], buf, len);
+    sqe->addr = (uint64_t)(uintptr_t)g_uring.buf[slot];
+    sqe->len = len;
+    sqe->buf_index = 0;
+    sqe_push();
+
+    g_uring.busy[slot] = 1;
+    return 0;
+}
+
+
+#endif /* HAVE_LINUX_IO_URING_H */
+
+
+/* ==========================================================================
+                                        __     __ _
+                         ____   __  __ / /_   / /(_)_____
+                        / __ \ / / / // __ \ / // // ___/
+                       / /_/ // /_/ // /_/ // // // /__
+                      / .___/ \__,_//_.___//_//_/ \___/
+                     /_/
+               ____                     __   _
+              / __/__  __ ____   _____ / /_ (_)____   ____   _____
+             / /_ / / / // __ \ / ___// __// // __ \ / __ \ / ___/
+            / __// /_/ // / / // /__ / /_ / // /_/ // / / /(__  )
+           /_/   \__,_//_/ /_/ \___/ \__//_/ \____//_/ /_//____/
+
+   ========================================================================== */
+
+
+/* ==========================================================================
+    Waits for events on fds, with poll() semantics. With io_uring, sends
+    queued by uring_send() are submitted in the same syscall. Every fd
+    polled with this function must be passed to uring_forget() before it
+    is closed.
+
+    returns
+            number of fds with events, 0 on timeout, -1 on error, errno
+            is set
+   ========================================================================== */
+
+
+int uring_wait
+(
+    struct pollfd  *pfd,      /* fds to wait for */
+    int             nfds,     /* number of elements in pfd */
+    int             timeout   /* max time to wait in ms, -1 forever */
+)
+{
+#if HAVE_LINUX_IO_URING_H
+    if (ring_ready() == 0)
+        return ring_wait(pfd, nfds, timeout);
+#endif
+
+    metrics_syscalls(1);
+    return backend_poll(pfd, nfds, timeout);
+}
+
+
+/* ==========================================================================
+    Sends buf over connected socket fd. With io_uring, send is only
+    queued, it goes out with next uring_wait() or uring_flush(), together
+    with everything else queued in the meantime, and its error, if any,
+    is logged when it completes. Caller that needs to know when data
+    really left (ntp transmit time) has to take it from kernel timestamp,
+    or call uring_flush() right away.
+
+    returns
+            0       buf sent or queued
+           -1       on error, errno is set
+   ========================================================================== */
+
+
+int uring_send
+(
+    int          fd,    /* connected socket to send over */
+    const void  *buf,   /* data to send */
+    size_t       len    /* length of buf */
+)
+{
+#if HAVE_LINUX_IO_URING_H
+    if (ring_ready() == 0 && ring_send(fd, buf, len) == 0)
+        return 0;
+#endif
+
+    metrics_syscalls(1);
+    return backend_send(fd, buf, len, 0) == (ssize_t)len ? 0 : -1;
+}
+
+
+/* ==========================================================================
+    Stops polling fd, must be called before fd is closed. Poll still
+    armed in kernel is cancelled with next submission.
+   ========================================================================== */
+
+
+void uring_forget
+(
+    int            fd   /* fd that will be closed */
+)
+{
+#if HAVE_LINUX_IO_URING_H
+    struct watch  *w;   /* watch of fd */
+    /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+    if (g_uring.state != 1 || fd < 0 || (w = watch_find(fd)) == NULL)
+        return;
+
+    if (w->armed)
+        poll_cancel(w);
+
+    w->fd = -1;
+    w->revents = 0;
+#else
+    (void)fd;
+#endif
+}
+
+
+/* ==========================================================================
+    Submits everything that has been queued, without waiting, so sends
+    don't wait in queue until next wait.
+   ========================================================================== */
+
+
+void uring_flush(void)
+{
+#if HAVE_LINUX_IO_URING_H
+    if (g_uring.state == 1 && ring_enter(0, 0) != 0)
+        error("w/io_uring_enter()");
+#endif
+}
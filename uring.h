@@ -0,0 +1,17 @@
+/* ==========================================================================
+    Licensed under BSD 2clause license See LICENSE file for more information
+    Author: Michał Łyszczek <michal.lyszczek@bofc.pl>
+   ========================================================================== */
+
+#ifndef URING_H
+#define URING_H 1
+
+#include <poll.h>
+#include <stddef.h>
+
+int uring_wait(struct pollfd *, int, int);
+int uring_send(int, const void *, size_t);
+void uring_forget(int);
+void uring_flush(void);
+
+#endif